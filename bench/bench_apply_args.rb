@@ -0,0 +1,50 @@
+# Cost of apply by argument count, passed positionally and as keywords, to a
+# Python function, whose frame is set up straight from the argument vector,
+# and to a functools.partial of it, which still gets a tuple and a dict.
+#
+#   $ ruby -Ilib bench/bench_apply_args.rb
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, :__getitem__)
+dict = apply(getitem, unicode('dict'))
+py_eval = apply(getitem, unicode('eval'))
+
+names = %w[a b c d e f g h]
+params = names.map { |n| "#{n}=None" }.join(', ')
+function = apply(py_eval, unicode("lambda #{params}: a"), apply(dict))
+functools = apply(apply(getitem, unicode('__import__')), unicode('functools'))
+partial = apply(getattr(functools, :partial), function)
+arg = unicode('x')
+
+def per_call(tms)
+  '%8.1f ns/call' % [tms.real * 1e9 / N]
+end
+
+puts "#{N} calls per measurement"
+
+Benchmark.bm(24) do |x|
+  { 'function' => function, 'partial' => partial }.each { |label, f|
+    [0, 1, 4, 8].each { |n|
+      args = [arg] * n
+      kwargs = names.take(n).to_h { |name| [name.to_sym, arg] }
+
+      positional = x.report("#{label} #{n}") {
+        N.times { apply(f, *args) }
+      }
+      keywords = x.report("#{label} #{n} (kwargs)") {
+        N.times { apply(f, **kwargs) }
+      }
+
+      puts "#{label} #{n} args: #{per_call(positional)} positional, " \
+           "#{per_call(keywords)} keywords"
+    }
+  }
+end
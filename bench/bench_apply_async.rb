@@ -0,0 +1,50 @@
+# Throughput of cheap Python calls made with apply, one at a time, against
+# apply_async, submitted in windows and then waited on, from several Ruby
+# threads.  Also prints the executor's counters.
+#
+#   $ ruby -Ilib bench/bench_apply_async.rb
+#
+# Set N to change the number of calls per measurement, THREADS the number of
+# Ruby threads making them, and WINDOW how many calls each thread keeps in
+# flight.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+THREADS = Integer(ENV['THREADS'] || 4)
+WINDOW = Integer(ENV['WINDOW'] || 256)
+
+py_abs = getitem(builtins, :abs)
+per_thread = N / THREADS
+
+cases = {
+  'apply' => lambda {
+    per_thread.times { |i| apply(py_abs, -i) }
+  },
+  'apply_async' => lambda {
+    (0...per_thread).each_slice(WINDOW) { |slice|
+      slice.map { |i| apply_async(py_abs, -i) }.each(&:value)
+    }
+  },
+}
+
+puts "#{N} calls per measurement, #{THREADS} threads"
+
+Benchmark.bm(12) do |x|
+  cases.each { |label, op|
+    tms = x.report(label) {
+      (1..THREADS).map { Thread.new { op.call } }.each(&:join)
+    }
+
+    puts "#{label}: %8.3f us/call" % [tms.real * 1e6 / N]
+  }
+end
+
+stats = async_stats
+puts "executor: %d calls in %d batches, %.1f us mean wait, %.2f us mean " \
+     "service" % [stats[:completed], stats[:batches],
+                  stats[:total_wait_ns] / 1e3 / stats[:completed],
+                  stats[:total_service_ns] / 1e3 / stats[:completed]]
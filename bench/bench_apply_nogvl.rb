@@ -0,0 +1,46 @@
+# Progress of other Ruby threads while one of them is in a 100ms Python
+# call, made through apply (GVL held) versus apply_nogvl (GVL released).
+#
+#   $ ruby -Ilib bench/bench_apply_nogvl.rb
+#
+# Coming back from apply_nogvl means waiting for a turn on the GVL, so with
+# CPU-bound competitors the calls themselves take longer in wall time.
+#
+# Set THREADS to change the number of Ruby threads competing for the GVL.
+
+require 'redrat'
+
+include RedRat::Internal
+
+THREADS = Integer(ENV['THREADS'] || 4)
+CALLS = 5
+
+getitem = getattr(builtins, unicode('__getitem__'))
+import = apply(getitem, unicode('__import__'))
+time = apply(import, unicode('time'))
+py_sleep = getattr(time, unicode('sleep'))
+seconds = apply(apply(getitem, unicode('float')), unicode('0.1'))
+
+def measure(label, threads)
+  counts = Array.new(threads, 0)
+  running = true
+  workers = (0...threads).map { |i|
+    Thread.new { counts[i] += 1 while running }
+  }
+
+  sleep 0.05
+  before = counts.sum
+  start = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+  CALLS.times { yield }
+  elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - start
+  progress = counts.sum - before
+
+  running = false
+  workers.each(&:join)
+
+  puts '%-12s %6.3fs for %d calls, other threads made %12d iterations' %
+    [label, elapsed, CALLS, progress]
+end
+
+measure('apply', THREADS) { apply(py_sleep, seconds) }
+measure('apply_nogvl', THREADS) { apply_nogvl(py_sleep, seconds) }
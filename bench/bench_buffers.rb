@@ -0,0 +1,43 @@
+# Cost of moving blobs between Ruby and Python by copying (unicode and str)
+# versus sharing memory (bytes_view and string_view), by blob size.
+#
+#   $ ruby -Ilib bench/bench_buffers.rb
+#
+# Set N to change the number of transfers per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200)
+
+getitem = getattr(builtins, :__getitem__)
+py_str = apply(getitem, unicode('str'))
+
+def rate(tms, size)
+  '%10.1f MB/s' % [size * N / tms.real / 1e6]
+end
+
+puts "#{N} transfers per measurement"
+
+Benchmark.bm(24) do |x|
+  [1024, 1024 * 1024, 16 * 1024 * 1024].each { |size|
+    blob = 'x' * size
+    pv = apply(py_str, unicode(blob))
+
+    to_py_copy = x.report("unicode #{size}") { N.times { unicode(blob) } }
+    to_py_view = x.report("bytes_view #{size}") {
+      N.times { bytes_view(blob) }
+    }
+    to_rb_copy = x.report("str #{size}") { N.times { str(pv) } }
+    to_rb_view = x.report("string_view #{size}") {
+      N.times { string_view(pv) }
+    }
+
+    puts "#{size} bytes to Python: #{rate(to_py_copy, size)} copying, " \
+         "#{rate(to_py_view, size)} viewing"
+    puts "#{size} bytes to Ruby:   #{rate(to_rb_copy, size)} copying, " \
+         "#{rate(to_rb_view, size)} viewing"
+  }
+end
@@ -0,0 +1,51 @@
+# Cost of moving a 10k-element Array and a 1k-key Hash into Python, one
+# apply per element versus a single to_python(deep: true), and of bringing
+# them back with to_ruby(deep: true).
+#
+#   $ ruby -Ilib bench/bench_containers.rb
+#
+# Set N to change the number of conversions per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200)
+
+getitem = getattr(builtins, :__getitem__)
+list = apply(getitem, unicode('list'))
+dict = apply(getitem, unicode('dict'))
+
+array = Array.new(10_000) { |i| i.even? ? i : "item #{i}" }
+hash = Array.new(1_000) { |i| ["key #{i}", i.even? ? i : i.to_f] }.to_h
+
+cases = {
+  'Array, apply each' => lambda {
+    pv = apply(list)
+    append = getattr(pv, :append)
+    array.each { |v| apply(append, v.is_a?(String) ? unicode(v) : v) }
+  },
+  'Array, to_python' => lambda { to_python(array, deep: true) },
+  'Hash, apply each' => lambda {
+    pv = apply(dict)
+    setitem = getattr(pv, :__setitem__)
+    hash.each { |k, v| apply(setitem, unicode(k), v) }
+  },
+  'Hash, to_python' => lambda { to_python(hash, deep: true) },
+}
+
+array_pv = to_python(array, deep: true)
+hash_pv = to_python(hash, deep: true)
+cases['Array, to_ruby'] = lambda { to_ruby(array_pv, deep: true) }
+cases['Hash, to_ruby'] = lambda { to_ruby(hash_pv, deep: true) }
+
+puts "#{N} conversions per measurement"
+
+Benchmark.bm(24) do |x|
+  cases.each { |label, op|
+    tms = x.report(label) { N.times { op.call } }
+
+    puts "#{label}: %10.1f us/conversion" % [tms.real * 1e6 / N]
+  }
+end
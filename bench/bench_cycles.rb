@@ -0,0 +1,46 @@
+# Time for RedRat::Internal.collect_cycles to find and break cycles between
+# Ruby Arrays and the Python lists they hold, with more and more of them
+# garbage, and with as many again still in use.
+#
+#   $ ruby -Ilib bench/bench_cycles.rb
+#
+# Set N to change the largest number of garbage cycles per pass.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 1_000_000)
+
+py_list = getitem(builtins, :list)
+
+make_cycles = lambda { |n|
+  (0...n).map {
+    a = []
+    l = apply(py_list)
+    apply(getattr(l, :append), a)
+    a << l
+  }
+}
+
+live = []
+
+[N / 100, N / 10, N].each { |n|
+  [0, n].each { |kept|
+    live = make_cycles.call(kept)
+    make_cycles.call(n)
+    GC.start
+
+    broken = nil
+    elapsed = Benchmark.realtime { broken = collect_cycles }
+
+    puts "%8d garbage, %8d live: %7.3f s, %8d broken" %
+      [n, kept, elapsed, broken]
+
+    live = nil
+    collect_cycles
+  }
+}
+
+p cycle_stats
@@ -0,0 +1,40 @@
+# Cost of Ruby GC sweeping PythonValues, whose references are dropped through
+# the deferred Py_DECREF queue, and of draining that queue afterwards.
+#
+#   $ ruby -Ilib bench/bench_decref_queue.rb
+#
+# Set N to change the number of PythonValues swept per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 100_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+str = apply(getitem, unicode('str'))
+pv = unicode('x')
+
+# Leaves N unreachable PythonValues for the next GC to sweep
+def garbage(str, pv)
+  GC.disable
+  N.times { apply(str, pv) }
+  GC.enable
+end
+
+puts "#{N} PythonValues per sweep"
+
+Benchmark.bm(26) do |x|
+  garbage(str, pv)
+  x.report('GC.start, queued') { GC.start }
+  x.report('drain on next call') { truth(pv) }
+
+  garbage(str, pv)
+  x.report('GC.start, GIL already held') { with_gil { GC.start } }
+end
+
+stats = decref_queue_stats
+puts stats.inspect
+puts '%.1f ns per queued Py_DECREF drained' %
+  [stats[:total_drain_ns].to_f / stats[:drained]]
@@ -0,0 +1,43 @@
+# Items per second pulled from a Python generator of ITEMS items, through
+# PythonValue#each at several batch sizes, versus one apply of its next
+# method per item.
+#
+#   $ ruby -Ilib bench/bench_each.rb
+#
+# Set ITEMS to change the length of the generator.  The per-item apply
+# baseline runs over a tenth as many items, as it is that much slower.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+ITEMS = Integer(ENV['ITEMS'] || 10_000_000)
+
+getitem = getattr(builtins, :__getitem__)
+py_eval = apply(getitem, unicode('eval'))
+globals = apply(apply(getitem, unicode('dict')))
+gen = apply(py_eval, unicode('lambda n: (i for i in xrange(n))'), globals)
+
+cases = {
+  'apply next' => [ITEMS / 10, lambda { |n|
+    step = getattr(apply(gen, n), :next)
+    n.times { apply(step) }
+  }],
+}
+
+[1, 16, 256, 4096].each { |batch|
+  cases["each, batch #{batch}"] = [ITEMS, lambda { |n|
+    apply(gen, n).each(batch: batch) { }
+  }]
+}
+
+puts "#{ITEMS} items per generator"
+
+Benchmark.bm(18) do |x|
+  cases.each { |label, (n, op)|
+    tms = x.report(label) { op.call(n) }
+
+    puts "#{label}: %12.0f items/s" % [n / tms.real]
+  }
+end
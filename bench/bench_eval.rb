@@ -0,0 +1,38 @@
+# Cost of evaluating a Python expression from Ruby: Python's eval through
+# apply, which compiles the source every time, against eval through the code
+# cache, and against code compiled once up front.
+#
+#   $ ruby -Ilib bench/bench_eval.rb
+#
+# Set N to change the number of evaluations per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 100_000)
+
+SOURCE = 'sum(i * i for i in range(10)) + len(name)'
+
+py_eval = getitem(builtins, :eval)
+py_source = unicode(SOURCE)
+py_globals = to_python({})
+py_locals = to_python({'name' => 'redrat'}, deep: true)
+code = RedRat::Internal.compile(SOURCE)
+
+puts "#{N} evaluations per measurement"
+
+Benchmark.bm(20) do |bm|
+  bm.report('apply(eval, source)') {
+    N.times { apply(py_eval, py_source, py_globals, py_locals) }
+  }
+  bm.report('eval, cached') {
+    N.times { RedRat::Internal.eval(SOURCE, name: 'redrat') }
+  }
+  bm.report('eval, compiled') {
+    N.times { RedRat::Internal.eval(code, py_locals) }
+  }
+end
+
+p RedRat::Internal::code_cache_stats
@@ -0,0 +1,49 @@
+# Cost of a Python KeyError raised into Ruby and rescued, with and without
+# looking at the Python exception afterwards.
+#
+#   $ ruby -Ilib bench/bench_exceptions.rb
+#
+# Set N to change the number of lookups per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 100_000)
+
+getitem = getattr(to_python({'present' => 1}, deep: true), :__getitem__)
+
+cases = {
+  'hit' => lambda { apply(getitem, :present) },
+  'miss, rescued' => lambda {
+    begin
+      apply(getitem, :absent)
+    rescue RedRat::KeyError
+    end
+  },
+  'miss, python_value' => lambda {
+    begin
+      apply(getitem, :absent)
+    rescue RedRat::KeyError => e
+      e.python_value
+    end
+  },
+  'miss, message' => lambda {
+    begin
+      apply(getitem, :absent)
+    rescue RedRat::KeyError => e
+      e.message
+    end
+  },
+}
+
+puts "#{N} lookups per measurement"
+
+Benchmark.bm(20) do |x|
+  cases.each { |label, op|
+    tms = x.report(label) { N.times { op.call } }
+
+    puts "#{label}: %8.3f us/lookup" % [tms.real * 1e6 / N]
+  }
+end
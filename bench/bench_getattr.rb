@@ -0,0 +1,40 @@
+# Ruby allocations and time per getattr, naming the attribute through a
+# freshly built unicode() PythonValue versus a Symbol or String.
+#
+#   $ ruby -Ilib bench/bench_getattr.rb
+#
+# Set N to change the number of lookups per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+pv_42 = apply(apply(getitem, unicode('int')), unicode('42'))
+name = 'real'
+
+cases = {
+  'unicode(name)' => lambda { getattr(pv_42, unicode(name)) },
+  'Symbol'        => lambda { getattr(pv_42, :real) },
+  'String'        => lambda { getattr(pv_42, name) },
+}
+
+def allocations
+  GC.stat(:total_allocated_objects)
+end
+
+puts "#{N} lookups per measurement"
+
+Benchmark.bm(14) do |x|
+  cases.each { |label, op|
+    before = allocations
+    tms = x.report(label) { N.times { op.call } }
+    per_call = (allocations - before).to_f / N
+
+    puts '%-14s %5.2f Ruby allocations/getattr, %7.1f ns/getattr' %
+      [label, per_call, tms.real * 1e9 / N]
+  }
+end
@@ -0,0 +1,63 @@
+# Throughput of a PythonInterpreterPool from 1 to N interpreters, each fed
+# by a Ruby thread of its own.
+#
+#   $ ruby -Ilib bench/bench_interpreters.rb
+#
+# Python 2 has one GIL for all interpreters, so the pure Python loop does not
+# scale, while hashing large buffers, which lets go of the GIL, does.
+#
+# Set N to change the largest pool (the number of processors by default) and
+# JOBS to change the number of jobs per measurement.
+
+require 'etc'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || Etc.nprocessors)
+JOBS = Integer(ENV['JOBS'] || 64)
+
+SETUP = <<PYTHON
+import hashlib
+
+def loop(n):
+    total = 0
+    for i in xrange(n):
+        total += i
+    return total
+
+BUFFER = 'x' * (1 << 22)
+
+def sha256():
+    return hashlib.sha256(BUFFER).hexdigest()
+PYTHON
+
+workloads = {
+  'python loop' => ['loop', 200_000],
+  'sha256 4MB' => ['sha256'],
+}
+
+puts "#{JOBS} jobs per measurement"
+
+workloads.each { |label, call|
+  base = nil
+
+  (1..N).each { |size|
+    pool = PythonInterpreterPool.new(size)
+    pool.exec_all(SETUP)
+
+    started = Process.clock_gettime(Process::CLOCK_MONOTONIC)
+    (0...size).map { |t|
+      Thread.new {
+        (t...JOBS).step(size) { pool.call(*call) }
+      }
+    }.each(&:join)
+    elapsed = Process.clock_gettime(Process::CLOCK_MONOTONIC) - started
+
+    pool.close
+    base ||= elapsed
+
+    puts "#{label}, %2d interpreters: %8.1f jobs/s, %5.2fx" %
+      [size, JOBS / elapsed, base / elapsed]
+  }
+}
@@ -0,0 +1,44 @@
+# Calling a Python method through chained getattr and apply, versus through
+# the PythonValue method proxy (pv.method(args)).
+#
+#   $ ruby -Ilib bench/bench_method_proxy.rb
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+p_hi = apply(apply(getitem, unicode('str')), unicode('hi'))
+p_h = unicode('h')
+p_i = unicode('i')
+
+cases = {
+  'apply(getattr(unicode))' => lambda {
+    apply(getattr(p_hi, unicode('replace')), p_h, p_i)
+  },
+  'apply(getattr(Symbol))' => lambda {
+    apply(getattr(p_hi, :replace), p_h, p_i)
+  },
+  'proxy' => lambda { p_hi.replace(p_h, p_i) },
+}
+
+# The first proxy call goes through method_missing and defines the stub
+p_hi.replace(p_h, p_i)
+
+puts "#{N} calls per measurement"
+
+Benchmark.bm(24) do |x|
+  cases.each { |label, op|
+    before = GC.stat(:total_allocated_objects)
+    tms = x.report(label) { N.times { op.call } }
+    allocations = (GC.stat(:total_allocated_objects) - before).to_f / N
+
+    puts '%-24s %7.1f ns/call, %4.2f Ruby allocations/call' %
+      [label, tms.real * 1e9 / N, allocations]
+  }
+end
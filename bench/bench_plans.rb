@@ -0,0 +1,53 @@
+# Cost of calling the end of an attribute chain through the manual chain of
+# the README against a PythonCallPlan, for json.dumps(x) and the cheaper
+# os.path.basename(x).
+#
+#   $ ruby -Ilib bench/bench_plans.rb
+#
+# The manual chain crosses into Python once per step: the builtin, the
+# import, each attribute and the call.  A plan checks each step's guard in C
+# and makes the call, in one crossing.
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+def get_builtin name
+  apply(getattr(builtins, unicode('__getitem__')), unicode(name))
+end
+
+chains = {
+  'json.dumps' => [unicode('json'), [:dumps],
+                   to_python([1, 2, 3], deep: true)],
+  'os.path.basename' => [unicode('os'), [:path, :basename], unicode('a/b')],
+}
+
+puts "#{N} calls per measurement"
+
+Benchmark.bm(40) do |bm|
+  chains.each { |label, (name, attrs, x)|
+    root = apply(get_builtin('__import__'), name)
+    callable = attrs.inject(root) { |o, a| getattr(o, a) }
+    planned = plan(root, *attrs)
+
+    bm.report("#{label}, manual chain") {
+      N.times {
+        apply(attrs.inject(apply(get_builtin('__import__'), name)) { |o, a|
+                getattr(o, a)
+              }, x)
+      }
+    }
+    bm.report("#{label}, manual, import hoisted") {
+      N.times { apply(attrs.inject(root) { |o, a| getattr(o, a) }, x) }
+    }
+    bm.report("#{label}, apply, callable hoisted") {
+      N.times { apply(callable, x) }
+    }
+    bm.report("#{label}, plan") { N.times { planned.call(x) } }
+  }
+end
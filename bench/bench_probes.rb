@@ -0,0 +1,53 @@
+# Cost of probing for an attribute that is missing: with a default, with
+# hasattr, and by rescuing the AttributeError.  Missing dict keys and failing
+# calls are measured likewise, with getitem and apply?.
+#
+#   $ ruby -Ilib bench/bench_probes.rb
+#
+# Set N to change the number of probes per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 1_000_000)
+
+p_hi = unicode('hi')
+p_dict = to_python({'present' => 1}, deep: true)
+dict_getitem = getattr(p_dict, :__getitem__)
+
+cases = {
+  'getattr, rescued' => lambda {
+    begin
+      getattr(p_hi, :nope)
+    rescue RedRat::AttributeError
+    end
+  },
+  'getattr, default' => lambda { getattr(p_hi, :nope, nil) },
+  'hasattr' => lambda { hasattr(p_hi, :nope) },
+  'getitem, rescued' => lambda {
+    begin
+      getitem(p_dict, :absent)
+    rescue RedRat::KeyError
+    end
+  },
+  'getitem, default' => lambda { getitem(p_dict, :absent, nil) },
+  'apply, rescued' => lambda {
+    begin
+      apply(dict_getitem, :absent)
+    rescue RedRat::KeyError
+    end
+  },
+  'apply?' => lambda { apply?(dict_getitem, :absent) },
+}
+
+puts "#{N} probes per measurement"
+
+Benchmark.bm(20) do |x|
+  cases.each { |label, op|
+    tms = x.report(label) { N.times { op.call } }
+
+    puts "#{label}: %8.3f us/probe" % [tms.real * 1e6 / N]
+  }
+end
@@ -0,0 +1,60 @@
+# Overhead of RedRat::Internal.profile on a workload that alternates between
+# Ruby and Python, unprofiled and at a few sampling intervals, then the
+# heaviest stitched stacks of the last run, innermost frames only.
+#
+#   $ ruby -Ilib bench/bench_profile.rb
+#
+# Set N to change the number of Python calls per measurement, and INTERVALS
+# to a comma separated list of sampling intervals in microseconds.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 2_000)
+INTERVALS = (ENV['INTERVALS'] || '10000,1000,100').split(',').map { |i|
+  Integer(i)
+}
+
+unless RedRat::Internal.respond_to?(:profile)
+  abort "RedRat::Internal.profile is not available on this Ruby"
+end
+
+ns = to_python({})
+RedRat::Internal.eval(RedRat::Internal.compile(<<PY, :exec), ns)
+def work(f, n):
+    r = 0
+    for i in xrange(n):
+        r += i * i
+        if i % 100 == 0:
+            r += f(i)
+    return r
+PY
+work = getitem(ns, :work)
+callback = proc { |i| (1..50).reduce(:+) + i }
+
+run = lambda { N.times { apply(work, callback, 1000) } }
+run.call
+
+base = Benchmark.measure { run.call }
+puts "%-12s %8.3f s" % ['unprofiled', base.real]
+
+stacks = nil
+
+INTERVALS.each { |interval|
+  tms = Benchmark.measure {
+    stacks = RedRat::Internal.profile(interval) { run.call }
+  }
+  samples = stacks.each_line.sum { |line| line.split.last.to_i }
+
+  puts "%-12s %8.3f s  %+6.1f%%  %6d samples" %
+       ["#{interval} us", tms.real, (tms.real / base.real - 1) * 100, samples]
+}
+
+puts
+stacks.each_line.map { |line| line.rpartition(' ') }.
+  sort_by { |stack, _, count| -count.to_i }.first(5).
+  each { |stack, _, count|
+    puts "%6d  ...;%s" % [count.to_i, stack.split(';').last(4).join(';')]
+  }
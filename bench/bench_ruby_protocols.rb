@@ -0,0 +1,45 @@
+# Cost of Python code reading a 1M-element Array and a 100k-key Hash in
+# place, through the sequence, mapping and iterator protocols of RubyObject,
+# versus converting them with to_python(deep: true) first.
+#
+#   $ ruby -Ilib bench/bench_ruby_protocols.rb
+#
+# Set N to change the number of passes per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 10)
+
+getitem = getattr(builtins, :__getitem__)
+py_eval = apply(getitem, unicode('eval'))
+globals = apply(apply(getitem, unicode('dict')))
+
+py_sum = apply(py_eval, unicode('lambda a: sum(a)'), globals)
+py_index = apply(py_eval,
+                 unicode('lambda a: sum(a[i] for i in xrange(len(a)))'),
+                 globals)
+py_lookup = apply(py_eval, unicode('lambda h: sum(h[k] for k in h)'), globals)
+
+array = Array.new(1_000_000) { |i| i }
+hash = Array.new(100_000) { |i| ["key #{i}", i] }.to_h
+
+cases = {
+  'Array, iterate' => lambda { apply(py_sum, array) },
+  'Array, index' => lambda { apply(py_index, array) },
+  'Array, to_python' => lambda { apply(py_sum, to_python(array, deep: true)) },
+  'Hash, iterate' => lambda { apply(py_lookup, hash) },
+  'Hash, to_python' => lambda { apply(py_lookup, to_python(hash, deep: true)) },
+}
+
+puts "#{N} passes per measurement"
+
+Benchmark.bm(20) do |x|
+  cases.each { |label, op|
+    tms = x.report(label) { N.times { op.call } }
+
+    puts "#{label}: %10.1f ms/pass" % [tms.real * 1e3 / N]
+  }
+end
@@ -0,0 +1,28 @@
+# Cost of keeping many Ruby objects alive from Python: creating RubyObjects,
+# running Ruby GC while they are live, and releasing them all.
+#
+#   $ ruby -Ilib bench/bench_ruby_roots.rb
+#
+# Set N to change the number of live RubyObjects (default one million).
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 1_000_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+py_list = apply(apply(getitem, unicode('list')))
+append = getattr(py_list, unicode('append'))
+clear = getattr(py_list, unicode('__init__'))
+
+puts "#{N} live RubyObjects"
+
+Benchmark.bm(20) do |x|
+  x.report('create') { with_gil { N.times { apply(append, Object.new) } } }
+  x.report('GC.start, all live') { GC.start }
+  x.report('GC.start, again') { GC.start }
+  x.report('release all') { apply(clear) }
+  x.report('GC.start, released') { GC.start }
+end
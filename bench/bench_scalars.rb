@@ -0,0 +1,46 @@
+# Cost of getting Ruby scalars into Python, by way of unicode() and int() as
+# used to be necessary versus handing them off directly, and of bringing the
+# results back with to_ruby.
+#
+#   $ ruby -Ilib bench/bench_scalars.rb
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, :__getitem__)
+int = apply(getitem, unicode('int'))
+add = apply(apply(getitem, unicode('eval')), unicode('lambda a, b: a + b'),
+            apply(apply(getitem, unicode('dict'))))
+
+cases = {
+  'add via unicode/int'  => lambda {
+    apply(add, apply(int, unicode('40')), apply(int, unicode('2')))
+  },
+  'add Integers'         => lambda { apply(add, 40, 2) },
+  'add, to_ruby'         => lambda { apply(add, 40, 2).to_ruby },
+  'add Floats, to_ruby'  => lambda { apply(add, 40.5, 1.5).to_ruby },
+  'add Bignums, to_ruby' => lambda { apply(add, 2**100, 2**100).to_ruby },
+}
+
+def allocations
+  GC.stat(:total_allocated_objects)
+end
+
+puts "#{N} calls per measurement"
+
+Benchmark.bm(24) do |x|
+  cases.each { |label, op|
+    before = allocations
+    tms = x.report(label) { N.times { op.call } }
+    allocated = allocations - before
+
+    puts "#{label}: %8.1f ns/call, %.2f Ruby allocations/call" %
+         [tms.real * 1e9 / N, allocated.to_f / N]
+  }
+end
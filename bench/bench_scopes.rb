@@ -0,0 +1,43 @@
+# Time and garbage collections for loops making many short-lived
+# PythonValues, left to Ruby's GC and the decref queue, and released in one
+# pass at the end of RedRat::Internal.scope.
+#
+#   $ ruby -Ilib bench/bench_scopes.rb
+#
+# Set N to change the number of PythonValues per measurement, and BATCH the
+# number made per scope.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 1_000_000)
+BATCH = Integer(ENV['BATCH'] || 1_000)
+
+py_abs = getitem(builtins, :abs)
+
+cases = {
+  "apply(abs, float), GC" => lambda {
+    N.times { |i| apply(py_abs, -i - 0.5) }
+  },
+  "apply(abs, float), scope" => lambda {
+    (N / BATCH).times { |j|
+      scope { BATCH.times { |i| apply(py_abs, -i - 0.5) }; nil }
+    }
+  },
+}
+
+puts "#{N} PythonValues per measurement, #{BATCH} per scope"
+
+cases.each { |label, op|
+  GC.start
+  gcs = GC.count
+  enqueued = decref_queue_stats[:enqueued]
+  elapsed = Benchmark.realtime { op.call }
+
+  puts "%-26s %6.3f s, %4d GCs, %8d deferred decrefs" %
+    [label, elapsed, GC.count - gcs, decref_queue_stats[:enqueued] - enqueued]
+}
+
+p wrapper_stats
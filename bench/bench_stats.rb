@@ -0,0 +1,50 @@
+# Per-call overhead of the counters behind RedRat::Internal.stats, with
+# counting stopped and started, then the counters in the Prometheus format.
+# Without --enable-stats at build time only the first column is measured.
+#
+#   $ ruby -Ilib bench/bench_stats.rb
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+int = apply(getitem, unicode('int'))
+pv_42 = apply(int, unicode('42'))
+name = unicode('real')
+
+cases = {
+  'truth'   => lambda { truth(pv_42) },
+  'getattr' => lambda { getattr(pv_42, name) },
+  'apply'   => lambda { apply(int, pv_42) },
+  'str'     => lambda { str(pv_42) },
+}
+
+def per_call(tms)
+  '%8.1f ns/call' % [tms.real * 1e9 / N]
+end
+
+counting = RedRat::Internal.respond_to?(:stats_enabled=)
+
+cases.each { |label, call|
+  call.call
+
+  stopped = Benchmark.measure { N.times { call.call } }
+  line = "%-8s stopped %s" % [label, per_call(stopped)]
+
+  if counting
+    RedRat::Internal.stats_enabled = true
+    started = Benchmark.measure { N.times { call.call } }
+    RedRat::Internal.stats_enabled = false
+    line << "  started %s" % [per_call(started)]
+  end
+
+  puts line
+}
+
+puts stats(:prometheus)
@@ -0,0 +1,39 @@
+# Throughput of String transfer with unicode (Ruby to Python) and str (Python
+# to Ruby), for ASCII and for UTF-8 text with characters outside of ASCII,
+# by string size.
+#
+#   $ ruby -Ilib bench/bench_strings.rb
+#
+# Set N to change the number of bytes transferred per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000_000)
+
+def rate(tms, bytes)
+  '%10.1f MB/s' % [bytes / tms.real / 1e6]
+end
+
+puts "#{N} bytes per measurement"
+
+Benchmark.bm(24) do |x|
+  { 'ascii' => 'abcdefgh', 'utf-8' => 'abcdéfgh' }.each { |label, unit|
+    [16, 1024, 1024 * 1024].each { |size|
+      text = (unit * (size / unit.bytesize + 1)).byteslice(0, size).scrub('x')
+      times = N / text.bytesize
+      bytes = times * text.bytesize
+      pv = unicode(text)
+
+      to_py = x.report("unicode #{label} #{size}") {
+        times.times { unicode(text) }
+      }
+      to_rb = x.report("str #{label} #{size}") { times.times { str(pv) } }
+
+      puts "#{label} #{size}: #{rate(to_py, bytes)} to Python, " \
+           "#{rate(to_rb, bytes)} to Ruby"
+    }
+  }
+end
@@ -0,0 +1,56 @@
+# Per-call overhead of RedRat::Internal entry points, each taking the GIL
+# for itself versus all of them running inside of one with_gil session.
+#
+#   $ ruby -Ilib bench/bench_with_gil.rb
+#
+# Set N to change the number of calls per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 200_000)
+
+getitem = getattr(builtins, unicode('__getitem__'))
+int = apply(getitem, unicode('int'))
+pv_42 = apply(int, unicode('42'))
+name = unicode('real')
+
+cases = {
+  'truth'   => lambda { truth(pv_42) },
+  'getattr' => lambda { getattr(pv_42, name) },
+  'apply'   => lambda { apply(int, pv_42) },
+  'str'     => lambda { str(pv_42) },
+}
+
+def per_call(tms)
+  '%8.1f ns/call' % [tms.real * 1e9 / N]
+end
+
+puts "#{N} calls per measurement"
+
+Benchmark.bm(24) do |x|
+  cases.each { |label, op|
+    plain = x.report(label) { N.times { op.call } }
+    session = x.report("#{label} (with_gil)") {
+      with_gil { N.times { op.call } }
+    }
+
+    puts "#{label}: #{per_call(plain)} plain, #{per_call(session)} in session"
+  }
+end
+
+# The same comparison from a thread other than the one that initialized
+# Python, where each PyGILState_Ensure also builds a fresh thread state.
+Thread.new {
+  Benchmark.bm(24) do |x|
+    plain = x.report('truth, thread') { N.times { truth(pv_42) } }
+    session = x.report('truth, thread (with_gil)') {
+      with_gil { N.times { truth(pv_42) } }
+    }
+
+    puts "thread truth: #{per_call(plain)} plain, " \
+         "#{per_call(session)} in session"
+  end
+}.join
@@ -0,0 +1,74 @@
+# Latency and throughput of a PythonWorkerPool against apply in-process.
+#
+#   $ ruby -Ilib bench/bench_workers.rb
+#
+# A call to a worker marshals its arguments and result through shared memory
+# and wakes two processes, so cheap calls are far slower than in-process.
+# What workers buy is parallelism the one GIL cannot give: the pure Python
+# loop scales with processors, fed by a Ruby thread per worker.
+#
+# Set N to change the number of workers (the number of processors by
+# default), ITERATIONS the number of cheap calls and JOBS the number of loop
+# calls per measurement.
+
+require 'benchmark'
+require 'etc'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || Etc.nprocessors)
+ITERATIONS = Integer(ENV['ITERATIONS'] || 20_000)
+JOBS = Integer(ENV['JOBS'] || 64)
+
+SETUP = <<PYTHON
+def loop(n):
+    total = 0
+    for i in xrange(n):
+        total += i
+    return total
+PYTHON
+
+py_import = getitem(builtins, :__import__)
+py_add = getattr(apply(py_import, unicode('operator')), :add)
+
+# The in-process loop runs in __main__, as exec_all runs it in the workers
+main = apply(py_import, unicode('__main__'))
+code = apply(getitem(builtins, :compile),
+             unicode(SETUP), unicode('<bench>'), unicode('exec'))
+apply(getitem(builtins, :eval), code, getattr(main, :__dict__))
+py_loop = getattr(main, :loop)
+
+pool = PythonWorkerPool.new(N)
+pool.exec_all(SETUP)
+
+def per_call(label, n)
+  elapsed = Benchmark.realtime { n.times { yield } }
+  puts "%-34s %8.2f us/call" % [label, elapsed * 1e6 / n]
+end
+
+puts "#{N} workers"
+per_call('apply, operator.add', ITERATIONS) { apply(py_add, 1, 2) }
+per_call('worker apply, operator.add', ITERATIONS) {
+  pool.apply('operator.add', 1, 2)
+}
+
+list = (0...1000).to_a
+per_call('apply, 1000-element list, deep', ITERATIONS / 10) {
+  apply(py_add, to_python(list, deep: true), to_python(list, deep: true))
+}
+per_call('worker apply, 1000-element list', ITERATIONS / 10) {
+  pool.apply('operator.add', list, list)
+}
+
+elapsed = Benchmark.realtime { JOBS.times { apply(py_loop, 200_000) } }
+puts "%-34s %8.1f jobs/s" % ['apply, python loop', JOBS / elapsed]
+
+elapsed = Benchmark.realtime {
+  (0...N).map { |t|
+    Thread.new { (t...JOBS).step(N) { pool.apply(:loop, 200_000) } }
+  }.each(&:join)
+}
+puts "%-34s %8.1f jobs/s" % ['worker apply, python loop', JOBS / elapsed]
+
+pool.close
@@ -0,0 +1,38 @@
+# Time, allocations and garbage collections for handing off PyObjects to
+# Ruby, when the same objects come back over and over, and when every result
+# is a new object, which the identity map has to take in and forget.
+#
+#   $ ruby -Ilib bench/bench_wrappers.rb
+#
+# Set N to change the number of handoffs per measurement.
+
+require 'benchmark'
+require 'redrat'
+
+include RedRat::Internal
+
+N = Integer(ENV['N'] || 1_000_000)
+
+os = apply(getitem(builtins, :__import__), unicode('os'))
+py_abs = getitem(builtins, :abs)
+
+cases = {
+  "getitem(builtins, :len)" => lambda { N.times { getitem(builtins, :len) } },
+  "getattr(os, :path)" => lambda { N.times { getattr(os, :path) } },
+  "apply(abs, float), new" => lambda { N.times { |i| apply(py_abs, -i - 0.5) } },
+}
+
+puts "#{N} handoffs per measurement"
+
+cases.each { |label, op|
+  GC.start
+  objects = GC.stat(:total_allocated_objects)
+  gcs = GC.count
+  elapsed = Benchmark.realtime { op.call }
+
+  puts "%-26s %6.3f s, %8d objects, %4d GCs" %
+    [label, elapsed, GC.stat(:total_allocated_objects) - objects,
+     GC.count - gcs]
+}
+
+p wrapper_stats if respond_to?(:wrapper_stats, true)
@@ -23,5 +23,41 @@ find_header('Python.h') or
 
 have_func 'Py_Initialize'
 
+# Used to wait for the Python GIL without blocking other Ruby threads
+have_header 'ruby/thread.h'
+have_func 'rb_thread_call_without_gvl', 'ruby/thread.h'
+
+# Lets Python code running in apply_nogvl call back into Ruby
+have_func 'rb_thread_call_with_gvl', 'ruby/thread.h'
+
+# Signals Python worker processes through shared memory
+have_header 'linux/futex.h'
+
+# Lets Fibers wait on PythonFutures without blocking their thread
+have_func 'rb_fiber_scheduler_current', ['ruby.h', 'ruby/fiber/scheduler.h']
+
+# Passes Python keyword arguments to callable RubyObjects as keywords
+have_func 'rb_funcallv_kw', 'ruby.h'
+
+# Tells keyword arguments apart from a trailing Hash passed positionally
+have_func 'rb_keyword_given_p', 'ruby.h'
+
+# Lets Strings from string_view point into Python's memory
+have_func 'rb_str_new_static', 'ruby.h'
+
+# Presizes Hashes built by to_ruby
+have_func 'rb_hash_new_capa', 'ruby.h'
+
+# Samples Ruby frames for RedRat::Internal.profile
+have_header 'ruby/debug.h'
+have_func 'rb_profile_frames', 'ruby/debug.h'
+have_func 'rb_postponed_job_preregister', 'ruby/debug.h'
+
+# Counters behind RedRat::Internal.stats, left out of release builds
+if enable_config('stats', !!ENV['MAINTAINER_MODE'])
+  $stderr.puts "Instrumentation counters enabled."
+  $defs << '-DREDRAT_STATS'
+end
+
 dir_config("redrat_ext")
 create_makefile( "redrat_ext" )
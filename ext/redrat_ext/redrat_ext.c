@@ -53,17 +53,77 @@ redrat_stringify_generate_prototype(repr);
 redrat_stringify_generate_prototype(str);
 
 /* Internal Ruby procedure definitions */
+static long redrat_root_add(VALUE r);
+static void redrat_root_remove(long root);
+static void redrat_root_suspend(long root, bool suspended);
+static void redrat_gil_ensure(void);
+static void redrat_gil_release(void);
+static VALUE redrat_gil_session_end(VALUE unused);
 static void redrat_py_decref_wrap(PyObject *freeing);
 static VALUE redrat_ruby_handoff(PyObject *gced_by_ruby);
 static VALUE redrat_exception_convert();
+static void redrat_rb_exc_raise(VALUE rExc, const char *reason);
 static PyObject *redrat_ruby_string_to_python(VALUE rStr);
 static PyObject *redrat_ruby_symbol_to_python_string(VALUE rSym);
-static VALUE redrat_getattr(VALUE self, VALUE rTarget, VALUE rPyString);
+static VALUE redrat_getattr(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_hasattr(VALUE self, VALUE rTarget, VALUE rName);
+static VALUE redrat_getitem(int argc, VALUE *argv, VALUE self);
 static VALUE redrat_builtin_mapping(VALUE self);
 static VALUE redrat_apply(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_apply_nogvl(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_apply_p(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_plan_new(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_plan_call(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_plan_callable(VALUE self);
+static VALUE redrat_plan_resolutions(VALUE self);
+static VALUE redrat_compile(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_eval(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_code_cache_stats(VALUE self);
+static VALUE redrat_apply_async(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_future_value(VALUE self);
+static VALUE redrat_future_wait(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_future_done_p(VALUE self);
+static VALUE redrat_async_stats(VALUE self);
 static VALUE redrat_truth(VALUE self, VALUE rVal);
 static VALUE redrat_unicode(VALUE self, VALUE rVal);
 static VALUE redrat_python_exception_getter(VALUE self);
+static VALUE redrat_with_gil(VALUE self);
+static VALUE redrat_decref_queue_stats(VALUE self);
+static VALUE redrat_wrapper_stats(VALUE self);
+static VALUE redrat_scope_block(VALUE self);
+static VALUE redrat_cycle_collect(VALUE self);
+static VALUE redrat_cycle_stats(VALUE self);
+static VALUE redrat_to_python(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_to_ruby(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_pythonvalue_to_ruby(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_pythonvalue_each(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_bytes_view(VALUE self, VALUE rStr);
+static VALUE redrat_string_view(VALUE self, VALUE rVal);
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static VALUE redrat_interp_alloc(VALUE klass);
+static VALUE redrat_interp_initialize(VALUE self);
+static VALUE redrat_interp_eval(VALUE self, VALUE rSource);
+static VALUE redrat_interp_exec(VALUE self, VALUE rSource);
+static VALUE redrat_interp_call(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_interp_pending(VALUE self);
+static VALUE redrat_interp_close(VALUE self);
+static VALUE redrat_pool_alloc(VALUE klass);
+static VALUE redrat_pool_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_pool_interpreters(VALUE self);
+static VALUE redrat_pool_eval(VALUE self, VALUE rSource);
+static VALUE redrat_pool_exec(VALUE self, VALUE rSource);
+static VALUE redrat_pool_exec_all(VALUE self, VALUE rSource);
+static VALUE redrat_pool_call(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_pool_close(VALUE self);
+#endif
+#ifdef HAVE_LINUX_FUTEX_H
+static VALUE redrat_worker_pool_alloc(VALUE klass);
+static VALUE redrat_worker_pool_initialize(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_worker_pool_apply(int argc, VALUE *argv, VALUE self);
+static VALUE redrat_worker_pool_exec_all(VALUE self, VALUE rSource);
+static VALUE redrat_worker_pool_pids(VALUE self);
+static VALUE redrat_worker_pool_close(VALUE self);
+#endif
 
 
 /* Python definitions */
@@ -72,6 +132,7 @@ static VALUE redrat_python_exception_getter(VALUE self);
 typedef struct {
     PyObject_HEAD
     VALUE r;
+    long  root;     /* Slot in redrat_roots keeping r alive */
 } redrat_RubyObject;
 
 /* Python procedure prototypes */
@@ -82,7 +143,55 @@ typedef struct {
 PyMODINIT_FUNC initredrat(void);
 
 static void redrat_rubyobject_dealloc(redrat_RubyObject *self);
+static int redrat_rubyobject_traverse(PyObject *self, visitproc visit,
+                                      void *arg);
+static int redrat_rubyobject_clear(PyObject *self);
 static PyObject *redrat_python_handoff(VALUE r);
+static Py_ssize_t redrat_rubybuffer_getreadbuf(PyObject *self,
+                                               Py_ssize_t segment,
+                                               void **ptrptr);
+static Py_ssize_t redrat_rubybuffer_getsegcount(PyObject *self,
+                                                Py_ssize_t *lenp);
+static Py_ssize_t redrat_rubybuffer_getcharbuf(PyObject *self,
+                                               Py_ssize_t segment,
+                                               char **ptrptr);
+static int redrat_rubybuffer_getbuffer(PyObject *self, Py_buffer *view,
+                                       int flags);
+static Py_ssize_t redrat_rubyobject_length(PyObject *self);
+static PyObject *redrat_rubyobject_item(PyObject *self, Py_ssize_t i);
+static int redrat_rubyobject_contains(PyObject *self, PyObject *pKey);
+static PyObject *redrat_rubyobject_subscript(PyObject *self, PyObject *pKey);
+static int redrat_rubyobject_ass_subscript(PyObject *self, PyObject *pKey,
+                                           PyObject *pValue);
+static long redrat_rubyobject_hash(PyObject *self);
+static PyObject *redrat_rubyobject_call(PyObject *self, PyObject *pArgs,
+                                       PyObject *pKwargs);
+static PyObject *redrat_rubyobject_richcompare(PyObject *self,
+                                               PyObject *pOther, int op);
+static PyObject *redrat_rubyobject_iter(PyObject *self);
+static PyObject *redrat_rubyiterator_next(PyObject *self);
+
+/*
+ * RubyObjects support Python's sequence, mapping, iteration, call, hash and
+ * comparison protocols by calling straight into Ruby, so Python code can use
+ * Arrays, Hashes and Procs handed to it without copying them first.
+ */
+static PySequenceMethods redrat_rubyobject_as_sequence = {
+    redrat_rubyobject_length,       /*sq_length*/
+    NULL,                           /*sq_concat*/
+    NULL,                           /*sq_repeat*/
+    redrat_rubyobject_item,         /*sq_item*/
+    NULL,                           /*sq_slice*/
+    NULL,                           /*sq_ass_item*/
+    NULL,                           /*sq_ass_slice*/
+    redrat_rubyobject_contains,     /*sq_contains*/
+};
+
+static PyMappingMethods redrat_rubyobject_as_mapping = {
+    redrat_rubyobject_length,       /*mp_length*/
+    redrat_rubyobject_subscript,    /*mp_subscript*/
+    redrat_rubyobject_ass_subscript, /*mp_ass_subscript*/
+};
 
 /* The type instance for RubyObjects in Python */
 static PyTypeObject redrat_RubyType = {
@@ -98,6 +207,47 @@ static PyTypeObject redrat_RubyType = {
     0,                         /*tp_compare*/
     0,                         /*tp_repr*/
     0,                         /*tp_as_number*/
+    &redrat_rubyobject_as_sequence, /*tp_as_sequence*/
+    &redrat_rubyobject_as_mapping, /*tp_as_mapping*/
+    redrat_rubyobject_hash,    /*tp_hash */
+    redrat_rubyobject_call,    /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
+    "redrat Ruby objects",     /* tp_doc */
+    redrat_rubyobject_traverse, /* tp_traverse */
+    redrat_rubyobject_clear,   /* tp_clear */
+    redrat_rubyobject_richcompare, /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    redrat_rubyobject_iter,    /* tp_iter */
+};
+
+/*
+ * An iterator over a Ruby collection, see redrat_rubyobject_iter.  Starts out
+ * laid out like a RubyObject, so that it shares its deallocation.
+ */
+typedef struct {
+    PyObject_HEAD
+    VALUE r;        /* The Array, or Enumerator, being iterated over */
+    long  root;
+    long  index;    /* Next index into an Array, or -1 for an Enumerator */
+} redrat_RubyIterator;
+
+static PyTypeObject redrat_RubyIteratorType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "redrat.RubyIterator",     /*tp_name*/
+    sizeof(redrat_RubyIterator), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)redrat_rubyobject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
     0,                         /*tp_as_sequence*/
     0,                         /*tp_as_mapping*/
     0,                         /*tp_hash */
@@ -107,7 +257,53 @@ static PyTypeObject redrat_RubyType = {
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT,        /*tp_flags*/
-    "redrat Ruby objects",     /* tp_doc */
+    "Iterators over Ruby Arrays, Hashes and Enumerables", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    PyObject_SelfIter,         /* tp_iter */
+    redrat_rubyiterator_next,  /* tp_iternext */
+};
+
+/*
+ * A frozen Ruby String lent to Python through the buffer protocol, see
+ * redrat_bytes_view.  Laid out like a RubyObject, of which it is a lookalike
+ * rather than a subclass, so that it is not confused for a Ruby value to hand
+ * back.
+ */
+static PyBufferProcs redrat_rubybuffer_as_buffer = {
+    redrat_rubybuffer_getreadbuf,   /*bf_getreadbuffer*/
+    NULL,                           /*bf_getwritebuffer*/
+    redrat_rubybuffer_getsegcount,  /*bf_getsegcount*/
+    redrat_rubybuffer_getcharbuf,   /*bf_getcharbuffer*/
+    redrat_rubybuffer_getbuffer,    /*bf_getbuffer*/
+    NULL,                           /*bf_releasebuffer*/
+};
+
+static PyTypeObject redrat_RubyBufferType = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "redrat.RubyBuffer",       /*tp_name*/
+    sizeof(redrat_RubyObject), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)redrat_rubyobject_dealloc, /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &redrat_rubybuffer_as_buffer, /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+    "Read-only views of frozen Ruby Strings", /* tp_doc */
 };
 
 /*
@@ -118,17 +314,10 @@ static PyTypeObject redrat_RubyType = {
  * (passing that information to something like Init_redrat_ext), then these
  * should occupy a struct that can be passed to every extension function.
  *
- * TODO: Right now sub-interpreters for Python are not supported.  That
- * limitation should be lifted, which will mean creating a new Object in Ruby
- * that calls the Py_NewInterpreter() function (let's call it
- * RedRat::Internal::PythonInterpreter), and holds a reference to the
- * subinterpreter, and each one of those should possess references to their
- * Python-loaded RubyValue and RubyException types.  It also means globally
- * accessed builtins like apply, repr, and str latch onto an interpreter state
- * instead singletons of the Module, as they do now.  Py_EndInterpreter will
- * need to be called upon the garbage collection of a PythonInterpreter
- * instance, and PyThreadState_Swap will need to be called when messages on
- * those PythonInterpreter instances are accessed.
+ * Everything here belongs to the main Python interpreter.  Sub-interpreters
+ * are only reachable through RedRat::Internal::PythonInterpreter, see PYTHON
+ * SUB-INTERPRETERS, and builtins like apply, repr and str do not latch onto
+ * them.
  */
 
 /* The RedRat Module */
@@ -143,596 +332,10076 @@ static VALUE rb_cPythonValue;
 /* The RedRat::Internal::RedRatException class */
 static VALUE rb_eRedRatException;
 
+/* The RedRat::Internal::PythonCallPlan class */
+static VALUE rb_cPythonCallPlan;
+
+/* The RedRat::Internal::PythonFuture class */
+static VALUE rb_cPythonFuture;
+
+/* The RedRat::Internal::PythonInterpreter class */
+static VALUE rb_cPythonInterpreter;
+
+/* The RedRat::Internal::PythonInterpreterPool class */
+static VALUE rb_cPythonInterpreterPool;
+
+/* The RedRat::Internal::PythonWorkerPool class */
+static VALUE rb_cPythonWorkerPool;
+
 /*
- * INTERNAL PROCEDURE DEFINITIONS
+ * PYTHON SUB-INTERPRETERS
  *
- * These procedures have no obvious exposure to Ruby, and could be classified
- * as internal mechanics.
+ * A PythonInterpreter is a Python sub-interpreter from Py_NewInterpreter, with
+ * its own modules, __builtin__, sys and __main__, and its own redrat module.
+ * It lives on an OS thread of its own, unknown to Ruby, which runs the jobs
+ * Ruby threads queue up for it one at a time and never needs the GVL.  Ruby
+ * threads wait on their jobs with the GVL released.
+ *
+ * Python 2 has one GIL for all interpreters, so only work that lets go of the
+ * GIL, such as IO, hashing or compression of large buffers, runs in parallel;
+ * pure Python code is interleaved.  The types of the redrat module are static
+ * and so shared by every interpreter, which the shared GIL makes safe.
+ *
+ * Arguments are converted to Python, and results back to Ruby, by the waiting
+ * Ruby thread, as by to_python and to_ruby with deep: true.  Only plain data
+ * crosses over: both are copied with Python's marshal module, the guest
+ * thread state of the interpreter swapped in for its side of the copy.
+ * Anything marshal cannot copy raises a TypeError, as an object of one
+ * interpreter must not be used from the other.
+ *
+ * A PythonInterpreterPool spreads jobs over several PythonInterpreters,
+ * giving each job to the one with the fewest pending.
  */
+typedef struct redrat_interp_job {
+    struct redrat_interp_job *next;
+    const char               *source;   /* Code to run, or a global's name */
+    int                       start;    /* Py_eval_input, Py_file_input or -1 */
+    PyObject                 *pArgs;    /* When calling, else NULL */
+    PyObject                 *pResult;
+    PyObject                 *pType;    /* The error, if pResult is NULL */
+    PyObject                 *pValue;
+    PyObject                 *pTraceback;
+    bool                      done;
+} redrat_interp_job;
+
+typedef struct {
+    pthread_t          thread;
+    pthread_mutex_t    lock;        /* Protects all below */
+    pthread_cond_t     cond;        /* Signalled on any change to them */
+    redrat_interp_job *head;        /* Queued jobs */
+    redrat_interp_job *tail;
+    long               pending;     /* Queued or running jobs */
+    PyThreadState     *tstate;      /* Of the interpreter's own thread */
+    PyThreadState     *guest;       /* Swapped in by waiting Ruby threads */
+    PyObject          *pGlobals;    /* Of __main__ */
+    bool               ready;       /* Set up, successfully or not */
+    bool               stopping;    /* Set by close, or by Ruby GC */
+    bool               orphaned;    /* The thread frees this on stopping */
+    bool               joined;
+} redrat_interp;
+
+typedef struct {
+    VALUE interps;                  /* Frozen Array of PythonInterpreters */
+    long  next;                     /* Where ties are broken from */
+} redrat_pool;
 
 /*
- * redrat_py_decref_wrap - Work around Py_DECREF being a macro
+ * PYTHON WORKER PROCESSES
  *
- * This enables function pointer passing for Ruby GC.
+ * A PythonWorkerPool forks processes that run nothing but Python, so that
+ * CPU-bound Python code runs in parallel despite the GIL.  Calls to them are
+ * marshalled with Python's marshal module, so arguments and results must be
+ * plain data, and go through a pair of ring buffers in memory shared with
+ * each worker: requests one way and responses the other.  Waiting on either
+ * is done with a futex in the shared memory, with no pipes involved.
+ *
+ * Workers serve requests in order, so several Ruby threads can have calls in
+ * flight to one worker; they take their responses in the order they wrote
+ * their requests.  Each side bumps the futex word of the other whenever it
+ * writes a record, or frees space by reading one.
  */
-static void
-redrat_py_decref_wrap(PyObject *freeing)
-{
-    PyGILState_STATE gstate = PyGILState_Ensure();
+#ifdef HAVE_LINUX_FUTEX_H
+#define REDRAT_RING_SIZE (1 << 20)
 
-    Py_DECREF(freeing);
-    PyGILState_Release(gstate);
-}
+typedef struct {
+    uint64_t head;                      /* Bytes ever written */
+    uint64_t tail;                      /* Bytes ever read */
+    char     data[REDRAT_RING_SIZE];
+} redrat_ring;
+
+typedef struct {
+    uint32_t    toWorker;               /* Bumped for the worker to look */
+    uint32_t    toParent;               /* Bumped for the parent to look */
+    redrat_ring requests;
+    redrat_ring responses;
+} redrat_worker_shm;
+
+typedef struct {
+    pid_t              pid;
+    redrat_worker_shm *shm;
+    pthread_mutex_t    lock;            /* Serializes the parent's side */
+    pthread_cond_t     cond;            /* Signalled as responses are taken */
+    uint64_t           written;         /* Requests written */
+    uint64_t           served;          /* Responses taken */
+    long               pending;         /* Written, and not yet taken */
+    bool               dead;
+} redrat_worker;
+
+typedef struct {
+    redrat_worker *workers;
+    long           size;
+    long           next;                /* Where ties are broken from */
+} redrat_worker_pool;
+#endif /* HAVE_LINUX_FUTEX_H */
 
 /*
- * redrat_ruby_handoff - Hands off a PyObject to Ruby
+ * PYTHON EXCEPTIONS IN RUBY
  *
- * If this PyObject is of type redrat.RubyObject, then just return the
- * unwrapped Ruby object inside.
+ * A Python error is raised in Ruby as a RedRatException holding the triple
+ * from PyErr_Fetch in a redrat_python_error, kept in a hidden instance
+ * variable.  python_type, python_value and python_traceback only wrap its
+ * parts in PythonValues when first called, and the message is only computed
+ * when asked for, so errors that are rescued and dropped, such as KeyErrors
+ * from lookups, cost two Ruby objects.
  *
- * This procedure presumes that the Python GIL and Ruby GILs are already held.
+ * Common Python exception classes are raised as RedRatException subclasses of
+ * the same name under RedRat, arranged as in Python, so that for example a
+ * KeyError can be rescued as RedRat::KeyError or RedRat::LookupError.
+ */
+typedef struct {
+    PyObject   *pType;
+    PyObject   *pValue;         /* Possibly NULL */
+    PyObject   *pTraceback;     /* Possibly NULL */
+    const char *reason;         /* Static, or NULL */
+} redrat_python_error;
+
+typedef struct {
+    const char  *name;          /* Of the classes in Python and in Ruby */
+    PyObject   **pyClass;
+    int          parent;        /* Index of the superclass, or -1 */
+    VALUE        klass;
+} redrat_exc_class;
+
+/* Superclasses come first, and are matched last */
+static redrat_exc_class redrat_exc_classes[] = {
+    {"LookupError", &PyExc_LookupError, -1},
+    {"KeyError", &PyExc_KeyError, 0},
+    {"IndexError", &PyExc_IndexError, 0},
+    {"ArithmeticError", &PyExc_ArithmeticError, -1},
+    {"ZeroDivisionError", &PyExc_ZeroDivisionError, 3},
+    {"OverflowError", &PyExc_OverflowError, 3},
+    {"EnvironmentError", &PyExc_EnvironmentError, -1},
+    {"IOError", &PyExc_IOError, 6},
+    {"OSError", &PyExc_OSError, 6},
+    {"ValueError", &PyExc_ValueError, -1},
+    {"UnicodeError", &PyExc_UnicodeError, 9},
+    {"RuntimeError", &PyExc_RuntimeError, -1},
+    {"NotImplementedError", &PyExc_NotImplementedError, 11},
+    {"AttributeError", &PyExc_AttributeError, -1},
+    {"TypeError", &PyExc_TypeError, -1},
+    {"NameError", &PyExc_NameError, -1},
+    {"ImportError", &PyExc_ImportError, -1},
+    {"AssertionError", &PyExc_AssertionError, -1},
+    {"MemoryError", &PyExc_MemoryError, -1},
+    {"StopIteration", &PyExc_StopIteration, -1},
+    {"KeyboardInterrupt", &PyExc_KeyboardInterrupt, -1},
+    {"SystemExit", &PyExc_SystemExit, -1},
+    {"SyntaxError", &PyExc_SyntaxError, -1},
+};
+
+#define REDRAT_EXC_CLASSES                                                    \
+    ((int) (sizeof(redrat_exc_classes) / sizeof(redrat_exc_classes[0])))
+
+/*
+ * The PythonValue of each PyObject handed off, by address, as an
+ * ObjectSpace::WeakMap; see redrat_pythonvalue_wrap
+ */
+static VALUE redrat_wrappers = Qnil;
+static long redrat_wrapper_hits = 0;
+static long redrat_wrapper_misses = 0;
+static long redrat_wrapper_unshared = 0;
+
+/* The message every RedRatException is created with, shared */
+static VALUE redrat_exc_default_message = Qnil;
+
+/* Names of the hidden redrat_python_error, and of the lazy attributes */
+static ID redrat_id_python_error;
+static ID redrat_id_python_type;
+static ID redrat_id_python_value;
+static ID redrat_id_python_traceback;
+static ID redrat_id_iv_python_type;
+static ID redrat_id_iv_python_value;
+static ID redrat_id_iv_python_traceback;
+static ID redrat_id_iv_redrat_reason;
+static ID redrat_id_iv_message;
+
+/*
+ * GIL SESSIONS
  *
- * This includes the hybridization of Ruby and Python GC.  To do this, Ruby
- * will get its own reference (Py_INCREF) and registers a callback that exists
- * to call Py_DECREF.  In this way, a PythonValue that has no remaining
- * references in the Python runtime will still not be freed, since Ruby has not
- * GCed it yet.
+ * The Python GIL is taken through redrat_gil_ensure and given back through
+ * redrat_gil_release, never through PyGILState_Ensure directly.  These keep a
+ * per-thread depth counter, so only the outermost acquisition on a thread
+ * touches the GIL and nested ones are nearly free.  That is what makes
+ * RedRat::Internal.with_gil worthwhile: inside of its block every entry point
+ * skips the PyGILState_Ensure/Release round trip.
+ *
+ * Holding the GIL across arbitrary Ruby code has a hazard: that code can let
+ * go of the Ruby GVL (IO, sleep, or just the thread timer), and another Ruby
+ * thread that then blocks in PyGILState_Ensure while holding the GVL would
+ * deadlock against us.  To prevent that, redrat_gil_detached counts threads
+ * that hold (or are queued for) the GIL without necessarily holding the GVL.
+ * When it is non-zero, the GIL is waited for with the GVL released.
  */
-static VALUE
-redrat_ruby_handoff(PyObject *handing_off)
-{
-    if (handing_off->ob_type == &redrat_RubyType)
-        return ((redrat_RubyObject *) handing_off)->r;
-    else
-    {
-        Py_INCREF(handing_off);
 
-        return Data_Wrap_Struct(rb_cPythonValue,
-                                NULL, redrat_py_decref_wrap,
-                                handing_off);
-    }
-}
+/* Nesting depth of GIL acquisitions on this thread */
+static REDRAT_THREAD_LOCAL int redrat_gil_depth = 0;
 
-static void
-redrat_rb_exc_raise(VALUE rExc, const char *reason)
-{
-    rb_iv_set(rExc, "@redrat_reason", rb_str_new2(reason));
-    rb_exc_raise(rExc);
-}
+/* What the outermost PyGILState_Ensure on this thread returned */
+static REDRAT_THREAD_LOCAL PyGILState_STATE redrat_gil_outer_state;
 
 /*
- * redrat_exception_convert - Convert Python exceptions to Ruby exceptions
+ * Threads that may hold the GIL while not holding the GVL.  Only modified
+ * while holding the GVL.
+ */
+static volatile int redrat_gil_detached = 0;
+
+/*
+ * DEFERRED PY_DECREF QUEUE
  *
- * This procedure presumes that the Python GIL is already held.
+ * When Ruby GC frees a PythonValue, its reference is not dropped on the spot,
+ * which would mean taking the GIL once per PythonValue in the middle of a
+ * sweep.  Instead it is pushed onto a lock-free multiple-producer list, which
+ * is taken whole and drained under a single GIL acquisition: by the next
+ * outermost redrat_gil_ensure, or by a background thread once it grows past
+ * REDRAT_DECREF_DRAINER_THRESHOLD.
  *
- * The convention in the Python C API is to allow NULL-valued PyObject* values
- * flow through the system while an out-of-band error state is left intact.
- * Before returning control to MRI, determine if it is necessary to raise a
- * Ruby exception or not.
+ * Draining swaps the head for NULL, so any number of consumers can drain
+ * concurrently without the ABA problems of popping one node at a time.
  */
-static VALUE
-redrat_exception_convert()
-{
-    PyObject *pType;
-    PyObject *pValue;
-    PyObject *pTraceback;
+#define REDRAT_DECREF_DRAINER_THRESHOLD 4096
+
+typedef struct redrat_decref_node {
+    struct redrat_decref_node *next;
+    PyObject                  *freeing;
+} redrat_decref_node;
+
+static redrat_decref_node *redrat_decref_head = NULL;
+
+/* Counters, exposed through RedRat::Internal.decref_queue_stats */
+static long redrat_decref_depth = 0;
+static long redrat_decref_enqueued = 0;
+static long redrat_decref_drained = 0;
+static long redrat_decref_drains = 0;
+static long redrat_decref_background_drains = 0;
+static long redrat_decref_last_drain_ns = 0;
+static long redrat_decref_max_drain_ns = 0;
+static long redrat_decref_total_drain_ns = 0;
+
+/* Wakes up the background drainer, which is started on first use */
+static pthread_mutex_t redrat_decref_drainer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t redrat_decref_drainer_cond = PTHREAD_COND_INITIALIZER;
+static bool redrat_decref_drainer_started = false;
 
-    PyErr_Fetch(&pType, &pValue, &pTraceback);
+/*
+ * Whether this thread is running Python code after having let go of the GVL,
+ * in which case it must not call back into Ruby without rb_thread_call_with_gvl.
+ */
+static REDRAT_THREAD_LOCAL bool redrat_gvl_released = false;
 
-    if (pType != NULL)
-    {
-        VALUE rException;
+/* The Python thread state of the thread that ran Init_redrat_ext */
+static PyThreadState *redrat_main_tstate;
 
-        /* The trinity of Python exception information, see PyErr_Fetch */
-        VALUE rpType;
-        VALUE rpValue = Qnil;
-        VALUE rpTraceback = Qnil;
+/*
+ * RUBY ROOTS HELD BY PYTHON
+ *
+ * Every RubyObject keeps its Ruby value alive through a slot in this table,
+ * which a single mark function walks during Ruby GC.  Unused slots are chained
+ * into a free list, so adding and removing a root are both O(1), unlike
+ * rb_gc_register_address and rb_gc_unregister_address.
+ *
+ * RubyObjects can be deallocated by Python code running without the GVL, so
+ * the table has its own lock rather than relying on the GVL.  It is only held
+ * for a handful of instructions, and never while allocating Ruby objects.
+ */
+typedef struct {
+    VALUE value;        /* Qundef when on the free list */
+    long  nextFree;     /* Next slot on the free list, -1, or suspended */
+} redrat_root_slot;
 
-        rpType = redrat_ruby_handoff(pType);
+/* nextFree of slots not marked while collecting cycles */
+#define REDRAT_ROOT_SUSPENDED (-2)
 
-        if (pValue != NULL)
-            rpValue = redrat_ruby_handoff(pValue);
+static redrat_root_slot *redrat_roots = NULL;
 
-        if (pTraceback != NULL)
-            rpTraceback = redrat_ruby_handoff(pTraceback);
+/* Slots allocated, and slots ever handed out (the high-water mark) */
+static long redrat_roots_cap = 0;
+static long redrat_roots_used = 0;
 
-        rException = rb_exc_new2(rb_eRedRatException, "RedRat exception");
-        rb_iv_set(rException, "@python_type", rpType);
-        rb_iv_set(rException, "@python_value", rpValue);
-        rb_iv_set(rException, "@python_traceback", rpTraceback);
+/* Head of the free list, or -1 */
+static long redrat_roots_free = -1;
 
-        Py_DECREF(pType);
-        Py_XDECREF(pValue);
-        Py_XDECREF(pTraceback);
+static pthread_mutex_t redrat_roots_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        PyErr_Clear();
-        return rException;
-    }
-    else
-    {
-        Assert(pValue == NULL);
+/* A hidden object whose mark function marks redrat_roots */
+static VALUE redrat_roots_keeper = Qnil;
 
-        rb_bug("redrat_ext: expected Python error state, "
-               "but no error state was found");
-    }
-}
+/*
+ * Interned Python strings for Ruby IDs, for use as attribute names.  Only
+ * accessed while holding both the GIL and the GVL.
+ */
+static st_table *redrat_attr_names;
+
+/*
+ * PythonValues for None, True, False and the small ints that Python caches
+ * itself, created at initialization and handed out by redrat_ruby_handoff
+ * instead of fresh wrappers.
+ */
+#define REDRAT_SMALL_INT_MIN (-5)
+#define REDRAT_SMALL_INT_MAX 256
 
-/* XXX: Total and possibly exploitable ignorance of unicode encodings. */
+static VALUE redrat_pv_none;
+static VALUE redrat_pv_true;
+static VALUE redrat_pv_false;
+static VALUE redrat_pv_small_ints[REDRAT_SMALL_INT_MAX -
+                                  REDRAT_SMALL_INT_MIN + 1];
 
 /*
- * This procedure presumes that the Python GIL is already held.
+ * Names the hidden instance variable of a String from redrat_string_view that
+ * keeps the Python object owning its memory alive.
  */
-static PyObject *
-redrat_ruby_string_to_python(VALUE rStr)
-{
-    return PyUnicode_FromString(RSTRING_PTR(rStr));
-}
+static ID redrat_id_buffer_owner;
+
+/* Keyword and method names used by to_python and to_ruby */
+static ID redrat_id_deep;
+static ID redrat_id_compare_by_identity;
+
+/* Keyword of PythonValue#each */
+static ID redrat_id_batch;
+
+/* Wraps the pipe a PythonFuture notifies Fibers through */
+static ID redrat_id_for_fd;
+
+/* Method names called by the protocols of RubyObject */
+static ID redrat_id_aref;
+static ID redrat_id_aset;
+static ID redrat_id_call;
+static ID redrat_id_cmp;
+static ID redrat_id_delete;
+static ID redrat_id_each;
+static ID redrat_id_include_p;
+static ID redrat_id_keys;
+static ID redrat_id_message;
+static ID redrat_id_next;
+static ID redrat_id_size;
+static ID redrat_id_to_enum;
+
+/* Ruby encodings with a Python codec of their own, see rb_enc_find_index */
+static int redrat_enc_latin1;
+static int redrat_enc_utf16le;
+static int redrat_enc_utf16be;
+static int redrat_enc_utf32le;
+static int redrat_enc_utf32be;
 
 /*
- * This procedure presumes that the Python GIL is already held.
+ * ARGUMENT VECTORS
+ *
+ * Arguments handed off from Ruby for a Python call.  They live in an array
+ * that the caller allocates on the stack with ALLOCV_N, so that calls into
+ * Python functions need neither an argument tuple nor a keyword dict.
  */
-static PyObject *
-redrat_ruby_symbol_to_python_string(VALUE rSym)
-{
-    return redrat_ruby_string_to_python(rb_id2str(SYM2ID(rSym)));
-}
+#define REDRAT_CALLARGS_SLOTS(nargs, nkws) (1 + (nargs) + 2 * (nkws))
+
+typedef struct {
+    PyObject   **args;      /* Positional arguments */
+    Py_ssize_t   nargs;
+    PyObject   **kws;       /* Alternating names and values */
+    Py_ssize_t   nkws;      /* Number of name and value pairs */
+    bool         spare;     /* Whether args[-1] is free for a prepended self */
+    bool         badKey;    /* A keyword was neither a Symbol nor a String */
+} redrat_callargs;
 
 /*
- * RUBY INTERFACE PROCEDURES
+ * ASYNCHRONOUS CALLS
  *
- * These procedures have direct impact on what constructs are exposed to a Ruby
- * program.
+ * apply_async pushes a call onto a lock-free multiple-producer list like the
+ * deferred Py_DECREF queue, and returns a PythonFuture for it straight away.
+ * The executor, a thread of its own unknown to Ruby, takes the list whole and
+ * makes the calls in order.  It takes the GIL once per batch rather than once
+ * per call, and keeps it for as long as calls keep coming.
+ *
+ * Unless an argument needs the GVL to convert (Bignums and Symbols), nothing
+ * is converted at submission: the executor hands off the arguments itself, so
+ * submitting does not take the GIL at all.  Nor does getting the result,
+ * which is handed off with the executor's reference.
+ *
+ * A PythonFuture is kept alive through redrat_roots until its call is done.
+ * Waiting on it lets go of the GVL, or yields to the Fiber scheduler, which
+ * is woken through a pipe.
  */
+typedef struct {
+    redrat_callargs  ca;
+    PyObject       **slots;         /* Of ca, REDRAT_CALLARGS_SLOTS(argc, 0) */
+    PyObject        *pCallable;     /* NULL until handed off */
+    VALUE           *argv;          /* To hand off on the executor, or NULL */
+    int              argc;          /* Of the arguments after the callable */
+    VALUE            rArgs;         /* The callable and arguments */
+    VALUE            rNotify;       /* IO on notifyFds[0], or Qnil */
+    VALUE            rResult;       /* Result or exception, or Qundef */
+    long             root;          /* In redrat_roots until done */
+    long             submittedNs;
+    long             startedNs;
+    long             finishedNs;
+    PyObject        *pResult;       /* Taken over on the first value */
+    PyObject        *pType;         /* The error, if pResult is NULL */
+    PyObject        *pValue;
+    PyObject        *pTraceback;
+    VALUE            klass;         /* Of the error, see redrat_exc_classes */
+    pthread_mutex_t  lock;          /* Protects done and notifyFds */
+    pthread_cond_t   cond;
+    int              notifyFds[2];  /* Written to once done, or -1 */
+    bool             done;
+    bool             failed;        /* Whether rResult is the exception */
+} redrat_async_call;
+
+typedef struct redrat_async_node {
+    struct redrat_async_node *next;
+    redrat_async_call        *call;
+} redrat_async_node;
+
+static redrat_async_node *redrat_async_head = NULL;
+
+/* Counters, exposed through RedRat::Internal.async_stats */
+static long redrat_async_depth = 0;
+static long redrat_async_submitted = 0;
+static long redrat_async_completed = 0;
+static long redrat_async_batches = 0;
+static long redrat_async_total_wait_ns = 0;
+static long redrat_async_max_wait_ns = 0;
+static long redrat_async_total_service_ns = 0;
+static long redrat_async_max_service_ns = 0;
+
+/* Wakes up the executor, which is started on first use */
+static pthread_mutex_t redrat_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t redrat_async_cond = PTHREAD_COND_INITIALIZER;
+static bool redrat_async_started = false;
+static int redrat_async_sleeping = 0;
 
 /*
- * redrat_getattr - Get attributes from a PythonValue via a PythonValue
+ * CALL PLANS
+ *
+ * A plan is an attribute chain resolved ahead of time, such as
+ * json.dumps from the json module, so that calling what it ends in takes one
+ * Ruby call and no crossing per step.  Every step keeps what it resolved to,
+ * and a guard saying how to tell whether that is still current:
  *
- * Nominally the second argument will be constructed via the 'unicode' method
- * provided in this module.
+ * - Attributes of modules are current while the module's dict still maps the
+ *   name to the very same object, which costs one dict lookup.
+ * - Attributes of classes are current while the class keeps the type version
+ *   tag it had, which Python changes whenever the class or a base changes.
+ * - Anything else is resolved again on every call, from that step on.
+ *
+ * Resolved objects are held with references of their own, rather than
+ * borrowed from their holders, so that a guard cannot be fooled by a new
+ * object at the address of a freed one.
  */
-static VALUE
-redrat_getattr(VALUE self, VALUE rTarget, VALUE rPyString)
-{
-    PyGILState_STATE    gstate;
+typedef enum {
+    REDRAT_PLAN_UNRESOLVED = 0,
+    REDRAT_PLAN_MODULE,
+    REDRAT_PLAN_TYPE,
+    REDRAT_PLAN_DYNAMIC
+} redrat_plan_guard;
 
-    PyObject *pTarget;
-    PyObject *pAttrName;
-    PyObject *pResult = NULL;
+typedef struct {
+    PyObject          *pName;       /* Interned attribute name */
+    PyObject          *pResolved;   /* What the name resolved to, or NULL */
+    redrat_plan_guard  guard;
+    unsigned int       versionTag;  /* Of the holder, for REDRAT_PLAN_TYPE */
+} redrat_plan_step;
 
-    VALUE rExcFromDelegation;
-    VALUE rResult;
+typedef struct {
+    PyObject         *pRoot;
+    long              nsteps;
+    long              resolutions;  /* Steps resolved, for tests and tuning */
+    redrat_plan_step  steps[1];     /* Actually nsteps long */
+} redrat_plan;
 
-    if (!(REDRAT_PYTHONVALUE_P(rTarget) && REDRAT_PYTHONVALUE_P(rPyString)))
-        rb_raise(rb_eArgError,
-                 "redrat_ext: getattr only supports PythonValues");
+/*
+ * CODE CACHE
+ *
+ * compile and eval compile Python source with Py_CompileString once, and keep
+ * the code objects in a Hash per mode, keyed by the source String.  Hashes
+ * keep insertion order, so moving a hit to the end and evicting from the
+ * front makes them least recently used caches.  Code runs against one
+ * globals dict holding only __builtins__, which expressions cannot change.
+ */
+#define REDRAT_CODE_CACHE_SIZE 256
 
-    gstate = PyGILState_Ensure();
+static VALUE redrat_code_cache[2] = { Qnil, Qnil };  /* Of eval, exec */
+static PyObject *redrat_eval_globals = NULL;
 
-    Data_Get_Struct(rTarget, PyObject, pTarget);
-    Data_Get_Struct(rPyString, PyObject, pAttrName);
+/* Counters, exposed through RedRat::Internal.code_cache_stats */
+static long redrat_code_hits = 0;
+static long redrat_code_misses = 0;
+static long redrat_code_evictions = 0;
+static long redrat_code_total_compile_ns = 0;
+static long redrat_code_max_compile_ns = 0;
 
-    pResult = PyObject_GenericGetAttr(pTarget, pAttrName);
-    REDRAT_ERRJMP_PYEXC(rExcFromDelegation, pResult);
-    rResult = redrat_ruby_handoff(pResult);
+/*
+ * WRAPPER ALLOCATION
+ *
+ * RubyObjects, RubyBuffers and RubyIterators are allocated from slabs, with
+ * a free list per size class of REDRAT_SLAB_ALIGN bytes, rather than through
+ * PyType_GenericAlloc.  Blocks are only ever allocated and freed with the
+ * GIL held, which is what protects the free lists; slabs are never given
+ * back.
+ *
+ * PythonValues made inside of RedRat::Internal.scope are kept in a list, and
+ * let go of their PyObjects all at once, under one GIL acquisition, when the
+ * block exits.  Their pointers are then NULL, which redrat_pythonvalue_get
+ * and redrat_python_handoff raise on, and Ruby collects them without
+ * finalizers.
+ */
+#define REDRAT_SLAB_BYTES (64 * 1024)
+#define REDRAT_SLAB_ALIGN 16
+#define REDRAT_SLAB_CLASSES 4
 
-    PyGILState_Release(gstate);
+typedef struct redrat_slab_block {
+    struct redrat_slab_block *next;
+} redrat_slab_block;
 
-    return rResult;
+static redrat_slab_block *redrat_slab_free_lists[REDRAT_SLAB_CLASSES];
+static long redrat_slabs = 0;
+static long redrat_ruby_objects_live = 0;
+static long redrat_ruby_objects_peak = 0;
 
-py_rb_error:
-    PyGILState_Release(gstate);
+/* PythonValues that hold a reference, counted under the GVL */
+static long redrat_python_values_live = 0;
+static long redrat_python_values_peak = 0;
 
-    if (rExcFromDelegation != Qnil)
-        redrat_rb_exc_raise(rExcFromDelegation,
-                            "redrat_ext: Could not delegate to Python");
+typedef struct redrat_scope {
+    VALUE                rValues;   /* PythonValues made in it, an Array */
+    VALUE                rKeep;     /* Of those, ones to keep, or Qnil */
+    VALUE                rFiber;    /* The Fiber the scope is for */
+    VALUE                rResult;   /* What the block returned, kept */
+    struct redrat_scope *outer;
+} redrat_scope;
 
-    Assert(false);
-}
+#define REDRAT_RELEASED_MESSAGE                                               \
+    "redrat_ext: PythonValue was released by RedRat::Internal.scope"
+
+/* The innermost scope of this thread, or NULL */
+static REDRAT_THREAD_LOCAL redrat_scope *redrat_scope_current = NULL;
 
 /*
- * redrat_builtin_mapping - The Root of All Things
+ * CROSS-HEAP CYCLES
  *
- * Retrieves a PythonValue that supports the dictionary protocol to access the
- * builtins.
- *
- * From here, just about everything is possible because of the existence of
- * __import__.  An annotated example of what this C code is intended to enable
- * follows:
- *
- *     # Access the builtins, available as a dictionary
+ * A Ruby object holding a PythonValue whose PyObject holds a RubyObject of
+ * that same Ruby object is never freed by either collector: Ruby sees a root
+ * in redrat_roots, and Python a reference it cannot account for.
+ * RedRat::Internal.collect_cycles finds and breaks such cycles in one pass,
+ * under the GIL and the GVL:
  *
- *     >>> __builtins__
- *     <module '__builtin__' (built-in)>
- *
- *     # __import__ is the low-level method used for importing modules
+ *   1. Like Python's own collector, subtract the references tracked objects
+ *      hold to each other, and those PythonValues hold, from every tracked
+ *      object's reference count, in its gc_refs.  Whatever is reachable from
+ *      an object with references left over is rooted in Python.
+ *   2. Each RubyObject that is not rooted is a candidate.  Its Ruby value is
+ *      taken out of redrat_roots, and instead marked from the PythonValues
+ *      through which it can be reached, by way of redrat_cycle_reach, during
+ *      one full Ruby GC.
+ *   3. Candidates whose values were not marked are part of garbage cycles.
+ *      They are cleared, which lets the Python side go once the PythonValues
+ *      Ruby just swept have let go of their references.  The others are
+ *      rooted again.
  *
- *     >>> __builtins__.__import__
- *     <built-in function __import__>
+ * Each PythonValue's PyObject gets an Array of what it reaches, in which
+ * parts of the Python heap reached from several PythonValues are shared,
+ * so a pass is linear in the size of both heaps.  Sharing can also make a
+ * PythonValue seem to reach more than it does, which only keeps some
+ * garbage for another pass.  Py_DECREFs are deferred for the whole pass, so
+ * no Python code runs in its middle.
+ */
+
+#define REDRAT_GC_REFS(op) (_Py_AS_GC(op)->gc.gc_refs)
+
+/* Values of gc_refs, besides Python's own, during a pass */
+#define REDRAT_CYCLE_ROOTED (-5)
+#define REDRAT_CYCLE_OWNED(owner) (-8 - (long) (owner))
+#define REDRAT_CYCLE_OWNER(refs) (-8 - (long) (refs))
+
+/* A RubyObject that may be part of a cycle, see redrat_cycle_witness_mark */
+typedef struct {
+    redrat_RubyObject *pObj;        /* A reference of our own */
+    bool               suspended;   /* Whether its root is */
+    size_t             markedBy;    /* rb_gc_count of the last GC to mark it */
+} redrat_cycle_candidate;
+
+typedef struct {
+    PyObject              **held;       /* PyObjects of PythonValues */
+    long                    nheld;
+    long                    capHeld;
+    PyObject              **stack;      /* Left to traverse */
+    long                    nstack;
+    long                    capStack;
+    redrat_cycle_candidate *cands;
+    long                    ncands;
+    long                    capCands;
+    long                   *edges;      /* Pairs of owner, and candidate or
+                                         * -1 - another owner */
+    long                    nedges;
+    long                    capEdges;
+    long                    owner;      /* Index into held being traversed */
+    bool                    failed;     /* Out of memory */
+    st_table               *reach;
+} redrat_cycle_pass;
+
+/* The pass being run, or NULL */
+static redrat_cycle_pass *redrat_cycle_current = NULL;
+
+/* PyObjects held by PythonValues, to the Arrays they reach, during its GC */
+static st_table *redrat_cycle_reach = NULL;
+
+/* Counters, exposed through RedRat::Internal.cycle_stats */
+static long redrat_cycle_passes = 0;
+static long redrat_cycle_candidates = 0;
+static long redrat_cycle_broken = 0;
+static long redrat_cycle_last_pass_ns = 0;
+static long redrat_cycle_total_pass_ns = 0;
+
+/*
+ * INSTRUMENTATION
  *
- *     # Any available module can be imported, yielding another module
- *     # PyObject; furthermore, those modules can be delegated messages from
- *     # Ruby, as Python modules are just PyObjects.
+ * Counters of how often Ruby crosses into Python, what that costs in GIL
+ * waits, wrappers and exceptions, read through RedRat::Internal.stats.  They
+ * are only compiled in with --enable-stats (the default in maintainer mode),
+ * and only counted while RedRat::Internal.stats_enabled is set.
  *
- *     >>> __builtins__.__import__('argparse')
- *     <module 'argparse' from '/usr/lib/python2.7/argparse.pyc'>
+ * Each thread counts into a block of its own, so that counting takes neither
+ * a lock nor an atomic read-modify-write, and stats sums the blocks.  When a
+ * thread exits, its block is folded into redrat_stat_retired and freed.
  */
-static VALUE
-redrat_builtin_mapping(VALUE self)
-{
-    PyGILState_STATE     gstate;
+typedef enum {
+    REDRAT_STAT_APPLY_CALLS,
+    REDRAT_STAT_GETATTR_CALLS,
+    REDRAT_STAT_TRUTH_CALLS,
+    REDRAT_STAT_UNICODE_CALLS,
+    REDRAT_STAT_REPR_CALLS,
+    REDRAT_STAT_STR_CALLS,
+    REDRAT_STAT_GIL_WAITS,
+    REDRAT_STAT_GIL_WAIT_NS,
+    REDRAT_STAT_PYTHON_VALUES_MADE,
+    REDRAT_STAT_RUBY_OBJECTS_MADE,
+    REDRAT_STAT_PYTHON_VALUES_FREED,
+    REDRAT_STAT_RUBY_OBJECTS_FREED,
+    REDRAT_STAT_EXCEPTIONS_CONVERTED,
+    REDRAT_STAT_COUNT
+} redrat_stat;
 
-    PyObject *pBuiltins;
+/*
+ * How each counter is named in the Hash, and as a Prometheus sample; samples
+ * of the same metric must stay next to each other
+ */
+static const struct {
+    const char *key;
+    const char *metric;
+    const char *labels;
+} redrat_stat_names[REDRAT_STAT_COUNT] = {
+    {"apply_calls", "redrat_calls_total", "{entry=\"apply\"}"},
+    {"getattr_calls", "redrat_calls_total", "{entry=\"getattr\"}"},
+    {"truth_calls", "redrat_calls_total", "{entry=\"truth\"}"},
+    {"unicode_calls", "redrat_calls_total", "{entry=\"unicode\"}"},
+    {"repr_calls", "redrat_calls_total", "{entry=\"repr\"}"},
+    {"str_calls", "redrat_calls_total", "{entry=\"str\"}"},
+    {"gil_waits", "redrat_gil_waits_total", ""},
+    {"gil_wait_ns", "redrat_gil_wait_seconds_total", ""},
+    {"python_values_made", "redrat_wrappers_made_total",
+     "{direction=\"python_to_ruby\"}"},
+    {"ruby_objects_made", "redrat_wrappers_made_total",
+     "{direction=\"ruby_to_python\"}"},
+    {"python_values_freed", "redrat_wrappers_freed_total",
+     "{direction=\"python_to_ruby\"}"},
+    {"ruby_objects_freed", "redrat_wrappers_freed_total",
+     "{direction=\"ruby_to_python\"}"},
+    {"exceptions_converted", "redrat_exceptions_converted_total", ""},
+};
 
-    VALUE rExcGetBuiltin = Qnil;
-    VALUE rReturn;
+#ifdef REDRAT_STATS
+typedef struct redrat_stat_block {
+    long                      counts[REDRAT_STAT_COUNT];
+    struct redrat_stat_block *prev;
+    struct redrat_stat_block *next;
+} redrat_stat_block;
 
-    gstate = PyGILState_Ensure();
+/* Whether to count, see RedRat::Internal.stats_enabled= */
+static bool redrat_stats_on = false;
 
-    pBuiltins = PyEval_GetBuiltins();
-    REDRAT_ERRJMP_PYEXC(rExcGetBuiltin, pBuiltins);
-    Py_INCREF(pBuiltins);
-    Assert_PyMapping(pBuiltins);
+/* This thread's block, or NULL until it first counts */
+static REDRAT_THREAD_LOCAL redrat_stat_block *redrat_stat_mine = NULL;
 
-    rReturn = redrat_ruby_handoff(pBuiltins);
+/* Frees a thread's block when it exits */
+static pthread_key_t redrat_stat_key;
 
-    PyGILState_Release(gstate);
+/* Blocks of live threads, and the sums of exited ones; under the lock */
+static pthread_mutex_t    redrat_stat_lock = PTHREAD_MUTEX_INITIALIZER;
+static redrat_stat_block *redrat_stat_blocks = NULL;
+static long               redrat_stat_retired[REDRAT_STAT_COUNT];
 
-    return rReturn;
+static void redrat_stat_add(redrat_stat stat, long n);
+static long redrat_now_ns(void);
 
-py_rb_error:
-    /*
-     * A failure to return the builtin mapping to Ruby, which makes it
-     * seemingly impossible to bootstrap access to richer Python functionality.
-     * That's bad news so early in the game, but faithfully clean up and raise
-     * an exception.
-     *
-     * These Py_XDECREF calls have to be carefully checked that they do not
-     * cause over-decref-ing should a procedure returns a "borrowed" reference
-     * and yet winds up in this error path.  In the above, PyEval_GetBuiltins()
-     * is such an example.
+#define REDRAT_STAT_ADD(stat, n)                                              \
+    do                                                                        \
+    {                                                                         \
+        if (redrat_stats_on)                                                  \
+            redrat_stat_add((stat), (n));                                     \
+    } while (0)
+
+/* A clock reading to time a wait with, or 0 when not counting */
+#define REDRAT_STAT_CLOCK() (redrat_stats_on ? redrat_now_ns() : 0)
+#else
+#define REDRAT_STAT_ADD(stat, n) do { } while (0)
+#define REDRAT_STAT_CLOCK() 0L
+#endif /* REDRAT_STATS */
+
+/*
+ * SAMPLING PROFILER
+ *
+ * RedRat::Internal.profile samples the thread that calls it.  A sampler
+ * thread sends it SIGPROF every interval of wall-clock time, so that time
+ * spent waiting for the GIL is sampled as well as time spent running.
+ *
+ * The signal handler may take neither lock, so it only copies what this
+ * thread alone changes: the names of the Python frames it is running, the
+ * calls from Python back into Ruby that it is inside of, and whether it is
+ * waiting for the GIL.  That is queued as a pending sample, and a postponed
+ * job adds the Ruby frames once the thread next checks for interrupts.  The
+ * Ruby stack stays put while an entry point runs Python, so those are the
+ * frames the sample was taken under.
+ *
+ * The two are stitched where they cross: Ruby frames up to the entry point's
+ * own (say RedRat::Internal.apply), then the Python frames it ran, then for
+ * each call back into Ruby, the Ruby frames it ran, and so on.
+ */
+#ifdef HAVE_RB_PROFILE_FRAMES
+#define REDRAT_PROF_PENDING   64        /* Samples awaiting Ruby frames */
+#define REDRAT_PROF_PY_FRAMES 64        /* Outermost Python frames kept */
+#define REDRAT_PROF_RB_FRAMES 1024      /* Innermost Ruby frames kept */
+#define REDRAT_PROF_CROSSINGS 16        /* Outermost calls into Ruby kept */
+#define REDRAT_PROF_NAME      128       /* Bytes per Python frame name */
+
+/* Where a call from Python back into Ruby was made */
+typedef struct {
+    int rubyDepth;                      /* Ruby frames below it */
+    int pythonDepth;                    /* Python frames below it */
+} redrat_prof_crossing;
+
+typedef struct {
+    long                 count;         /* Times taken in a row */
+    bool                 gilWait;
+    int                  ncross;
+    redrat_prof_crossing cross[REDRAT_PROF_CROSSINGS];
+    int                  npy;
+    char                 py[REDRAT_PROF_PY_FRAMES][REDRAT_PROF_NAME];
+} redrat_prof_sample;
+
+typedef struct {
+    pthread_t            thread;        /* The thread being sampled */
+    pthread_t            sampler;
+    long                 intervalNs;
+    pthread_mutex_t      lock;          /* Protects stopping */
+    pthread_cond_t       cond;
+    bool                 stopping;
+
+    /* Written by the sampled thread, read by its signal handler */
+    volatile bool        gilWait;
+    volatile int         ncross;
+    redrat_prof_crossing cross[REDRAT_PROF_CROSSINGS];
+
+    /*
+     * Pending samples, queued by the handler and taken by the job.  A sample
+     * like the last one pending only counts it again, so that a thread stuck
+     * in Python or waiting for the GIL does not overflow the queue.
      */
-    Py_XDECREF(pBuiltins);
+    unsigned long        head;
+    unsigned long        tail;
+    volatile bool        draining;      /* The job is taking samples */
+    redrat_prof_sample   next;          /* The handler's scratch space */
+    redrat_prof_sample   pending[REDRAT_PROF_PENDING];
+
+    VALUE                rubyFrames[REDRAT_PROF_RB_FRAMES];
+} redrat_profile;
+
+/* The profile being taken, or NULL */
+static redrat_profile *redrat_prof = NULL;
+
+/* Collapsed stacks sampled so far, to how many times */
+static VALUE redrat_prof_stacks = Qnil;
+
+/* SIGPROF's action before the first profile */
+static struct sigaction redrat_prof_old_action;
+static bool             redrat_prof_installed = false;
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+static rb_postponed_job_handle_t redrat_prof_job_handle =
+    POSTPONED_JOB_HANDLE_INVALID;
+#endif
+
+/* Whether the profile samples this thread; needs the Ruby GVL */
+#define REDRAT_PROF_HERE()                                                    \
+    (redrat_prof != NULL && pthread_equal(redrat_prof->thread, pthread_self()))
+
+#define REDRAT_PROF_GIL_WAIT(waiting)                                         \
+    do                                                                        \
+    {                                                                         \
+        if (REDRAT_PROF_HERE())                                               \
+            redrat_prof->gilWait = (waiting);                                 \
+    } while (0)
+
+/*
+ * Completes pending samples straight after a call into Python, while the Ruby
+ * frames are still the ones they were taken under.  The postponed job may
+ * only get to run once handing off the result has pushed frames of its own.
+ */
+#define REDRAT_PROF_FLUSH()                                                   \
+    do                                                                        \
+    {                                                                         \
+        if (REDRAT_PROF_HERE())                                               \
+            redrat_prof_job(NULL);                                            \
+    } while (0)
+#else
+#define REDRAT_PROF_GIL_WAIT(waiting) do { } while (0)
+#define REDRAT_PROF_FLUSH() do { } while (0)
+#endif /* HAVE_RB_PROFILE_FRAMES */
+
+/*
+ * INTERNAL PROCEDURE DEFINITIONS
+ *
+ * These procedures have no obvious exposure to Ruby, and could be classified
+ * as internal mechanics.
+ */
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+static void *
+redrat_gil_ensure_nogvl(void *unused)
+{
+    redrat_gil_outer_state = PyGILState_Ensure();
+    redrat_gil_depth = 1;
+
+    return NULL;
+}
+
+static VALUE
+redrat_gil_ensure_blocking(VALUE unused)
+{
+    rb_thread_call_without_gvl(redrat_gil_ensure_nogvl, NULL, NULL, NULL);
+
+    return Qnil;
+}
+#endif /* HAVE_RB_THREAD_CALL_WITHOUT_GVL */
+
+/*
+ * redrat_now_ns - A monotonic clock reading, in nanoseconds
+ */
+static long
+redrat_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+#ifdef REDRAT_STATS
+/*
+ * redrat_stat_block_exit - Fold an exiting thread's counters into
+ * redrat_stat_retired, and free its block
+ */
+static void
+redrat_stat_block_exit(void *exiting)
+{
+    redrat_stat_block *block = exiting;
+    int                i;
+
+    pthread_mutex_lock(&redrat_stat_lock);
+
+    for (i = 0; i < REDRAT_STAT_COUNT; i++)
+        redrat_stat_retired[i] += block->counts[i];
+
+    if (block->prev != NULL)
+        block->prev->next = block->next;
+    else
+        redrat_stat_blocks = block->next;
+
+    if (block->next != NULL)
+        block->next->prev = block->prev;
+
+    pthread_mutex_unlock(&redrat_stat_lock);
+
+    free(block);
+}
+
+/*
+ * redrat_stat_add - Count n into one of this thread's counters
+ *
+ * Only this thread writes to its block; the relaxed store keeps readers in
+ * redrat_stats_sum from seeing a torn value.  Neither the Ruby GVL nor the
+ * Python GIL need be held.
+ */
+static void
+redrat_stat_add(redrat_stat stat, long n)
+{
+    redrat_stat_block *block = redrat_stat_mine;
+
+    if (block == NULL)
+    {
+        block = calloc(1, sizeof(*block));
+
+        /* Not worth failing anything over */
+        if (block == NULL)
+            return;
+
+        pthread_mutex_lock(&redrat_stat_lock);
+
+        block->next = redrat_stat_blocks;
+        if (block->next != NULL)
+            block->next->prev = block;
+        redrat_stat_blocks = block;
+
+        pthread_mutex_unlock(&redrat_stat_lock);
+
+        pthread_setspecific(redrat_stat_key, block);
+        redrat_stat_mine = block;
+    }
+
+    __atomic_store_n(&block->counts[stat], block->counts[stat] + n,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * Threads do not survive fork, but may have held the lock.  Their blocks stay
+ * listed, as counts from before the fork.
+ */
+static void
+redrat_stat_atfork_child(void)
+{
+    pthread_mutex_init(&redrat_stat_lock, NULL);
+}
+#endif /* REDRAT_STATS */
+
+#ifdef HAVE_RB_PROFILE_FRAMES
+/*
+ * redrat_prof_name - Copy a Python frame's name into a sample, as
+ * "function (file)"
+ *
+ * Async-signal-safe: it only reads the frame, which this thread is running.
+ */
+static void
+redrat_prof_name(char *into, PyFrameObject *f)
+{
+    PyObject   *parts[2];
+    const char *text[4];
+    size_t      len = 0;
+    int         i;
+
+    parts[0] = f->f_code->co_name;
+    parts[1] = f->f_code->co_filename;
+
+    text[0] = PyString_Check(parts[0]) ? PyString_AS_STRING(parts[0]) : "?";
+    text[1] = " (";
+    text[2] = PyString_Check(parts[1]) ? PyString_AS_STRING(parts[1]) : "?";
+    text[3] = ")";
+
+    for (i = 0; i < 4; i++)
+    {
+        const char *c;
+
+        for (c = text[i]; *c != '\0' && len < REDRAT_PROF_NAME - 1; c++)
+            into[len++] = (*c == ';') ? ':' : *c;
+    }
+
+    into[len] = '\0';
+}
+
+static void redrat_prof_job(void *unused);
+
+/*
+ * redrat_prof_same - Whether two samples would record the same stack, as far
+ * as the handler can tell
+ */
+static bool
+redrat_prof_same(redrat_prof_sample *a, redrat_prof_sample *b)
+{
+    int i;
+
+    if (a->gilWait != b->gilWait || a->ncross != b->ncross ||
+        a->npy != b->npy)
+        return false;
+
+    for (i = 0; i < a->ncross && i < REDRAT_PROF_CROSSINGS; i++)
+        if (a->cross[i].rubyDepth != b->cross[i].rubyDepth ||
+            a->cross[i].pythonDepth != b->cross[i].pythonDepth)
+            return false;
+
+    for (i = 0; i < a->npy; i++)
+        if (strcmp(a->py[i], b->py[i]) != 0)
+            return false;
+
+    return true;
+}
+
+/*
+ * redrat_prof_signal - SIGPROF handler, queueing a pending sample
+ *
+ * Python frames are only read while this thread holds the GIL, since only
+ * then is this thread the one changing them.
+ */
+static void
+redrat_prof_signal(int signo, siginfo_t *info, void *context)
+{
+    redrat_profile     *prof = redrat_prof;
+    redrat_prof_sample *sample;
+    redrat_prof_sample *last;
+    PyThreadState      *ts;
+    PyFrameObject      *f;
+    unsigned long       head;
+    unsigned long       tail;
+    int                 savedErrno = errno;
+    int                 depth;
+
+    if (prof == NULL || !pthread_equal(prof->thread, pthread_self()))
+        goto done;
+
+    sample = &prof->next;
+    sample->count = 1;
+    sample->gilWait = prof->gilWait;
+    sample->ncross = prof->ncross;
+    memcpy(sample->cross, prof->cross, sizeof(sample->cross));
+    sample->npy = 0;
+
+    ts = _PyThreadState_Current;
+
+    if (!sample->gilWait && ts != NULL &&
+        ts->thread_id == PyThread_get_thread_ident())
+    {
+        for (f = ts->frame, depth = 0; f != NULL; f = f->f_back)
+            depth += 1;
+
+        sample->npy = (depth < REDRAT_PROF_PY_FRAMES) ?
+                      depth : REDRAT_PROF_PY_FRAMES;
+
+        for (f = ts->frame; f != NULL; f = f->f_back)
+        {
+            depth -= 1;
+
+            if (depth < REDRAT_PROF_PY_FRAMES)
+                redrat_prof_name(sample->py[depth], f);
+        }
+    }
+
+    head = prof->head;
+    tail = __atomic_load_n(&prof->tail, __ATOMIC_ACQUIRE);
+    last = &prof->pending[(head - 1) % REDRAT_PROF_PENDING];
+
+    if (head != tail && !prof->draining && redrat_prof_same(sample, last))
+    {
+        last->count += 1;
+        goto done;
+    }
+
+    /* Full: the thread has not checked for interrupts in a while */
+    if (head - tail >= REDRAT_PROF_PENDING)
+        goto done;
+
+    memcpy(&prof->pending[head % REDRAT_PROF_PENDING], sample,
+           offsetof(redrat_prof_sample, py) + sample->npy * REDRAT_PROF_NAME);
+    __atomic_store_n(&prof->head, head + 1, __ATOMIC_RELEASE);
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+    rb_postponed_job_trigger(redrat_prof_job_handle);
+#else
+    rb_postponed_job_register_one(0, redrat_prof_job, NULL);
+#endif
+
+done:
+    errno = savedErrno;
+}
+
+/*
+ * redrat_prof_sampler - Body of the sampler thread, signalling the profiled
+ * thread every interval until the profile stops
+ */
+static void *
+redrat_prof_sampler(void *data)
+{
+    redrat_profile  *prof = data;
+    struct timespec  next;
+
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    pthread_mutex_lock(&prof->lock);
+
+    while (!prof->stopping)
+    {
+        next.tv_nsec += prof->intervalNs;
+        next.tv_sec += next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+
+        if (pthread_cond_timedwait(&prof->cond, &prof->lock, &next) == 0)
+            continue;
+
+        if (!prof->stopping)
+            pthread_kill(prof->thread, SIGPROF);
+    }
+
+    pthread_mutex_unlock(&prof->lock);
+
+    return NULL;
+}
+
+/*
+ * redrat_prof_ruby_frames - Append the names of Ruby frames from..to, counted
+ * from the outermost, to a collapsed stack
+ */
+static void
+redrat_prof_ruby_frames(VALUE rStack, redrat_profile *prof, int nruby,
+                        int from, int to)
+{
+    int i;
+
+    for (i = from; i < to; i++)
+    {
+        VALUE rFrame = prof->rubyFrames[nruby - 1 - i];
+        VALUE rLabel = rb_profile_frame_full_label(rFrame);
+        VALUE rPath = rb_profile_frame_path(rFrame);
+        long  start = RSTRING_LEN(rStack);
+        char *c;
+
+        if (start > 0)
+            rb_str_cat_cstr(rStack, ";");
+
+        start = RSTRING_LEN(rStack);
+
+        if (NIL_P(rLabel))
+            rb_str_cat_cstr(rStack, "?");
+        else
+            rb_str_append(rStack, rLabel);
+
+        if (!NIL_P(rPath))
+            rb_str_catf(rStack, " (%"PRIsVALUE")", rPath);
+
+        for (c = RSTRING_PTR(rStack) + start;
+             c < RSTRING_END(rStack); c++)
+            if (*c == ';')
+                *c = ':';
+    }
+}
+
+/*
+ * redrat_prof_python_frames - Append a sample's Python frames from..to,
+ * counted from the outermost, to a collapsed stack
+ */
+static void
+redrat_prof_python_frames(VALUE rStack, redrat_prof_sample *sample, int from,
+                          int to)
+{
+    int i;
+
+    for (i = from; i < to; i++)
+    {
+        if (RSTRING_LEN(rStack) > 0)
+            rb_str_cat_cstr(rStack, ";");
+
+        rb_str_cat_cstr(rStack, sample->py[i]);
+    }
+}
+
+/*
+ * redrat_prof_record - Stitch a sample's Python frames with the Ruby frames
+ * in prof->rubyFrames, and count the stack
+ */
+static void
+redrat_prof_record(redrat_profile *prof, redrat_prof_sample *sample,
+                   int nruby)
+{
+    VALUE rStack = rb_str_buf_new(256);
+    VALUE rCount;
+    int   ncross = sample->ncross;
+    int   rEnd = nruby;
+    int   ri = 0;
+    int   pi = 0;
+    int   i;
+
+    if (ncross > REDRAT_PROF_CROSSINGS)
+        ncross = REDRAT_PROF_CROSSINGS;
+
+    /*
+     * Ruby frames pushed by calls into Ruby that started after the sample was
+     * taken are not part of it
+     */
+    if (ncross < prof->ncross && ncross < REDRAT_PROF_CROSSINGS &&
+        prof->cross[ncross].rubyDepth < nruby)
+        rEnd = prof->cross[ncross].rubyDepth;
+
+    for (i = 0; i < ncross; i++)
+    {
+        int rTo = sample->cross[i].rubyDepth;
+        int pTo = sample->cross[i].pythonDepth;
+
+        rTo = (rTo < ri) ? ri : (rTo > rEnd) ? rEnd : rTo;
+        pTo = (pTo < pi) ? pi : (pTo > sample->npy) ? sample->npy : pTo;
+
+        redrat_prof_ruby_frames(rStack, prof, nruby, ri, rTo);
+        redrat_prof_python_frames(rStack, sample, pi, pTo);
+        ri = rTo;
+        pi = pTo;
+    }
+
+    redrat_prof_ruby_frames(rStack, prof, nruby, ri, rEnd);
+
+    if (sample->gilWait)
+        rb_str_cat_cstr(rStack, RSTRING_LEN(rStack) > 0 ?
+                        ";[GIL wait]" : "[GIL wait]");
+    else
+        redrat_prof_python_frames(rStack, sample, pi, sample->npy);
+
+    rCount = rb_hash_lookup2(redrat_prof_stacks, rStack, INT2FIX(0));
+    rb_hash_aset(redrat_prof_stacks, rStack,
+                 LONG2FIX(FIX2LONG(rCount) + sample->count));
+}
+
+/*
+ * redrat_prof_job - Postponed job, completing pending samples with the Ruby
+ * frames of the thread as they are now
+ */
+static void
+redrat_prof_job(void *unused)
+{
+    redrat_profile *prof = redrat_prof;
+    unsigned long   head;
+    unsigned long   tail;
+    int             nruby;
+
+    /* Run for another thread; its own turn will come */
+    if (prof == NULL || !pthread_equal(prof->thread, pthread_self()))
+        return;
+
+    head = __atomic_load_n(&prof->head, __ATOMIC_ACQUIRE);
+    tail = prof->tail;
+
+    if (head == tail)
+        return;
+
+    nruby = rb_profile_frames(0, REDRAT_PROF_RB_FRAMES, prof->rubyFrames,
+                              NULL);
+
+    prof->draining = true;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    for (; tail != head; tail++)
+        redrat_prof_record(prof, &prof->pending[tail % REDRAT_PROF_PENDING],
+                           nruby);
+
+    __atomic_store_n(&prof->tail, tail, __ATOMIC_RELEASE);
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    prof->draining = false;
+}
+
+/*
+ * redrat_prof_cross_enter - Note a call from Python into Ruby on this thread,
+ * returning whether redrat_prof_cross_leave should be called after it
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static bool
+redrat_prof_cross_enter(void)
+{
+    redrat_profile *prof = redrat_prof;
+    PyFrameObject  *f;
+    int             n;
+
+    if (!REDRAT_PROF_HERE())
+        return false;
+
+    n = prof->ncross;
+
+    if (n < REDRAT_PROF_CROSSINGS)
+    {
+        prof->cross[n].pythonDepth = 0;
+
+        for (f = PyThreadState_GET()->frame; f != NULL; f = f->f_back)
+            prof->cross[n].pythonDepth += 1;
+
+        prof->cross[n].rubyDepth =
+            rb_profile_frames(0, REDRAT_PROF_RB_FRAMES, prof->rubyFrames,
+                              NULL);
+    }
+
+    /* The handler must not see the count before the crossing itself */
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    prof->ncross = n + 1;
+
+    return true;
+}
+
+static void
+redrat_prof_cross_leave(void)
+{
+    if (REDRAT_PROF_HERE() && redrat_prof->ncross > 0)
+        redrat_prof->ncross -= 1;
+}
+#endif /* HAVE_RB_PROFILE_FRAMES */
+
+/*
+ * redrat_decref_drain - Drop every reference on the deferred Py_DECREF queue
+ *
+ * Returns whether there was anything to drain.  This procedure presumes that
+ * the Python GIL is already held; the Ruby GVL need not be.
+ */
+static bool
+redrat_decref_drain(void)
+{
+    redrat_decref_node *node;
+    long                start;
+    long                elapsed;
+    long                count = 0;
+
+    node = __atomic_exchange_n(&redrat_decref_head, NULL, __ATOMIC_ACQUIRE);
+
+    if (node == NULL)
+        return false;
+
+    start = redrat_now_ns();
+
+    while (node != NULL)
+    {
+        redrat_decref_node *next = node->next;
+
+        Py_DECREF(node->freeing);
+        free(node);
+
+        node = next;
+        count += 1;
+    }
+
+    elapsed = redrat_now_ns() - start;
+
+    __atomic_sub_fetch(&redrat_decref_depth, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&redrat_decref_drained, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&redrat_decref_drains, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&redrat_decref_total_drain_ns, elapsed,
+                       __ATOMIC_RELAXED);
+    redrat_decref_last_drain_ns = elapsed;
+
+    /* Draining is serialized by the GIL */
+    if (elapsed > redrat_decref_max_drain_ns)
+        redrat_decref_max_drain_ns = elapsed;
+
+    return true;
+}
+
+/*
+ * redrat_decref_drainer_main - Drain the queue whenever it grows too long
+ *
+ * Runs on a thread of its own, unknown to Ruby.  It never needs the GVL, so
+ * Ruby threads waiting on the GIL while holding the GVL are safe from it.
+ */
+static void *
+redrat_decref_drainer_main(void *unused)
+{
+    for (;;)
+    {
+        PyGILState_STATE gstate;
+
+        pthread_mutex_lock(&redrat_decref_drainer_lock);
+
+        while (__atomic_load_n(&redrat_decref_depth, __ATOMIC_RELAXED) <
+               REDRAT_DECREF_DRAINER_THRESHOLD)
+            pthread_cond_wait(&redrat_decref_drainer_cond,
+                              &redrat_decref_drainer_lock);
+
+        pthread_mutex_unlock(&redrat_decref_drainer_lock);
+
+        gstate = PyGILState_Ensure();
+
+        if (redrat_decref_drain())
+            __atomic_add_fetch(&redrat_decref_background_drains, 1,
+                               __ATOMIC_RELAXED);
+
+        PyGILState_Release(gstate);
+    }
+
+    return NULL;
+}
+
+/* Threads do not survive fork, so a child must start its own drainer */
+static void
+redrat_decref_drainer_atfork_child(void)
+{
+    redrat_decref_drainer_started = false;
+}
+
+/*
+ * redrat_decref_drainer_wake - Get the background drainer going
+ */
+static void
+redrat_decref_drainer_wake(void)
+{
+    pthread_mutex_lock(&redrat_decref_drainer_lock);
+
+    if (!redrat_decref_drainer_started)
+    {
+        pthread_t      drainer;
+        pthread_attr_t attr;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        /* On failure, leave it to redrat_gil_ensure and try again later */
+        if (pthread_create(&drainer, &attr,
+                           redrat_decref_drainer_main, NULL) == 0)
+            redrat_decref_drainer_started = true;
+
+        pthread_attr_destroy(&attr);
+    }
+
+    pthread_cond_signal(&redrat_decref_drainer_cond);
+    pthread_mutex_unlock(&redrat_decref_drainer_lock);
+}
+
+/*
+ * redrat_decref_enqueue - Defer a Py_DECREF until the GIL is next taken
+ *
+ * Needs neither the GIL nor the GVL.
+ */
+static void
+redrat_decref_enqueue(PyObject *freeing)
+{
+    redrat_decref_node *node = malloc(sizeof(redrat_decref_node));
+    long                depth;
+
+    if (node == NULL)
+        rb_bug("redrat_ext: out of memory deferring a Py_DECREF");
+
+    node->freeing = freeing;
+    node->next = __atomic_load_n(&redrat_decref_head, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&redrat_decref_head, &node->next, node,
+                                        true, __ATOMIC_RELEASE,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    __atomic_add_fetch(&redrat_decref_enqueued, 1, __ATOMIC_RELAXED);
+    depth = __atomic_add_fetch(&redrat_decref_depth, 1, __ATOMIC_RELAXED);
+
+    if (depth == REDRAT_DECREF_DRAINER_THRESHOLD)
+        redrat_decref_drainer_wake();
+}
+
+/*
+ * redrat_gil_ensure - Take the Python GIL, unless this thread has it already
+ *
+ * Every call must be paired with a redrat_gil_release.  This procedure
+ * presumes that the Ruby GVL is already held.
+ */
+static void
+redrat_gil_ensure(void)
+{
+    long waitStart;
+
+    if (redrat_gil_depth > 0)
+    {
+        redrat_gil_depth += 1;
+        return;
+    }
+
+    waitStart = REDRAT_STAT_CLOCK();
+    REDRAT_PROF_GIL_WAIT(true);
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (redrat_gil_detached > 0)
+    {
+        int state = 0;
+
+        /*
+         * Somebody may be holding the GIL and waiting on the GVL, so wait for
+         * the GIL without the GVL.  Until this thread gets the GVL back, it is
+         * one of those somebodies itself.
+         */
+        redrat_gil_detached += 1;
+        rb_protect(redrat_gil_ensure_blocking, Qnil, &state);
+        redrat_gil_detached -= 1;
+
+        if (state != 0)
+        {
+            REDRAT_PROF_GIL_WAIT(false);
+
+            /* Interrupted on the way back into Ruby, e.g. by Thread#raise */
+            if (redrat_gil_depth > 0)
+            {
+                redrat_gil_depth = 0;
+                PyGILState_Release(redrat_gil_outer_state);
+            }
+
+            rb_jump_tag(state);
+        }
+    }
+    else
+#endif /* HAVE_RB_THREAD_CALL_WITHOUT_GVL */
+    {
+        redrat_gil_outer_state = PyGILState_Ensure();
+        redrat_gil_depth = 1;
+    }
+
+    REDRAT_PROF_GIL_WAIT(false);
+
+    if (waitStart != 0)
+    {
+        REDRAT_STAT_ADD(REDRAT_STAT_GIL_WAITS, 1);
+        REDRAT_STAT_ADD(REDRAT_STAT_GIL_WAIT_NS, redrat_now_ns() - waitStart);
+    }
+
+    redrat_decref_drain();
+}
+
+/*
+ * redrat_gil_release - Undo one redrat_gil_ensure
+ */
+static void
+redrat_gil_release(void)
+{
+    Assert(redrat_gil_depth > 0);
+
+    redrat_gil_depth -= 1;
+
+    if (redrat_gil_depth == 0)
+        PyGILState_Release(redrat_gil_outer_state);
+}
+
+/*
+ * redrat_py_decref_wrap - Work around Py_DECREF being a macro
+ *
+ * This enables function pointer passing for Ruby GC.
+ *
+ * Unless this thread happens to hold the GIL already, and is not collecting
+ * cycles, the reference is dropped later, see redrat_decref_enqueue.
+ */
+static void
+redrat_py_decref_wrap(PyObject *freeing)
+{
+    if (redrat_gil_depth > 0 && redrat_cycle_current == NULL)
+        Py_DECREF(freeing);
+    else
+        redrat_decref_enqueue(freeing);
+}
+
+/*
+ * redrat_decref_queue_stats - Counters of the deferred Py_DECREF queue
+ *
+ * Returns a Hash of how many references are waiting (depth), were ever
+ * deferred (enqueued) and dropped (drained), how many drains happened (drains,
+ * background_drains), and how long they took in nanoseconds.
+ */
+static VALUE
+redrat_decref_queue_stats(VALUE self)
+{
+    VALUE rStats = rb_hash_new();
+
+#define redrat_stat_set(name, counter)                                        \
+    rb_hash_aset(rStats, ID2SYM(rb_intern(name)),                             \
+                 LONG2NUM(__atomic_load_n(&(counter), __ATOMIC_RELAXED)))
+
+    redrat_stat_set("depth", redrat_decref_depth);
+    redrat_stat_set("enqueued", redrat_decref_enqueued);
+    redrat_stat_set("drained", redrat_decref_drained);
+    redrat_stat_set("drains", redrat_decref_drains);
+    redrat_stat_set("background_drains", redrat_decref_background_drains);
+    redrat_stat_set("last_drain_ns", redrat_decref_last_drain_ns);
+    redrat_stat_set("max_drain_ns", redrat_decref_max_drain_ns);
+    redrat_stat_set("total_drain_ns", redrat_decref_total_drain_ns);
+
+#undef redrat_stat_set
+
+    return rStats;
+}
+
+/*
+ * redrat_roots_mark - Mark every Ruby value referenced from Python
+ *
+ * Ruby does not call mark functions of objects with a NULL data pointer, so
+ * the keeper wraps &redrat_roots even though it is unused here.
+ */
+static void
+redrat_roots_mark(void *unused)
+{
+    long i;
+
+    pthread_mutex_lock(&redrat_roots_lock);
+
+    for (i = 0; i < redrat_roots_used; i += 1)
+        if (redrat_roots[i].value != Qundef &&
+            redrat_roots[i].nextFree != REDRAT_ROOT_SUSPENDED)
+            rb_gc_mark(redrat_roots[i].value);
+
+    pthread_mutex_unlock(&redrat_roots_lock);
+}
+
+/*
+ * redrat_root_add - Keep a Ruby value alive until redrat_root_remove
+ *
+ * Returns the slot to hand to redrat_root_remove.
+ */
+static long
+redrat_root_add(VALUE r)
+{
+    long root;
+
+    pthread_mutex_lock(&redrat_roots_lock);
+
+    if (redrat_roots_free >= 0)
+    {
+        root = redrat_roots_free;
+        redrat_roots_free = redrat_roots[root].nextFree;
+    }
+    else
+    {
+        if (redrat_roots_used == redrat_roots_cap)
+        {
+            long              newCap = redrat_roots_cap * 2 + 1024;
+            redrat_root_slot *grown;
+
+            /*
+             * Not xrealloc, which could run GC and with it redrat_roots_mark
+             * while the lock is held.
+             */
+            grown = realloc(redrat_roots, newCap * sizeof(redrat_root_slot));
+
+            if (grown == NULL)
+            {
+                pthread_mutex_unlock(&redrat_roots_lock);
+                rb_memerror();
+            }
+
+            redrat_roots = grown;
+            redrat_roots_cap = newCap;
+        }
+
+        root = redrat_roots_used;
+        redrat_roots_used += 1;
+    }
+
+    redrat_roots[root].value = r;
+    redrat_roots[root].nextFree = -1;
+
+    pthread_mutex_unlock(&redrat_roots_lock);
+
+    return root;
+}
+
+/*
+ * redrat_root_remove - Let go of a Ruby value kept by redrat_root_add
+ *
+ * This procedure does not need the Ruby GVL.
+ */
+static void
+redrat_root_remove(long root)
+{
+    pthread_mutex_lock(&redrat_roots_lock);
+
+    Assert(root >= 0 && root < redrat_roots_used);
+    Assert(redrat_roots[root].value != Qundef);
+
+    redrat_roots[root].value = Qundef;
+    redrat_roots[root].nextFree = redrat_roots_free;
+    redrat_roots_free = root;
+
+    pthread_mutex_unlock(&redrat_roots_lock);
+}
+
+/*
+ * redrat_root_suspend - Stop, or go back to, marking a root
+ *
+ * Only for redrat_cycle_collect, which has Ruby reach the value another way
+ * while it is suspended.
+ */
+static void
+redrat_root_suspend(long root, bool suspended)
+{
+    pthread_mutex_lock(&redrat_roots_lock);
+
+    Assert(root >= 0 && root < redrat_roots_used);
+    Assert(redrat_roots[root].value != Qundef);
+
+    redrat_roots[root].nextFree = suspended ? REDRAT_ROOT_SUSPENDED : -1;
+
+    pthread_mutex_unlock(&redrat_roots_lock);
+}
+
+/*
+ * redrat_pythonvalue_free - Free a PythonValue, dropping its reference
+ */
+static void
+redrat_pythonvalue_free(PyObject *freeing)
+{
+    redrat_python_values_live -= 1;
+    REDRAT_STAT_ADD(REDRAT_STAT_PYTHON_VALUES_FREED, 1);
+    redrat_py_decref_wrap(freeing);
+}
+
+/*
+ * redrat_pythonvalue_free_unmapped - redrat_pythonvalue_free, for PythonValues
+ * left out of redrat_wrappers
+ *
+ * A distinct function so that they can be told apart by their dfree, see
+ * redrat_pythonvalue_wrap.
+ */
+static void
+redrat_pythonvalue_free_unmapped(PyObject *freeing)
+{
+    redrat_pythonvalue_free(freeing);
+}
+
+/*
+ * redrat_pythonvalue_mark - Mark what a PythonValue's PyObject reaches, while
+ * collecting cycles, see redrat_cycle_collect
+ */
+static void
+redrat_pythonvalue_mark(PyObject *p)
+{
+    st_data_t rReach;
+
+    if (redrat_cycle_reach != NULL &&
+        st_lookup(redrat_cycle_reach, (st_data_t) p, &rReach))
+        rb_gc_mark((VALUE) rReach);
+}
+
+/*
+ * redrat_pythonvalue_made - Count a new PythonValue, and add it to the scope
+ */
+static VALUE
+redrat_pythonvalue_made(VALUE r)
+{
+    redrat_python_values_live += 1;
+    REDRAT_STAT_ADD(REDRAT_STAT_PYTHON_VALUES_MADE, 1);
+
+    if (redrat_python_values_live > redrat_python_values_peak)
+        redrat_python_values_peak = redrat_python_values_live;
+
+    if (redrat_scope_current != NULL)
+    {
+        VALUE         rFiber = rb_fiber_current();
+        redrat_scope *scope;
+
+        for (scope = redrat_scope_current; scope != NULL; scope = scope->outer)
+            if (scope->rFiber == rFiber)
+            {
+                rb_ary_push(scope->rValues, r);
+                break;
+            }
+    }
+
+    return r;
+}
+
+/*
+ * redrat_slab_alloc - tp_alloc of RubyObjects and their lookalikes
+ *
+ * Takes a zeroed block off of the free list of the type's size class,
+ * carving a new slab into blocks if the list is empty.  Objects of types
+ * taking part in Python's cyclic GC are preceded by their PyGC_Head, and
+ * start out untracked.  All of these types start out laid out like a
+ * RubyObject, which starts out holding nil and no root, not slot 0 of
+ * redrat_roots, so that freeing it before it gets either is harmless.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_slab_alloc(PyTypeObject *type, Py_ssize_t nitems)
+{
+    size_t             head = PyType_IS_GC(type) ? sizeof(PyGC_Head) : 0;
+    size_t             sizeClass;
+    redrat_slab_block *block;
+    PyObject          *op;
+
+    sizeClass = (head + type->tp_basicsize - 1) / REDRAT_SLAB_ALIGN;
+
+    Assert(nitems == 0 && sizeClass < REDRAT_SLAB_CLASSES);
+
+    if (redrat_slab_free_lists[sizeClass] == NULL)
+    {
+        size_t  size = (sizeClass + 1) * REDRAT_SLAB_ALIGN;
+        char   *slab = malloc(REDRAT_SLAB_BYTES);
+        size_t  offset;
+
+        if (slab == NULL)
+            return PyErr_NoMemory();
+
+        for (offset = 0; offset + size <= REDRAT_SLAB_BYTES; offset += size)
+        {
+            block = (void *) (slab + offset);
+            block->next = redrat_slab_free_lists[sizeClass];
+            redrat_slab_free_lists[sizeClass] = block;
+        }
+
+        redrat_slabs += 1;
+    }
+
+    block = redrat_slab_free_lists[sizeClass];
+    redrat_slab_free_lists[sizeClass] = block->next;
+    memset(block, 0, head + type->tp_basicsize);
+
+    op = (PyObject *) ((char *) block + head);
+    ((redrat_RubyObject *) op)->r = Qnil;
+    ((redrat_RubyObject *) op)->root = -1;
+
+    if (head > 0)
+        REDRAT_GC_REFS(op) = _PyGC_REFS_UNTRACKED;
+
+    redrat_ruby_objects_live += 1;
+    REDRAT_STAT_ADD(REDRAT_STAT_RUBY_OBJECTS_MADE, 1);
+
+    if (redrat_ruby_objects_live > redrat_ruby_objects_peak)
+        redrat_ruby_objects_peak = redrat_ruby_objects_live;
+
+    return PyObject_INIT(op, type);
+}
+
+/*
+ * redrat_slab_free - tp_free of RubyObjects and their lookalikes
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static void
+redrat_slab_free(void *freeing)
+{
+    PyTypeObject      *type = ((PyObject *) freeing)->ob_type;
+    size_t             head = PyType_IS_GC(type) ? sizeof(PyGC_Head) : 0;
+    size_t             sizeClass;
+    redrat_slab_block *block = (void *) ((char *) freeing - head);
+
+    sizeClass = (head + type->tp_basicsize - 1) / REDRAT_SLAB_ALIGN;
+
+    block->next = redrat_slab_free_lists[sizeClass];
+    redrat_slab_free_lists[sizeClass] = block;
+
+    redrat_ruby_objects_live -= 1;
+    REDRAT_STAT_ADD(REDRAT_STAT_RUBY_OBJECTS_FREED, 1);
+}
+
+/*
+ * redrat_pythonvalue_wrap - The PythonValue of a PyObject
+ *
+ * Returns the PythonValue already wrapping it, if one is alive, so that a
+ * PyObject has one PythonValue at a time, and equal? and hash say whether
+ * two PythonValues are the same Python object.  Otherwise wraps it in a new
+ * PythonValue holding a reference of its own, either new or, with steal,
+ * taken over from the caller.  An existing PythonValue already holds one, so
+ * a stolen reference is then dropped.
+ *
+ * redrat_wrappers, an ObjectSpace::WeakMap, maps from addresses.  A
+ * PyObject's address cannot be reused while its PythonValue holds it, and the
+ * WeakMap forgets PythonValues as Ruby collects them, without returning ones
+ * that are awaiting sweeping.
+ *
+ * Adding to the WeakMap costs more than making the PythonValue, so a PyObject
+ * whose only reference is the one stolen, such as a fresh result, is wrapped
+ * without: no other PythonValue can hold it, and until this one goes back to
+ * Python nothing else can hand it off again.  It is added once it does, see
+ * redrat_pythonvalue_share.  Only objects Python reaches through weak
+ * references alone, as of their first handoff, can get a second PythonValue.
+ * A borrowed PyObject is always looked up, even with a count of one: whoever
+ * holds that reference, such as a list over its items, can hand it off again.
+ *
+ * This procedure presumes that the Ruby GVL is held, and, without steal, the
+ * Python GIL too.
+ */
+static VALUE
+redrat_pythonvalue_wrap(PyObject *wrapping, bool steal)
+{
+    VALUE rKey;
+    VALUE r;
+
+    if (steal && Py_REFCNT(wrapping) == 1)
+    {
+        redrat_wrapper_unshared += 1;
+
+        return redrat_pythonvalue_made(
+            Data_Wrap_Struct(rb_cPythonValue, redrat_pythonvalue_mark,
+                             redrat_pythonvalue_free_unmapped, wrapping));
+    }
+
+    rKey = LONG2FIX((long) ((uintptr_t) wrapping >> 3));
+    r = rb_funcall(redrat_wrappers, redrat_id_aref, 1, rKey);
+
+    if (r != Qnil)
+    {
+        redrat_wrapper_hits += 1;
+
+        if (steal)
+            redrat_py_decref_wrap(wrapping);
+
+        return r;
+    }
+
+    if (!steal)
+        Py_INCREF(wrapping);
+
+    r = Data_Wrap_Struct(rb_cPythonValue, redrat_pythonvalue_mark,
+                         redrat_pythonvalue_free, wrapping);
+    redrat_wrapper_misses += 1;
+    rb_funcall(redrat_wrappers, redrat_id_aset, 2, rKey, r);
+
+    return redrat_pythonvalue_made(r);
+}
+
+/*
+ * redrat_pythonvalue_share - Add a PythonValue going to Python to the map
+ *
+ * For PythonValues that redrat_pythonvalue_wrap left out of redrat_wrappers,
+ * as their PyObjects can come back once Python holds them.  Cheap for all
+ * others.  This procedure presumes that the Ruby GVL is held.
+ */
+static void
+redrat_pythonvalue_share(VALUE r)
+{
+    VALUE rKey;
+
+    if (RDATA(r)->dfree != (RUBY_DATA_FUNC) redrat_pythonvalue_free_unmapped)
+        return;
+
+    rKey = LONG2FIX((long) ((uintptr_t) DATA_PTR(r) >> 3));
+
+    /* Some other PythonValue got there first; keep to it */
+    if (rb_funcall(redrat_wrappers, redrat_id_aref, 1, rKey) == Qnil)
+        rb_funcall(redrat_wrappers, redrat_id_aset, 2, rKey, r);
+
+    RDATA(r)->dfree = (RUBY_DATA_FUNC) redrat_pythonvalue_free;
+}
+
+/*
+ * redrat_pythonvalue_get - The PyObject of a PythonValue, borrowed
+ *
+ * Raises if RedRat::Internal.scope has released it, so call this before
+ * taking the GIL.
+ */
+static PyObject *
+redrat_pythonvalue_get(VALUE r)
+{
+    PyObject *p;
+
+    Data_Get_Struct(r, PyObject, p);
+
+    if (p == NULL)
+        rb_raise(rb_eRuntimeError, "%s", REDRAT_RELEASED_MESSAGE);
+
+    return p;
+}
+
+static VALUE
+redrat_scope_yield(VALUE data)
+{
+    redrat_scope *scope = (void *) data;
+
+    scope->rResult = rb_yield(Qnil);
+
+    return scope->rResult;
+}
+
+/*
+ * redrat_scope_release - Let go of the PyObjects of a scope's PythonValues
+ *
+ * The block's value is passed on to the enclosing scope of the same Fiber,
+ * if any, rather than released.
+ */
+static VALUE
+redrat_scope_release(VALUE data)
+{
+    redrat_scope  *scope = (void *) data;
+    redrat_scope **link;
+    redrat_scope  *outer;
+    long           i;
+
+    /* Fibers can leave scopes out of order, so unlink rather than pop */
+    for (link = &redrat_scope_current; *link != scope; link = &(*link)->outer)
+        Assert(*link != NULL);
+
+    *link = scope->outer;
+
+    for (outer = scope->outer; outer != NULL; outer = outer->outer)
+        if (outer->rFiber == scope->rFiber)
+            break;
+
+    redrat_gil_ensure();
+
+    for (i = 0; i < RARRAY_LEN(scope->rValues); i += 1)
+    {
+        VALUE     r = RARRAY_AREF(scope->rValues, i);
+        PyObject *p = DATA_PTR(r);
+
+        if (r == scope->rResult ||
+            (scope->rKeep != Qnil && rb_hash_lookup(scope->rKeep, r) != Qnil))
+        {
+            if (outer != NULL)
+                rb_ary_push(outer->rValues, r);
+
+            continue;
+        }
+
+        if (RDATA(r)->dfree == (RUBY_DATA_FUNC) redrat_pythonvalue_free)
+        {
+            VALUE rKey = LONG2FIX((long) ((uintptr_t) p >> 3));
+
+            if (rb_funcall(redrat_wrappers, redrat_id_aref, 1, rKey) == r)
+                rb_funcall(redrat_wrappers, redrat_id_delete, 1, rKey);
+        }
+
+        RDATA(r)->dfree = NULL;
+        DATA_PTR(r) = NULL;
+        redrat_python_values_live -= 1;
+        REDRAT_STAT_ADD(REDRAT_STAT_PYTHON_VALUES_FREED, 1);
+
+        Py_DECREF(p);
+    }
+
+    redrat_gil_release();
+
+    return Qnil;
+}
+
+/*
+ * redrat_scope_block - Release the PythonValues made in a block, at its exit
+ *
+ * For loops making many short-lived PythonValues: rather than each being
+ * finalized by Ruby's GC, and its Py_DECREF deferred to the decref queue,
+ * their PyObjects are all let go of in one pass when the block exits, even
+ * if it raises.
+ *
+ * Only the block's value escapes, not anything it refers to: a PythonValue
+ * made in the block and kept any other way, in an Array, an instance
+ * variable or a closure, is released all the same, and raises a
+ * RuntimeError when used afterwards.  So return PythonValues themselves, or
+ * convert them to Ruby first.  A nested scope's value escapes to the
+ * enclosing one.  Only PythonValues made by the calling Fiber are released.
+ */
+static VALUE
+redrat_scope_block(VALUE self)
+{
+    redrat_scope scope;
+
+    rb_need_block();
+
+    scope.rValues = rb_ary_new();
+    scope.rKeep = Qnil;
+    scope.rFiber = rb_fiber_current();
+    scope.rResult = Qnil;
+    scope.outer = redrat_scope_current;
+    redrat_scope_current = &scope;
+
+    rb_ensure(redrat_scope_yield, (VALUE) &scope,
+              redrat_scope_release, (VALUE) &scope);
+
+    RB_GC_GUARD(scope.rValues);
+    RB_GC_GUARD(scope.rKeep);
+
+    return scope.rResult;
+}
+
+/*
+ * redrat_wrapper_stats - Counters of the PythonValue identity map
+ *
+ * Returns a Hash of how many handoffs found the PythonValue of their PyObject
+ * alive (hits), how many had to make one (misses), how many made one without
+ * the map because only a stolen reference held the PyObject (unshared), and
+ * how many PythonValues the map holds (size).  Also how many PythonValues and
+ * RubyObjects there are, and have been at most, and how many slabs the latter
+ * take.
+ */
+static VALUE
+redrat_wrapper_stats(VALUE self)
+{
+    VALUE rStats = rb_hash_new();
+
+#define redrat_stat_set(name, value)                                          \
+    rb_hash_aset(rStats, ID2SYM(rb_intern(name)), (value))
+
+    redrat_stat_set("hits", LONG2NUM(redrat_wrapper_hits));
+    redrat_stat_set("misses", LONG2NUM(redrat_wrapper_misses));
+    redrat_stat_set("unshared", LONG2NUM(redrat_wrapper_unshared));
+    redrat_stat_set("size", rb_funcall(redrat_wrappers, rb_intern("size"), 0));
+    redrat_stat_set("python_values_live", LONG2NUM(redrat_python_values_live));
+    redrat_stat_set("python_values_peak", LONG2NUM(redrat_python_values_peak));
+    redrat_stat_set("ruby_objects_live", LONG2NUM(redrat_ruby_objects_live));
+    redrat_stat_set("ruby_objects_peak", LONG2NUM(redrat_ruby_objects_peak));
+    redrat_stat_set("slabs", LONG2NUM(redrat_slabs));
+
+#undef redrat_stat_set
+
+    return rStats;
+}
+
+/*
+ * redrat_cycle_witness_mark - Mark a candidate's Ruby value, noting that it
+ * was reached
+ *
+ * Witnesses hold the candidate's index rather than a pointer, so ones that
+ * outlive their pass do nothing.
+ */
+static void
+redrat_cycle_witness_mark(void *data)
+{
+    redrat_cycle_pass *pass = redrat_cycle_current;
+    long               index = (long) (intptr_t) data - 1;
+
+    if (pass == NULL || index >= pass->ncands)
+        return;
+
+    pass->cands[index].markedBy = rb_gc_count();
+    rb_gc_mark(pass->cands[index].pObj->r);
+}
+
+/*
+ * redrat_cycle_grow - Make room for one more item at the end of an array of
+ * a pass
+ */
+static bool
+redrat_cycle_grow(redrat_cycle_pass *pass, void *items, long n, long *cap,
+                  size_t size)
+{
+    void **pItems = items;
+    void  *grown;
+    long   newCap = *cap * 2 + 1024;
+
+    if (n < *cap)
+        return true;
+
+    /* Not xrealloc, which could run GC and with it Ruby code */
+    grown = realloc(*pItems, newCap * size);
+
+    if (grown == NULL)
+    {
+        pass->failed = true;
+        return false;
+    }
+
+    *pItems = grown;
+    *cap = newCap;
+
+    return true;
+}
+
+/*
+ * redrat_cycle_push - Leave a PyObject for redrat_cycle_drain to traverse
+ */
+static int
+redrat_cycle_push(redrat_cycle_pass *pass, PyObject *op)
+{
+    if (!redrat_cycle_grow(pass, &pass->stack, pass->nstack, &pass->capStack,
+                           sizeof(PyObject *)))
+        return -1;
+
+    pass->stack[pass->nstack] = op;
+    pass->nstack += 1;
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_edge - Note that the owner being traversed reaches a candidate,
+ * or -1 - another owner
+ */
+static int
+redrat_cycle_edge(redrat_cycle_pass *pass, long target)
+{
+    /* Runs of links to the same owner are common */
+    if (pass->nedges > 0 && pass->edges[pass->nedges - 2] == pass->owner &&
+        pass->edges[pass->nedges - 1] == target)
+        return 0;
+
+    if (!redrat_cycle_grow(pass, &pass->edges, pass->nedges + 1,
+                           &pass->capEdges, sizeof(long)))
+        return -1;
+
+    pass->edges[pass->nedges] = pass->owner;
+    pass->edges[pass->nedges + 1] = target;
+    pass->nedges += 2;
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_claim - Make a PyObject part of what the owner being traversed
+ * reaches, and a candidate if it is a RubyObject
+ */
+static int
+redrat_cycle_claim(redrat_cycle_pass *pass, PyObject *op)
+{
+    REDRAT_GC_REFS(op) = REDRAT_CYCLE_OWNED(pass->owner);
+
+    if (op->ob_type == &redrat_RubyType &&
+        ((redrat_RubyObject *) op)->root >= 0)
+    {
+        redrat_cycle_candidate *cand;
+
+        if (!redrat_cycle_grow(pass, &pass->cands, pass->ncands,
+                               &pass->capCands,
+                               sizeof(redrat_cycle_candidate)) ||
+            redrat_cycle_edge(pass, pass->ncands) < 0)
+            return -1;
+
+        cand = &pass->cands[pass->ncands];
+        cand->pObj = (redrat_RubyObject *) op;
+        cand->suspended = false;
+        cand->markedBy = 0;
+        Py_INCREF(op);
+
+        pass->ncands += 1;
+    }
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_visit_decref - tp_traverse visitor taking a reference held by
+ * a tracked object off of gc_refs
+ */
+static int
+redrat_cycle_visit_decref(PyObject *op, void *unused)
+{
+    if (PyObject_IS_GC(op) && REDRAT_GC_REFS(op) > 0)
+        REDRAT_GC_REFS(op) -= 1;
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_visit_root - tp_traverse visitor spreading rootedness
+ */
+static int
+redrat_cycle_visit_root(PyObject *op, void *data)
+{
+    if (PyObject_IS_GC(op) && REDRAT_GC_REFS(op) >= 0)
+    {
+        REDRAT_GC_REFS(op) = REDRAT_CYCLE_ROOTED;
+        return redrat_cycle_push(data, op);
+    }
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_visit_own - tp_traverse visitor claiming what is not rooted
+ * for the owner being traversed, and linking it to what other owners did
+ */
+static int
+redrat_cycle_visit_own(PyObject *op, void *data)
+{
+    redrat_cycle_pass *pass = data;
+    Py_ssize_t         refs;
+
+    if (!PyObject_IS_GC(op))
+        return 0;
+
+    refs = REDRAT_GC_REFS(op);
+
+    if (refs >= 0)
+    {
+        if (redrat_cycle_claim(pass, op) < 0)
+            return -1;
+
+        return redrat_cycle_push(pass, op);
+    }
+    else if (refs <= REDRAT_CYCLE_OWNED(0) &&
+             REDRAT_CYCLE_OWNER(refs) != pass->owner)
+        return redrat_cycle_edge(pass, -1 - REDRAT_CYCLE_OWNER(refs));
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_drain - Traverse everything pushed, and whatever the visitor
+ * pushes in turn
+ */
+static int
+redrat_cycle_drain(redrat_cycle_pass *pass, visitproc visit)
+{
+    while (pass->nstack > 0)
+    {
+        PyObject *op;
+
+        pass->nstack -= 1;
+        op = pass->stack[pass->nstack];
+
+        if (op->ob_type->tp_traverse(op, visit, pass) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * redrat_cycle_find - Find the candidates of a pass, and what reaches them
+ *
+ * pObjects is the list gc.get_objects returned.  Allocates nothing from
+ * either runtime, so no Ruby or Python code can run in its middle.  Returns
+ * false if Python's own collector is running, or if memory ran out.
+ */
+static bool
+redrat_cycle_find(redrat_cycle_pass *pass, PyObject *pObjects)
+{
+    Py_ssize_t n = PyList_GET_SIZE(pObjects);
+    Py_ssize_t i;
+    long       k;
+    bool       found = false;
+
+    /* Between its collections, Python keeps tracked objects at REACHABLE */
+    for (i = 0; i < n; i += 1)
+        if (REDRAT_GC_REFS(PyList_GET_ITEM(pObjects, i)) !=
+            _PyGC_REFS_REACHABLE)
+            return false;
+
+    /* Less the reference in pObjects */
+    for (i = 0; i < n; i += 1)
+    {
+        PyObject *op = PyList_GET_ITEM(pObjects, i);
+
+        REDRAT_GC_REFS(op) = Py_REFCNT(op) - 1;
+    }
+
+    for (i = 0; i < n; i += 1)
+    {
+        PyObject *op = PyList_GET_ITEM(pObjects, i);
+
+        op->ob_type->tp_traverse(op, redrat_cycle_visit_decref, NULL);
+    }
+
+    for (k = 0; k < pass->nheld; k += 1)
+        redrat_cycle_visit_decref(pass->held[k], NULL);
+
+    /* What has references left is referred to from outside of both */
+    for (i = 0; i < n; i += 1)
+    {
+        PyObject *op = PyList_GET_ITEM(pObjects, i);
+
+        if (REDRAT_GC_REFS(op) > 0)
+        {
+            REDRAT_GC_REFS(op) = REDRAT_CYCLE_ROOTED;
+
+            if (redrat_cycle_push(pass, op) < 0)
+                goto restore;
+        }
+    }
+
+    if (redrat_cycle_drain(pass, redrat_cycle_visit_root) < 0)
+        goto restore;
+
+    /*
+     * Claim PythonValues' PyObjects first, so that each owns what only it
+     * reaches, and links to the others.
+     */
+    for (k = 0; k < pass->nheld; k += 1)
+    {
+        PyObject *op = pass->held[k];
+
+        if (PyObject_IS_GC(op) && REDRAT_GC_REFS(op) >= 0)
+        {
+            pass->owner = k;
+
+            if (redrat_cycle_claim(pass, op) < 0)
+                goto restore;
+        }
+    }
+
+    for (k = 0; k < pass->nheld; k += 1)
+    {
+        PyObject *op = pass->held[k];
+
+        if (PyObject_IS_GC(op) &&
+            REDRAT_GC_REFS(op) == REDRAT_CYCLE_OWNED(k))
+        {
+            pass->owner = k;
+
+            if (redrat_cycle_push(pass, op) < 0 ||
+                redrat_cycle_drain(pass, redrat_cycle_visit_own) < 0)
+                goto restore;
+        }
+    }
+
+    found = true;
+
+restore:
+    for (i = 0; i < n; i += 1)
+        REDRAT_GC_REFS(PyList_GET_ITEM(pObjects, i)) = _PyGC_REFS_REACHABLE;
+
+    return found;
+}
+
+/*
+ * redrat_cycle_held_i - ObjectSpace.each_object block noting the PyObjects of
+ * PythonValues
+ */
+static VALUE
+redrat_cycle_held_i(RB_BLOCK_CALL_FUNC_ARGLIST(rVal, data))
+{
+    redrat_cycle_pass *pass = (void *) data;
+
+    /* Ones released by RedRat::Internal.scope hold no reference */
+    if (RDATA(rVal)->dfree == NULL ||
+        !redrat_cycle_grow(pass, &pass->held, pass->nheld, &pass->capHeld,
+                           sizeof(PyObject *)))
+        return Qnil;
+
+    pass->held[pass->nheld] = DATA_PTR(rVal);
+    pass->nheld += 1;
+
+    return Qnil;
+}
+
+/*
+ * redrat_cycle_reach_for - The Array of what an owner reaches, in rReaches
+ */
+static VALUE
+redrat_cycle_reach_for(VALUE rReaches, long owner)
+{
+    VALUE rReach = rb_ary_entry(rReaches, owner);
+
+    if (NIL_P(rReach))
+    {
+        rReach = rb_ary_new();
+        rb_ary_store(rReaches, owner, rReach);
+    }
+
+    return rReach;
+}
+
+/*
+ * redrat_cycle_run - The body of redrat_cycle_collect
+ *
+ * Returns how many RubyObjects it cleared.
+ */
+static VALUE
+redrat_cycle_run(VALUE data)
+{
+    redrat_cycle_pass *pass = (void *) data;
+    PyObject          *pGc;
+    PyObject          *pObjects;
+    VALUE              rExc = Qnil;
+    VALUE              rClass = rb_cPythonValue;
+    VALUE              rReaches;
+    size_t             gcCount;
+    bool               gcRan;
+    long               broken = 0;
+    long               e;
+    long               k;
+    long               c;
+
+    rb_block_call(rb_const_get(rb_cObject, rb_intern("ObjectSpace")),
+                  rb_intern("each_object"), 1, &rClass, redrat_cycle_held_i,
+                  (VALUE) pass);
+
+    if (pass->failed)
+        rb_memerror();
+
+    pGc = PyImport_ImportModule("gc");
+    REDRAT_ERRJMP_PYEXC(rExc, pGc);
+
+    pObjects = PyObject_CallMethod(pGc, (char *) "get_objects", NULL);
+    Py_DECREF(pGc);
+    REDRAT_ERRJMP_PYEXC(rExc, pObjects);
+
+    if (!redrat_cycle_find(pass, pObjects))
+    {
+        Py_DECREF(pObjects);
+
+        if (pass->failed)
+            rb_memerror();
+
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: cannot collect cycles while Python collects");
+    }
+
+    Py_DECREF(pObjects);
+
+    if (pass->ncands == 0)
+        return INT2FIX(0);
+
+    /* Arrays of witnesses and of each other, held until the GC */
+    rReaches = rb_ary_new();
+
+    for (e = 0; e < pass->nedges; e += 2)
+    {
+        VALUE rReach = redrat_cycle_reach_for(rReaches, pass->edges[e]);
+        long  target = pass->edges[e + 1];
+
+        if (target >= 0)
+            rb_ary_push(rReach,
+                        Data_Wrap_Struct(0, redrat_cycle_witness_mark, NULL,
+                                         (void *) (intptr_t) (target + 1)));
+        else
+            rb_ary_push(rReach, redrat_cycle_reach_for(rReaches, -1 - target));
+    }
+
+    pass->reach = st_init_numtable();
+
+    for (k = 0; k < RARRAY_LEN(rReaches); k += 1)
+        if (!NIL_P(RARRAY_AREF(rReaches, k)))
+            st_insert(pass->reach, (st_data_t) pass->held[k],
+                      (st_data_t) RARRAY_AREF(rReaches, k));
+
+    /* From here on, candidates' values are only marked by PythonValues */
+    redrat_cycle_reach = pass->reach;
+
+    for (c = 0; c < pass->ncands; c += 1)
+    {
+        redrat_root_suspend(pass->cands[c].pObj->root, true);
+        pass->cands[c].suspended = true;
+    }
+
+    rb_ary_clear(rReaches);
+    RB_GC_GUARD(rReaches);
+
+    /*
+     * rb_gc_start may first finish a GC already under way, so only marks by
+     * the last one count.  GC.disable keeps it from running at all.
+     */
+    gcCount = rb_gc_count();
+    rb_gc_start();
+
+    redrat_cycle_reach = NULL;
+
+    gcRan = rb_gc_count() != gcCount;
+
+    for (c = 0; c < pass->ncands; c += 1)
+    {
+        redrat_cycle_candidate *cand = &pass->cands[c];
+
+        cand->suspended = false;
+
+        if (!gcRan || cand->markedBy == rb_gc_count())
+            redrat_root_suspend(cand->pObj->root, false);
+        else
+        {
+            redrat_rubyobject_clear((PyObject *) cand->pObj);
+            broken += 1;
+        }
+    }
+
+    return LONG2NUM(broken);
+
+py_rb_error:
+    redrat_rb_exc_raise(rExc, "redrat_ext: could not list Python objects");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_cycle_finish - The ensure of redrat_cycle_collect
+ */
+static VALUE
+redrat_cycle_finish(VALUE data)
+{
+    redrat_cycle_pass *pass = (void *) data;
+    long               c;
+
+    redrat_cycle_reach = NULL;
+
+    if (pass->reach != NULL)
+        st_free_table(pass->reach);
+
+    for (c = 0; c < pass->ncands; c += 1)
+        if (pass->cands[c].suspended)
+            redrat_root_suspend(pass->cands[c].pObj->root, false);
+
+    redrat_cycle_current = NULL;
+
+    for (c = 0; c < pass->ncands; c += 1)
+        Py_DECREF(pass->cands[c].pObj);
+
+    free(pass->held);
+    free(pass->stack);
+    free(pass->cands);
+    free(pass->edges);
+
+    /* Let go of what the swept PythonValues held, and its Python cycles */
+    redrat_decref_drain();
+    PyGC_Collect();
+
+    redrat_gil_session_end(Qnil);
+
+    return Qnil;
+}
+
+/*
+ * redrat_cycle_collect - Find cycles between Ruby and Python objects, and
+ * break them
+ *
+ * Returns how many RubyObjects were cleared, each of which let go of a
+ * cycle.  Runs a full Ruby GC and Python collection, so is best called now
+ * and then, e.g. between jobs of a long-running worker.
+ */
+static VALUE
+redrat_cycle_collect(VALUE self)
+{
+    redrat_cycle_pass pass;
+    long              start;
+    VALUE             rBroken;
+    VALUE             rGcOpts;
+
+    if (redrat_cycle_current != NULL)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: collect_cycles is already running");
+
+    start = redrat_now_ns();
+
+    redrat_gil_ensure();
+
+    /* Like with_gil, for ObjectSpace.each_object's block */
+    if (redrat_gil_depth == 1)
+        redrat_gil_detached += 1;
+
+    /*
+     * Finish sweeping first.  ObjectSpace.each_object skips PythonValues
+     * found dead but not yet swept, and their PyObjects would then look
+     * referred to from outside.  A minor GC sweeps all of them.
+     */
+    rGcOpts = rb_hash_new();
+    rb_hash_aset(rGcOpts, ID2SYM(rb_intern("full_mark")), Qfalse);
+    rb_hash_aset(rGcOpts, ID2SYM(rb_intern("immediate_sweep")), Qtrue);
+#ifdef HAVE_RB_FUNCALLV_KW
+    rb_funcallv_kw(rb_mGC, rb_intern("start"), 1, &rGcOpts, RB_PASS_KEYWORDS);
+#else
+    rb_funcall(rb_mGC, rb_intern("start"), 1, rGcOpts);
+#endif
+
+    /* Python's own cycles first, which shrinks what is left to look at */
+    PyGC_Collect();
+
+    memset(&pass, 0, sizeof(pass));
+    redrat_cycle_current = &pass;
+
+    rBroken = rb_ensure(redrat_cycle_run, (VALUE) &pass,
+                        redrat_cycle_finish, (VALUE) &pass);
+
+    redrat_cycle_passes += 1;
+    redrat_cycle_candidates += pass.ncands;
+    redrat_cycle_broken += NUM2LONG(rBroken);
+    redrat_cycle_last_pass_ns = redrat_now_ns() - start;
+    redrat_cycle_total_pass_ns += redrat_cycle_last_pass_ns;
+
+    return rBroken;
+}
+
+/*
+ * redrat_cycle_stats - Counters of redrat_cycle_collect
+ *
+ * Returns a Hash of how many passes ran, how many RubyObjects they looked at
+ * (candidates) and cleared (broken), and how long they took in nanoseconds.
+ */
+static VALUE
+redrat_cycle_stats(VALUE self)
+{
+    VALUE rStats = rb_hash_new();
+
+#define redrat_stat_set(name, counter)                                        \
+    rb_hash_aset(rStats, ID2SYM(rb_intern(name)), LONG2NUM(counter))
+
+    redrat_stat_set("passes", redrat_cycle_passes);
+    redrat_stat_set("candidates", redrat_cycle_candidates);
+    redrat_stat_set("broken", redrat_cycle_broken);
+    redrat_stat_set("last_pass_ns", redrat_cycle_last_pass_ns);
+    redrat_stat_set("total_pass_ns", redrat_cycle_total_pass_ns);
+
+#undef redrat_stat_set
+
+    return rStats;
+}
+
+/*
+ * redrat_stats_sum - Sum every thread's counters into sums
+ *
+ * All zero when the counters were not compiled in.
+ */
+static void
+redrat_stats_sum(long sums[REDRAT_STAT_COUNT])
+{
+#ifdef REDRAT_STATS
+    redrat_stat_block *block;
+    int                i;
+
+    pthread_mutex_lock(&redrat_stat_lock);
+
+    for (i = 0; i < REDRAT_STAT_COUNT; i++)
+        sums[i] = redrat_stat_retired[i];
+
+    for (block = redrat_stat_blocks; block != NULL; block = block->next)
+        for (i = 0; i < REDRAT_STAT_COUNT; i++)
+            sums[i] += __atomic_load_n(&block->counts[i], __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(&redrat_stat_lock);
+#else
+    memset(sums, 0, REDRAT_STAT_COUNT * sizeof(long));
+#endif /* REDRAT_STATS */
+}
+
+/*
+ * redrat_stats - Counters of crossings into Python, see INSTRUMENTATION
+ *
+ * Returns a Hash of how many calls each entry point took, how many times and
+ * for how many nanoseconds threads waited for the GIL, how many PythonValues
+ * and RubyObjects were made and freed, and how many Python exceptions were
+ * converted.  With :prometheus, returns the same as a String in the
+ * Prometheus text exposition format instead.
+ */
+static VALUE
+redrat_stats(int argc, VALUE *argv, VALUE self)
+{
+    long  sums[REDRAT_STAT_COUNT];
+    VALUE rFormat;
+    VALUE rStats;
+    int   i;
+
+    rb_scan_args(argc, argv, "01", &rFormat);
+
+    if (rFormat != Qnil && rFormat != ID2SYM(rb_intern("hash")) &&
+        rFormat != ID2SYM(rb_intern("prometheus")))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: stats format must be :hash or :prometheus");
+
+    redrat_stats_sum(sums);
+
+    if (rFormat != ID2SYM(rb_intern("prometheus")))
+    {
+        rStats = rb_hash_new();
+
+        for (i = 0; i < REDRAT_STAT_COUNT; i++)
+            rb_hash_aset(rStats, ID2SYM(rb_intern(redrat_stat_names[i].key)),
+                         LONG2NUM(sums[i]));
+
+        return rStats;
+    }
+
+    rStats = rb_str_new(NULL, 0);
+
+    for (i = 0; i < REDRAT_STAT_COUNT; i++)
+    {
+        const char *metric = redrat_stat_names[i].metric;
+
+        if (i == 0 || strcmp(metric, redrat_stat_names[i - 1].metric) != 0)
+            rb_str_catf(rStats, "# TYPE %s counter\n", metric);
+
+        if (i == REDRAT_STAT_GIL_WAIT_NS)
+            rb_str_catf(rStats, "%s%s %ld.%09ld\n", metric,
+                        redrat_stat_names[i].labels, sums[i] / 1000000000L,
+                        sums[i] % 1000000000L);
+        else
+            rb_str_catf(rStats, "%s%s %ld\n", metric,
+                        redrat_stat_names[i].labels, sums[i]);
+    }
+
+    return rStats;
+}
+
+/*
+ * redrat_stats_enabled_p - Whether the counters of stats are counting
+ */
+static VALUE
+redrat_stats_enabled_p(VALUE self)
+{
+#ifdef REDRAT_STATS
+    return redrat_stats_on ? Qtrue : Qfalse;
+#else
+    return Qfalse;
+#endif /* REDRAT_STATS */
+}
+
+#ifdef REDRAT_STATS
+/*
+ * redrat_stats_enabled_set - Start or stop counting
+ *
+ * Counts are kept while stopped.  Without the counters compiled in, this
+ * raises NotImplementedError instead, and respond_to? tells which it is.
+ */
+static VALUE
+redrat_stats_enabled_set(VALUE self, VALUE rOn)
+{
+    redrat_stats_on = RTEST(rOn);
+
+    return rOn;
+}
+#endif /* REDRAT_STATS */
+
+#ifdef HAVE_RB_PROFILE_FRAMES
+/*
+ * redrat_profile_stop - Stop the sampler, and record what is still pending
+ */
+static VALUE
+redrat_profile_stop(VALUE data)
+{
+    redrat_profile *prof = (void *) data;
+
+    pthread_mutex_lock(&prof->lock);
+    prof->stopping = true;
+    pthread_cond_signal(&prof->cond);
+    pthread_mutex_unlock(&prof->lock);
+
+    pthread_join(prof->sampler, NULL);
+
+    redrat_prof_job(NULL);
+
+    /* Let go of it before freeing it, so that late signals see NULL */
+    redrat_prof = NULL;
+    __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+    pthread_cond_destroy(&prof->cond);
+    pthread_mutex_destroy(&prof->lock);
+    free(prof);
+
+    return Qnil;
+}
+
+static int
+redrat_profile_collapse_i(VALUE rStack, VALUE rCount, VALUE rCollapsed)
+{
+    rb_str_catf(rCollapsed, "%"PRIsVALUE" %ld\n", rStack, FIX2LONG(rCount));
+
+    return ST_CONTINUE;
+}
+
+/*
+ * redrat_profile_block - Sample this thread while running the block
+ *
+ * Takes the sampling interval in microseconds, 1000 by default.  Returns the
+ * stacks sampled in the collapsed format that flamegraph.pl, speedscope and
+ * the like read: one line per distinct stack, outermost frame first, frames
+ * separated by semicolons, and followed by how many samples it got.  Samples
+ * taken while waiting for the GIL end in a [GIL wait] frame.
+ *
+ * Only one thread can be profiled at a time.  Python 2 does not retry system
+ * calls that a signal interrupts, so some, such as time.sleep, can end early
+ * under the profiler.
+ */
+static VALUE
+redrat_profile_block(int argc, VALUE *argv, VALUE self)
+{
+    redrat_profile     *prof;
+    pthread_condattr_t  condAttr;
+    VALUE               rInterval;
+    VALUE               rCollapsed;
+    long                interval = 1000;
+
+    rb_scan_args(argc, argv, "01", &rInterval);
+    rb_need_block();
+
+    if (!NIL_P(rInterval))
+        interval = NUM2LONG(rInterval);
+
+    if (interval <= 0)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: profile interval must be positive");
+
+    if (redrat_prof != NULL)
+        rb_raise(rb_eRuntimeError, "redrat_ext: already profiling");
+
+    prof = calloc(1, sizeof(*prof));
+
+    if (prof == NULL)
+        rb_memerror();
+
+    prof->thread = pthread_self();
+    prof->intervalNs = interval * 1000L;
+    pthread_mutex_init(&prof->lock, NULL);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&prof->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+#ifdef HAVE_RB_POSTPONED_JOB_PREREGISTER
+    if (redrat_prof_job_handle == POSTPONED_JOB_HANDLE_INVALID)
+        redrat_prof_job_handle =
+            rb_postponed_job_preregister(0, redrat_prof_job, NULL);
+#endif
+
+    if (!redrat_prof_installed)
+    {
+        struct sigaction action;
+
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = redrat_prof_signal;
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGPROF, &action, &redrat_prof_old_action);
+
+        /*
+         * Stays installed after the profile, since a stray SIGPROF would
+         * otherwise terminate the process.  The handler does nothing then.
+         */
+        redrat_prof_installed = true;
+    }
+
+    redrat_prof_stacks = rb_hash_new();
+    redrat_prof = prof;
+
+    if (pthread_create(&prof->sampler, NULL, redrat_prof_sampler, prof) != 0)
+    {
+        redrat_prof = NULL;
+        pthread_cond_destroy(&prof->cond);
+        pthread_mutex_destroy(&prof->lock);
+        free(prof);
+
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: could not start the sampler thread");
+    }
+
+    rb_ensure(rb_yield, Qnil, redrat_profile_stop, (VALUE) prof);
+
+    rCollapsed = rb_str_new(NULL, 0);
+    rb_hash_foreach(redrat_prof_stacks, redrat_profile_collapse_i,
+                    rCollapsed);
+    redrat_prof_stacks = Qnil;
+
+    return rCollapsed;
+}
+#endif /* HAVE_RB_PROFILE_FRAMES */
+
+/*
+ * redrat_ruby_handoff_shared - The Ruby value a PyObject hands off as, if any
+ *
+ * RubyObjects hand off as the Ruby objects inside of them, and Python's own
+ * singletons as the shared PythonValues pinned for them at initialization.
+ * Returns Qundef for everything else, which needs a PythonValue of its own.
+ *
+ * Needs neither the GIL nor the GVL.
+ */
+static VALUE
+redrat_ruby_handoff_shared(PyObject *handing_off)
+{
+    if (handing_off->ob_type == &redrat_RubyType)
+        return ((redrat_RubyObject *) handing_off)->r;
+    else if (handing_off == Py_None)
+        return redrat_pv_none;
+    else if (handing_off == Py_True)
+        return redrat_pv_true;
+    else if (handing_off == Py_False)
+        return redrat_pv_false;
+    else if (PyInt_CheckExact(handing_off) &&
+             PyInt_AS_LONG(handing_off) >= REDRAT_SMALL_INT_MIN &&
+             PyInt_AS_LONG(handing_off) <= REDRAT_SMALL_INT_MAX)
+        return redrat_pv_small_ints[PyInt_AS_LONG(handing_off) -
+                                    REDRAT_SMALL_INT_MIN];
+    else
+        return Qundef;
+}
+
+/*
+ * redrat_ruby_handoff - Hands off a PyObject to Ruby
+ *
+ * If this PyObject is of type redrat.RubyObject, then just return the
+ * unwrapped Ruby object inside.
+ *
+ * This procedure presumes that the Python GIL and Ruby GILs are already held.
+ *
+ * This includes the hybridization of Ruby and Python GC.  To do this, Ruby
+ * will get its own reference (Py_INCREF) and registers a callback that exists
+ * to call Py_DECREF.  In this way, a PythonValue that has no remaining
+ * references in the Python runtime will still not be freed, since Ruby has not
+ * GCed it yet.
+ */
+static VALUE
+redrat_ruby_handoff(PyObject *handing_off)
+{
+    VALUE r = redrat_ruby_handoff_shared(handing_off);
+
+    if (r != Qundef)
+        return r;
+
+    return redrat_pythonvalue_wrap(handing_off, false);
+}
+
+/*
+ * redrat_ruby_handoff_kept - redrat_ruby_handoff, for PythonValues that must
+ * outlive any scope
+ *
+ * For the ones redrat_ext itself keeps, such as the owners of String views,
+ * which RedRat::Internal.scope must not release.
+ */
+static VALUE
+redrat_ruby_handoff_kept(PyObject *handing_off)
+{
+    redrat_scope *saved = redrat_scope_current;
+    redrat_scope *scope;
+    VALUE         r;
+
+    redrat_scope_current = NULL;
+    r = redrat_ruby_handoff(handing_off);
+    redrat_scope_current = saved;
+
+    /* It may have been made in a scope already */
+    for (scope = saved; scope != NULL; scope = scope->outer)
+    {
+        if (scope->rKeep == Qnil)
+            scope->rKeep = rb_funcall(rb_hash_new(),
+                                      redrat_id_compare_by_identity, 0);
+
+        rb_hash_aset(scope->rKeep, r, Qtrue);
+    }
+
+    return r;
+}
+
+/*
+ * redrat_ruby_handoff_steal - redrat_ruby_handoff, taking over the reference
+ *
+ * Needs no GIL, so that results computed by other threads can be handed off
+ * without taking it.  This procedure presumes that the Ruby GVL is held.
+ */
+static VALUE
+redrat_ruby_handoff_steal(PyObject *handing_off)
+{
+    VALUE r = redrat_ruby_handoff_shared(handing_off);
+
+    if (r == Qundef)
+        return redrat_pythonvalue_wrap(handing_off, true);
+
+    redrat_py_decref_wrap(handing_off);
+
+    return r;
+}
+
+static void
+redrat_python_error_free(void *data)
+{
+    redrat_python_error *err = data;
+
+    redrat_py_decref_wrap(err->pType);
+
+    if (err->pValue != NULL)
+        redrat_py_decref_wrap(err->pValue);
+
+    if (err->pTraceback != NULL)
+        redrat_py_decref_wrap(err->pTraceback);
+
+    xfree(err);
+}
+
+/*
+ * redrat_python_error_get - The Python error behind a RedRatException
+ *
+ * Returns NULL for exceptions not made by redrat_exception_convert.
+ */
+static redrat_python_error *
+redrat_python_error_get(VALUE rExc)
+{
+    VALUE                rErr = rb_attr_get(rExc, redrat_id_python_error);
+    redrat_python_error *err;
+
+    if (NIL_P(rErr))
+        return NULL;
+
+    Data_Get_Struct(rErr, redrat_python_error, err);
+
+    return err;
+}
+
+static void
+redrat_rb_exc_raise(VALUE rExc, const char *reason)
+{
+    redrat_python_error *err = redrat_python_error_get(rExc);
+
+    if (err != NULL)
+        err->reason = reason;
+    else
+        rb_ivar_set(rExc, redrat_id_iv_redrat_reason, rb_str_new2(reason));
+
+    rb_exc_raise(rExc);
+}
+
+/*
+ * redrat_exception_class - The RedRatException subclass for a Python class
+ *
+ * The most specific class in redrat_exc_classes that pType is, or inherits
+ * from, or RedRatException itself if there is none.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static VALUE
+redrat_exception_class(PyObject *pType)
+{
+    int i;
+
+    for (i = 0; i < REDRAT_EXC_CLASSES; i += 1)
+        if (pType == *redrat_exc_classes[i].pyClass)
+            return redrat_exc_classes[i].klass;
+
+    if (!PyType_Check(pType))
+        return rb_eRedRatException;
+
+    for (i = REDRAT_EXC_CLASSES - 1; i >= 0; i -= 1)
+        if (PyType_IsSubtype((PyTypeObject *) pType,
+                             (PyTypeObject *) *redrat_exc_classes[i].pyClass))
+            return redrat_exc_classes[i].klass;
+
+    return rb_eRedRatException;
+}
+
+/*
+ * redrat_exception_new - A RedRatException of klass for a fetched error
+ *
+ * Takes over the references to the triple, which need not have been fetched
+ * on this thread, so the GIL need not be held.
+ */
+static VALUE
+redrat_exception_new(PyObject *pType, PyObject *pValue, PyObject *pTraceback,
+                     VALUE klass)
+{
+    redrat_python_error *err;
+
+    VALUE rErr;
+    VALUE rException;
+
+    /* Hidden, so that only RedRatException can get at it */
+    rErr = Data_Make_Struct(0, redrat_python_error, NULL,
+                            redrat_python_error_free, err);
+
+    err->pType = pType;
+    err->pValue = pValue;
+    err->pTraceback = pTraceback;
+    err->reason = NULL;
+
+    rException = rb_exc_new_str(klass, redrat_exc_default_message);
+    rb_ivar_set(rException, redrat_id_python_error, rErr);
+
+    return rException;
+}
+
+/*
+ * redrat_exception_convert - Convert Python exceptions to Ruby exceptions
+ *
+ * This procedure presumes that the Python GIL is already held.
+ *
+ * The convention in the Python C API is to allow NULL-valued PyObject* values
+ * flow through the system while an out-of-band error state is left intact.
+ * Before returning control to MRI, determine if it is necessary to raise a
+ * Ruby exception or not.
+ *
+ * The error state is moved into the exception as it is, see
+ * redrat_python_error.
+ */
+static VALUE
+redrat_exception_convert()
+{
+    PyObject *pType;
+    PyObject *pValue;
+    PyObject *pTraceback;
+
+    PyErr_Fetch(&pType, &pValue, &pTraceback);
+
+    if (pType == NULL)
+    {
+        Assert(pValue == NULL);
+
+        rb_bug("redrat_ext: expected Python error state, "
+               "but no error state was found");
+    }
+
+    REDRAT_STAT_ADD(REDRAT_STAT_EXCEPTIONS_CONVERTED, 1);
+
+    /* The references from PyErr_Fetch are taken over */
+    return redrat_exception_new(pType, pValue, pTraceback,
+                                redrat_exception_class(pType));
+}
+
+/*
+ * redrat_python_exception_getter - python_type, python_value, python_traceback
+ *
+ * The three share this procedure, and tell which one was called from the
+ * method name.  The PythonValue is made on first use and kept, and can be
+ * replaced through the writer of the same name.
+ */
+static VALUE
+redrat_python_exception_getter(VALUE self)
+{
+    ID                   name = rb_frame_this_func();
+    ID                   ivar;
+    PyObject            *pPart;
+    redrat_python_error *err;
+    VALUE                rPart;
+
+    if (name == redrat_id_python_type)
+        ivar = redrat_id_iv_python_type;
+    else if (name == redrat_id_python_value)
+        ivar = redrat_id_iv_python_value;
+    else
+        ivar = redrat_id_iv_python_traceback;
+
+    if (rb_ivar_defined(self, ivar))
+        return rb_ivar_get(self, ivar);
+
+    err = redrat_python_error_get(self);
+
+    if (err == NULL)
+        return Qnil;
+
+    if (ivar == redrat_id_iv_python_type)
+        pPart = err->pType;
+    else if (ivar == redrat_id_iv_python_value)
+        pPart = err->pValue;
+    else
+        pPart = err->pTraceback;
+
+    if (pPart == NULL)
+        rPart = Qnil;
+    else
+    {
+        redrat_gil_ensure();
+        rPart = redrat_ruby_handoff_kept(pPart);
+        redrat_gil_release();
+    }
+
+    rb_ivar_set(self, ivar, rPart);
+
+    return rPart;
+}
+
+static VALUE
+redrat_exception_reason(VALUE self)
+{
+    redrat_python_error *err;
+
+    if (rb_ivar_defined(self, redrat_id_iv_redrat_reason))
+        return rb_ivar_get(self, redrat_id_iv_redrat_reason);
+
+    err = redrat_python_error_get(self);
+
+    if (err == NULL || err->reason == NULL)
+        return Qnil;
+
+    return rb_str_new_cstr(err->reason);
+}
+
+/*
+ * redrat_exception_to_s - The message of a RedRatException
+ *
+ * For exceptions from Python, the Python class name and str() of the value,
+ * much as Python would print them, computed on first use.
+ */
+static VALUE
+redrat_exception_to_s(VALUE self)
+{
+    redrat_python_error *err;
+    PyObject            *pType;
+    PyObject            *pValue;
+    PyObject            *pTraceback;
+    PyObject            *pStr = NULL;
+    const char          *typeName;
+    const char          *dot;
+    VALUE                rMessage;
+
+    if (rb_ivar_defined(self, redrat_id_iv_message))
+        return rb_ivar_get(self, redrat_id_iv_message);
+
+    err = redrat_python_error_get(self);
+
+    if (err == NULL)
+        return rb_call_super(0, NULL);
+
+    redrat_gil_ensure();
+
+    /* Normalized copies, so that str() sees an exception instance */
+    pType = err->pType;
+    pValue = err->pValue;
+    pTraceback = err->pTraceback;
+    Py_INCREF(pType);
+    Py_XINCREF(pValue);
+    Py_XINCREF(pTraceback);
+
+    PyErr_NormalizeException(&pType, &pValue, &pTraceback);
+
+    if (pValue != NULL)
+        pStr = PyObject_Str(pValue);
+
+    if (pStr == NULL)
+        PyErr_Clear();
+
+    typeName = PyExceptionClass_Check(pType) ?
+        PyExceptionClass_Name(pType) : Py_TYPE(pType)->tp_name;
+    dot = strrchr(typeName, '.');
+
+    if (dot != NULL)
+        typeName = dot + 1;
+
+    if (pStr != NULL && PyString_Check(pStr) && PyString_GET_SIZE(pStr) > 0)
+        rMessage = rb_sprintf("%s: %.*s", typeName,
+                              (int) PyString_GET_SIZE(pStr),
+                              PyString_AS_STRING(pStr));
+    else
+        rMessage = rb_str_new_cstr(typeName);
+
+    Py_XDECREF(pStr);
+    Py_DECREF(pType);
+    Py_XDECREF(pValue);
+    Py_XDECREF(pTraceback);
+
+    redrat_gil_release();
+
+    rb_ivar_set(self, redrat_id_iv_message, rMessage);
+
+    return rMessage;
+}
+
+/*
+ * redrat_ascii_p - Whether a run of bytes is all 7-bit ASCII
+ *
+ * Checks 32 bytes at a time by OR-ing together machine words, which compilers
+ * turn into SIMD where the target has it, and then tests their high bits.
+ */
+static bool
+redrat_ascii_p(const char *ptr, long len)
+{
+    const uint64_t  highBits = UINT64_C(0x8080808080808080);
+    uint64_t        acc = 0;
+    long            i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        uint64_t words[4];
+
+        memcpy(words, ptr + i, sizeof(words));
+
+        if ((words[0] | words[1] | words[2] | words[3]) & highBits)
+            return false;
+    }
+
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, ptr + i, sizeof(word));
+        acc |= word;
+    }
+
+    for (; i < len; i += 1)
+        acc |= (unsigned char) ptr[i];
+
+    return (acc & highBits) == 0;
+}
+
+/*
+ * redrat_ruby_string_ascii_p - Whether a String is all ASCII
+ *
+ * Uses the code range Ruby has cached on the String if there is one, and
+ * otherwise scans and caches the answer if it is yes.
+ */
+static bool
+redrat_ruby_string_ascii_p(VALUE rStr)
+{
+    switch (ENC_CODERANGE(rStr))
+    {
+        case ENC_CODERANGE_7BIT:
+            return true;
+        case ENC_CODERANGE_VALID:
+        case ENC_CODERANGE_BROKEN:
+            return false;
+        default:
+            break;
+    }
+
+    if (!rb_enc_asciicompat(rb_enc_get(rStr)) ||
+        !redrat_ascii_p(RSTRING_PTR(rStr), RSTRING_LEN(rStr)))
+        return false;
+
+    ENC_CODERANGE_SET(rStr, ENC_CODERANGE_7BIT);
+    return true;
+}
+
+static VALUE
+redrat_str_to_utf8(VALUE rStr)
+{
+    return rb_str_encode(rStr, rb_enc_from_encoding(rb_utf8_encoding()),
+                         0, Qnil);
+}
+
+/*
+ * redrat_ruby_string_to_python - Convert a String to Python unicode
+ *
+ * ASCII is copied straight into the unicode object without decoding.
+ * Otherwise UTF-8 and binary Strings are decoded as UTF-8, ISO-8859-1,
+ * UTF-16 and UTF-32 with their Python codecs, and other encodings are
+ * transcoded to UTF-8 by Ruby first.  Embedded NULs are kept.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static PyObject *
+redrat_ruby_string_to_python(VALUE rStr)
+{
+    const char *ptr = RSTRING_PTR(rStr);
+    long        len = RSTRING_LEN(rStr);
+    int         encIndex;
+    int         byteOrder;
+    int         state = 0;
+    PyObject   *pUnicode;
+    VALUE       rUtf8;
+
+    if (redrat_ruby_string_ascii_p(rStr))
+    {
+        Py_UNICODE *u;
+        long        i;
+
+        pUnicode = PyUnicode_FromUnicode(NULL, len);
+
+        if (pUnicode == NULL)
+            return NULL;
+
+        u = PyUnicode_AS_UNICODE(pUnicode);
+
+        for (i = 0; i < len; i += 1)
+            u[i] = (unsigned char) ptr[i];
+
+        return pUnicode;
+    }
+
+    encIndex = ENCODING_GET(rStr);
+
+    if (encIndex == rb_utf8_encindex() || encIndex == rb_ascii8bit_encindex())
+        return PyUnicode_DecodeUTF8(ptr, len, "strict");
+    else if (encIndex == redrat_enc_latin1)
+        return PyUnicode_DecodeLatin1(ptr, len, "strict");
+    else if (encIndex == redrat_enc_utf16le || encIndex == redrat_enc_utf16be)
+    {
+        byteOrder = (encIndex == redrat_enc_utf16le) ? -1 : 1;
+        return PyUnicode_DecodeUTF16(ptr, len, "strict", &byteOrder);
+    }
+    else if (encIndex == redrat_enc_utf32le || encIndex == redrat_enc_utf32be)
+    {
+        byteOrder = (encIndex == redrat_enc_utf32le) ? -1 : 1;
+        return PyUnicode_DecodeUTF32(ptr, len, "strict", &byteOrder);
+    }
+
+    rUtf8 = rb_protect(redrat_str_to_utf8, rStr, &state);
+
+    if (state != 0)
+    {
+        rb_set_errinfo(Qnil);
+        PyErr_Format(PyExc_UnicodeError,
+                     "cannot transcode Ruby String from %s to UTF-8",
+                     rb_enc_name(rb_enc_from_index(encIndex)));
+        return NULL;
+    }
+
+    pUnicode = PyUnicode_DecodeUTF8(RSTRING_PTR(rUtf8), RSTRING_LEN(rUtf8),
+                                    "strict");
+    RB_GC_GUARD(rUtf8);
+
+    return pUnicode;
+}
+
+/*
+ * redrat_python_string_to_ruby - Convert a Python str or unicode to a String
+ *
+ * strs that are all ASCII become UTF-8 Strings, and other strs binary ones,
+ * as Python 2 does not know what encoding their bytes are in.  unicode
+ * objects become UTF-8 Strings, skipping the encoder when they are all ASCII.
+ * Either way Ruby is told about all-ASCII contents, so it does not scan them
+ * again.
+ *
+ * Returns Qundef, with a Python exception set, on failure.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static VALUE
+redrat_python_string_to_ruby(PyObject *pStr)
+{
+    VALUE rStr;
+
+    if (PyString_Check(pStr))
+    {
+        const char *ptr = PyString_AS_STRING(pStr);
+        Py_ssize_t  len = PyString_GET_SIZE(pStr);
+
+        if (!redrat_ascii_p(ptr, len))
+            return rb_str_new(ptr, len);
+
+        rStr = rb_utf8_str_new(ptr, len);
+    }
+    else
+    {
+        const Py_UNICODE *u = PyUnicode_AS_UNICODE(pStr);
+        Py_ssize_t        len = PyUnicode_GET_SIZE(pStr);
+        Py_UNICODE        acc = 0;
+        Py_ssize_t        i;
+        char             *ptr;
+
+        Assert(PyUnicode_Check(pStr));
+
+        for (i = 0; i < len; i += 1)
+            acc |= u[i];
+
+        if (acc >= 0x80)
+        {
+            PyObject *pUtf8 = PyUnicode_AsUTF8String(pStr);
+
+            if (pUtf8 == NULL)
+                return Qundef;
+
+            rStr = rb_utf8_str_new(PyString_AS_STRING(pUtf8),
+                                   PyString_GET_SIZE(pUtf8));
+            Py_DECREF(pUtf8);
+
+            return rStr;
+        }
+
+        rStr = rb_utf8_str_new(NULL, len);
+        ptr = RSTRING_PTR(rStr);
+
+        for (i = 0; i < len; i += 1)
+            ptr[i] = (char) u[i];
+    }
+
+    ENC_CODERANGE_SET(rStr, ENC_CODERANGE_7BIT);
+    return rStr;
+}
+
+/*
+ * redrat_python_str - str(), except that unicode objects are left alone
+ *
+ * Python 2's str() would encode them as ASCII, failing on anything else.
+ */
+static PyObject *
+redrat_python_str(PyObject *pObj)
+{
+    if (PyUnicode_CheckExact(pObj))
+    {
+        Py_INCREF(pObj);
+        return pObj;
+    }
+
+    return PyObject_Str(pObj);
+}
+
+/*
+ * redrat_id_to_python_string - An interned Python str for a Ruby ID
+ *
+ * The strings are cached in redrat_attr_names, so repeated calls allocate
+ * nothing.  Returns a new reference.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_id_to_python_string(ID id)
+{
+    st_data_t  cached;
+    PyObject  *pName;
+    VALUE      rName;
+
+    if (st_lookup(redrat_attr_names, (st_data_t) id, &cached))
+    {
+        pName = (PyObject *) cached;
+        Py_INCREF(pName);
+
+        return pName;
+    }
+
+    rName = rb_id2str(id);
+    pName = PyString_FromStringAndSize(RSTRING_PTR(rName),
+                                       RSTRING_LEN(rName));
+
+    if (pName == NULL)
+        return NULL;
+
+    PyString_InternInPlace(&pName);
+
+    /* The cache keeps a reference of its own, forever */
+    Py_INCREF(pName);
+    st_insert(redrat_attr_names, (st_data_t) id, (st_data_t) pName);
+
+    return pName;
+}
+
+/*
+ * redrat_ruby_symbol_to_python_string - An interned Python str for a Symbol
+ *
+ * Only Symbols that already have an ID for good go through the cache of
+ * redrat_id_to_python_string.  SYM2ID would pin a dynamic Symbol, such as
+ * one from String#to_sym, for as long as the process lives, and the cache
+ * would keep its str as long, so those are converted like other Strings.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_ruby_symbol_to_python_string(VALUE rSym)
+{
+    VALUE     rName = rSym;
+    ID        id = rb_check_id(&rName);
+    PyObject *pName;
+
+    if (id != 0)
+        return redrat_id_to_python_string(id);
+
+    rName = rb_sym2str(rSym);
+    pName = PyString_FromStringAndSize(RSTRING_PTR(rName),
+                                       RSTRING_LEN(rName));
+
+    if (pName != NULL)
+        PyString_InternInPlace(&pName);
+
+    return pName;
+}
+
+/*
+ * redrat_attr_name_p - Whether a VALUE can be used as an attribute name
+ */
+static bool
+redrat_attr_name_p(VALUE rName)
+{
+    return (SYMBOL_P(rName) || TYPE(rName) == T_STRING ||
+            REDRAT_PYTHONVALUE_P(rName));
+}
+
+/*
+ * redrat_attr_name_to_python - Convert an attribute name to Python
+ *
+ * Accepts Symbols, Strings and PythonValues, and returns a new reference.
+ * Static Symbols, and Strings that name one, go through the cache of
+ * redrat_id_to_python_string.  Other names are not cached, so that arbitrary
+ * ones do not pile up.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_attr_name_to_python(VALUE rName)
+{
+    PyObject *pName;
+
+    Assert(redrat_attr_name_p(rName));
+
+    if (SYMBOL_P(rName))
+        return redrat_ruby_symbol_to_python_string(rName);
+    else if (TYPE(rName) == T_STRING)
+    {
+        ID id = rb_check_id(&rName);
+
+        if (id != 0)
+            return redrat_id_to_python_string(id);
+
+        pName = PyString_FromStringAndSize(RSTRING_PTR(rName),
+                                           RSTRING_LEN(rName));
+
+        if (pName != NULL)
+            PyString_InternInPlace(&pName);
+
+        return pName;
+    }
+    else
+    {
+        Data_Get_Struct(rName, PyObject, pName);
+
+        if (pName == NULL)
+        {
+            PyErr_SetString(PyExc_RuntimeError, REDRAT_RELEASED_MESSAGE);
+            return NULL;
+        }
+
+        Py_INCREF(pName);
+
+        return pName;
+    }
+}
+
+/*
+ * redrat_ruby_integer_to_python - Convert an Integer to a Python int or long
+ *
+ * Integers that fit in a C long become ints, as they would in Python, and the
+ * rest become longs, copied over as two's complement bytes.
+ */
+static PyObject *
+redrat_ruby_integer_to_python(VALUE rInt)
+{
+    unsigned long   magnitude;
+    int             sign;
+    size_t          nbytes;
+    unsigned char  *bytes;
+    PyObject       *pLong;
+    VALUE           bytesBuf;
+
+    if (FIXNUM_P(rInt))
+        return PyInt_FromLong(FIX2LONG(rInt));
+
+    /* The magnitude, with a sign of +-2 if it does not fit */
+    sign = rb_integer_pack(rInt, &magnitude, 1, sizeof(magnitude), 0,
+                           INTEGER_PACK_NATIVE_BYTE_ORDER);
+
+    if (sign == 1 && magnitude <= (unsigned long) LONG_MAX)
+        return PyInt_FromLong((long) magnitude);
+    else if (sign == -1 && magnitude - 1 <= (unsigned long) LONG_MAX)
+        return PyInt_FromLong(-(long) (magnitude - 1) - 1);
+
+    /* One more byte than the magnitude needs, for the sign bit */
+    nbytes = rb_absint_size(rInt, NULL) + 1;
+    bytes = ALLOCV_N(unsigned char, bytesBuf, nbytes);
+
+    rb_integer_pack(rInt, bytes, nbytes, 1, 0,
+                    INTEGER_PACK_LITTLE_ENDIAN | INTEGER_PACK_2COMP);
+    pLong = _PyLong_FromByteArray(bytes, nbytes, 1, 1);
+
+    ALLOCV_END(bytesBuf);
+
+    return pLong;
+}
+
+/*
+ * redrat_python_long_to_ruby - Convert a Python long to an Integer
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static VALUE
+redrat_python_long_to_ruby(PyObject *pLong)
+{
+    int             overflow;
+    long            small;
+    size_t          nbytes;
+    unsigned char  *bytes;
+    VALUE           rInt;
+    VALUE           bytesBuf;
+
+    small = PyLong_AsLongAndOverflow(pLong, &overflow);
+
+    if (overflow == 0)
+        return LONG2NUM(small);
+
+    nbytes = _PyLong_NumBits(pLong) / 8 + 1;
+    bytes = ALLOCV_N(unsigned char, bytesBuf, nbytes);
+
+    _PyLong_AsByteArray((PyLongObject *) pLong, bytes, nbytes, 1, 1);
+    rInt = rb_integer_unpack(bytes, nbytes, 1, 0,
+                             INTEGER_PACK_LITTLE_ENDIAN | INTEGER_PACK_2COMP);
+
+    ALLOCV_END(bytesBuf);
+
+    return rInt;
+}
+
+/*
+ * redrat_python_scalar_to_ruby - Convert a Python scalar to its Ruby equivalent
+ *
+ * None, bools, ints, longs and floats are converted, and Qundef is returned
+ * for anything else, including subclasses of int and float, which may well
+ * carry behavior that would be lost.
+ *
+ * Apart from longs, these are immutable and are only read, so this procedure
+ * only presumes that the Ruby GVL is held and a reference to pVal is owned.
+ * Longs need the Python GIL too.
+ */
+static VALUE
+redrat_python_scalar_to_ruby(PyObject *pVal)
+{
+    VALUE rResult;
+
+    if (pVal == Py_None)
+        return Qnil;
+    else if (pVal == Py_True)
+        return Qtrue;
+    else if (pVal == Py_False)
+        return Qfalse;
+    else if (PyInt_CheckExact(pVal))
+        return LONG2NUM(PyInt_AS_LONG(pVal));
+    else if (PyFloat_CheckExact(pVal))
+        return DBL2NUM(PyFloat_AS_DOUBLE(pVal));
+    else if (!PyLong_CheckExact(pVal))
+        return Qundef;
+
+    redrat_gil_ensure();
+    rResult = redrat_python_long_to_ruby(pVal);
+    redrat_gil_release();
+
+    return rResult;
+}
+
+/*
+ * BULK CONTAINER CONVERSION
+ *
+ * to_python and to_ruby with deep: true convert nested Arrays and Hashes to
+ * lists and dicts and back in one pass, rather than wrapping each element.
+ * Containers met more than once, including through cycles, are converted
+ * once, so the result has the same sharing as the original.
+ *
+ * The memos are Ruby Hashes rather than st_tables, as Ruby GC keeps their
+ * contents up to date should compaction move the objects in them.
+ */
+typedef struct {
+    VALUE memo;     /* Ruby containers to (borrowed) Python ones, or back */
+    bool  deep;     /* Whether to convert elements too */
+} redrat_convert;
+
+static PyObject *redrat_convert_to_python(redrat_convert *cv, VALUE r,
+                                          bool key);
+static VALUE redrat_convert_to_ruby(redrat_convert *cv, PyObject *p);
+
+static PyObject *
+redrat_convert_element_to_python(redrat_convert *cv, VALUE r, bool key)
+{
+    if (cv->deep)
+        return redrat_convert_to_python(cv, r, key);
+
+    return redrat_python_handoff(r);
+}
+
+/*
+ * redrat_array_to_python - Convert an Array to a list, or for keys a tuple
+ *
+ * Tuples cannot be created before their elements, so a tuple's Array is only
+ * in the memo while it is being converted, marked with nil, to catch it
+ * containing itself.
+ */
+static PyObject *
+redrat_array_to_python(redrat_convert *cv, VALUE rAry, bool key)
+{
+    PyObject   *pSeq;
+    VALUE       rFound;
+    long        len = RARRAY_LEN(rAry);
+    long        i;
+
+    rFound = rb_hash_lookup2(cv->memo, rAry, Qundef);
+
+    if (rFound == Qnil)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "a dict key cannot be an Array that contains itself");
+        return NULL;
+    }
+    else if (rFound != Qundef && !key)
+    {
+        pSeq = (PyObject *) NUM2SIZET(rFound);
+        Py_INCREF(pSeq);
+
+        return pSeq;
+    }
+
+    pSeq = key ? PyTuple_New(len) : PyList_New(len);
+
+    if (pSeq == NULL)
+        return NULL;
+
+    rb_hash_aset(cv->memo, rAry, key ? Qnil : SIZET2NUM((size_t) pSeq));
+
+    for (i = 0; i < len; i += 1)
+    {
+        PyObject *pItem;
+
+        pItem = redrat_convert_element_to_python(cv, RARRAY_AREF(rAry, i),
+                                                 key);
+
+        if (pItem == NULL)
+        {
+            Py_DECREF(pSeq);
+            return NULL;
+        }
+
+        if (key)
+            PyTuple_SET_ITEM(pSeq, i, pItem);
+        else
+            PyList_SET_ITEM(pSeq, i, pItem);
+    }
+
+    /* Put back whatever list the Array may also have been converted to */
+    if (key && rFound != Qundef)
+        rb_hash_aset(cv->memo, rAry, rFound);
+    else if (key)
+        rb_hash_delete(cv->memo, rAry);
+
+    return pSeq;
+}
+
+/* State for redrat_hash_to_python_i */
+typedef struct {
+    redrat_convert *cv;
+    PyObject       *pDict;
+    bool            failed;
+} redrat_hash_to_python_state;
+
+static int
+redrat_hash_to_python_i(VALUE rKey, VALUE rValue, VALUE data)
+{
+    redrat_hash_to_python_state *hs = (void *) data;
+    PyObject                    *pKey;
+    PyObject                    *pValue;
+    int                          status;
+
+    pKey = redrat_convert_element_to_python(hs->cv, rKey, true);
+
+    if (pKey == NULL)
+    {
+        hs->failed = true;
+        return ST_STOP;
+    }
+
+    pValue = redrat_convert_element_to_python(hs->cv, rValue, false);
+
+    if (pValue == NULL)
+    {
+        Py_DECREF(pKey);
+        hs->failed = true;
+        return ST_STOP;
+    }
+
+    status = PyDict_SetItem(hs->pDict, pKey, pValue);
+    Py_DECREF(pKey);
+    Py_DECREF(pValue);
+
+    if (status < 0)
+    {
+        hs->failed = true;
+        return ST_STOP;
+    }
+
+    return ST_CONTINUE;
+}
+
+static PyObject *
+redrat_hash_to_python(redrat_convert *cv, VALUE rHash)
+{
+    redrat_hash_to_python_state hs;
+    VALUE                       rFound;
+
+    rFound = rb_hash_lookup2(cv->memo, rHash, Qundef);
+
+    if (rFound != Qundef)
+    {
+        PyObject *pDict = (PyObject *) NUM2SIZET(rFound);
+
+        Py_INCREF(pDict);
+        return pDict;
+    }
+
+    hs.cv = cv;
+    hs.failed = false;
+    hs.pDict = _PyDict_NewPresized(RHASH_SIZE(rHash));
+
+    if (hs.pDict == NULL)
+        return NULL;
+
+    rb_hash_aset(cv->memo, rHash, SIZET2NUM((size_t) hs.pDict));
+    rb_hash_foreach(rHash, redrat_hash_to_python_i, (VALUE) &hs);
+
+    if (hs.failed)
+    {
+        Py_DECREF(hs.pDict);
+        return NULL;
+    }
+
+    return hs.pDict;
+}
+
+/*
+ * redrat_convert_to_python - Convert a Ruby value to its Python counterpart
+ *
+ * Arrays become lists (tuples when used as dict keys), Hashes dicts, binary
+ * Strings strs and other Strings unicode.  Anything else is handed off as by
+ * redrat_python_handoff.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static PyObject *
+redrat_convert_to_python(redrat_convert *cv, VALUE r, bool key)
+{
+    switch (TYPE(r))
+    {
+        case T_ARRAY:
+            return redrat_array_to_python(cv, r, key);
+        case T_HASH:
+            if (!key)
+                return redrat_hash_to_python(cv, r);
+            break;
+        case T_STRING:
+            if (ENCODING_GET(r) == rb_ascii8bit_encindex())
+                return PyString_FromStringAndSize(RSTRING_PTR(r),
+                                                  RSTRING_LEN(r));
+
+            return redrat_ruby_string_to_python(r);
+        default:
+            break;
+    }
+
+    return redrat_python_handoff(r);
+}
+
+static VALUE
+redrat_sequence_to_ruby(redrat_convert *cv, PyObject *pSeq)
+{
+    Py_ssize_t  len = PySequence_Fast_GET_SIZE(pSeq);
+    PyObject  **items = PySequence_Fast_ITEMS(pSeq);
+    Py_ssize_t  i;
+    VALUE       rAry;
+
+    rAry = rb_ary_new_capa(len);
+    rb_hash_aset(cv->memo, SIZET2NUM((size_t) pSeq), rAry);
+
+    for (i = 0; i < len; i += 1)
+    {
+        VALUE rItem = redrat_convert_to_ruby(cv, items[i]);
+
+        if (rItem == Qundef)
+            return Qundef;
+
+        rb_ary_push(rAry, rItem);
+    }
+
+    return rAry;
+}
+
+static VALUE
+redrat_dict_to_ruby(redrat_convert *cv, PyObject *pDict)
+{
+    PyObject   *pKey;
+    PyObject   *pValue;
+    Py_ssize_t  pos = 0;
+    VALUE       rHash;
+
+#ifdef HAVE_RB_HASH_NEW_CAPA
+    rHash = rb_hash_new_capa(PyDict_Size(pDict));
+#else
+    rHash = rb_hash_new();
+#endif
+    rb_hash_aset(cv->memo, SIZET2NUM((size_t) pDict), rHash);
+
+    while (PyDict_Next(pDict, &pos, &pKey, &pValue))
+    {
+        VALUE rKey = redrat_convert_to_ruby(cv, pKey);
+        VALUE rValue;
+
+        if (rKey == Qundef)
+            return Qundef;
+
+        rValue = redrat_convert_to_ruby(cv, pValue);
+
+        if (rValue == Qundef)
+            return Qundef;
+
+        rb_hash_aset(rHash, rKey, rValue);
+    }
+
+    return rHash;
+}
+
+/*
+ * redrat_convert_to_ruby - Convert a Python value to its Ruby counterpart
+ *
+ * Scalars are converted as by redrat_python_scalar_to_ruby, strs and unicode
+ * objects become Strings, lists and tuples Arrays, and dicts Hashes.  Only
+ * exact types are converted, as subclasses may well carry behavior that would
+ * be lost; they and everything else are handed off as PythonValues.
+ *
+ * Returns Qundef, with a Python exception set, on failure.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static VALUE
+redrat_convert_to_ruby(redrat_convert *cv, PyObject *p)
+{
+    VALUE r = redrat_python_scalar_to_ruby(p);
+
+    if (r != Qundef)
+        return r;
+
+    if (PyString_CheckExact(p) || PyUnicode_CheckExact(p))
+        return redrat_python_string_to_ruby(p);
+
+    if (!PyList_CheckExact(p) && !PyTuple_CheckExact(p) &&
+        !PyDict_CheckExact(p))
+        return redrat_ruby_handoff(p);
+
+    r = rb_hash_lookup2(cv->memo, SIZET2NUM((size_t) p), Qundef);
+
+    if (r != Qundef)
+        return r;
+    else if (PyDict_CheckExact(p))
+        return redrat_dict_to_ruby(cv, p);
+    else
+        return redrat_sequence_to_ruby(cv, p);
+}
+
+/*
+ * redrat_convert_new_memo - A Hash comparing keys by identity
+ */
+static VALUE
+redrat_convert_new_memo(void)
+{
+    return rb_funcall(rb_hash_new(), redrat_id_compare_by_identity, 0);
+}
+
+/*
+ * redrat_deep_option - Parse the arguments to to_python and to_ruby
+ *
+ * Both take a value and an optional deep: keyword, which defaults to false.
+ */
+static bool
+redrat_deep_option(int argc, VALUE *argv, VALUE *rVal)
+{
+    VALUE rOpts = Qnil;
+    VALUE rDeep = Qundef;
+
+    rb_scan_args(argc, argv, "1:", rVal, &rOpts);
+
+    if (rOpts != Qnil)
+        rb_get_kwargs(rOpts, &redrat_id_deep, 0, 1, &rDeep);
+
+    return rDeep != Qundef && RTEST(rDeep);
+}
+
+/*
+ * redrat_kwargs_split - Find keyword arguments at the end of argv
+ *
+ * Returns the Hash holding them, taking it off of the end of argv by
+ * decrementing *argc, or Qnil if there are none.  Where Ruby can say whether
+ * keywords were passed, a Hash passed positionally stays positional;
+ * otherwise any trailing Hash is taken for keywords.
+ */
+static VALUE
+redrat_kwargs_split(int *argc, const VALUE *argv)
+{
+    VALUE rLast;
+
+    if (*argc == 0)
+        return Qnil;
+
+#ifdef HAVE_RB_KEYWORD_GIVEN_P
+    if (!rb_keyword_given_p())
+        return Qnil;
+#endif
+
+    rLast = argv[*argc - 1];
+
+    if (TYPE(rLast) != T_HASH)
+        return Qnil;
+
+    *argc -= 1;
+    return rLast;
+}
+
+static int
+redrat_callargs_kw_i(VALUE rKey, VALUE rValue, VALUE data)
+{
+    redrat_callargs  *ca = (redrat_callargs *) data;
+    PyObject        **pair = ca->kws + 2 * ca->nkws;
+
+    if (!SYMBOL_P(rKey) && TYPE(rKey) != T_STRING)
+    {
+        ca->badKey = true;
+        return ST_STOP;
+    }
+
+    pair[0] = redrat_attr_name_to_python(rKey);
+
+    if (pair[0] == NULL)
+        return ST_STOP;
+
+    pair[1] = redrat_python_handoff(rValue);
+    ca->nkws += 1;
+
+    return (pair[1] == NULL) ? ST_STOP : ST_CONTINUE;
+}
+
+/*
+ * redrat_callargs_fill - Hand off Ruby arguments into an argument vector
+ *
+ * slots must have room for REDRAT_CALLARGS_SLOTS(argc, size of rKwargs)
+ * pointers, and is usually allocated on the stack by the caller.  The first
+ * slot is left spare so that a self can be prepended without copying.
+ *
+ * Returns false if an argument could not be handed off, with a Python
+ * exception set, or if a keyword is neither a Symbol nor a String, flagged in
+ * ca->badKey.  Either way, redrat_callargs_clear must still be called.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static bool
+redrat_callargs_fill(redrat_callargs *ca, PyObject **slots,
+                     int argc, const VALUE *argv, VALUE rKwargs)
+{
+    int argIter;
+
+    slots[0] = NULL;
+    ca->args = slots + 1;
+    ca->nargs = 0;
+    ca->kws = slots + 1 + argc;
+    ca->nkws = 0;
+    ca->spare = true;
+    ca->badKey = false;
+
+    for (argIter = 0; argIter < argc; argIter += 1)
+    {
+        PyObject *pArg = redrat_python_handoff(argv[argIter]);
+
+        if (pArg == NULL)
+            return false;
+
+        ca->args[ca->nargs] = pArg;
+        ca->nargs += 1;
+    }
+
+    if (rKwargs != Qnil)
+    {
+        rb_hash_foreach(rKwargs, redrat_callargs_kw_i, (VALUE) ca);
+
+        if (ca->badKey || PyErr_Occurred())
+            return false;
+    }
+
+    return true;
+}
+
+/*
+ * redrat_callargs_prepend - Use the spare slot for a leading argument
+ *
+ * The reference to pFirst is stolen.
+ */
+static void
+redrat_callargs_prepend(redrat_callargs *ca, PyObject *pFirst)
+{
+    Assert(ca->spare);
+
+    ca->args -= 1;
+    ca->args[0] = pFirst;
+    ca->nargs += 1;
+    ca->spare = false;
+}
+
+/*
+ * redrat_callargs_clear - Drop the references held by an argument vector
+ */
+static void
+redrat_callargs_clear(redrat_callargs *ca)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < ca->nargs; i += 1)
+        Py_DECREF(ca->args[i]);
+
+    for (i = 0; i < 2 * ca->nkws; i += 1)
+        Py_XDECREF(ca->kws[i]);
+
+    ca->nargs = 0;
+    ca->nkws = 0;
+}
+
+/*
+ * redrat_callargs_pack - Copy an argument vector into a tuple and a dict
+ *
+ * For callables that only take arguments the classic way.  *pKwargs is set to
+ * NULL when there are no keywords.  Returns a new reference to the tuple.
+ */
+static PyObject *
+redrat_callargs_pack(redrat_callargs *ca, PyObject **pKwargs)
+{
+    PyObject   *pArgs;
+    Py_ssize_t  i;
+
+    *pKwargs = NULL;
+    pArgs = PyTuple_New(ca->nargs);
+
+    if (pArgs == NULL)
+        return NULL;
+
+    for (i = 0; i < ca->nargs; i += 1)
+    {
+        Py_INCREF(ca->args[i]);
+        PyTuple_SET_ITEM(pArgs, i, ca->args[i]);
+    }
+
+    if (ca->nkws == 0)
+        return pArgs;
+
+    *pKwargs = _PyDict_NewPresized(ca->nkws);
+
+    if (*pKwargs == NULL)
+        goto fail;
+
+    for (i = 0; i < ca->nkws; i += 1)
+        if (PyDict_SetItem(*pKwargs, ca->kws[2 * i], ca->kws[2 * i + 1]) < 0)
+            goto fail;
+
+    return pArgs;
+
+fail:
+    Py_DECREF(pArgs);
+    Py_CLEAR(*pKwargs);
+
+    return NULL;
+}
+
+/*
+ * redrat_call_vector - Call a Python object with an argument vector
+ *
+ * Python functions, and bound methods of them, have their frames set up
+ * straight from the vector, and built-in functions taking no argument or a
+ * single one are called directly.  Everything else gets an argument tuple,
+ * and a dict if there are keywords, as with PyObject_Call.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_call_vector(PyObject *pCallable, redrat_callargs *ca)
+{
+    PyObject *pArgs;
+    PyObject *pKwargs;
+    PyObject *pResult;
+
+    if (PyMethod_Check(pCallable) && PyMethod_GET_SELF(pCallable) != NULL &&
+        PyFunction_Check(PyMethod_GET_FUNCTION(pCallable)) && ca->spare)
+    {
+        /* Borrowed for the duration of the call, the method holds it */
+        redrat_callargs_prepend(ca, PyMethod_GET_SELF(pCallable));
+        pResult = redrat_call_vector(PyMethod_GET_FUNCTION(pCallable), ca);
+
+        ca->args += 1;
+        ca->nargs -= 1;
+        ca->spare = true;
+
+        return pResult;
+    }
+
+    if (PyFunction_Check(pCallable))
+    {
+        PyObject   *pDefaults = PyFunction_GET_DEFAULTS(pCallable);
+        PyObject  **defs = NULL;
+        int         ndefs = 0;
+
+        if (pDefaults != NULL)
+        {
+            defs = &PyTuple_GET_ITEM(pDefaults, 0);
+            ndefs = (int) PyTuple_GET_SIZE(pDefaults);
+        }
+
+        if (Py_EnterRecursiveCall(" while calling a Python object"))
+            return NULL;
+
+        pResult = PyEval_EvalCodeEx(
+            (PyCodeObject *) PyFunction_GET_CODE(pCallable),
+            PyFunction_GET_GLOBALS(pCallable), NULL,
+            ca->args, (int) ca->nargs,
+            ca->kws, (int) ca->nkws,
+            defs, ndefs,
+            PyFunction_GET_CLOSURE(pCallable));
+
+        Py_LeaveRecursiveCall();
+
+        return pResult;
+    }
+
+    if (PyCFunction_Check(pCallable) && ca->nkws == 0)
+    {
+        int flags = PyCFunction_GET_FLAGS(pCallable) &
+            ~(METH_CLASS | METH_STATIC | METH_COEXIST);
+
+        if ((flags == METH_NOARGS && ca->nargs == 0) ||
+            (flags == METH_O && ca->nargs == 1))
+            return (*PyCFunction_GET_FUNCTION(pCallable))(
+                PyCFunction_GET_SELF(pCallable),
+                (ca->nargs == 0) ? NULL : ca->args[0]);
+    }
+
+    pArgs = redrat_callargs_pack(ca, &pKwargs);
+
+    if (pArgs == NULL)
+        return NULL;
+
+    pResult = PyObject_Call(pCallable, pArgs, pKwargs);
+
+    Py_DECREF(pArgs);
+    Py_XDECREF(pKwargs);
+
+    return pResult;
+}
+
+/*
+ * RUBY INTERFACE PROCEDURES
+ *
+ * These procedures have direct impact on what constructs are exposed to a Ruby
+ * program.
+ */
+
+/*
+ * redrat_getattr_common - The body of getattr and hasattr
+ *
+ * When rDefault is not Qundef, a missing attribute returns it instead of
+ * raising: the AttributeError is cleared in C, and no Ruby exception is made.
+ * With present, only whether the attribute exists is returned.
+ */
+static VALUE
+redrat_getattr_common(VALUE rTarget, VALUE rName, VALUE rDefault,
+                      bool present)
+{
+    PyObject *pTarget;
+    PyObject *pAttrName = NULL;
+    PyObject *pResult = NULL;
+
+    VALUE rExcFromDelegation;
+    VALUE rResult;
+
+    if (!(REDRAT_PYTHONVALUE_P(rTarget) && redrat_attr_name_p(rName)))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: getattr only supports PythonValues, with a "
+                 "PythonValue, Symbol or String name");
+
+    REDRAT_STAT_ADD(REDRAT_STAT_GETATTR_CALLS, 1);
+
+    pTarget = redrat_pythonvalue_get(rTarget);
+
+    redrat_gil_ensure();
+
+    pAttrName = redrat_attr_name_to_python(rName);
+    REDRAT_ERRJMP_PYEXC(rExcFromDelegation, pAttrName);
+
+    /* Through the type, for old-style instances and __getattr__ */
+    pResult = PyObject_GetAttr(pTarget, pAttrName);
+
+    if (pResult == NULL && rDefault != Qundef &&
+        PyErr_ExceptionMatches(PyExc_AttributeError))
+    {
+        PyErr_Clear();
+        Py_DECREF(pAttrName);
+        redrat_gil_release();
+
+        return rDefault;
+    }
+
+    REDRAT_ERRJMP_PYEXC(rExcFromDelegation, pResult);
+    rResult = present ? Qtrue : redrat_ruby_handoff(pResult);
+    Py_DECREF(pResult);
+    Py_DECREF(pAttrName);
+
+    redrat_gil_release();
+
+    return rResult;
+
+py_rb_error:
+    Py_XDECREF(pAttrName);
+
+    redrat_gil_release();
+
+    if (rExcFromDelegation != Qnil)
+        redrat_rb_exc_raise(rExcFromDelegation,
+                            "redrat_ext: Could not delegate to Python");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_getattr - Get attributes from a PythonValue
+ *
+ * The name can be a Symbol or a String, which is cheapest, see
+ * redrat_attr_name_to_python.  It can also be a PythonValue, nominally
+ * constructed via the 'unicode' method provided in this module.
+ *
+ * Like Python's getattr, an optional third argument is returned if the
+ * attribute does not exist, rather than raising.
+ */
+static VALUE
+redrat_getattr(int argc, VALUE *argv, VALUE self)
+{
+    rb_check_arity(argc, 2, 3);
+
+    return redrat_getattr_common(argv[0], argv[1],
+                                 (argc == 3) ? argv[2] : Qundef, false);
+}
+
+/*
+ * redrat_hasattr - Whether a PythonValue has an attribute
+ *
+ * As in Python 3, only an AttributeError means that it does not; any other
+ * error is raised.
+ */
+static VALUE
+redrat_hasattr(VALUE self, VALUE rTarget, VALUE rName)
+{
+    return redrat_getattr_common(rTarget, rName, Qfalse, true);
+}
+
+/*
+ * redrat_getitem - Index a PythonValue, as with [] in Python
+ *
+ * The key is handed off as apply would hand it off.  An optional third
+ * argument is returned if the key or index is missing, that is on a
+ * LookupError, rather than raising.  Exact dicts with str or int keys are
+ * looked up without any exception being set on a miss.
+ */
+static VALUE
+redrat_getitem(int argc, VALUE *argv, VALUE self)
+{
+    PyObject *pTarget;
+    PyObject *pKey = NULL;
+    PyObject *pResult = NULL;
+
+    VALUE rExcGetItem = Qnil;
+    VALUE rDefault;
+    VALUE rResult;
+
+    rb_check_arity(argc, 2, 3);
+    rDefault = (argc == 3) ? argv[2] : Qundef;
+
+    if (!REDRAT_PYTHONVALUE_P(argv[0]))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: getitem only supports PythonValues");
+
+    pTarget = redrat_pythonvalue_get(argv[0]);
+
+    redrat_gil_ensure();
+
+    pKey = redrat_python_handoff(argv[1]);
+    REDRAT_ERRJMP_PYEXC(rExcGetItem, pKey);
+
+    if (PyDict_CheckExact(pTarget) &&
+        (PyString_CheckExact(pKey) || PyInt_CheckExact(pKey)))
+    {
+        /* Hashing and comparing these cannot fail */
+        pResult = PyDict_GetItem(pTarget, pKey);
+        Py_XINCREF(pResult);
+
+        if (pResult == NULL && rDefault != Qundef)
+            goto missing;
+    }
+
+    /* Also to raise the KeyError for a dict miss without a default */
+    if (pResult == NULL)
+        pResult = PyObject_GetItem(pTarget, pKey);
+
+    if (pResult == NULL && rDefault != Qundef &&
+        PyErr_ExceptionMatches(PyExc_LookupError))
+    {
+        PyErr_Clear();
+        goto missing;
+    }
+
+    REDRAT_ERRJMP_PYEXC(rExcGetItem, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+    Py_DECREF(pResult);
+    Py_DECREF(pKey);
+
+    redrat_gil_release();
+
+    return rResult;
+
+missing:
+    Py_DECREF(pKey);
+    redrat_gil_release();
+
+    return rDefault;
+
+py_rb_error:
+    Py_XDECREF(pKey);
+
+    redrat_gil_release();
+
+    if (rExcGetItem != Qnil)
+        redrat_rb_exc_raise(rExcGetItem,
+                            "redrat_ext: could not get item of Python "
+                            "object");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_builtin_mapping - The Root of All Things
+ *
+ * Retrieves a PythonValue that supports the dictionary protocol to access the
+ * builtins.
+ *
+ * From here, just about everything is possible because of the existence of
+ * __import__.  An annotated example of what this C code is intended to enable
+ * follows:
+ *
+ *     # Access the builtins, available as a dictionary
+ *
+ *     >>> __builtins__
+ *     <module '__builtin__' (built-in)>
+ *
+ *     # __import__ is the low-level method used for importing modules
+ *
+ *     >>> __builtins__.__import__
+ *     <built-in function __import__>
+ *
+ *     # Any available module can be imported, yielding another module
+ *     # PyObject; furthermore, those modules can be delegated messages from
+ *     # Ruby, as Python modules are just PyObjects.
+ *
+ *     >>> __builtins__.__import__('argparse')
+ *     <module 'argparse' from '/usr/lib/python2.7/argparse.pyc'>
+ */
+static VALUE
+redrat_builtin_mapping(VALUE self)
+{
+    PyObject *pBuiltins;
+
+    VALUE rExcGetBuiltin = Qnil;
+    VALUE rReturn;
+
+    redrat_gil_ensure();
+
+    pBuiltins = PyEval_GetBuiltins();
+    REDRAT_ERRJMP_PYEXC(rExcGetBuiltin, pBuiltins);
+    Py_INCREF(pBuiltins);
+    Assert_PyMapping(pBuiltins);
+
+    rReturn = redrat_ruby_handoff(pBuiltins);
+
+    redrat_gil_release();
+
+    return rReturn;
+
+py_rb_error:
+    /*
+     * A failure to return the builtin mapping to Ruby, which makes it
+     * seemingly impossible to bootstrap access to richer Python functionality.
+     * That's bad news so early in the game, but faithfully clean up and raise
+     * an exception.
+     *
+     * These Py_XDECREF calls have to be carefully checked that they do not
+     * cause over-decref-ing should a procedure returns a "borrowed" reference
+     * and yet winds up in this error path.  In the above, PyEval_GetBuiltins()
+     * is such an example.
+     */
+    Py_XDECREF(pBuiltins);
+
+    redrat_gil_release();
+
+    if (rExcGetBuiltin != Qnil)
+        redrat_rb_exc_raise(rExcGetBuiltin,
+                            "redrat_ext: couldn't read Python builtins, "
+                            "RedRat cannot initialize");
+    else
+        rb_fatal("redrat_ext: report this bug in redrat_builtin_mapping");
+
+    Assert(false);
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+/* A Python call to be made with the Ruby GVL released */
+typedef struct {
+    PyObject *pCallable;
+    PyObject *pArgs;
+    PyObject *pKwargs;
+    PyObject *pResult;
+    bool      called;
+} redrat_nogvl_call;
+
+static void *
+redrat_nogvl_call_run(void *data)
+{
+    redrat_nogvl_call *call = data;
+
+    redrat_gvl_released = true;
+    call->pResult = PyObject_Call(call->pCallable, call->pArgs, call->pKwargs);
+    call->called = true;
+    redrat_gvl_released = false;
+
+    return NULL;
+}
+
+static VALUE
+redrat_nogvl_call_blocking(VALUE data)
+{
+    rb_thread_call_without_gvl(redrat_nogvl_call_run, (void *) data,
+                               NULL, NULL);
+
+    return Qnil;
+}
+
+/*
+ * redrat_call_without_gvl - PyObject_Call with the Ruby GVL released
+ *
+ * Other Ruby threads run while the call is in progress.  The GIL stays held
+ * throughout (save for where Python itself lets go of it), which is announced
+ * through redrat_gil_detached.
+ *
+ * The call cannot be cancelled: interrupts such as Thread#raise are delivered
+ * once it returns.  They are reported through *state, in which case NULL is
+ * returned with no Python exception set, and the caller is expected to clean
+ * up, release the GIL and rb_jump_tag.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static PyObject *
+redrat_call_without_gvl(PyObject *pCallable, PyObject *pArgs,
+                        PyObject *pKwargs, int *state)
+{
+    redrat_nogvl_call call;
+
+    call.pCallable = pCallable;
+    call.pArgs = pArgs;
+    call.pKwargs = pKwargs;
+    call.pResult = NULL;
+    call.called = false;
+
+    redrat_gil_detached += 1;
+    rb_protect(redrat_nogvl_call_blocking, (VALUE) &call, state);
+    redrat_gil_detached -= 1;
+
+    if (*state != 0)
+    {
+        /* Interrupted either before or after the call */
+        if (call.called)
+        {
+            if (call.pResult == NULL)
+                PyErr_Clear();
+
+            Py_CLEAR(call.pResult);
+        }
+    }
+
+    return call.pResult;
+}
+#endif /* HAVE_RB_THREAD_CALL_WITHOUT_GVL */
+
+/*
+ * redrat_apply_common - The body of apply, apply_nogvl and apply?
+ *
+ * Arguments after the callable are passed positionally, save for trailing
+ * keyword arguments, which are passed as Python keyword arguments.
+ *
+ * With tryCall, an error raised by the call itself is not raised in Ruby, and
+ * a [result, exception] pair is returned instead; see redrat_apply_p.
+ */
+static VALUE
+redrat_apply_common(int argc, VALUE *argv, bool releaseGvl, bool tryCall)
+{
+    PyObject        *pMaybeCallable = NULL;
+    PyObject        *pResult = NULL;
+    PyObject       **slots;
+    redrat_callargs  ca;
+
+    VALUE rExcApplication = Qnil;
+    VALUE rKwargs;
+    VALUE rResult;
+    VALUE slotsBuf;
+
+    int state = 0;
+
+    REDRAT_STAT_ADD(REDRAT_STAT_APPLY_CALLS, 1);
+
+    rKwargs = redrat_kwargs_split(&argc, argv);
+
+    /* Reject zero arguments */
+    if (argc == 0)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: apply must take at least one argument");
+
+    /*
+     * The first Ruby argument is the callable, and is not counted towards the
+     * argument vector.
+     */
+    slots = ALLOCV_N(PyObject *, slotsBuf,
+                     REDRAT_CALLARGS_SLOTS(argc - 1, (rKwargs == Qnil) ?
+                                           0 : RHASH_SIZE(rKwargs)));
+
+    redrat_gil_ensure();
+
+    if (!redrat_callargs_fill(&ca, slots, argc - 1, argv + 1, rKwargs))
+    {
+        if (!ca.badKey)
+            rExcApplication = redrat_exception_convert();
+
+        goto py_rb_error;
+    }
+
+    pMaybeCallable = redrat_python_handoff(argv[0]);
+    REDRAT_ERRJMP_PYEXC(rExcApplication, pMaybeCallable);
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    if (releaseGvl)
+    {
+        PyObject *pArgs;
+        PyObject *pKwargs;
+
+        pArgs = redrat_callargs_pack(&ca, &pKwargs);
+        REDRAT_ERRJMP_PYEXC(rExcApplication, pArgs);
+
+        pResult = redrat_call_without_gvl(pMaybeCallable, pArgs, pKwargs,
+                                          &state);
+
+        Py_DECREF(pArgs);
+        Py_XDECREF(pKwargs);
+
+        if (state != 0)
+            goto py_rb_error;
+    }
+    else
+#endif
+        pResult = redrat_call_vector(pMaybeCallable, &ca);
+
+    REDRAT_PROF_FLUSH();
+
+    if (pResult == NULL && tryCall)
+    {
+        PyObject *pType;
+        PyObject *pValue;
+        PyObject *pTraceback;
+
+        /* Hand over the exception instance, without making a Ruby one */
+        PyErr_Fetch(&pType, &pValue, &pTraceback);
+        PyErr_NormalizeException(&pType, &pValue, &pTraceback);
+
+        rResult = rb_assoc_new(Qnil, redrat_ruby_handoff(pValue));
+
+        Py_XDECREF(pType);
+        Py_XDECREF(pValue);
+        Py_XDECREF(pTraceback);
+
+        Py_DECREF(pMaybeCallable);
+        redrat_callargs_clear(&ca);
+
+        redrat_gil_release();
+        ALLOCV_END(slotsBuf);
+
+        return rResult;
+    }
+
+    REDRAT_ERRJMP_PYEXC(rExcApplication, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+
+    if (tryCall)
+        rResult = rb_assoc_new(rResult, Qnil);
+
+    Py_DECREF(pMaybeCallable);
+    redrat_callargs_clear(&ca);
+    Py_DECREF(pResult);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    return rResult;
+
+py_rb_error:
+    Py_XDECREF(pMaybeCallable);
+    redrat_callargs_clear(&ca);
+    Py_XDECREF(pResult);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    if (state != 0)
+        rb_jump_tag(state);
+    else if (ca.badKey)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: keywords must be Symbols or Strings");
+    else if (rExcApplication != Qnil)
+        redrat_rb_exc_raise(rExcApplication,
+                            "redrat_ext: applied function raised an error");
+
+    Assert(false);
+}
+
+static VALUE
+redrat_apply(int argc, VALUE *argv, VALUE self)
+{
+    return redrat_apply_common(argc, argv, false, false);
+}
+
+/*
+ * redrat_apply_nogvl - apply, letting other Ruby threads run meanwhile
+ *
+ * Worth it for calls that take a while, such as ones that block on IO or spend
+ * their time in C code that lets go of the GIL.  For short calls the cost of
+ * giving up and taking back the GVL dominates, so prefer plain apply.
+ */
+static VALUE
+redrat_apply_nogvl(int argc, VALUE *argv, VALUE self)
+{
+    return redrat_apply_common(argc, argv, true, false);
+}
+
+/*
+ * redrat_apply_p - apply, returning a [result, exception] pair
+ *
+ * If the call raises, the pair is [nil, the Python exception instance] and
+ * the error state is cleared without building a Ruby exception, which is much
+ * cheaper where failure is expected.  Otherwise it is [result, nil]; the
+ * result is never nil, as None is a PythonValue too.  Errors that arise
+ * before the call, such as in converting its arguments, are still raised.
+ */
+static VALUE
+redrat_apply_p(int argc, VALUE *argv, VALUE self)
+{
+    return redrat_apply_common(argc, argv, false, true);
+}
+
+/*
+ * redrat_plan_resolve - Bring a plan up to date, returning its callable
+ *
+ * Checks the guard of each step, and resolves it and every step after it
+ * anew once one fails.  Returns a borrowed reference, or NULL with a Python
+ * error set.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static PyObject *
+redrat_plan_resolve(redrat_plan *plan)
+{
+    PyObject *pHolder = plan->pRoot;
+    bool      stale = false;
+    long      i;
+
+    for (i = 0; i < plan->nsteps; i += 1)
+    {
+        redrat_plan_step *step = &plan->steps[i];
+
+        if (!stale)
+        {
+            switch (step->guard)
+            {
+                case REDRAT_PLAN_MODULE:
+                    stale = PyDict_GetItem(PyModule_GetDict(pHolder),
+                                           step->pName) != step->pResolved;
+                    break;
+                case REDRAT_PLAN_TYPE:
+                    stale = !PyType_HasFeature((PyTypeObject *) pHolder,
+                                               Py_TPFLAGS_VALID_VERSION_TAG) ||
+                        ((PyTypeObject *) pHolder)->tp_version_tag !=
+                        step->versionTag;
+                    break;
+                default:
+                    stale = true;
+                    break;
+            }
+        }
+
+        if (stale)
+        {
+            PyObject *pResolved = PyObject_GetAttr(pHolder, step->pName);
+
+            if (pResolved == NULL)
+                return NULL;
+
+            Py_XDECREF(step->pResolved);
+            step->pResolved = pResolved;
+            plan->resolutions += 1;
+
+            /* Version tags are assigned by the lookup that just happened */
+            if (PyModule_CheckExact(pHolder))
+                step->guard = REDRAT_PLAN_MODULE;
+            else if (Py_TYPE(pHolder) == &PyType_Type &&
+                     PyType_HasFeature((PyTypeObject *) pHolder,
+                                       Py_TPFLAGS_VALID_VERSION_TAG))
+            {
+                step->guard = REDRAT_PLAN_TYPE;
+                step->versionTag = ((PyTypeObject *) pHolder)->tp_version_tag;
+            }
+            else
+                step->guard = REDRAT_PLAN_DYNAMIC;
+        }
+
+        pHolder = step->pResolved;
+    }
+
+    return pHolder;
+}
+
+static void
+redrat_plan_free(void *data)
+{
+    redrat_plan *plan = data;
+    long         i;
+
+    for (i = 0; i < plan->nsteps; i += 1)
+    {
+        if (plan->steps[i].pName != NULL)
+            redrat_py_decref_wrap(plan->steps[i].pName);
+
+        if (plan->steps[i].pResolved != NULL)
+            redrat_py_decref_wrap(plan->steps[i].pResolved);
+    }
+
+    if (plan->pRoot != NULL)
+        redrat_py_decref_wrap(plan->pRoot);
+
+    xfree(plan);
+}
+
+/*
+ * redrat_plan_new - Plan calls to an attribute chain of a PythonValue
+ *
+ * plan(json, :dumps) returns a PythonCallPlan whose call is apply of
+ * getattr(json, :dumps), resolved once and kept until the module or class it
+ * came from changes.  Attributes are looked up as Python's own attribute
+ * access does.  The chain is resolved straight away, so that a missing
+ * attribute raises here rather than on the first call.
+ */
+static VALUE
+redrat_plan_new(int argc, VALUE *argv, VALUE self)
+{
+    redrat_plan *plan;
+    PyObject    *pRoot;
+    PyObject    *pResolved;
+
+    VALUE rExcPlanning = Qnil;
+    VALUE rPlan;
+
+    int i;
+
+    rb_check_arity(argc, 2, UNLIMITED_ARGUMENTS);
+
+    if (!REDRAT_PYTHONVALUE_P(argv[0]))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: plan only supports PythonValue roots");
+
+    for (i = 1; i < argc; i += 1)
+        if (!redrat_attr_name_p(argv[i]))
+            rb_raise(rb_eArgError,
+                     "redrat_ext: plan takes PythonValue, Symbol or String "
+                     "attribute names");
+
+    pRoot = redrat_pythonvalue_get(argv[0]);
+    plan = xcalloc(1, sizeof(redrat_plan) +
+                   (argc - 2) * sizeof(redrat_plan_step));
+    plan->nsteps = argc - 1;
+    rPlan = Data_Wrap_Struct(rb_cPythonCallPlan, NULL, redrat_plan_free,
+                             plan);
+
+    redrat_gil_ensure();
+
+    plan->pRoot = pRoot;
+    Py_INCREF(plan->pRoot);
+
+    for (i = 1; i < argc; i += 1)
+    {
+        plan->steps[i - 1].pName = redrat_attr_name_to_python(argv[i]);
+        REDRAT_ERRJMP_PYEXC(rExcPlanning, plan->steps[i - 1].pName);
+    }
+
+    pResolved = redrat_plan_resolve(plan);
+    REDRAT_ERRJMP_PYEXC(rExcPlanning, pResolved);
+
+    redrat_gil_release();
+
+    return rPlan;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcPlanning != Qnil)
+        redrat_rb_exc_raise(rExcPlanning,
+                            "redrat_ext: could not resolve attribute chain");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_plan_call - Call what a plan resolves to, as apply would
+ *
+ * Arguments are passed as apply passes them, keywords included.  Steps whose
+ * guards fail are resolved again first, within the same call.
+ */
+static VALUE
+redrat_plan_call(int argc, VALUE *argv, VALUE self)
+{
+    redrat_plan      *plan;
+    PyObject         *pCallable;
+    PyObject         *pResult = NULL;
+    PyObject        **slots;
+    redrat_callargs   ca;
+
+    VALUE rExcApplication = Qnil;
+    VALUE rKwargs;
+    VALUE rResult;
+    VALUE slotsBuf;
+
+    Data_Get_Struct(self, redrat_plan, plan);
+
+    rKwargs = redrat_kwargs_split(&argc, argv);
+    slots = ALLOCV_N(PyObject *, slotsBuf,
+                     REDRAT_CALLARGS_SLOTS(argc, (rKwargs == Qnil) ?
+                                           0 : RHASH_SIZE(rKwargs)));
+
+    redrat_gil_ensure();
+
+    if (!redrat_callargs_fill(&ca, slots, argc, argv, rKwargs))
+    {
+        if (!ca.badKey)
+            rExcApplication = redrat_exception_convert();
+
+        goto py_rb_error;
+    }
+
+    pCallable = redrat_plan_resolve(plan);
+    REDRAT_ERRJMP_PYEXC(rExcApplication, pCallable);
+
+    /* A later resolution may drop the plan's reference during the call */
+    Py_INCREF(pCallable);
+    pResult = redrat_call_vector(pCallable, &ca);
+    Py_DECREF(pCallable);
+    REDRAT_PROF_FLUSH();
+    REDRAT_ERRJMP_PYEXC(rExcApplication, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+
+    redrat_callargs_clear(&ca);
+    Py_DECREF(pResult);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    return rResult;
+
+py_rb_error:
+    redrat_callargs_clear(&ca);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    if (ca.badKey)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: keywords must be Symbols or Strings");
+    else if (rExcApplication != Qnil)
+        redrat_rb_exc_raise(rExcApplication,
+                            "redrat_ext: applied function raised an error");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_plan_callable - What a plan currently resolves to
+ */
+static VALUE
+redrat_plan_callable(VALUE self)
+{
+    redrat_plan *plan;
+    PyObject    *pCallable;
+
+    VALUE rExcPlanning = Qnil;
+    VALUE rCallable;
+
+    Data_Get_Struct(self, redrat_plan, plan);
+
+    redrat_gil_ensure();
+
+    pCallable = redrat_plan_resolve(plan);
+    REDRAT_ERRJMP_PYEXC(rExcPlanning, pCallable);
+    rCallable = redrat_ruby_handoff(pCallable);
+
+    redrat_gil_release();
+
+    return rCallable;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcPlanning != Qnil)
+        redrat_rb_exc_raise(rExcPlanning,
+                            "redrat_ext: could not resolve attribute chain");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_plan_resolutions - How many steps a plan has resolved so far
+ *
+ * A chain of n steps resolves n when planned; it goes up after that only as
+ * guards fail, or on every call for steps that cannot be guarded.
+ */
+static VALUE
+redrat_plan_resolutions(VALUE self)
+{
+    redrat_plan *plan;
+
+    Data_Get_Struct(self, redrat_plan, plan);
+
+    return LONG2NUM(plan->resolutions);
+}
+
+/*
+ * redrat_code_for - The code object compiled from a source String
+ *
+ * With exec, the source is compiled as statements, as for Python's exec;
+ * otherwise as an expression.  Returns a PythonValue from the cache, or
+ * compiles the source and caches it, evicting the least recently used code
+ * of the mode if the cache is full.
+ */
+static VALUE
+redrat_code_for(VALUE rSource, bool exec)
+{
+    VALUE       rCache = redrat_code_cache[exec ? 1 : 0];
+    VALUE       rCode;
+    VALUE       rExcCompile = Qnil;
+    PyObject   *pCode;
+    const char *source;
+    long        started;
+    long        elapsed;
+
+    source = StringValueCStr(rSource);
+
+    rCode = rb_hash_delete(rCache, rSource);
+
+    if (rCode != Qnil)
+    {
+        redrat_code_hits += 1;
+        rb_hash_aset(rCache, rSource, rCode);
+
+        return rCode;
+    }
+
+    redrat_code_misses += 1;
+
+    redrat_gil_ensure();
+
+    started = redrat_now_ns();
+    pCode = Py_CompileString(source, "<redrat>",
+                             exec ? Py_file_input : Py_eval_input);
+    elapsed = redrat_now_ns() - started;
+
+    redrat_code_total_compile_ns += elapsed;
+
+    if (elapsed > redrat_code_max_compile_ns)
+        redrat_code_max_compile_ns = elapsed;
+
+    REDRAT_ERRJMP_PYEXC(rExcCompile, pCode);
+    rCode = redrat_ruby_handoff_kept(pCode);
+    Py_DECREF(pCode);
+
+    redrat_gil_release();
+
+    if (RHASH_SIZE(rCache) >= REDRAT_CODE_CACHE_SIZE)
+    {
+        VALUE rOldest = rb_funcall(rCache, rb_intern("first"), 0);
+
+        rb_hash_delete(rCache, RARRAY_AREF(rOldest, 0));
+        redrat_code_evictions += 1;
+    }
+
+    rb_hash_aset(rCache, rSource, rCode);
+
+    return rCode;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcCompile != Qnil)
+        redrat_rb_exc_raise(rExcCompile,
+                            "redrat_ext: could not compile Python source");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_compile - Compile Python source, through the code cache
+ *
+ * The mode is :eval, the default, for an expression, or :exec for
+ * statements.  Returns the code object as a PythonValue, which eval runs.
+ */
+static VALUE
+redrat_compile(int argc, VALUE *argv, VALUE self)
+{
+    VALUE rSource;
+    VALUE rMode;
+
+    rb_scan_args(argc, argv, "11", &rSource, &rMode);
+
+    if (rMode != Qnil && rMode != ID2SYM(rb_intern("eval")) &&
+        rMode != ID2SYM(rb_intern("exec")))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: compile mode must be :eval or :exec");
+
+    return redrat_code_for(rSource, rMode == ID2SYM(rb_intern("exec")));
+}
+
+typedef struct {
+    redrat_convert  cv;
+    PyObject       *pLocals;
+    bool            failed;
+    bool            badKey;
+} redrat_eval_locals_state;
+
+static int
+redrat_eval_locals_i(VALUE rKey, VALUE rValue, VALUE data)
+{
+    redrat_eval_locals_state *ls = (void *) data;
+    PyObject                 *pName;
+    PyObject                 *pValue;
+    int                       status;
+
+    if (!redrat_attr_name_p(rKey))
+    {
+        ls->badKey = true;
+        return ST_STOP;
+    }
+
+    pName = redrat_attr_name_to_python(rKey);
+
+    if (pName == NULL)
+    {
+        ls->failed = true;
+        return ST_STOP;
+    }
+
+    pValue = redrat_convert_to_python(&ls->cv, rValue, false);
+
+    if (pValue == NULL)
+    {
+        Py_DECREF(pName);
+        ls->failed = true;
+        return ST_STOP;
+    }
+
+    status = PyDict_SetItem(ls->pLocals, pName, pValue);
+    Py_DECREF(pName);
+    Py_DECREF(pValue);
+
+    if (status < 0)
+    {
+        ls->failed = true;
+        return ST_STOP;
+    }
+
+    return ST_CONTINUE;
+}
+
+/*
+ * redrat_eval - Evaluate Python source, or code from compile
+ *
+ * Source is compiled as an expression through the code cache.  Locals can be
+ * a Hash, whose values are converted as to_python converts them, or a
+ * PythonValue mapping, which code from compile(source, :exec) assigns into.
+ * Returns the value of the expression, or None for statements.
+ *
+ * Defined on RedRat::Internal only, not as a module function, so that
+ * including RedRat::Internal does not shadow Kernel#eval.
+ */
+static VALUE
+redrat_eval(int argc, VALUE *argv, VALUE self)
+{
+    redrat_eval_locals_state  ls;
+    PyObject                 *pCode;
+    PyObject                 *pLocals = NULL;
+    PyObject                 *pResult = NULL;
+
+    VALUE rExcEval = Qnil;
+    VALUE rCode;
+    VALUE rLocals;
+    VALUE rResult;
+
+    rb_scan_args(argc, argv, "11", &rCode, &rLocals);
+
+    if (!REDRAT_PYTHONVALUE_P(rCode))
+        rCode = redrat_code_for(rCode, false);
+
+    if (!(rLocals == Qnil || TYPE(rLocals) == T_HASH ||
+          REDRAT_PYTHONVALUE_P(rLocals)))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: eval locals must be a Hash or a PythonValue");
+
+    ls.cv.deep = false;
+    ls.cv.memo = redrat_convert_new_memo();
+    ls.failed = false;
+    ls.badKey = false;
+
+    pCode = redrat_pythonvalue_get(rCode);
+
+    if (REDRAT_PYTHONVALUE_P(rLocals))
+        pLocals = redrat_pythonvalue_get(rLocals);
+
+    redrat_gil_ensure();
+
+    if (!PyCode_Check(pCode))
+    {
+        PyErr_SetString(PyExc_TypeError,
+                        "eval takes source or a code object");
+        rExcEval = redrat_exception_convert();
+        goto py_rb_error;
+    }
+
+    if (redrat_eval_globals == NULL)
+    {
+        redrat_eval_globals = PyDict_New();
+        REDRAT_ERRJMP_PYEXC(rExcEval, redrat_eval_globals);
+
+        if (PyDict_SetItemString(redrat_eval_globals, "__builtins__",
+                                 PyEval_GetBuiltins()) < 0)
+        {
+            Py_CLEAR(redrat_eval_globals);
+            rExcEval = redrat_exception_convert();
+            goto py_rb_error;
+        }
+    }
+
+    if (pLocals != NULL)
+        Py_INCREF(pLocals);
+    else
+    {
+        pLocals = PyDict_New();
+        REDRAT_ERRJMP_PYEXC(rExcEval, pLocals);
+
+        if (rLocals != Qnil)
+        {
+            ls.pLocals = pLocals;
+            rb_hash_foreach(rLocals, redrat_eval_locals_i, (VALUE) &ls);
+
+            if (ls.badKey)
+                goto py_rb_error;
+
+            if (ls.failed)
+            {
+                rExcEval = redrat_exception_convert();
+                goto py_rb_error;
+            }
+        }
+    }
+
+    pResult = PyEval_EvalCode((PyCodeObject *) pCode, redrat_eval_globals,
+                              pLocals);
+    REDRAT_ERRJMP_PYEXC(rExcEval, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+    Py_DECREF(pResult);
+    Py_DECREF(pLocals);
+
+    redrat_gil_release();
+    RB_GC_GUARD(ls.cv.memo);
+
+    return rResult;
+
+py_rb_error:
+    Py_XDECREF(pLocals);
+
+    redrat_gil_release();
+
+    if (ls.badKey)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: eval locals must be named by Symbols or "
+                 "Strings");
+    else if (rExcEval != Qnil)
+        redrat_rb_exc_raise(rExcEval,
+                            "redrat_ext: evaluated Python code raised an "
+                            "error");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_code_cache_stats - Counters of the code cache
+ *
+ * Returns a Hash of how many lookups hit and missed the cache, how many code
+ * objects were evicted, how many are cached (size) out of how many per mode
+ * (capacity), and the total and longest compile times in nanoseconds.
+ */
+static VALUE
+redrat_code_cache_stats(VALUE self)
+{
+    VALUE rStats = rb_hash_new();
+
+#define redrat_stat_set(name, counter)                                        \
+    rb_hash_aset(rStats, ID2SYM(rb_intern(name)), LONG2NUM(counter))
+
+    redrat_stat_set("hits", redrat_code_hits);
+    redrat_stat_set("misses", redrat_code_misses);
+    redrat_stat_set("evictions", redrat_code_evictions);
+    redrat_stat_set("size", RHASH_SIZE(redrat_code_cache[0]) +
+                    RHASH_SIZE(redrat_code_cache[1]));
+    redrat_stat_set("capacity", REDRAT_CODE_CACHE_SIZE);
+    redrat_stat_set("total_compile_ns", redrat_code_total_compile_ns);
+    redrat_stat_set("max_compile_ns", redrat_code_max_compile_ns);
+
+#undef redrat_stat_set
+
+    return rStats;
+}
+
+/*
+ * redrat_async_run - Make an asynchronous call, on the executor
+ *
+ * This procedure presumes that the Python GIL is already held; the Ruby GVL
+ * is not.
+ */
+static void
+redrat_async_run(redrat_async_call *call)
+{
+    PyObject *pResult = NULL;
+    long      root = call->root;
+    long      wait;
+    long      service;
+
+    call->startedNs = redrat_now_ns();
+
+    if (call->pCallable == NULL)
+    {
+        call->pCallable = redrat_python_handoff(call->argv[0]);
+
+        if (call->pCallable != NULL &&
+            !redrat_callargs_fill(&call->ca, call->slots, call->argc,
+                                  call->argv + 1, Qnil))
+            Py_CLEAR(call->pCallable);
+    }
+
+    if (call->pCallable != NULL)
+        pResult = redrat_call_vector(call->pCallable, &call->ca);
+
+    redrat_callargs_clear(&call->ca);
+    Py_CLEAR(call->pCallable);
+
+    if (pResult == NULL)
+    {
+        PyErr_Fetch(&call->pType, &call->pValue, &call->pTraceback);
+        call->klass = redrat_exception_class(call->pType);
+    }
+
+    call->pResult = pResult;
+    call->finishedNs = redrat_now_ns();
+
+    wait = call->startedNs - call->submittedNs;
+    service = call->finishedNs - call->startedNs;
+
+    /* The executor is the only writer */
+    redrat_async_completed += 1;
+    redrat_async_total_wait_ns += wait;
+    redrat_async_total_service_ns += service;
+
+    if (wait > redrat_async_max_wait_ns)
+        redrat_async_max_wait_ns = wait;
+
+    if (service > redrat_async_max_service_ns)
+        redrat_async_max_service_ns = service;
+
+    pthread_mutex_lock(&call->lock);
+    __atomic_store_n(&call->done, true, __ATOMIC_RELEASE);
+
+    if (call->notifyFds[1] >= 0 && write(call->notifyFds[1], "", 1) < 0)
+    {
+        /* Nothing to be done: the waiter will time out */
+    }
+
+    pthread_cond_broadcast(&call->cond);
+    pthread_mutex_unlock(&call->lock);
+
+    /* Only now may the PythonFuture, and call with it, be freed */
+    redrat_root_remove(root);
+}
+
+/*
+ * redrat_async_main - The executor of asynchronous calls
+ *
+ * Runs on a thread of its own, unknown to Ruby, and never needs the GVL.
+ */
+static void *
+redrat_async_main(void *unused)
+{
+    for (;;)
+    {
+        PyGILState_STATE   gstate;
+        redrat_async_node *batch;
+
+        pthread_mutex_lock(&redrat_async_lock);
+        __atomic_store_n(&redrat_async_sleeping, 1, __ATOMIC_SEQ_CST);
+
+        while (__atomic_load_n(&redrat_async_head, __ATOMIC_SEQ_CST) == NULL)
+            pthread_cond_wait(&redrat_async_cond, &redrat_async_lock);
+
+        __atomic_store_n(&redrat_async_sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&redrat_async_lock);
+
+        gstate = PyGILState_Ensure();
+        redrat_decref_drain();
+
+        /* Keep the GIL for as long as calls keep coming */
+        while ((batch = __atomic_exchange_n(&redrat_async_head, NULL,
+                                            __ATOMIC_ACQUIRE)) != NULL)
+        {
+            redrat_async_node *fifo = NULL;
+
+            redrat_async_batches += 1;
+
+            /* Pushed last in, first out */
+            while (batch != NULL)
+            {
+                redrat_async_node *next = batch->next;
+
+                batch->next = fifo;
+                fifo = batch;
+                batch = next;
+            }
+
+            while (fifo != NULL)
+            {
+                redrat_async_node *next = fifo->next;
+
+                __atomic_sub_fetch(&redrat_async_depth, 1, __ATOMIC_RELAXED);
+                redrat_async_run(fifo->call);
+                free(fifo);
+
+                fifo = next;
+            }
+        }
+
+        PyGILState_Release(gstate);
+    }
+
+    return NULL;
+}
+
+/* Threads do not survive fork, so a child must start its own executor */
+static void
+redrat_async_atfork_child(void)
+{
+    redrat_async_started = false;
+    redrat_async_sleeping = 0;
+}
+
+/*
+ * redrat_async_push - Hand a call over to the executor, starting it if need be
+ *
+ * rFuture, the PythonFuture of call, is kept alive until the call is done.
+ */
+static void
+redrat_async_push(redrat_async_call *call, VALUE rFuture)
+{
+    redrat_async_node *node = malloc(sizeof(redrat_async_node));
+
+    if (node == NULL)
+        rb_memerror();
+
+    if (!redrat_async_started)
+    {
+        pthread_t      executor;
+        pthread_attr_t attr;
+        int            rc;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rc = pthread_create(&executor, &attr, redrat_async_main, NULL);
+        pthread_attr_destroy(&attr);
+
+        if (rc != 0)
+        {
+            free(node);
+            rb_raise(rb_eRuntimeError,
+                     "redrat_ext: could not start the asynchronous call "
+                     "executor");
+        }
+
+        /* Only ever started while holding the GVL */
+        redrat_async_started = true;
+    }
+
+    call->root = redrat_root_add(rFuture);
+    call->submittedNs = redrat_now_ns();
+
+    node->call = call;
+    node->next = __atomic_load_n(&redrat_async_head, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&redrat_async_head, &node->next, node,
+                                        true, __ATOMIC_SEQ_CST,
+                                        __ATOMIC_RELAXED))
+        ;
+
+    __atomic_add_fetch(&redrat_async_depth, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&redrat_async_submitted, 1, __ATOMIC_RELAXED);
+
+    /* Either the executor sees the call, or this sees it sleeping */
+    if (__atomic_load_n(&redrat_async_sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&redrat_async_lock);
+        pthread_cond_signal(&redrat_async_cond);
+        pthread_mutex_unlock(&redrat_async_lock);
+    }
+}
+
+static void
+redrat_future_mark(void *data)
+{
+    redrat_async_call *call = data;
+    int                i;
+
+    rb_gc_mark(call->rArgs);
+    rb_gc_mark(call->rNotify);
+
+    /* The executor reads these without the GVL, so they must not move */
+    if (call->argv != NULL)
+        for (i = 0; i <= call->argc; i += 1)
+            rb_gc_mark(call->argv[i]);
+
+    if (call->rResult != Qundef)
+        rb_gc_mark(call->rResult);
+}
+
+static void
+redrat_future_free(void *data)
+{
+    redrat_async_call *call = data;
+
+    /* Not done until the executor lets go of it, see redrat_async_run */
+    Assert(call->done || call->root < 0);
+
+    if (call->pResult != NULL)
+        redrat_py_decref_wrap(call->pResult);
+
+    if (call->pType != NULL)
+        redrat_py_decref_wrap(call->pType);
+
+    if (call->pValue != NULL)
+        redrat_py_decref_wrap(call->pValue);
+
+    if (call->pTraceback != NULL)
+        redrat_py_decref_wrap(call->pTraceback);
+
+    if (call->notifyFds[1] >= 0)
+        close(call->notifyFds[1]);
+
+    /* Otherwise the IO closes it */
+    if (call->notifyFds[0] >= 0 && call->rNotify == Qnil)
+        close(call->notifyFds[0]);
+
+    pthread_mutex_destroy(&call->lock);
+    pthread_cond_destroy(&call->cond);
+    xfree(call->slots);
+    xfree(call->argv);
+    xfree(call);
+}
+
+/*
+ * redrat_apply_async - apply, on the executor, returning a PythonFuture
+ *
+ * Arguments are passed positionally.  Errors from the call, and from handing
+ * off arguments on the executor, are raised by PythonFuture#value.
+ */
+static VALUE
+redrat_apply_async(int argc, VALUE *argv, VALUE self)
+{
+    redrat_async_call   *call;
+    pthread_condattr_t   attr;
+
+    VALUE rExcApplication = Qnil;
+    VALUE rFuture;
+
+    bool direct = true;
+    int  i;
+
+    rb_check_arity(argc, 1, UNLIMITED_ARGUMENTS);
+
+    rFuture = Data_Make_Struct(rb_cPythonFuture, redrat_async_call,
+                               redrat_future_mark, redrat_future_free, call);
+
+    call->argc = argc - 1;
+    call->rArgs = rb_ary_new_from_values(argc, argv);
+    call->rNotify = Qnil;
+    call->rResult = Qundef;
+    call->root = -1;
+    call->notifyFds[0] = -1;
+    call->notifyFds[1] = -1;
+    call->slots = ALLOC_N(PyObject *, REDRAT_CALLARGS_SLOTS(argc - 1, 0));
+
+    pthread_mutex_init(&call->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&call->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Bignums and Symbols need the GVL to convert */
+    for (i = 0; i < argc; i += 1)
+        if (RB_TYPE_P(argv[i], T_BIGNUM) || SYMBOL_P(argv[i]))
+            direct = false;
+        else if (REDRAT_PYTHONVALUE_P(argv[i]))
+            redrat_pythonvalue_share(argv[i]);
+
+    if (direct)
+    {
+        call->argv = ALLOC_N(VALUE, argc);
+        MEMCPY(call->argv, argv, VALUE, argc);
+    }
+    else
+    {
+        redrat_gil_ensure();
+
+        call->pCallable = redrat_python_handoff(argv[0]);
+
+        if (call->pCallable == NULL ||
+            !redrat_callargs_fill(&call->ca, call->slots, argc - 1, argv + 1,
+                                  Qnil))
+        {
+            rExcApplication = redrat_exception_convert();
+            redrat_callargs_clear(&call->ca);
+            Py_CLEAR(call->pCallable);
+        }
+
+        redrat_gil_release();
+
+        if (rExcApplication != Qnil)
+            redrat_rb_exc_raise(rExcApplication,
+                                "redrat_ext: could not hand off arguments "
+                                "for apply_async");
+    }
+
+    redrat_async_push(call, rFuture);
+
+    return rFuture;
+}
+
+typedef struct {
+    redrat_async_call *call;
+    long               deadlineNs;      /* Or -1 */
+    bool               interrupted;
+} redrat_async_wait;
+
+static void *
+redrat_async_wait_nogvl(void *data)
+{
+    redrat_async_wait *w = data;
+    redrat_async_call *call = w->call;
+
+    pthread_mutex_lock(&call->lock);
+
+    while (!call->done && !w->interrupted)
+    {
+        if (w->deadlineNs < 0)
+            pthread_cond_wait(&call->cond, &call->lock);
+        else
+        {
+            struct timespec ts;
+
+            ts.tv_sec = w->deadlineNs / 1000000000L;
+            ts.tv_nsec = w->deadlineNs % 1000000000L;
+
+            if (pthread_cond_timedwait(&call->cond, &call->lock, &ts) != 0)
+                break;
+        }
+    }
+
+    pthread_mutex_unlock(&call->lock);
+
+    return NULL;
+}
+
+static void
+redrat_async_wait_ubf(void *data)
+{
+    redrat_async_wait *w = data;
+
+    pthread_mutex_lock(&w->call->lock);
+    w->interrupted = true;
+    pthread_cond_broadcast(&w->call->cond);
+    pthread_mutex_unlock(&w->call->lock);
+}
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+/*
+ * redrat_future_wait_fiber - Wait through the Fiber scheduler
+ *
+ * The executor writes to a pipe once done, which the scheduler waits on like
+ * any other IO, so other Fibers on this thread run meanwhile.
+ */
+static void
+redrat_future_wait_fiber(redrat_async_call *call, VALUE rScheduler,
+                         VALUE rTimeout)
+{
+    if (call->rNotify == Qnil)
+    {
+        int fds[2];
+
+        if (rb_cloexec_pipe(fds) != 0)
+            rb_sys_fail("redrat_ext: could not create a pipe for a "
+                        "PythonFuture");
+
+        pthread_mutex_lock(&call->lock);
+
+        if (!call->done)
+        {
+            call->notifyFds[0] = fds[0];
+            call->notifyFds[1] = fds[1];
+        }
+
+        pthread_mutex_unlock(&call->lock);
+
+        if (call->notifyFds[0] < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return;
+        }
+
+        call->rNotify = rb_funcall(rb_cIO, redrat_id_for_fd, 1,
+                                   INT2FIX(fds[0]));
+    }
+
+    rb_fiber_scheduler_io_wait(rScheduler, call->rNotify,
+                               INT2FIX(RUBY_IO_READABLE), rTimeout);
+}
+#endif /* HAVE_RB_FIBER_SCHEDULER_CURRENT */
+
+/*
+ * redrat_future_wait_done - Wait for a call to be done, or for the timeout
+ *
+ * rTimeout is in seconds, or nil for no timeout.  Returns whether the call is
+ * done.
+ */
+static bool
+redrat_future_wait_done(redrat_async_call *call, VALUE rTimeout)
+{
+    redrat_async_wait w;
+
+    if (__atomic_load_n(&call->done, __ATOMIC_ACQUIRE))
+        return true;
+
+    /* The executor would wait on this thread for the GIL, and it on it */
+    if (redrat_gil_depth > 0)
+        rb_raise(rb_eThreadError,
+                 "redrat_ext: cannot wait on a PythonFuture while holding "
+                 "the GIL, as in with_gil");
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+    {
+        VALUE rScheduler = rb_fiber_scheduler_current();
+
+        if (rScheduler != Qnil)
+        {
+            redrat_future_wait_fiber(call, rScheduler, rTimeout);
+
+            return __atomic_load_n(&call->done, __ATOMIC_ACQUIRE);
+        }
+    }
+#endif
+
+    w.call = call;
+    w.deadlineNs = NIL_P(rTimeout) ?
+        -1 : redrat_now_ns() + (long) (NUM2DBL(rTimeout) * 1e9);
+
+    while (!__atomic_load_n(&call->done, __ATOMIC_ACQUIRE))
+    {
+        if (w.deadlineNs >= 0 && redrat_now_ns() >= w.deadlineNs)
+            return false;
+
+        w.interrupted = false;
+        rb_thread_call_without_gvl(redrat_async_wait_nogvl, &w,
+                                   redrat_async_wait_ubf, &w);
+        rb_thread_check_ints();
+    }
+
+    return true;
+}
+
+/*
+ * redrat_future_value - The result of the call, waiting for it if need be
+ *
+ * Raises the error of the call, if any, as a RedRatException.  The result is
+ * handed off on the first call and kept, so every call returns (or raises)
+ * the same object.
+ */
+static VALUE
+redrat_future_value(VALUE self)
+{
+    redrat_async_call *call;
+
+    Data_Get_Struct(self, redrat_async_call, call);
+
+    redrat_future_wait_done(call, Qnil);
+
+    if (call->rResult == Qundef)
+    {
+        if (call->pResult != NULL)
+        {
+            call->rResult = redrat_ruby_handoff_steal(call->pResult);
+            call->pResult = NULL;
+        }
+        else
+        {
+            call->rResult = redrat_exception_new(call->pType, call->pValue,
+                                                 call->pTraceback,
+                                                 call->klass);
+            call->pType = NULL;
+            call->pValue = NULL;
+            call->pTraceback = NULL;
+            call->failed = true;
+        }
+    }
+
+    if (call->failed)
+        redrat_rb_exc_raise(call->rResult,
+                            "redrat_ext: asynchronously applied function "
+                            "raised an error");
+
+    return call->rResult;
+}
+
+/*
+ * redrat_future_wait - Wait for the call to be done
+ *
+ * Takes an optional timeout in seconds.  Returns self, or nil on timing out.
+ */
+static VALUE
+redrat_future_wait(int argc, VALUE *argv, VALUE self)
+{
+    redrat_async_call *call;
+
+    rb_check_arity(argc, 0, 1);
+    Data_Get_Struct(self, redrat_async_call, call);
+
+    return redrat_future_wait_done(call, (argc == 0) ? Qnil : argv[0]) ?
+        self : Qnil;
+}
+
+static VALUE
+redrat_future_done_p(VALUE self)
+{
+    redrat_async_call *call;
+
+    Data_Get_Struct(self, redrat_async_call, call);
+
+    return __atomic_load_n(&call->done, __ATOMIC_ACQUIRE) ? Qtrue : Qfalse;
+}
+
+/*
+ * redrat_async_stats - Counters of the asynchronous call executor
+ *
+ * Returns a Hash of how many calls are queued (depth), were ever submitted
+ * and completed, how many batches the executor took the GIL for, and the
+ * total and longest times in nanoseconds that calls waited in the queue and
+ * took to run.
+ */
+static VALUE
+redrat_async_stats(VALUE self)
+{
+    VALUE rStats = rb_hash_new();
+
+#define redrat_stat_set(name, counter)                                        \
+    rb_hash_aset(rStats, ID2SYM(rb_intern(name)),                             \
+                 LONG2NUM(__atomic_load_n(&(counter), __ATOMIC_RELAXED)))
+
+    redrat_stat_set("depth", redrat_async_depth);
+    redrat_stat_set("submitted", redrat_async_submitted);
+    redrat_stat_set("completed", redrat_async_completed);
+    redrat_stat_set("batches", redrat_async_batches);
+    redrat_stat_set("total_wait_ns", redrat_async_total_wait_ns);
+    redrat_stat_set("max_wait_ns", redrat_async_max_wait_ns);
+    redrat_stat_set("total_service_ns", redrat_async_total_service_ns);
+    redrat_stat_set("max_service_ns", redrat_async_max_service_ns);
+
+#undef redrat_stat_set
+
+    return rStats;
+}
+
+/*
+ * redrat_to_python - Convert a Ruby value to its Python counterpart
+ *
+ * Arrays become lists, Hashes dicts and Strings unicode objects, or strs for
+ * binary Strings.  Without deep: true, their elements are handed off as apply
+ * would hand them off, which wraps anything but scalars and Symbols.  With
+ * it, elements are converted too, all the way down, and Arrays used as Hash
+ * keys become tuples so that they can be dict keys.
+ *
+ * Returns a PythonValue.
+ */
+static VALUE
+redrat_to_python(int argc, VALUE *argv, VALUE self)
+{
+    redrat_convert  cv;
+    PyObject       *pResult;
+
+    VALUE rExcConvert = Qnil;
+    VALUE rVal;
+    VALUE rResult;
+
+    cv.deep = redrat_deep_option(argc, argv, &rVal);
+    cv.memo = redrat_convert_new_memo();
+
+    redrat_gil_ensure();
+
+    pResult = redrat_convert_to_python(&cv, rVal, false);
+    REDRAT_ERRJMP_PYEXC(rExcConvert, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+    Py_DECREF(pResult);
+
+    redrat_gil_release();
+    RB_GC_GUARD(cv.memo);
+
+    return rResult;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcConvert != Qnil)
+        redrat_rb_exc_raise(rExcConvert,
+                            "redrat_ext: could not convert Ruby value to "
+                            "Python");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_to_ruby_common - Convert the Python value in a PythonValue to Ruby
+ *
+ * Without deep, only None, bools, ints, longs and floats are converted, to
+ * nil, true, false, Integers and Floats.  With it, strs and unicode objects
+ * become Strings, lists and tuples Arrays and dicts Hashes, all the way
+ * down, see redrat_convert_to_ruby.
+ *
+ * Anything not converted, including values that are not PythonValues, is
+ * returned as it is, so this is safe to apply to any result.
+ */
+static VALUE
+redrat_to_ruby_common(VALUE rVal, bool deep)
+{
+    redrat_convert  cv;
+    PyObject       *pVal;
+
+    VALUE rExcConvert = Qnil;
+    VALUE rResult;
+
+    if (!REDRAT_PYTHONVALUE_P(rVal))
+        return rVal;
+
+    pVal = redrat_pythonvalue_get(rVal);
+
+    if (!deep)
+    {
+        rResult = redrat_python_scalar_to_ruby(pVal);
+
+        return (rResult == Qundef) ? rVal : rResult;
+    }
+
+    cv.deep = true;
+    cv.memo = rb_hash_new();
+
+    redrat_gil_ensure();
+
+    rResult = redrat_convert_to_ruby(&cv, pVal);
+
+    if (rResult == Qundef)
+    {
+        rExcConvert = redrat_exception_convert();
+        goto py_rb_error;
+    }
+
+    redrat_gil_release();
+    RB_GC_GUARD(cv.memo);
+
+    return rResult;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcConvert != Qnil)
+        redrat_rb_exc_raise(rExcConvert,
+                            "redrat_ext: could not convert Python value to "
+                            "Ruby");
+
+    Assert(false);
+    return Qnil;
+}
+
+static VALUE
+redrat_to_ruby(int argc, VALUE *argv, VALUE self)
+{
+    VALUE rVal;
+    bool  deep = redrat_deep_option(argc, argv, &rVal);
+
+    return redrat_to_ruby_common(rVal, deep);
+}
+
+static VALUE
+redrat_pythonvalue_to_ruby(int argc, VALUE *argv, VALUE self)
+{
+    VALUE rOpts = Qnil;
+    VALUE rDeep = Qundef;
+
+    rb_scan_args(argc, argv, "0:", &rOpts);
+
+    if (rOpts != Qnil)
+        rb_get_kwargs(rOpts, &redrat_id_deep, 0, 1, &rDeep);
+
+    return redrat_to_ruby_common(self, rDeep != Qundef && RTEST(rDeep));
+}
+
+/*
+ * STREAMING PYTHON ITERATORS
+ *
+ * PythonValue#each pulls items off of a Python iterator in batches: each GIL
+ * acquisition calls PyIter_Next up to batch times, handing the items off into
+ * a buffer that is reused from batch to batch, and only then are they yielded,
+ * with the GIL given back.  Exhaustion is not an exception, so the end of the
+ * iterator costs nothing extra.
+ */
+#define REDRAT_ITER_BATCH 256
+
+typedef struct {
+    PyObject *pIter;    /* The Python iterator */
+    long      batch;    /* Items to pull per GIL acquisition */
+    VALUE     rBuf;     /* Items pulled but not yet yielded */
+} redrat_stream;
+
+static VALUE
+redrat_stream_body(VALUE data)
+{
+    redrat_stream *st = (void *) data;
+    bool           done = false;
+
+    while (!done)
+    {
+        VALUE rExc = Qnil;
+        long  i;
+
+        redrat_gil_ensure();
+
+        for (i = 0; i < st->batch; i += 1)
+        {
+            PyObject *pItem = PyIter_Next(st->pIter);
+
+            if (pItem == NULL)
+            {
+                if (PyErr_Occurred())
+                    rExc = redrat_exception_convert();
+
+                done = true;
+                break;
+            }
+
+            rb_ary_push(st->rBuf, redrat_ruby_handoff(pItem));
+            Py_DECREF(pItem);
+        }
+
+        redrat_gil_release();
+
+        /* Items that came before an error are still yielded */
+        for (i = 0; i < RARRAY_LEN(st->rBuf); i += 1)
+            rb_yield(RARRAY_AREF(st->rBuf, i));
+
+        rb_ary_clear(st->rBuf);
+
+        if (rExc != Qnil)
+            redrat_rb_exc_raise(rExc,
+                                "redrat_ext: Python iterator raised an error");
+    }
+
+    return Qnil;
+}
+
+static VALUE
+redrat_stream_end(VALUE data)
+{
+    redrat_stream *st = (void *) data;
+
+    redrat_py_decref_wrap(st->pIter);
+
+    return Qnil;
+}
+
+/*
+ * redrat_pythonvalue_each - Yield every item of a Python iterable
+ *
+ * Takes a batch: keyword, the number of items pulled per GIL acquisition,
+ * which defaults to REDRAT_ITER_BATCH.  Larger batches amortize the GIL
+ * better, at the cost of reading further ahead, which matters for iterators
+ * with side effects such as database cursors.
+ *
+ * Without a block, returns an Enumerator, which also gives Enumerator::Lazy
+ * through lazy.
+ */
+static VALUE
+redrat_pythonvalue_each(int argc, VALUE *argv, VALUE self)
+{
+    redrat_stream  st;
+    PyObject      *pObj;
+
+    VALUE rOpts = Qnil;
+    VALUE rBatch = Qundef;
+    VALUE rExcIter;
+
+#ifdef RETURN_ENUMERATOR_KW
+    RETURN_ENUMERATOR_KW(self, argc, argv, RB_PASS_CALLED_KEYWORDS);
+#else
+    RETURN_ENUMERATOR(self, argc, argv);
+#endif
+
+    rb_scan_args(argc, argv, "0:", &rOpts);
+
+    if (rOpts != Qnil)
+        rb_get_kwargs(rOpts, &redrat_id_batch, 0, 1, &rBatch);
+
+    st.batch = (rBatch == Qundef) ? REDRAT_ITER_BATCH : NUM2LONG(rBatch);
+
+    if (st.batch < 1)
+        rb_raise(rb_eArgError, "redrat_ext: batch must be at least 1");
+
+    st.rBuf = rb_ary_new_capa(st.batch);
+
+    pObj = redrat_pythonvalue_get(self);
+
+    redrat_gil_ensure();
+
+    st.pIter = PyObject_GetIter(pObj);
+
+    if (st.pIter == NULL)
+    {
+        rExcIter = redrat_exception_convert();
+        redrat_gil_release();
+
+        redrat_rb_exc_raise(rExcIter,
+                            "redrat_ext: could not iterate over Python "
+                            "object");
+    }
+
+    redrat_gil_release();
+
+    rb_ensure(redrat_stream_body, (VALUE) &st, redrat_stream_end, (VALUE) &st);
+    RB_GC_GUARD(st.rBuf);
+
+    return self;
+}
+
+static VALUE
+redrat_truth(VALUE self, VALUE rVal)
+{
+    PyObject *pVal;
+    VALUE     rTruth;
+
+    if (!REDRAT_PYTHONVALUE_P(rVal))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: truth can only accept a PythonValue");
+
+    REDRAT_STAT_ADD(REDRAT_STAT_TRUTH_CALLS, 1);
+
+    Assert(REDRAT_PYTHONVALUE_P(rVal));
+    pVal = redrat_pythonvalue_get(rVal);
+
+    redrat_gil_ensure();
+
+    switch (PyObject_Not(pVal))
+    {
+        case -1:
+            goto py_rb_error;
+        case 0:
+            rTruth = Qtrue;
+            break;
+        case 1:
+            rTruth = Qfalse;
+            break;
+        default:
+            Assert(false);
+            rb_fatal("redrat_ext: received totally unexpected return code in "
+                     "redrat_truth");
+            rTruth = Qnil;
+    }
+
+    redrat_gil_release();
+
+    return rTruth;
+
+py_rb_error:
+    {
+        VALUE     rExc;
+
+        /*
+         * Assumption: getting here means that a Python Exception will be
+         * found.  That may be a false one, though, and in general this
+         * function will screw up the GIL state when that happens.
+         */
+        rExc = redrat_exception_convert();
+        PyErr_Clear();
+
+        redrat_gil_release();
+
+        redrat_rb_exc_raise(
+            rExc, "redrat_ext: could not compute truth value for PythonValue");
+        Assert(false);
+    }
+}
+
+static VALUE
+redrat_unicode(VALUE self, VALUE rVal)
+{
+    REDRAT_STAT_ADD(REDRAT_STAT_UNICODE_CALLS, 1);
+
+    if (TYPE(rVal) == T_STRING)
+    {
+        PyObject *pUnicode;
+        VALUE     rExcPythonUnicode = Qnil;
+        VALUE     rRetVal;
+
+        redrat_gil_ensure();
+
+        pUnicode = redrat_ruby_string_to_python(rVal);
+        REDRAT_ERRJMP_PYEXC(rExcPythonUnicode, pUnicode);
+
+        rRetVal = redrat_ruby_handoff(pUnicode);
+        Py_DECREF(pUnicode);
+
+        redrat_gil_release();
+
+        return rRetVal;
+
+    py_rb_error:
+        /*
+         * This is the only error path, so this should never be non-NULL, yet
+         * do the normal XDECREF handling for idiom's sake.
+         */
+        Assert(pUnicode == NULL);
+        Py_XDECREF(pUnicode);
+
+        redrat_gil_release();
+
+        /*
+         * There is only one error path, so this must be the exception
+         * condition raised, but follow the usual error handling protocol
+         * anyway, which involves checking the exception for Nillity.
+         */
+        Assert(rExcPythonUnicode != Qnil);
+        if (rExcPythonUnicode != Qnil)
+            redrat_rb_exc_raise(
+                rExcPythonUnicode,
+                "redrat_exc: could not construct PythonValue from "
+                "Ruby String");
+
+        Assert(false);
+    }
+    else
+        rb_raise(rb_eArgError,
+                 "redrat_ext: Only Ruby Strings are accepted when "
+                 "constructing Python Unicode");
+}
+
+/*
+ * redrat_bytes_view - Lend a Ruby String's bytes to Python without copying
+ *
+ * Returns a PythonValue of a read-only memoryview.  Python sees a frozen copy
+ * of the String, which for all but the shortest Strings shares its memory
+ * with the original, so later changes to the original are not visible: Ruby
+ * gives the original its own memory before writing to it.
+ *
+ * Binary contents, including NULs, are seen exactly as they are.
+ */
+static VALUE
+redrat_bytes_view(VALUE self, VALUE rStr)
+{
+    redrat_RubyObject *pBuf;
+    PyObject          *pView = NULL;
+
+    VALUE rExcView = Qnil;
+    VALUE rFrozen;
+    VALUE rView;
+
+    StringValue(rStr);
+    rFrozen = rb_str_new_frozen(rStr);
+
+    redrat_gil_ensure();
+
+    pBuf = (void *) redrat_RubyBufferType.tp_alloc(&redrat_RubyBufferType, 0);
+    REDRAT_ERRJMP_PYEXC(rExcView, pBuf);
+
+    pBuf->r = rFrozen;
+    pBuf->root = redrat_root_add(rFrozen);
+
+    pView = PyMemoryView_FromObject((PyObject *) pBuf);
+    Py_DECREF(pBuf);
+    REDRAT_ERRJMP_PYEXC(rExcView, pView);
+
+    rView = redrat_ruby_handoff(pView);
+    Py_DECREF(pView);
+
+    redrat_gil_release();
+
+    return rView;
+
+py_rb_error:
+    redrat_gil_release();
+
+    if (rExcView != Qnil)
+        redrat_rb_exc_raise(rExcView,
+                            "redrat_ext: could not view Ruby String as a "
+                            "Python buffer");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_string_view - Read a Python buffer as a Ruby String without copying
+ *
+ * Accepts anything supporting either Python buffer protocol, such as strs,
+ * bytearrays, memoryviews and mmaps, so long as it is contiguous.  Returns a
+ * frozen binary String pointing at Python's memory, which keeps the Python
+ * object (or a memoryview of it) alive for as long as the String, or anything
+ * sharing its memory, is alive.
+ *
+ * The String is only read-only from Ruby: if Python writes to a mutable
+ * buffer, the change shows through.
+ */
+static VALUE
+redrat_string_view(VALUE self, VALUE rVal)
+{
+    PyObject   *pObj;
+    PyObject   *pOwner = NULL;
+    const void *ptr;
+    Py_ssize_t  len;
+
+    VALUE rExcView = Qnil;
+    VALUE rOwner;
+    VALUE rStr;
+
+    if (!REDRAT_PYTHONVALUE_P(rVal))
+        rb_raise(rb_eArgError,
+                 "redrat_ext: string_view only accepts PythonValues");
+
+    pObj = redrat_pythonvalue_get(rVal);
+
+    redrat_gil_ensure();
+
+    if (PyObject_CheckBuffer(pObj))
+    {
+        Py_buffer *view;
+
+        /* The memoryview holds the buffer, and releases it when freed */
+        pOwner = PyMemoryView_FromObject(pObj);
+        REDRAT_ERRJMP_PYEXC(rExcView, pOwner);
+
+        view = PyMemoryView_GET_BUFFER(pOwner);
+
+        if (!PyBuffer_IsContiguous(view, 'C'))
+        {
+            PyErr_SetString(PyExc_BufferError,
+                            "string_view needs a contiguous buffer");
+            rExcView = redrat_exception_convert();
+            goto py_rb_error;
+        }
+
+        ptr = view->buf;
+        len = view->len;
+    }
+    else
+    {
+        if (PyObject_AsReadBuffer(pObj, &ptr, &len) < 0)
+        {
+            rExcView = redrat_exception_convert();
+            goto py_rb_error;
+        }
+
+        pOwner = pObj;
+        Py_INCREF(pOwner);
+    }
+
+    rOwner = redrat_ruby_handoff_kept(pOwner);
+    Py_DECREF(pOwner);
+
+    redrat_gil_release();
+
+#ifdef HAVE_RB_STR_NEW_STATIC
+    rStr = rb_str_new_static(ptr, len);
+    rb_ivar_set(rStr, redrat_id_buffer_owner, rOwner);
+#else
+    rStr = rb_str_new(ptr, len);
+    RB_GC_GUARD(rOwner);
+#endif
+
+    return rb_obj_freeze(rStr);
+
+py_rb_error:
+    Py_XDECREF(pOwner);
+
+    redrat_gil_release();
+
+    if (rExcView != Qnil)
+        redrat_rb_exc_raise(rExcView,
+                            "redrat_ext: could not view Python buffer as a "
+                            "Ruby String");
+
+    Assert(false);
+    return Qnil;
+}
+
+#define redrat_stringify_generate(lowcase, upcase, stringify)                 \
+    static VALUE                                                              \
+    redrat_##lowcase(VALUE self, VALUE rPythonValue)                          \
+    {                                                                         \
+        PyObject         *pThing;                                             \
+        PyObject         *pString = NULL;                                     \
+        VALUE             r;                                                  \
+        VALUE             rExcCant = Qnil;                                    \
+                                                                              \
+        REDRAT_STAT_ADD(REDRAT_STAT_##upcase##_CALLS, 1);                     \
+                                                                              \
+        pThing = redrat_pythonvalue_get(rPythonValue);                        \
+                                                                              \
+        redrat_gil_ensure();                                                  \
+                                                                              \
+        pString = stringify(pThing);                                          \
+        REDRAT_ERRJMP_PYEXC(rExcCant, pString);                               \
+                                                                              \
+        r = redrat_python_string_to_ruby(pString);                            \
+        if (r == Qundef)                                                      \
+        {                                                                     \
+            rExcCant = redrat_exception_convert();                            \
+            goto py_rb_error;                                                 \
+        }                                                                     \
+                                                                              \
+        Py_DECREF(pString);                                                   \
+                                                                              \
+        redrat_gil_release();                                                 \
+                                                                              \
+        return r;                                                             \
+                                                                              \
+    py_rb_error:                                                              \
+        Py_XDECREF(pString);                                                  \
+                                                                              \
+        redrat_gil_release();                                                 \
+                                                                              \
+        if (rExcCant != Qnil)                                                 \
+            redrat_rb_exc_raise(                                              \
+                rExcCant,                                                     \
+                "redrat_ext: could not compute representation of "            \
+                "Python object");                                             \
+    }
+
+redrat_stringify_generate(repr, REPR, PyObject_Repr)
+redrat_stringify_generate(str, STR, redrat_python_str)
+
+static VALUE
+redrat_gil_session_end(VALUE unused)
+{
+    if (redrat_gil_depth == 1)
+        redrat_gil_detached -= 1;
+
+    redrat_gil_release();
+
+    return Qnil;
+}
+
+/*
+ * redrat_with_gil - Hold the Python GIL for the duration of a block
+ *
+ * Every RedRat::Internal call made from inside of the block, on this thread,
+ * reuses the GIL taken here instead of taking it anew.  Sessions nest.
+ *
+ * The GIL is not given up while the block runs Ruby code, so Python threads
+ * make no progress until it returns: keep these blocks to tight loops.
+ */
+static VALUE
+redrat_with_gil(VALUE self)
+{
+    rb_need_block();
+
+    redrat_gil_ensure();
+
+    /* This thread may now hold the GIL while letting go of the GVL */
+    if (redrat_gil_depth == 1)
+        redrat_gil_detached += 1;
+
+    return rb_ensure(rb_yield, Qnil, redrat_gil_session_end, Qnil);
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+/*
+ * redrat_interp_run_job - Run a job in the interpreter of this thread
+ *
+ * This procedure presumes that the GIL is held, with the interpreter's own
+ * thread state.
+ */
+static void
+redrat_interp_run_job(redrat_interp *in, redrat_interp_job *job)
+{
+    if (job->start >= 0)
+        job->pResult = PyRun_String(job->source, job->start, in->pGlobals,
+                                    in->pGlobals);
+    else
+    {
+        PyObject *pCallable = PyDict_GetItemString(in->pGlobals, job->source);
+
+        if (pCallable == NULL)
+            PyErr_Format(PyExc_NameError, "name '%.200s' is not defined",
+                         job->source);
+        else
+            job->pResult = PyObject_Call(pCallable, job->pArgs, NULL);
+    }
+
+    if (job->pResult == NULL)
+        PyErr_Fetch(&job->pType, &job->pValue, &job->pTraceback);
+}
+
+/*
+ * redrat_interp_main - The thread of a PythonInterpreter
+ *
+ * Creates the sub-interpreter, runs jobs until asked to stop, then ends the
+ * sub-interpreter.  Never touches Ruby.
+ */
+static void *
+redrat_interp_main(void *data)
+{
+    redrat_interp *in = data;
+    bool           orphaned;
+
+    PyEval_AcquireLock();
+
+    in->tstate = Py_NewInterpreter();
+
+    if (in->tstate != NULL)
+    {
+        initredrat();
+
+        in->pGlobals = PyModule_GetDict(PyImport_AddModule("__main__"));
+        Py_INCREF(in->pGlobals);
+        in->guest = PyThreadState_New(in->tstate->interp);
+
+        PyEval_ReleaseThread(in->tstate);
+    }
+    else
+        PyEval_ReleaseLock();
+
+    pthread_mutex_lock(&in->lock);
+    in->ready = true;
+    pthread_cond_broadcast(&in->cond);
+
+    while (in->tstate != NULL)
+    {
+        redrat_interp_job *job;
+
+        while (in->head == NULL && !in->stopping)
+            pthread_cond_wait(&in->cond, &in->lock);
+
+        if (in->head == NULL)
+            break;
+
+        job = in->head;
+        in->head = job->next;
+
+        if (in->head == NULL)
+            in->tail = NULL;
+
+        pthread_mutex_unlock(&in->lock);
+
+        PyEval_RestoreThread(in->tstate);
+        redrat_interp_run_job(in, job);
+        PyEval_SaveThread();
+
+        pthread_mutex_lock(&in->lock);
+        job->done = true;
+        in->pending -= 1;
+        pthread_cond_broadcast(&in->cond);
+    }
+
+    pthread_mutex_unlock(&in->lock);
+
+    if (in->tstate != NULL)
+    {
+        PyEval_RestoreThread(in->tstate);
+
+        Py_CLEAR(in->pGlobals);
+        PyThreadState_Clear(in->guest);
+        PyThreadState_Delete(in->guest);
+
+        /* Leaves the GIL held, with no current thread state */
+        Py_EndInterpreter(in->tstate);
+        PyEval_ReleaseLock();
+    }
+
+    pthread_mutex_lock(&in->lock);
+    orphaned = in->orphaned;
+    pthread_mutex_unlock(&in->lock);
+
+    if (orphaned)
+    {
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->cond);
+        free(in);
+    }
+
+    return NULL;
+}
+
+/*
+ * redrat_interp_stop - Ask the thread of a PythonInterpreter to finish up
+ *
+ * Jobs already queued still run.  With orphan, the thread is left to free the
+ * interpreter by itself.
+ */
+static void
+redrat_interp_stop(redrat_interp *in, bool orphan)
+{
+    pthread_mutex_lock(&in->lock);
+    in->stopping = true;
+    in->orphaned = orphan;
+    pthread_cond_broadcast(&in->cond);
+    pthread_mutex_unlock(&in->lock);
+}
+
+static void *
+redrat_interp_join_nogvl(void *data)
+{
+    pthread_join(((redrat_interp *) data)->thread, NULL);
+
+    return NULL;
+}
+
+static void
+redrat_interp_free(void *data)
+{
+    redrat_interp *in = data;
+
+    if (in == NULL)
+        return;
+
+    if (in->joined)
+    {
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->cond);
+        free(in);
+        return;
+    }
+
+    /*
+     * Ruby GC cannot wait on the thread, which may be waiting on the GIL.  It
+     * frees the interpreter as soon as it is told to stop, so detach first.
+     */
+    redrat_gil_detached -= 1;
+    pthread_detach(in->thread);
+    redrat_interp_stop(in, true);
+}
+
+/*
+ * redrat_interp_get - The redrat_interp of a PythonInterpreter
+ *
+ * Raises if it has been closed.
+ */
+static redrat_interp *
+redrat_interp_get(VALUE rInterp)
+{
+    redrat_interp *in;
+
+    Data_Get_Struct(rInterp, redrat_interp, in);
+
+    if (in == NULL || in->stopping)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: PythonInterpreter is not running");
+
+    return in;
+}
+
+static VALUE
+redrat_interp_alloc(VALUE klass)
+{
+    return Data_Wrap_Struct(klass, NULL, redrat_interp_free, NULL);
+}
+
+static void *
+redrat_interp_ready_nogvl(void *data)
+{
+    redrat_interp *in = data;
+
+    pthread_mutex_lock(&in->lock);
+
+    while (!in->ready)
+        pthread_cond_wait(&in->cond, &in->lock);
+
+    pthread_mutex_unlock(&in->lock);
+
+    return NULL;
+}
+
+/*
+ * redrat_interp_initialize - Start a new Python sub-interpreter
+ *
+ * Waits until it is set up, which takes a few milliseconds.
+ */
+static VALUE
+redrat_interp_initialize(VALUE self)
+{
+    redrat_interp *in;
+
+    if (DATA_PTR(self) != NULL)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: PythonInterpreter is already initialized");
+
+    /* Not ALLOC, as the interpreter's own thread may be the one to free it */
+    in = calloc(1, sizeof(redrat_interp));
+
+    if (in == NULL)
+        rb_memerror();
+
+    pthread_mutex_init(&in->lock, NULL);
+    pthread_cond_init(&in->cond, NULL);
+
+    if (pthread_create(&in->thread, NULL, redrat_interp_main, in) != 0)
+    {
+        pthread_mutex_destroy(&in->lock);
+        pthread_cond_destroy(&in->cond);
+        free(in);
+
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: could not start a PythonInterpreter thread");
+    }
+
+    DATA_PTR(self) = in;
+
+    /* Its thread holds the GIL without the GVL whenever it runs a job */
+    redrat_gil_detached += 1;
+
+    rb_thread_call_without_gvl(redrat_interp_ready_nogvl, in, NULL, NULL);
+
+    if (in->tstate == NULL)
+    {
+        redrat_interp_close(self);
+
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: could not create a Python sub-interpreter");
+    }
+
+    return self;
+}
+
+typedef struct {
+    redrat_interp     *in;
+    redrat_interp_job *job;
+    bool               queued;
+} redrat_interp_wait;
+
+/*
+ * redrat_interp_submit_nogvl - Queue a job and wait for it to be done
+ *
+ * Only queues the job once called, so if Ruby does not call it at all for
+ * being interrupted, the job is known not to have run.
+ */
+static void *
+redrat_interp_submit_nogvl(void *data)
+{
+    redrat_interp_wait *w = data;
+    redrat_interp      *in = w->in;
+
+    pthread_mutex_lock(&in->lock);
+
+    if (in->tail == NULL)
+        in->head = w->job;
+    else
+        in->tail->next = w->job;
+
+    in->tail = w->job;
+    in->pending += 1;
+    w->queued = true;
+    pthread_cond_broadcast(&in->cond);
+
+    while (!w->job->done)
+        pthread_cond_wait(&in->cond, &in->lock);
+
+    pthread_mutex_unlock(&in->lock);
+
+    return NULL;
+}
+
+static VALUE
+redrat_interp_submit_blocking(VALUE data)
+{
+    rb_thread_call_without_gvl(redrat_interp_submit_nogvl, (void *) data,
+                               NULL, NULL);
+
+    return Qnil;
+}
+
+/*
+ * redrat_interp_marshal - Copy what crosses into or out of a PythonInterpreter
+ * to a string, which only works for plain data
+ */
+static PyObject *
+redrat_interp_marshal(PyObject *pCrossing)
+{
+    PyObject *pMarshalled;
+
+    pMarshalled = PyMarshal_WriteObjectToString(pCrossing, Py_MARSHAL_VERSION);
+
+    if (pMarshalled == NULL && PyErr_ExceptionMatches(PyExc_ValueError))
+    {
+        PyErr_Clear();
+        PyErr_SetString(PyExc_TypeError,
+                        "redrat: only plain data, such as numbers, strings, "
+                        "lists and dicts, crosses into or out of a "
+                        "PythonInterpreter");
+    }
+
+    return pMarshalled;
+}
+
+/*
+ * redrat_interp_unmarshal - The copy redrat_interp_marshal made, in the
+ * interpreter of the current thread state
+ *
+ * Drops the reference to pMarshalled.
+ */
+static PyObject *
+redrat_interp_unmarshal(PyObject *pMarshalled)
+{
+    PyObject *pCopy;
+
+    pCopy = PyMarshal_ReadObjectFromString(PyString_AS_STRING(pMarshalled),
+                                           PyString_GET_SIZE(pMarshalled));
+    Py_DECREF(pMarshalled);
+
+    return pCopy;
+}
+
+/*
+ * redrat_interp_run - Run a job in a PythonInterpreter and wait for it
+ *
+ * rArgs, if not Qnil, is an Array of arguments for calling the global named
+ * by source.  Returns the result converted as by to_ruby with deep: true, or
+ * raises the error as a RedRatException.  Arguments and result must be plain
+ * data, see redrat_interp_marshal.
+ *
+ * Like apply_nogvl, the wait cannot be cancelled: interrupts are delivered
+ * once the job is done.
+ */
+static VALUE
+redrat_interp_run(VALUE rInterp, VALUE rSource, int start, VALUE rArgs)
+{
+    redrat_interp      *in = redrat_interp_get(rInterp);
+    redrat_interp_job   job;
+    redrat_interp_wait  w;
+    redrat_convert      cv;
+    PyThreadState      *pPrev;
+    PyObject           *pMarshalled = NULL;
+
+    VALUE rExcInterp = Qnil;
+    VALUE rResult = Qnil;
+
+    int state = 0;
+
+    rSource = rb_str_new_frozen(StringValue(rSource));
+
+    MEMZERO(&job, redrat_interp_job, 1);
+    job.source = StringValueCStr(rSource);
+    job.start = start;
+
+    cv.deep = true;
+    cv.memo = redrat_convert_new_memo();
+
+    if (rArgs != Qnil)
+    {
+        PyObject *pArgs;
+        long      i;
+
+        redrat_gil_ensure();
+
+        pArgs = PyTuple_New(RARRAY_LEN(rArgs));
+
+        for (i = 0; pArgs != NULL && i < RARRAY_LEN(rArgs); i += 1)
+        {
+            PyObject *pArg = redrat_convert_to_python(
+                &cv, RARRAY_AREF(rArgs, i), false);
+
+            if (pArg == NULL)
+                Py_CLEAR(pArgs);
+            else
+                PyTuple_SET_ITEM(pArgs, i, pArg);
+        }
+
+        if (pArgs != NULL)
+        {
+            pMarshalled = redrat_interp_marshal(pArgs);
+            Py_DECREF(pArgs);
+        }
+
+        if (pMarshalled == NULL)
+            rExcInterp = redrat_exception_convert();
+        else
+        {
+            pPrev = PyThreadState_Swap(in->guest);
+            job.pArgs = redrat_interp_unmarshal(pMarshalled);
+            pMarshalled = NULL;
+
+            if (job.pArgs == NULL)
+                rExcInterp = redrat_exception_convert();
+
+            PyThreadState_Swap(pPrev);
+        }
+
+        redrat_gil_release();
+
+        if (rExcInterp != Qnil)
+            redrat_rb_exc_raise(rExcInterp,
+                                "redrat_ext: could not convert arguments for "
+                                "PythonInterpreter");
+    }
+
+    w.in = in;
+    w.job = &job;
+    w.queued = false;
+
+    rb_protect(redrat_interp_submit_blocking, (VALUE) &w, &state);
+
+    redrat_gil_ensure();
+    pPrev = PyThreadState_Swap(in->guest);
+
+    if (state != 0)
+    {
+        /* Interrupted, either before queueing the job or after it was done */
+        Py_XDECREF(job.pResult);
+        Py_XDECREF(job.pType);
+        Py_XDECREF(job.pValue);
+        Py_XDECREF(job.pTraceback);
+    }
+    else if (job.pResult != NULL)
+    {
+        pMarshalled = redrat_interp_marshal(job.pResult);
+        Py_DECREF(job.pResult);
+
+        if (pMarshalled == NULL)
+            rExcInterp = redrat_exception_convert();
+    }
+    else
+    {
+        /* Frames of the sub-interpreter stay behind */
+        Py_XDECREF(job.pTraceback);
+        PyErr_Restore(job.pType, job.pValue, NULL);
+        rExcInterp = redrat_exception_convert();
+    }
+
+    Py_XDECREF(job.pArgs);
+
+    PyThreadState_Swap(pPrev);
+
+    /* The result is copied back into the main interpreter before converting */
+    if (pMarshalled != NULL)
+    {
+        PyObject *pResult = redrat_interp_unmarshal(pMarshalled);
+
+        if (pResult != NULL)
+        {
+            cv.memo = rb_hash_new();
+            rResult = redrat_convert_to_ruby(&cv, pResult);
+            Py_DECREF(pResult);
+        }
+
+        if (pResult == NULL || rResult == Qundef)
+        {
+            rResult = Qnil;
+            rExcInterp = redrat_exception_convert();
+        }
+    }
+
+    redrat_gil_release();
+    RB_GC_GUARD(rSource);
+    RB_GC_GUARD(cv.memo);
+
+    if (state != 0)
+        rb_jump_tag(state);
+    else if (rExcInterp != Qnil)
+        redrat_rb_exc_raise(rExcInterp,
+                            "redrat_ext: PythonInterpreter raised an error");
+
+    return rResult;
+}
+
+/*
+ * redrat_interp_eval - Evaluate a Python expression in the interpreter
+ *
+ * Runs in the namespace of its __main__ module.
+ */
+static VALUE
+redrat_interp_eval(VALUE self, VALUE rSource)
+{
+    return redrat_interp_run(self, rSource, Py_eval_input, Qnil);
+}
+
+/*
+ * redrat_interp_exec - Run Python statements in the interpreter
+ *
+ * Runs in the namespace of its __main__ module, so that what it defines is
+ * there for later eval, exec and call.  Returns nil.
+ */
+static VALUE
+redrat_interp_exec(VALUE self, VALUE rSource)
+{
+    redrat_interp_run(self, rSource, Py_file_input, Qnil);
+
+    return Qnil;
+}
+
+/*
+ * redrat_interp_call - Call a global of the interpreter's __main__ module
+ *
+ * Takes the name, then the arguments, which are converted as by to_python
+ * with deep: true and must come out as plain data.
+ */
+static VALUE
+redrat_interp_call(int argc, VALUE *argv, VALUE self)
+{
+    rb_check_arity(argc, 1, UNLIMITED_ARGUMENTS);
+
+    return redrat_interp_run(self, argv[0], -1,
+                             rb_ary_new_from_values(argc - 1, argv + 1));
+}
+
+/*
+ * redrat_interp_pending - How many jobs are queued or running
+ */
+static VALUE
+redrat_interp_pending(VALUE self)
+{
+    redrat_interp *in;
+
+    Data_Get_Struct(self, redrat_interp, in);
+
+    if (in == NULL)
+        return INT2FIX(0);
+
+    return LONG2NUM(__atomic_load_n(&in->pending, __ATOMIC_RELAXED));
+}
+
+/*
+ * redrat_interp_close - End the sub-interpreter and its thread
+ *
+ * Queued jobs are run first.  Closing twice does nothing.
+ */
+static VALUE
+redrat_interp_close(VALUE self)
+{
+    redrat_interp *in;
+
+    Data_Get_Struct(self, redrat_interp, in);
+
+    if (in == NULL || in->joined)
+        return Qnil;
+
+    redrat_interp_stop(in, false);
+    rb_thread_call_without_gvl(redrat_interp_join_nogvl, in, NULL, NULL);
+
+    in->joined = true;
+    redrat_gil_detached -= 1;
+
+    return Qnil;
+}
+
+static void
+redrat_pool_mark(void *data)
+{
+    rb_gc_mark(((redrat_pool *) data)->interps);
+}
+
+static VALUE
+redrat_pool_alloc(VALUE klass)
+{
+    redrat_pool *pool;
+    VALUE        rPool;
+
+    rPool = Data_Make_Struct(klass, redrat_pool, redrat_pool_mark, xfree,
+                             pool);
+    pool->interps = rb_ary_new();
+    pool->next = 0;
+
+    return rPool;
+}
+
+/*
+ * redrat_pool_initialize - Start size PythonInterpreters
+ *
+ * The size defaults to the number of online processors.
+ */
+static VALUE
+redrat_pool_initialize(int argc, VALUE *argv, VALUE self)
+{
+    redrat_pool *pool;
+    VALUE        rSize;
+    long         size;
+    long         i;
+
+    rb_scan_args(argc, argv, "01", &rSize);
+
+    size = NIL_P(rSize) ? sysconf(_SC_NPROCESSORS_ONLN) : NUM2LONG(rSize);
+
+    if (size < 1)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: a PythonInterpreterPool needs at least one "
+                 "interpreter");
+
+    Data_Get_Struct(self, redrat_pool, pool);
+
+    for (i = 0; i < size; i += 1)
+        rb_ary_push(pool->interps, rb_class_new_instance(
+                        0, NULL, rb_cPythonInterpreter));
+
+    rb_obj_freeze(pool->interps);
+
+    return self;
+}
+
+static VALUE
+redrat_pool_interpreters(VALUE self)
+{
+    redrat_pool *pool;
+
+    Data_Get_Struct(self, redrat_pool, pool);
+
+    return pool->interps;
+}
+
+/*
+ * redrat_pool_pick - The PythonInterpreter with the fewest pending jobs
+ *
+ * Ties go round-robin.
+ */
+static VALUE
+redrat_pool_pick(VALUE self)
+{
+    redrat_pool *pool;
+    long         size;
+    long         best = -1;
+    long         bestPending = 0;
+    long         i;
+
+    Data_Get_Struct(self, redrat_pool, pool);
+
+    size = RARRAY_LEN(pool->interps);
+
+    if (size == 0)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: PythonInterpreterPool is not running");
+
+    for (i = 0; i < size; i += 1)
+    {
+        long           n = (pool->next + i) % size;
+        redrat_interp *in;
+        long           pending;
+
+        Data_Get_Struct(RARRAY_AREF(pool->interps, n), redrat_interp, in);
+        pending = __atomic_load_n(&in->pending, __ATOMIC_RELAXED);
+
+        if (best < 0 || pending < bestPending)
+        {
+            best = n;
+            bestPending = pending;
+        }
+
+        if (pending == 0)
+            break;
+    }
+
+    pool->next = (best + 1) % size;
+
+    return RARRAY_AREF(pool->interps, best);
+}
+
+static VALUE
+redrat_pool_eval(VALUE self, VALUE rSource)
+{
+    return redrat_interp_eval(redrat_pool_pick(self), rSource);
+}
+
+static VALUE
+redrat_pool_exec(VALUE self, VALUE rSource)
+{
+    return redrat_interp_exec(redrat_pool_pick(self), rSource);
+}
+
+/*
+ * redrat_pool_exec_all - exec in every interpreter of the pool
+ *
+ * For setting up what later jobs need, such as imports and functions.
+ */
+static VALUE
+redrat_pool_exec_all(VALUE self, VALUE rSource)
+{
+    VALUE rInterps = redrat_pool_interpreters(self);
+    long  i;
+
+    for (i = 0; i < RARRAY_LEN(rInterps); i += 1)
+        redrat_interp_exec(RARRAY_AREF(rInterps, i), rSource);
+
+    return Qnil;
+}
+
+static VALUE
+redrat_pool_call(int argc, VALUE *argv, VALUE self)
+{
+    return redrat_interp_call(argc, argv, redrat_pool_pick(self));
+}
+
+static VALUE
+redrat_pool_close(VALUE self)
+{
+    VALUE rInterps = redrat_pool_interpreters(self);
+    long  i;
+
+    for (i = 0; i < RARRAY_LEN(rInterps); i += 1)
+        redrat_interp_close(RARRAY_AREF(rInterps, i));
+
+    return Qnil;
+}
+#endif /* HAVE_RB_THREAD_CALL_WITHOUT_GVL */
+
+#ifdef HAVE_LINUX_FUTEX_H
+/*
+ * redrat_futex_wait - Sleep until *word moves on from seen, or for timeoutMs
+ *
+ * Wakes up spuriously now and then, so callers check what they wait for in a
+ * loop.  The word is in memory shared between processes.
+ */
+static void
+redrat_futex_wait(uint32_t *word, uint32_t seen, long timeoutMs)
+{
+    struct timespec ts;
+
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+/*
+ * redrat_futex_bump - Move *word on, and wake whoever sleeps on it
+ */
+static void
+redrat_futex_bump(uint32_t *word)
+{
+    __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * redrat_ring_copy - Copy into or out of a ring, wrapping around its end
+ */
+static void
+redrat_ring_copy(redrat_ring *ring, uint64_t pos, char *buf, uint64_t len,
+                 bool into)
+{
+    uint64_t offset = pos % REDRAT_RING_SIZE;
+    uint64_t first = REDRAT_RING_SIZE - offset;
+
+    if (first > len)
+        first = len;
+
+    if (into)
+    {
+        memcpy(ring->data + offset, buf, first);
+        memcpy(ring->data, buf + first, len - first);
+    }
+    else
+    {
+        memcpy(buf, ring->data + offset, first);
+        memcpy(buf + first, ring->data, len - first);
+    }
+}
+
+/*
+ * redrat_ring_put - Write a record of len bytes, if there is room for it
+ *
+ * Only one thread of one process may write to a ring at a time.
+ */
+static bool
+redrat_ring_put(redrat_ring *ring, const char *buf, uint64_t len)
+{
+    uint64_t head = ring->head;
+    uint64_t used = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (REDRAT_RING_SIZE - used < sizeof(len) + len)
+        return false;
+
+    redrat_ring_copy(ring, head, (char *) &len, sizeof(len), true);
+    redrat_ring_copy(ring, head + sizeof(len), (char *) buf, len, true);
+    __atomic_store_n(&ring->head, head + sizeof(len) + len, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/*
+ * redrat_ring_take - Read a record into a buffer from malloc, if there is one
+ *
+ * If malloc fails, the record is skipped and *buf set to NULL.  Only one
+ * thread of one process may read from a ring at a time.
+ */
+static bool
+redrat_ring_take(redrat_ring *ring, uint64_t *len, char **buf)
+{
+    uint64_t tail = ring->tail;
+
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+        return false;
+
+    redrat_ring_copy(ring, tail, (char *) len, sizeof(*len), false);
+    *buf = malloc(*len + 1);
+
+    if (*buf != NULL)
+        redrat_ring_copy(ring, tail + sizeof(*len), *buf, *len, false);
+
+    __atomic_store_n(&ring->tail, tail + sizeof(*len) + *len,
+                     __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/*
+ * redrat_worker_resolve - Find what a worker request names
+ *
+ * Either "module.attribute", or a global of __main__, as defined with
+ * exec_all.
+ */
+static PyObject *
+redrat_worker_resolve(PyObject *pGlobals, PyObject *pName)
+{
+    const char *name = PyString_AsString(pName);
+    const char *dot;
+    PyObject   *pModuleName;
+    PyObject   *pModule;
+    PyObject   *pFound;
+
+    if (name == NULL)
+        return NULL;
+
+    dot = strrchr(name, '.');
+
+    if (dot == NULL)
+    {
+        pFound = PyDict_GetItem(pGlobals, pName);
+
+        if (pFound == NULL)
+            PyErr_Format(PyExc_NameError, "name '%.200s' is not defined",
+                         name);
+        else
+            Py_INCREF(pFound);
+
+        return pFound;
+    }
+
+    pModuleName = PyString_FromStringAndSize(name, dot - name);
+
+    if (pModuleName == NULL)
+        return NULL;
+
+    pModule = PyImport_Import(pModuleName);
+    Py_DECREF(pModuleName);
+
+    if (pModule == NULL)
+        return NULL;
+
+    pFound = PyObject_GetAttrString(pModule, dot + 1);
+    Py_DECREF(pModule);
+
+    return pFound;
+}
+
+/*
+ * redrat_worker_serve - Serve one marshalled request
+ *
+ * Requests are (name, args) to call, or (None, source) to exec source in
+ * __main__.  Returns the marshalled response, (True, result) or (False, type
+ * name, message), or NULL if out of memory.
+ */
+static PyObject *
+redrat_worker_serve(PyObject *pGlobals, char *buf, uint64_t len)
+{
+    PyObject *pRequest;
+    PyObject *pResult = NULL;
+    PyObject *pResponse = NULL;
+
+    pRequest = PyMarshal_ReadObjectFromString(buf, (Py_ssize_t) len);
+
+    if (pRequest != NULL && PyTuple_CheckExact(pRequest) &&
+        PyTuple_GET_SIZE(pRequest) == 2)
+    {
+        PyObject *pName = PyTuple_GET_ITEM(pRequest, 0);
+        PyObject *pPayload = PyTuple_GET_ITEM(pRequest, 1);
+
+        if (pName == Py_None && PyString_CheckExact(pPayload))
+            pResult = PyRun_String(PyString_AS_STRING(pPayload),
+                                   Py_file_input, pGlobals, pGlobals);
+        else if (PyTuple_CheckExact(pPayload))
+        {
+            PyObject *pCallable = redrat_worker_resolve(pGlobals, pName);
+
+            if (pCallable != NULL)
+            {
+                pResult = PyObject_Call(pCallable, pPayload, NULL);
+                Py_DECREF(pCallable);
+            }
+        }
+        else
+            PyErr_SetString(PyExc_TypeError, "malformed worker request");
+    }
+    else if (pRequest != NULL)
+        PyErr_SetString(PyExc_TypeError, "malformed worker request");
+
+    Py_XDECREF(pRequest);
+
+    if (pResult != NULL)
+    {
+        PyObject *pOk = Py_BuildValue("(ON)", Py_True, pResult);
+
+        if (pOk != NULL)
+        {
+            pResponse = PyMarshal_WriteObjectToString(pOk,
+                                                      Py_MARSHAL_VERSION);
+            Py_DECREF(pOk);
+        }
+
+        if (pResponse != NULL &&
+            PyString_GET_SIZE(pResponse) + sizeof(uint64_t) >
+            REDRAT_RING_SIZE)
+        {
+            Py_CLEAR(pResponse);
+            PyErr_SetString(PyExc_ValueError,
+                            "result too large for the worker ring");
+        }
+    }
+
+    if (pResponse == NULL)
+    {
+        PyObject *pType;
+        PyObject *pValue;
+        PyObject *pTraceback;
+        PyObject *pMessage = NULL;
+        PyObject *pFailed;
+
+        PyErr_Fetch(&pType, &pValue, &pTraceback);
+        PyErr_NormalizeException(&pType, &pValue, &pTraceback);
+
+        if (pValue != NULL)
+            pMessage = PyObject_Str(pValue);
+
+        if (pMessage == NULL)
+        {
+            PyErr_Clear();
+            pMessage = PyString_FromString("");
+        }
+
+        pFailed = Py_BuildValue("(OsN)", Py_False,
+                                (pType == NULL) ?
+                                "SystemError" : PyExceptionClass_Name(pType),
+                                pMessage);
+
+        if (pFailed != NULL)
+        {
+            pResponse = PyMarshal_WriteObjectToString(pFailed,
+                                                      Py_MARSHAL_VERSION);
+            Py_DECREF(pFailed);
+        }
+
+        Py_XDECREF(pType);
+        Py_XDECREF(pValue);
+        Py_XDECREF(pTraceback);
+    }
+
+    PyErr_Clear();
+
+    return pResponse;
+}
+
+/*
+ * redrat_worker_main - The loop of a forked worker process
+ *
+ * Never returns, and never touches Ruby: the process exits once its parent
+ * is gone.  The GIL stays held, save for while waiting on requests.
+ */
+static void
+redrat_worker_main(redrat_worker_shm *shm, pid_t parent)
+{
+    PyObject *pGlobals = PyModule_GetDict(PyImport_AddModule("__main__"));
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    if (getppid() != parent)
+        _exit(0);
+
+    for (;;)
+    {
+        uint32_t  seen = __atomic_load_n(&shm->toWorker, __ATOMIC_SEQ_CST);
+        uint64_t  len;
+        char     *buf;
+        PyObject *pResponse;
+
+        if (!redrat_ring_take(&shm->requests, &len, &buf))
+        {
+            Py_BEGIN_ALLOW_THREADS
+            redrat_futex_wait(&shm->toWorker, seen, 1000);
+            Py_END_ALLOW_THREADS
+
+            if (getppid() != parent)
+                _exit(0);
+
+            continue;
+        }
+
+        /* Room for more requests */
+        redrat_futex_bump(&shm->toParent);
+
+        pResponse = (buf == NULL) ?
+            NULL : redrat_worker_serve(pGlobals, buf, len);
+        free(buf);
+
+        if (pResponse == NULL)
+            Py_FatalError("redrat_ext: out of memory in a Python worker");
+
+        for (;;)
+        {
+            seen = __atomic_load_n(&shm->toWorker, __ATOMIC_SEQ_CST);
+
+            if (redrat_ring_put(&shm->responses,
+                                PyString_AS_STRING(pResponse),
+                                PyString_GET_SIZE(pResponse)))
+                break;
+
+            Py_BEGIN_ALLOW_THREADS
+            redrat_futex_wait(&shm->toWorker, seen, 1000);
+            Py_END_ALLOW_THREADS
+
+            if (getppid() != parent)
+                _exit(0);
+        }
+
+        Py_DECREF(pResponse);
+        redrat_futex_bump(&shm->toParent);
+    }
+}
+
+/*
+ * redrat_worker_start - Fork a worker process
+ *
+ * The GIL is held across fork, so that the child gets Python in a consistent
+ * state, and it carries on as the only thread there is.
+ */
+static void
+redrat_worker_start(redrat_worker *w)
+{
+    redrat_worker_shm *shm;
+    pid_t              parent = getpid();
+    pid_t              pid;
+
+    shm = mmap(NULL, sizeof(redrat_worker_shm), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    if (shm == MAP_FAILED)
+        rb_sys_fail("redrat_ext: could not map memory for a Python worker");
+
+    redrat_gil_ensure();
+    pid = fork();
+
+    if (pid == 0)
+    {
+        sigset_t all;
+
+        /* Ruby's handlers would run Ruby; interrupts are for the parent */
+        sigemptyset(&all);
+        sigprocmask(SIG_SETMASK, &all, NULL);
+        signal(SIGINT, SIG_IGN);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+
+        PyOS_AfterFork();
+        redrat_worker_main(shm, parent);
+        _exit(0);
+    }
+
+    redrat_gil_release();
+
+    if (pid < 0)
+    {
+        munmap(shm, sizeof(redrat_worker_shm));
+        rb_sys_fail("redrat_ext: could not fork a Python worker");
+    }
+
+    w->pid = pid;
+    w->shm = shm;
+    w->written = 0;
+    w->served = 0;
+    w->pending = 0;
+    w->dead = false;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+}
+
+/*
+ * redrat_worker_alive - Whether a worker process is still there
+ *
+ * Reaps it if not.  This procedure presumes that w->lock is held.
+ */
+static bool
+redrat_worker_alive(redrat_worker *w)
+{
+    pid_t reaped;
+
+    if (w->dead)
+        return false;
+
+    reaped = waitpid(w->pid, NULL, WNOHANG);
+
+    if (reaped == w->pid || (reaped < 0 && errno == ECHILD))
+        w->dead = true;
+
+    return !w->dead;
+}
+
+/*
+ * redrat_worker_stop - Kill and reap a worker process
+ */
+static void
+redrat_worker_stop(redrat_worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+
+    if (!w->dead)
+    {
+        kill(w->pid, SIGKILL);
+        waitpid(w->pid, NULL, 0);
+        w->dead = true;
+    }
+
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+typedef struct {
+    redrat_worker *w;
+    const char    *request;
+    uint64_t       requestLen;
+    char          *response;        /* From malloc, or NULL */
+    uint64_t       responseLen;
+    bool           called;
+} redrat_worker_call;
+
+/*
+ * redrat_worker_call_nogvl - Write a request, and wait for its response
+ *
+ * Responses come back in the order requests were written, so each caller
+ * waits for its turn to take one.  Gives up if the worker dies, leaving
+ * response NULL.
+ */
+static void *
+redrat_worker_call_nogvl(void *data)
+{
+    redrat_worker_call *c = data;
+    redrat_worker      *w = c->w;
+    redrat_worker_shm  *shm = w->shm;
+    uint64_t            ticket;
+
+    c->called = true;
+
+    pthread_mutex_lock(&w->lock);
+
+    for (;;)
+    {
+        uint32_t seen = __atomic_load_n(&shm->toParent, __ATOMIC_SEQ_CST);
+
+        if (!redrat_worker_alive(w))
+            goto done;
+
+        if (redrat_ring_put(&shm->requests, c->request, c->requestLen))
+            break;
+
+        pthread_mutex_unlock(&w->lock);
+        redrat_futex_wait(&shm->toParent, seen, 100);
+        pthread_mutex_lock(&w->lock);
+    }
+
+    ticket = w->written;
+    w->written += 1;
+    w->pending += 1;
+    redrat_futex_bump(&shm->toWorker);
+
+    for (;;)
+    {
+        uint32_t seen;
+
+        if (w->dead)
+            goto done;
+
+        if (w->served != ticket)
+        {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        seen = __atomic_load_n(&shm->toParent, __ATOMIC_SEQ_CST);
+
+        if (redrat_ring_take(&shm->responses, &c->responseLen, &c->response))
+            break;
+
+        pthread_mutex_unlock(&w->lock);
+        redrat_futex_wait(&shm->toParent, seen, 100);
+        pthread_mutex_lock(&w->lock);
+
+        redrat_worker_alive(w);
+    }
+
+    w->served += 1;
+    w->pending -= 1;
+
+    /* Room for more responses */
+    redrat_futex_bump(&shm->toWorker);
+
+done:
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static VALUE
+redrat_worker_call_blocking(VALUE data)
+{
+    rb_thread_call_without_gvl(redrat_worker_call_nogvl, (void *) data,
+                               NULL, NULL);
+
+    return Qnil;
+}
+
+/*
+ * redrat_worker_failure - Set the Python error a worker reported
+ *
+ * Errors of builtin classes are set as they were; others become
+ * RuntimeErrors naming their class.
+ */
+static void
+redrat_worker_failure(PyObject *pResponse)
+{
+    const char *name;
+    const char *dot;
+    PyObject   *pClass;
+
+    name = PyString_AsString(PyTuple_GET_ITEM(pResponse, 1));
+
+    if (name == NULL)
+        return;
+
+    dot = strrchr(name, '.');
+    pClass = PyDict_GetItemString(PyEval_GetBuiltins(),
+                                  (dot == NULL) ? name : dot + 1);
+
+    if (pClass != NULL && PyExceptionClass_Check(pClass) &&
+        strncmp(name, "exceptions.", 11) == 0)
+        PyErr_SetObject(pClass, PyTuple_GET_ITEM(pResponse, 2));
+    else
+        PyErr_Format(PyExc_RuntimeError, "%s: %s", name,
+                     PyString_AsString(PyTuple_GET_ITEM(pResponse, 2)));
+}
+
+/*
+ * redrat_worker_run - Make a request of a worker, and wait for it
+ *
+ * With rArgs Qnil, rName is Python source to exec; otherwise it names what to
+ * call with rArgs, which are converted as by to_python with deep: true.
+ * Returns the result as a PythonValue, or raises the error as a
+ * RedRatException.
+ *
+ * Like apply_nogvl, the wait cannot be cancelled: interrupts are delivered
+ * once the response is in.
+ */
+static VALUE
+redrat_worker_run(redrat_worker *w, VALUE rName, VALUE rArgs)
+{
+    redrat_worker_call  c;
+    redrat_convert      cv;
+    PyObject           *pRequest = NULL;
+    PyObject           *pMarshalled = NULL;
+    PyObject           *pResponse = NULL;
+    PyObject           *pPayload;
+
+    VALUE rExcWorker = Qnil;
+    VALUE rResult = Qnil;
+
+    int state = 0;
+
+    if (SYMBOL_P(rName))
+        rName = rb_sym2str(rName);
+
+    StringValue(rName);
+
+    cv.deep = true;
+    cv.memo = redrat_convert_new_memo();
+
+    redrat_gil_ensure();
+
+    if (rArgs == Qnil)
+        pPayload = PyString_FromStringAndSize(RSTRING_PTR(rName),
+                                              RSTRING_LEN(rName));
+    else
+        pPayload = redrat_convert_to_python(
+            &cv, rb_ary_freeze(rb_ary_dup(rArgs)), false);
+
+    if (pPayload != NULL && PyList_CheckExact(pPayload))
+    {
+        PyObject *pTuple = PyList_AsTuple(pPayload);
+
+        Py_DECREF(pPayload);
+        pPayload = pTuple;
+    }
+
+    if (pPayload != NULL)
+        pRequest = Py_BuildValue(
+            "(NN)",
+            (rArgs == Qnil) ?
+            (Py_INCREF(Py_None), Py_None) :
+            PyString_FromStringAndSize(RSTRING_PTR(rName), RSTRING_LEN(rName)),
+            pPayload);
+
+    if (pRequest != NULL)
+        pMarshalled = PyMarshal_WriteObjectToString(pRequest,
+                                                    Py_MARSHAL_VERSION);
+
+    Py_XDECREF(pRequest);
+    REDRAT_ERRJMP_PYEXC(rExcWorker, pMarshalled);
+
+    redrat_gil_release();
+
+    if (PyString_GET_SIZE(pMarshalled) + sizeof(uint64_t) > REDRAT_RING_SIZE)
+    {
+        redrat_py_decref_wrap(pMarshalled);
+        rb_raise(rb_eArgError,
+                 "redrat_ext: request too large for a Python worker");
+    }
+
+    c.w = w;
+    c.request = PyString_AS_STRING(pMarshalled);
+    c.requestLen = PyString_GET_SIZE(pMarshalled);
+    c.response = NULL;
+    c.called = false;
+
+    rb_protect(redrat_worker_call_blocking, (VALUE) &c, &state);
+
+    redrat_gil_ensure();
+    Py_CLEAR(pMarshalled);
+
+    if (state != 0 || c.response == NULL)
+        goto py_rb_error;
+
+    pResponse = PyMarshal_ReadObjectFromString(c.response,
+                                               (Py_ssize_t) c.responseLen);
+    REDRAT_ERRJMP_PYEXC(rExcWorker, pResponse);
+
+    if (PyTuple_GET_ITEM(pResponse, 0) == Py_True)
+        rResult = redrat_ruby_handoff(PyTuple_GET_ITEM(pResponse, 1));
+    else
+    {
+        redrat_worker_failure(pResponse);
+        rExcWorker = redrat_exception_convert();
+        goto py_rb_error;
+    }
+
+    Py_DECREF(pResponse);
+    free(c.response);
+
+    redrat_gil_release();
+    RB_GC_GUARD(cv.memo);
+
+    return rResult;
+
+py_rb_error:
+    Py_XDECREF(pMarshalled);
+    Py_XDECREF(pResponse);
+
+    redrat_gil_release();
+
+    if (state != 0)
+    {
+        free(c.response);
+        rb_jump_tag(state);
+    }
+    else if (rExcWorker != Qnil)
+    {
+        free(c.response);
+        redrat_rb_exc_raise(rExcWorker,
+                            "redrat_ext: Python worker raised an error");
+    }
+    else if (c.called && c.response == NULL && w->dead)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: Python worker process %ld is gone",
+                 (long) w->pid);
+
+    rb_memerror();
+    return Qnil;
+}
+
+static void
+redrat_worker_pool_free(void *data)
+{
+    redrat_worker_pool *pool = data;
+    long                i;
+
+    for (i = 0; i < pool->size; i += 1)
+    {
+        redrat_worker_stop(&pool->workers[i]);
+        munmap(pool->workers[i].shm, sizeof(redrat_worker_shm));
+        pthread_mutex_destroy(&pool->workers[i].lock);
+        pthread_cond_destroy(&pool->workers[i].cond);
+    }
+
+    xfree(pool->workers);
+    xfree(pool);
+}
+
+static VALUE
+redrat_worker_pool_alloc(VALUE klass)
+{
+    redrat_worker_pool *pool;
+
+    return Data_Make_Struct(klass, redrat_worker_pool, NULL,
+                            redrat_worker_pool_free, pool);
+}
+
+static redrat_worker_pool *
+redrat_worker_pool_get(VALUE self)
+{
+    redrat_worker_pool *pool;
+
+    Data_Get_Struct(self, redrat_worker_pool, pool);
+
+    if (pool->size == 0)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: PythonWorkerPool is not initialized");
+
+    return pool;
+}
+
+/*
+ * redrat_worker_pool_initialize - Fork size Python worker processes
+ *
+ * The size defaults to the number of online processors.  Workers start out
+ * with the state of Python at the time, so modules imported beforehand need
+ * no importing again.
+ */
+static VALUE
+redrat_worker_pool_initialize(int argc, VALUE *argv, VALUE self)
+{
+    redrat_worker_pool *pool;
+    VALUE               rSize;
+    long                size;
+
+    rb_scan_args(argc, argv, "01", &rSize);
+
+    size = NIL_P(rSize) ? sysconf(_SC_NPROCESSORS_ONLN) : NUM2LONG(rSize);
+
+    if (size < 1)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: a PythonWorkerPool needs at least one worker");
+
+    Data_Get_Struct(self, redrat_worker_pool, pool);
+
+    if (pool->size != 0)
+        rb_raise(rb_eRuntimeError,
+                 "redrat_ext: PythonWorkerPool is already initialized");
+
+    pool->workers = ALLOC_N(redrat_worker, size);
+    pool->next = 0;
+
+    for (pool->size = 0; pool->size < size; pool->size += 1)
+        redrat_worker_start(&pool->workers[pool->size]);
+
+    return self;
+}
+
+/*
+ * redrat_worker_pool_apply - apply, in a worker process
+ *
+ * Takes the name of what to call instead of the callable itself, either
+ * "module.attribute" or a global defined with exec_all, then the arguments.
+ * They and the result must be marshallable, such as numbers, strings, lists,
+ * tuples and dicts of them.  The worker with the fewest calls in flight
+ * makes the call.
+ */
+static VALUE
+redrat_worker_pool_apply(int argc, VALUE *argv, VALUE self)
+{
+    redrat_worker_pool *pool = redrat_worker_pool_get(self);
+    long                best = -1;
+    long                bestPending = 0;
+    long                i;
+
+    rb_check_arity(argc, 1, UNLIMITED_ARGUMENTS);
+
+    for (i = 0; i < pool->size; i += 1)
+    {
+        long n = (pool->next + i) % pool->size;
+        long pending = __atomic_load_n(&pool->workers[n].pending,
+                                       __ATOMIC_RELAXED);
+
+        if (best < 0 || pending < bestPending)
+        {
+            best = n;
+            bestPending = pending;
+        }
+
+        if (pending == 0)
+            break;
+    }
+
+    pool->next = (best + 1) % pool->size;
+
+    return redrat_worker_run(&pool->workers[best], argv[0],
+                             rb_ary_new_from_values(argc - 1, argv + 1));
+}
+
+/*
+ * redrat_worker_pool_exec_all - exec Python source in every worker
+ *
+ * For defining what later calls need, in their __main__ modules.
+ */
+static VALUE
+redrat_worker_pool_exec_all(VALUE self, VALUE rSource)
+{
+    redrat_worker_pool *pool = redrat_worker_pool_get(self);
+    long                i;
+
+    for (i = 0; i < pool->size; i += 1)
+        redrat_worker_run(&pool->workers[i], rSource, Qnil);
+
+    return Qnil;
+}
+
+static VALUE
+redrat_worker_pool_pids(VALUE self)
+{
+    redrat_worker_pool *pool = redrat_worker_pool_get(self);
+    VALUE               rPids = rb_ary_new_capa(pool->size);
+    long                i;
+
+    for (i = 0; i < pool->size; i += 1)
+        rb_ary_push(rPids, LONG2NUM(pool->workers[i].pid));
+
+    return rPids;
+}
+
+/*
+ * redrat_worker_pool_close - Kill the worker processes
+ *
+ * Calls still in flight raise.  The shared memory stays mapped until the
+ * pool is garbage collected.
+ */
+static VALUE
+redrat_worker_pool_close(VALUE self)
+{
+    redrat_worker_pool *pool = redrat_worker_pool_get(self);
+    long                i;
+
+    for (i = 0; i < pool->size; i += 1)
+        redrat_worker_stop(&pool->workers[i]);
+
+    return Qnil;
+}
+#endif /* HAVE_LINUX_FUTEX_H */
+
+/*
+ * PYTHONVALUE METHOD PROXIES
+ *
+ * PythonValue#method_missing turns obj.foo(1, 2) into the Python call
+ * obj.foo(1, 2), then defines a stub method foo on PythonValue so that later
+ * such calls skip method_missing altogether.  With no arguments, attributes
+ * that are not callable are returned as they are; obj.foo = x sets them.
+ *
+ * Resolving foo is cached per (Python type, name) in redrat_mcache.  Entries
+ * are validated against the version tag of the type, which Python invalidates
+ * whenever the type or one of its bases is modified.  When the attribute is a
+ * plain method found on the type, the call is made on the unbound function
+ * with the object as the first argument, so in the steady state the cost is
+ * a single PyObject_Call: no attribute lookup and no bound method object.
+ */
+#define REDRAT_MCACHE_SIZE 512
+#define REDRAT_MCACHE_SLOT(type, name)                                        \
+    (((((uintptr_t) (type)) >> 4) ^ ((uintptr_t) (name))) &                   \
+     (REDRAT_MCACHE_SIZE - 1))
+
+/* Beyond this many stubs, rely on method_missing */
+#define REDRAT_MAX_STUBS 4096
+
+typedef enum {
+    REDRAT_MCACHE_GENERIC,      /* Resolve with PyObject_GetAttr every time */
+    REDRAT_MCACHE_UNBOUND       /* Call descr with the object prepended */
+} redrat_mcache_kind;
+
+typedef struct {
+    PyTypeObject       *type;       /* Strong reference, or NULL if unused */
+    unsigned int        version;
+    ID                  name;
+    redrat_mcache_kind  kind;
+    PyObject           *descr;      /* Strong reference, if UNBOUND */
+} redrat_mcache_entry;
+
+/* Only accessed while holding both the GIL and the GVL */
+static redrat_mcache_entry redrat_mcache[REDRAT_MCACHE_SIZE];
+static long redrat_stubs_defined = 0;
+
+/* The type of e.g. str.upper, which Python 2 does not export */
+static PyTypeObject *redrat_method_descr_type;
+
+/*
+ * redrat_mcache_lookup - Find how to call an attribute on instances of a type
+ *
+ * Returns NULL if the type cannot have a version tag, and so cannot be cached.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static redrat_mcache_entry *
+redrat_mcache_lookup(PyTypeObject *type, ID name, PyObject *pName)
+{
+    redrat_mcache_entry *entry;
+    PyObject            *descr;
+
+    entry = &redrat_mcache[REDRAT_MCACHE_SLOT(type, name)];
+
+    if (entry->type == type && entry->name == name &&
+        PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) &&
+        entry->version == type->tp_version_tag)
+        return entry;
+
+    /* Borrowed; also assigns the type a version tag when it can have one */
+    descr = _PyType_Lookup(type, pName);
+
+    if (!PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG))
+        return NULL;
+
+    Py_INCREF(type);
+    Py_XINCREF(descr);
+
+    Py_XDECREF(entry->type);
+    Py_XDECREF(entry->descr);
+
+    entry->type = type;
+    entry->version = type->tp_version_tag;
+    entry->name = name;
+
+    if (descr != NULL && type->tp_getattro == PyObject_GenericGetAttr &&
+        (PyFunction_Check(descr) ||
+         Py_TYPE(descr) == redrat_method_descr_type ||
+         Py_TYPE(descr) == &PyWrapperDescr_Type))
+    {
+        entry->kind = REDRAT_MCACHE_UNBOUND;
+        entry->descr = descr;
+    }
+    else
+    {
+        entry->kind = REDRAT_MCACHE_GENERIC;
+        entry->descr = NULL;
+        Py_XDECREF(descr);
+    }
+
+    return entry;
+}
+
+/*
+ * redrat_shadowed_p - Whether an instance dictionary overrides an attribute
+ */
+static bool
+redrat_shadowed_p(PyObject *pObj, PyObject *pName)
+{
+    PyObject **dictPtr = _PyObject_GetDictPtr(pObj);
+
+    return (dictPtr != NULL && *dictPtr != NULL &&
+            PyDict_GetItem(*dictPtr, pName) != NULL);
+}
+
+/*
+ * redrat_pythonvalue_send - Call a method, or read or write an attribute
+ *
+ * Returns Qundef if the attribute does not exist, leaving it to the caller to
+ * raise a NoMethodError.
+ */
+static VALUE
+redrat_pythonvalue_send(VALUE self, ID name, bool setter,
+                        int argc, const VALUE *argv)
+{
+    PyObject            *pObj;
+    PyObject            *pName;
+    PyObject            *pCallable = NULL;
+    PyObject            *pResult = NULL;
+    PyObject           **slots;
+    redrat_callargs      ca;
+    redrat_mcache_entry *entry;
+
+    VALUE rExcCall = Qnil;
+    VALUE rKwargs = Qnil;
+    VALUE rResult;
+    VALUE slotsBuf;
+
+    pObj = redrat_pythonvalue_get(self);
+
+    if (!setter)
+        rKwargs = redrat_kwargs_split(&argc, argv);
+
+    slots = ALLOCV_N(PyObject *, slotsBuf,
+                     REDRAT_CALLARGS_SLOTS(argc, (rKwargs == Qnil) ?
+                                           0 : RHASH_SIZE(rKwargs)));
+    ca.nargs = 0;
+    ca.nkws = 0;
+    ca.badKey = false;
+
+    redrat_gil_ensure();
+
+    pName = redrat_id_to_python_string(name);
+    REDRAT_ERRJMP_PYEXC(rExcCall, pName);
+
+    if (setter)
+    {
+        PyObject *pValue;
+
+        Assert(argc == 1);
+
+        pValue = redrat_python_handoff(argv[0]);
+        REDRAT_ERRJMP_PYEXC(rExcCall, pValue);
+
+        if (PyObject_SetAttr(pObj, pName, pValue) < 0)
+        {
+            Py_DECREF(pValue);
+            REDRAT_ERRJMP_PYEXC(rExcCall, pResult);
+        }
+
+        Py_DECREF(pValue);
+        Py_DECREF(pName);
+        redrat_gil_release();
+        ALLOCV_END(slotsBuf);
+
+        return argv[0];
+    }
+
+    entry = redrat_mcache_lookup(Py_TYPE(pObj), name, pName);
+
+    if (entry != NULL && entry->kind == REDRAT_MCACHE_UNBOUND &&
+        !redrat_shadowed_p(pObj, pName))
+    {
+        /* The entry may be replaced during the call, so hold on to descr */
+        pCallable = entry->descr;
+        Py_INCREF(pCallable);
+
+        if (redrat_callargs_fill(&ca, slots, argc, argv, rKwargs))
+        {
+            Py_INCREF(pObj);
+            redrat_callargs_prepend(&ca, pObj);
+        }
+    }
+    else
+    {
+        pCallable = PyObject_GetAttr(pObj, pName);
+
+        if (pCallable == NULL &&
+            PyErr_ExceptionMatches(PyExc_AttributeError))
+        {
+            PyErr_Clear();
+            Py_DECREF(pName);
+            redrat_gil_release();
+            ALLOCV_END(slotsBuf);
+
+            return Qundef;
+        }
+
+        REDRAT_ERRJMP_PYEXC(rExcCall, pCallable);
+
+        if (argc == 0 && rKwargs == Qnil && !PyCallable_Check(pCallable))
+        {
+            rResult = redrat_ruby_handoff(pCallable);
+
+            Py_DECREF(pCallable);
+            Py_DECREF(pName);
+            redrat_gil_release();
+            ALLOCV_END(slotsBuf);
+
+            return rResult;
+        }
+
+        redrat_callargs_fill(&ca, slots, argc, argv, rKwargs);
+    }
+
+    if (ca.badKey)
+        goto py_rb_error;
+
+    if (PyErr_Occurred())
+    {
+        rExcCall = redrat_exception_convert();
+        goto py_rb_error;
+    }
+
+    pResult = redrat_call_vector(pCallable, &ca);
+    REDRAT_PROF_FLUSH();
+    REDRAT_ERRJMP_PYEXC(rExcCall, pResult);
+
+    rResult = redrat_ruby_handoff(pResult);
+
+    Py_DECREF(pResult);
+    redrat_callargs_clear(&ca);
+    Py_DECREF(pCallable);
+    Py_DECREF(pName);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    return rResult;
+
+py_rb_error:
+    redrat_callargs_clear(&ca);
+    Py_XDECREF(pCallable);
+    Py_XDECREF(pName);
+
+    redrat_gil_release();
+    ALLOCV_END(slotsBuf);
+
+    if (ca.badKey)
+        rb_raise(rb_eArgError,
+                 "redrat_ext: keywords must be Symbols or Strings");
+    else if (rExcCall != Qnil)
+        redrat_rb_exc_raise(rExcCall,
+                            "redrat_ext: method call on PythonValue raised "
+                            "an error");
+
+    Assert(false);
+    return Qnil;
+}
+
+/*
+ * redrat_python_name_p - Whether a method name is a Python identifier
+ *
+ * Sets *setter for names like foo=, which are identifiers once the = is gone.
+ */
+static bool
+redrat_python_name_p(ID name, bool *setter)
+{
+    VALUE       rName = rb_id2str(name);
+    const char *p = RSTRING_PTR(rName);
+    long        len = RSTRING_LEN(rName);
+    long        i;
+
+    *setter = (len > 1 && p[len - 1] == '=');
+
+    if (*setter)
+        len -= 1;
+
+    if (len == 0 || !(isalpha((unsigned char) p[0]) || p[0] == '_'))
+        return false;
+
+    for (i = 1; i < len; i += 1)
+        if (!(isalnum((unsigned char) p[i]) || p[i] == '_'))
+            return false;
+
+    return true;
+}
+
+static void
+redrat_raise_no_method(VALUE self, ID name)
+{
+    rb_raise(rb_eNoMethodError,
+             "redrat_ext: undefined method `%s' for Python object",
+             rb_id2name(name));
+}
+
+/*
+ * redrat_pythonvalue_stub - A method defined by method_missing
+ *
+ * Every stub shares this function, and tells which one it is from the name
+ * it was called by.
+ */
+static VALUE
+redrat_pythonvalue_stub(int argc, VALUE *argv, VALUE self)
+{
+    ID    name = rb_frame_this_func();
+    VALUE rResult;
+
+    rResult = redrat_pythonvalue_send(self, name, false, argc, argv);
+
+    if (rResult == Qundef)
+        redrat_raise_no_method(self, name);
+
+    return rResult;
+}
+
+static VALUE
+redrat_pythonvalue_setter_stub(VALUE self, VALUE rValue)
+{
+    ID name = rb_frame_this_func();
+    ID attrName;
+
+    attrName = rb_intern_str(rb_str_substr(rb_id2str(name), 0,
+                                           RSTRING_LEN(rb_id2str(name)) - 1));
+
+    return redrat_pythonvalue_send(self, attrName, true, 1, &rValue);
+}
+
+/*
+ * redrat_pythonvalue_method_missing - Delegate unknown methods to Python
+ */
+static VALUE
+redrat_pythonvalue_method_missing(int argc, VALUE *argv, VALUE self)
+{
+    ID    name;
+    ID    attrName;
+    bool  setter;
+    VALUE rResult;
+
+    if (argc == 0 || !SYMBOL_P(argv[0]))
+        return rb_call_super(argc, argv);
+
+    name = SYM2ID(argv[0]);
+
+    if (!redrat_python_name_p(name, &setter) || (setter && argc != 2))
+        return rb_call_super(argc, argv);
+
+    if (setter)
+    {
+        VALUE rName = rb_id2str(name);
+
+        attrName = rb_intern_str(rb_str_substr(rName, 0,
+                                               RSTRING_LEN(rName) - 1));
+    }
+    else
+        attrName = name;
+
+    rResult = redrat_pythonvalue_send(self, attrName, setter,
+                                      argc - 1, argv + 1);
+
+    if (rResult == Qundef)
+        return rb_call_super(argc, argv);
+
+    if (redrat_stubs_defined < REDRAT_MAX_STUBS)
+    {
+        if (setter)
+            rb_define_method_id(rb_cPythonValue, name,
+                                redrat_pythonvalue_setter_stub, 1);
+        else
+            rb_define_method_id(rb_cPythonValue, name,
+                                redrat_pythonvalue_stub, -1);
+
+        redrat_stubs_defined += 1;
+    }
+
+    return rResult;
+}
+
+/*
+ * redrat_pythonvalue_respond_to_missing - Whether Python has the attribute
+ */
+static VALUE
+redrat_pythonvalue_respond_to_missing(VALUE self, VALUE rName,
+                                      VALUE rIncludePrivate)
+{
+    PyObject *pObj;
+    PyObject *pName;
+    bool      setter;
+    bool      has;
+    ID        name = rb_to_id(rName);
+
+    if (!redrat_python_name_p(name, &setter))
+        return Qfalse;
+
+    if (setter)
+        return Qtrue;
+
+    Data_Get_Struct(self, PyObject, pObj);
+
+    /* Asking is not using: Array#flatten asks after to_ary */
+    if (pObj == NULL)
+        return Qfalse;
+
+    redrat_gil_ensure();
+
+    pName = redrat_id_to_python_string(name);
+
+    if (pName == NULL)
+    {
+        PyErr_Clear();
+        has = false;
+    }
+    else
+    {
+        /* Like Python's own hasattr, this swallows any exception */
+        has = PyObject_HasAttr(pObj, pName);
+        Py_DECREF(pName);
+    }
+
+    redrat_gil_release();
+
+    return has ? Qtrue : Qfalse;
+}
+
+/*
+ * redrat_pythonvalue_pin - Wrap pVal in a PythonValue that is never freed
+ */
+static void
+redrat_pythonvalue_pin(VALUE *slot, PyObject *pVal)
+{
+    Py_INCREF(pVal);
+    *slot = Data_Wrap_Struct(rb_cPythonValue, NULL, redrat_py_decref_wrap,
+                             pVal);
+    rb_gc_register_address(slot);
+}
+
+void
+Init_redrat_ext()
+{
+    long i;
+
+    rb_mRedRat = rb_define_module("RedRat");
+    rb_mRedRatInternal = rb_define_module_under(rb_mRedRat, "Internal");
+
+    rb_define_module_function(rb_mRedRatInternal, "builtins",
+                              redrat_builtin_mapping, 0);
+    rb_define_module_function(rb_mRedRatInternal, "apply", redrat_apply, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "apply_nogvl", redrat_apply_nogvl, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "apply?", redrat_apply_p, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "plan", redrat_plan_new, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "apply_async", redrat_apply_async, -1);
+    rb_define_singleton_method(
+        rb_mRedRatInternal, "compile", redrat_compile, -1);
+    rb_define_singleton_method(rb_mRedRatInternal, "eval", redrat_eval, -1);
+    rb_define_module_function(rb_mRedRatInternal, "code_cache_stats",
+                              redrat_code_cache_stats, 0);
+    rb_define_module_function(rb_mRedRatInternal, "async_stats",
+                              redrat_async_stats, 0);
+    rb_define_module_function(
+        rb_mRedRatInternal, "unicode", redrat_unicode, 1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "getattr", redrat_getattr, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "hasattr", redrat_hasattr, 2);
+    rb_define_module_function(
+        rb_mRedRatInternal, "getitem", redrat_getitem, -1);
+    rb_define_module_function(rb_mRedRatInternal, "truth", redrat_truth, 1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "with_gil", redrat_with_gil, 0);
+    rb_define_module_function(rb_mRedRatInternal, "decref_queue_stats",
+                              redrat_decref_queue_stats, 0);
+    rb_define_module_function(rb_mRedRatInternal, "wrapper_stats",
+                              redrat_wrapper_stats, 0);
+    rb_define_module_function(
+        rb_mRedRatInternal, "scope", redrat_scope_block, 0);
+    rb_define_module_function(rb_mRedRatInternal, "collect_cycles",
+                              redrat_cycle_collect, 0);
+    rb_define_module_function(rb_mRedRatInternal, "cycle_stats",
+                              redrat_cycle_stats, 0);
+    rb_define_module_function(
+        rb_mRedRatInternal, "stats", redrat_stats, -1);
+    rb_define_module_function(rb_mRedRatInternal, "stats_enabled?",
+                              redrat_stats_enabled_p, 0);
+#ifdef REDRAT_STATS
+    rb_define_module_function(rb_mRedRatInternal, "stats_enabled=",
+                              redrat_stats_enabled_set, 1);
+#else
+    rb_define_module_function(rb_mRedRatInternal, "stats_enabled=",
+                              rb_f_notimplement, -1);
+#endif /* REDRAT_STATS */
+#ifdef HAVE_RB_PROFILE_FRAMES
+    rb_define_module_function(
+        rb_mRedRatInternal, "profile", redrat_profile_block, -1);
+#else
+    rb_define_module_function(
+        rb_mRedRatInternal, "profile", rb_f_notimplement, -1);
+#endif /* HAVE_RB_PROFILE_FRAMES */
+    rb_define_module_function(
+        rb_mRedRatInternal, "to_python", redrat_to_python, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "to_ruby", redrat_to_ruby, -1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "bytes_view", redrat_bytes_view, 1);
+    rb_define_module_function(
+        rb_mRedRatInternal, "string_view", redrat_string_view, 1);
+
+    /* Generated, see redrat_stringify_generate */
+    rb_define_module_function(rb_mRedRatInternal, "repr", redrat_repr, 1);
+    rb_define_module_function(rb_mRedRatInternal, "str", redrat_str, 1);
+
+    rb_cPythonValue = rb_define_class_under(rb_mRedRatInternal,
+                                            "PythonValue", rb_cObject);
+    rb_define_method(rb_cPythonValue, "method_missing",
+                     redrat_pythonvalue_method_missing, -1);
+    rb_define_method(rb_cPythonValue, "respond_to_missing?",
+                     redrat_pythonvalue_respond_to_missing, 2);
+    rb_define_method(rb_cPythonValue, "to_ruby",
+                     redrat_pythonvalue_to_ruby, -1);
+    rb_define_method(rb_cPythonValue, "each", redrat_pythonvalue_each, -1);
+
+    rb_cPythonFuture = rb_define_class_under(rb_mRedRatInternal,
+                                             "PythonFuture", rb_cObject);
+    rb_undef_alloc_func(rb_cPythonFuture);
+    rb_define_method(rb_cPythonFuture, "value", redrat_future_value, 0);
+    rb_define_method(rb_cPythonFuture, "wait", redrat_future_wait, -1);
+    rb_define_method(rb_cPythonFuture, "done?", redrat_future_done_p, 0);
+
+    rb_cPythonCallPlan = rb_define_class_under(rb_mRedRatInternal,
+                                               "PythonCallPlan", rb_cObject);
+    rb_undef_alloc_func(rb_cPythonCallPlan);
+    rb_define_method(rb_cPythonCallPlan, "call", redrat_plan_call, -1);
+    rb_define_method(rb_cPythonCallPlan, "callable", redrat_plan_callable, 0);
+    rb_define_method(rb_cPythonCallPlan, "resolutions",
+                     redrat_plan_resolutions, 0);
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL
+    rb_cPythonInterpreter = rb_define_class_under(
+        rb_mRedRatInternal, "PythonInterpreter", rb_cObject);
+    rb_define_alloc_func(rb_cPythonInterpreter, redrat_interp_alloc);
+    rb_define_method(rb_cPythonInterpreter, "initialize",
+                     redrat_interp_initialize, 0);
+    rb_define_method(rb_cPythonInterpreter, "eval", redrat_interp_eval, 1);
+    rb_define_method(rb_cPythonInterpreter, "exec", redrat_interp_exec, 1);
+    rb_define_method(rb_cPythonInterpreter, "call", redrat_interp_call, -1);
+    rb_define_method(rb_cPythonInterpreter, "pending",
+                     redrat_interp_pending, 0);
+    rb_define_method(rb_cPythonInterpreter, "close", redrat_interp_close, 0);
+
+    rb_cPythonInterpreterPool = rb_define_class_under(
+        rb_mRedRatInternal, "PythonInterpreterPool", rb_cObject);
+    rb_define_alloc_func(rb_cPythonInterpreterPool, redrat_pool_alloc);
+    rb_define_method(rb_cPythonInterpreterPool, "initialize",
+                     redrat_pool_initialize, -1);
+    rb_define_method(rb_cPythonInterpreterPool, "interpreters",
+                     redrat_pool_interpreters, 0);
+    rb_define_method(rb_cPythonInterpreterPool, "eval", redrat_pool_eval, 1);
+    rb_define_method(rb_cPythonInterpreterPool, "exec", redrat_pool_exec, 1);
+    rb_define_method(rb_cPythonInterpreterPool, "exec_all",
+                     redrat_pool_exec_all, 1);
+    rb_define_method(rb_cPythonInterpreterPool, "call", redrat_pool_call, -1);
+    rb_define_method(rb_cPythonInterpreterPool, "close",
+                     redrat_pool_close, 0);
+#endif
+
+#ifdef HAVE_LINUX_FUTEX_H
+    rb_cPythonWorkerPool = rb_define_class_under(
+        rb_mRedRatInternal, "PythonWorkerPool", rb_cObject);
+    rb_define_alloc_func(rb_cPythonWorkerPool, redrat_worker_pool_alloc);
+    rb_define_method(rb_cPythonWorkerPool, "initialize",
+                     redrat_worker_pool_initialize, -1);
+    rb_define_method(rb_cPythonWorkerPool, "apply",
+                     redrat_worker_pool_apply, -1);
+    rb_define_method(rb_cPythonWorkerPool, "exec_all",
+                     redrat_worker_pool_exec_all, 1);
+    rb_define_method(rb_cPythonWorkerPool, "pids",
+                     redrat_worker_pool_pids, 0);
+    rb_define_method(rb_cPythonWorkerPool, "close",
+                     redrat_worker_pool_close, 0);
+#endif
+
+    /* Roots for Ruby values referenced from Python, see redrat_roots */
+    redrat_roots_keeper = Data_Wrap_Struct(0, redrat_roots_mark, NULL,
+                                           &redrat_roots);
+    rb_gc_register_address(&redrat_roots_keeper);
+
+#ifdef HAVE_RB_PROFILE_FRAMES
+    rb_gc_register_address(&redrat_prof_stacks);
+#endif
+
+    redrat_wrappers = rb_class_new_instance(
+        0, NULL, rb_const_get(rb_const_get(rb_cObject, rb_intern("ObjectSpace")),
+                              rb_intern("WeakMap")));
+    rb_gc_register_address(&redrat_wrappers);
+
+    redrat_code_cache[0] = rb_hash_new();
+    redrat_code_cache[1] = rb_hash_new();
+    rb_gc_register_address(&redrat_code_cache[0]);
+    rb_gc_register_address(&redrat_code_cache[1]);
+
+    redrat_attr_names = st_init_numtable();
+
+    /* Not an instance variable name, so it cannot be seen from Ruby */
+    redrat_id_buffer_owner = rb_intern("__redrat_buffer_owner__");
+
+    redrat_id_deep = rb_intern("deep");
+    redrat_id_compare_by_identity = rb_intern("compare_by_identity");
+    redrat_id_batch = rb_intern("batch");
+    redrat_id_for_fd = rb_intern("for_fd");
+
+    redrat_id_aref = rb_intern("[]");
+    redrat_id_aset = rb_intern("[]=");
+    redrat_id_call = rb_intern("call");
+    redrat_id_cmp = rb_intern("<=>");
+    redrat_id_delete = rb_intern("delete");
+    redrat_id_each = rb_intern("each");
+    redrat_id_include_p = rb_intern("include?");
+    redrat_id_keys = rb_intern("keys");
+    redrat_id_message = rb_intern("message");
+    redrat_id_next = rb_intern("next");
+    redrat_id_size = rb_intern("size");
+    redrat_id_to_enum = rb_intern("to_enum");
+
+    redrat_enc_latin1 = rb_enc_find_index("ISO-8859-1");
+    redrat_enc_utf16le = rb_enc_find_index("UTF-16LE");
+    redrat_enc_utf16be = rb_enc_find_index("UTF-16BE");
+    redrat_enc_utf32le = rb_enc_find_index("UTF-32LE");
+    redrat_enc_utf32be = rb_enc_find_index("UTF-32BE");
+
+    /*
+     * The RedRatException type, which wraps (optionally) a RedRat reason for
+     * the exception as well as the underlying python_exception, which can be
+     * inspected as a normal PythonValue would.
+     */
+    rb_eRedRatException = rb_define_class_under(rb_mRedRatInternal,
+                                                "RedRatException",
+                                                rb_eStandardError);
+    rb_define_method(rb_eRedRatException, "redrat_reason",
+                     redrat_exception_reason, 0);
+    rb_define_method(rb_eRedRatException, "to_s", redrat_exception_to_s, 0);
+
+    /* Readers are lazy, see redrat_python_exception_getter */
+    rb_define_method(rb_eRedRatException, "python_type",
+                     redrat_python_exception_getter, 0);
+    rb_define_method(rb_eRedRatException, "python_value",
+                     redrat_python_exception_getter, 0);
+    rb_define_method(rb_eRedRatException, "python_traceback",
+                     redrat_python_exception_getter, 0);
+    rb_define_attr(rb_eRedRatException, "python_type", 0, 1);
+    rb_define_attr(rb_eRedRatException, "python_value", 0, 1);
+    rb_define_attr(rb_eRedRatException, "python_traceback", 0, 1);
+
+    /* RedRat::KeyError and friends, see redrat_exc_classes */
+    for (i = 0; i < REDRAT_EXC_CLASSES; i += 1)
+    {
+        int parent = redrat_exc_classes[i].parent;
+
+        redrat_exc_classes[i].klass = rb_define_class_under(
+            rb_mRedRat, redrat_exc_classes[i].name,
+            (parent < 0) ?
+            rb_eRedRatException : redrat_exc_classes[parent].klass);
+    }
+
+    redrat_exc_default_message = rb_obj_freeze(
+        rb_str_new_cstr("RedRat exception"));
+    rb_gc_register_address(&redrat_exc_default_message);
+
+    redrat_id_python_error = rb_intern("__redrat_python_error__");
+    redrat_id_python_type = rb_intern("python_type");
+    redrat_id_python_value = rb_intern("python_value");
+    redrat_id_python_traceback = rb_intern("python_traceback");
+    redrat_id_iv_python_type = rb_intern("@python_type");
+    redrat_id_iv_python_value = rb_intern("@python_value");
+    redrat_id_iv_python_traceback = rb_intern("@python_traceback");
+    redrat_id_iv_redrat_reason = rb_intern("@redrat_reason");
+    redrat_id_iv_message = rb_intern("__redrat_message__");
+
+    pthread_atfork(NULL, NULL, redrat_decref_drainer_atfork_child);
+    pthread_atfork(NULL, NULL, redrat_async_atfork_child);
+#ifdef REDRAT_STATS
+    pthread_key_create(&redrat_stat_key, redrat_stat_block_exit);
+    pthread_atfork(NULL, NULL, redrat_stat_atfork_child);
+#endif /* REDRAT_STATS */
+
+    Py_Initialize();
+    PyEval_InitThreads();
+
+    /* Initialize the redrat module in Python */
+    initredrat();
+
+    redrat_method_descr_type =
+        Py_TYPE(_PyType_Lookup(&PyString_Type,
+                               PyString_InternFromString("upper")));
+
+    /* Shared PythonValues for Python's own singletons */
+    redrat_pythonvalue_pin(&redrat_pv_none, Py_None);
+    redrat_pythonvalue_pin(&redrat_pv_true, Py_True);
+    redrat_pythonvalue_pin(&redrat_pv_false, Py_False);
+
+    for (i = REDRAT_SMALL_INT_MIN; i <= REDRAT_SMALL_INT_MAX; i += 1)
+    {
+        PyObject *pInt = PyInt_FromLong(i);
+
+        redrat_pythonvalue_pin(
+            &redrat_pv_small_ints[i - REDRAT_SMALL_INT_MIN], pInt);
+        Py_DECREF(pInt);
+    }
+
+    /*
+     * Py_Initialize leaves the GIL held by this thread.  Give it up, so that
+     * from here on it is only ever held inside of redrat_gil_ensure.
+     */
+    redrat_main_tstate = PyEval_SaveThread();
+}
+
+
+/* Python Constructs */
+
+/*
+ * The inverse of PythonValue in RedRat for Ruby is RubyObject in Python.  This
+ * is useful so that one can write Ruby classes that can be sent into Python
+ * classes, or even send standard Ruby Hashes, Arrays, and Unicode directly to
+ * Python, without marshalling or copying, so long as they are taught the right
+ * operator conventions.
+ */
+
+static PyMethodDef rubyobject_methods[] = {
+    {NULL}  /* Sentinel */
+};
+
+static void
+redrat_rubyobject_dealloc(redrat_RubyObject* self)
+{
+    /* RubyBuffers and RubyIterators share this, but not Python's GC */
+    if (PyObject_IS_GC((PyObject *) self))
+        PyObject_GC_UnTrack(self);
+
+    /*
+     * Notify Ruby that this value is no longer required by Python.  Analogous
+     * to its Ruby inverse, redrat_py_decref_wrap.
+     */
+    if (self->root >= 0)
+        redrat_root_remove(self->root);
+
+    self->ob_type->tp_free((PyObject*)self);
+}
+
+/*
+ * redrat_rubyobject_traverse - tp_traverse of RubyObjects
+ *
+ * A RubyObject refers to no PyObjects, only to its Ruby value.  It takes part
+ * in Python's GC anyway, so that containers holding RubyObjects stay tracked,
+ * and so redrat_cycle_collect can find them with gc.get_objects.
+ */
+static int
+redrat_rubyobject_traverse(PyObject *self, visitproc visit, void *arg)
+{
+    return 0;
+}
+
+/*
+ * redrat_rubyobject_clear - tp_clear of RubyObjects
+ *
+ * Lets go of the Ruby value, leaving nil in its place.
+ */
+static int
+redrat_rubyobject_clear(PyObject *self)
+{
+    redrat_RubyObject *pyr = (void *) self;
+
+    if (pyr->root >= 0)
+        redrat_root_remove(pyr->root);
+
+    pyr->root = -1;
+    pyr->r = Qnil;
+
+    return 0;
+}
+
+/*
+ * RubyBuffer buffer procedures
+ *
+ * The String is frozen and its object pinned by redrat_roots, so its contents
+ * neither change nor move and can be read without the GVL.
+ */
+static Py_ssize_t
+redrat_rubybuffer_getreadbuf(PyObject *self, Py_ssize_t segment,
+                             void **ptrptr)
+{
+    VALUE rStr = ((redrat_RubyObject *) self)->r;
+
+    if (segment != 0)
+    {
+        PyErr_SetString(PyExc_SystemError,
+                        "accessing non-existent RubyBuffer segment");
+        return -1;
+    }
+
+    *ptrptr = RSTRING_PTR(rStr);
+    return RSTRING_LEN(rStr);
+}
+
+static Py_ssize_t
+redrat_rubybuffer_getcharbuf(PyObject *self, Py_ssize_t segment,
+                             char **ptrptr)
+{
+    return redrat_rubybuffer_getreadbuf(self, segment, (void **) ptrptr);
+}
+
+static Py_ssize_t
+redrat_rubybuffer_getsegcount(PyObject *self, Py_ssize_t *lenp)
+{
+    if (lenp != NULL)
+        *lenp = RSTRING_LEN(((redrat_RubyObject *) self)->r);
+
+    return 1;
+}
+
+static int
+redrat_rubybuffer_getbuffer(PyObject *self, Py_buffer *view, int flags)
+{
+    VALUE rStr = ((redrat_RubyObject *) self)->r;
+
+    return PyBuffer_FillInfo(view, self, RSTRING_PTR(rStr),
+                             RSTRING_LEN(rStr), 1, flags);
+}
+
+/*
+ * CALLING RUBY FROM PYTHON
+ *
+ * The protocols of RubyObject run Ruby code on behalf of Python code, on a
+ * Ruby thread holding the GIL that some RedRat entry point took before calling
+ * into Python.  That thread holds the GVL too, unless it is inside of
+ * apply_nogvl, in which case the GVL is taken back for the duration.  Ruby
+ * exceptions are rescued and raised in Python instead.
+ *
+ * Python threads that Ruby does not know about cannot call into Ruby at all.
+ */
+
+/* A procedure run by redrat_ruby_run, and whether it succeeded */
+typedef struct {
+    VALUE (*fn)(VALUE);
+    void   *data;
+    bool    ok;
+} redrat_ruby_run_state;
+
+/* The operands and outcome of one RubyObject protocol call */
+typedef struct {
+    VALUE       r;          /* The Ruby value of the RubyObject */
+    PyObject   *pKey;       /* Index, key, other operand or argument tuple */
+    PyObject   *pValue;     /* Value to store, or keyword dict */
+    Py_ssize_t  n;          /* Index, length, hash or truth */
+    int         op;         /* Comparison operator */
+    PyObject   *pResult;    /* New reference */
+} redrat_rubyop;
+
+static VALUE
+redrat_exception_message(VALUE rExc)
+{
+    return rb_String(rb_funcall(rExc, redrat_id_message, 0));
+}
+
+/*
+ * redrat_ruby_exception_to_python - Raise a Ruby exception in Python
+ *
+ * Ruby exception classes with an obvious Python counterpart are raised as it,
+ * with the same message, and everything else as a RuntimeError naming the
+ * Ruby class.  RedRatExceptions raise their original Python error.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static void
+redrat_ruby_exception_to_python(VALUE rExc)
+{
+    PyObject            *pType = PyExc_RuntimeError;
+    PyObject            *pMessage;
+    redrat_python_error *err;
+    VALUE                rMessage;
+    int                  state = 0;
+
+    /* What rb_protect leaves behind for throw, which is not an exception */
+    if (!rb_obj_is_kind_of(rExc, rb_eException))
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "redrat: Ruby code called from Python jumped out of "
+                        "Python");
+        return;
+    }
+
+    /* A Python error that passed through Ruby is raised again as it was */
+    if ((err = redrat_python_error_get(rExc)) != NULL)
+    {
+        Py_INCREF(err->pType);
+        Py_XINCREF(err->pValue);
+        Py_XINCREF(err->pTraceback);
+        PyErr_Restore(err->pType, err->pValue, err->pTraceback);
+
+        return;
+    }
+
+    rMessage = rb_protect(redrat_exception_message, rExc, &state);
+
+    if (state != 0)
+    {
+        rb_set_errinfo(Qnil);
+        rMessage = rb_str_new_cstr("");
+    }
+
+    if (rb_obj_is_kind_of(rExc, rb_eKeyError))
+        pType = PyExc_KeyError;
+    else if (rb_obj_is_kind_of(rExc, rb_eIndexError))
+        pType = PyExc_IndexError;
+    else if (rb_obj_is_kind_of(rExc, rb_eStopIteration))
+        pType = PyExc_StopIteration;
+    else if (rb_obj_is_kind_of(rExc, rb_eArgError) ||
+             rb_obj_is_kind_of(rExc, rb_eTypeError) ||
+             rb_obj_is_kind_of(rExc, rb_eNoMethodError))
+        pType = PyExc_TypeError;
+    else if (rb_obj_is_kind_of(rExc, rb_eZeroDivError))
+        pType = PyExc_ZeroDivisionError;
+    else if (rb_obj_is_kind_of(rExc, rb_eNoMemError))
+        pType = PyExc_MemoryError;
+    else if (rb_obj_is_kind_of(rExc, rb_eInterrupt))
+        pType = PyExc_KeyboardInterrupt;
+    else
+        rMessage = rb_str_plus(rb_str_new_cstr(rb_obj_classname(rExc)),
+                               rb_str_plus(rb_str_new_cstr(": "), rMessage));
+
+    pMessage = PyString_FromStringAndSize(RSTRING_PTR(rMessage),
+                                          RSTRING_LEN(rMessage));
+
+    if (pMessage == NULL)
+        return;
+
+    PyErr_SetObject(pType, pMessage);
+    Py_DECREF(pMessage);
+}
+
+static void *
+redrat_ruby_run_with_gvl(void *data)
+{
+    redrat_ruby_run_state *rs = data;
+    int                    state = 0;
+    VALUE                  rOk;
+
+#ifdef HAVE_RB_PROFILE_FRAMES
+    bool                   crossed = redrat_prof_cross_enter();
+#endif
+
+    /* As in with_gil, this thread holds the GIL while running Ruby code */
+    redrat_gil_detached += 1;
+    rOk = rb_protect(rs->fn, (VALUE) rs->data, &state);
+    redrat_gil_detached -= 1;
+
+#ifdef HAVE_RB_PROFILE_FRAMES
+    if (crossed)
+        redrat_prof_cross_leave();
+#endif
+
+    if (state != 0)
+    {
+        VALUE rExc = rb_errinfo();
+
+        rb_set_errinfo(Qnil);
+        redrat_ruby_exception_to_python(rExc);
+        rs->ok = false;
+    }
+    else
+        rs->ok = RTEST(rOk);
+
+    return NULL;
+}
+
+/*
+ * redrat_ruby_run - Run Ruby code on behalf of Python
+ *
+ * fn is called with data, holding the GVL, and returns Qtrue on success or
+ * Qfalse with a Python exception set.  Ruby exceptions it raises are turned
+ * into Python ones.  Returns whether fn succeeded.
+ *
+ * This procedure presumes that the Python GIL is already held.
+ */
+static bool
+redrat_ruby_run(VALUE (*fn)(VALUE), void *data)
+{
+    redrat_ruby_run_state rs;
+
+    if (!ruby_native_thread_p())
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "redrat: Ruby objects can only be used from threads "
+                        "started by Ruby");
+        return false;
+    }
+
+    rs.fn = fn;
+    rs.data = data;
+    rs.ok = false;
+
+    if (redrat_gvl_released)
+    {
+#ifdef HAVE_RB_THREAD_CALL_WITH_GVL
+        redrat_gvl_released = false;
+        rb_thread_call_with_gvl(redrat_ruby_run_with_gvl, &rs);
+        redrat_gvl_released = true;
+
+        return rs.ok;
+#else
+        PyErr_SetString(PyExc_RuntimeError,
+                        "redrat: Ruby objects cannot be used from inside of "
+                        "apply_nogvl on this Ruby");
+        return false;
+#endif
+    }
+
+    redrat_ruby_run_with_gvl(&rs);
+
+    return rs.ok;
+}
+
+/*
+ * redrat_ruby_direct_p - Whether this thread can read Ruby objects as it is
+ *
+ * That is, whether it holds the GVL, so that Array elements can be handed to
+ * Python without the detour through redrat_ruby_run.
+ */
+static bool
+redrat_ruby_direct_p(void)
+{
+    return !redrat_gvl_released && ruby_native_thread_p();
+}
+
+/*
+ * redrat_python_arg_to_ruby - Convert a Python value passed to a RubyObject
+ *
+ * Keys, values, operands and arguments from Python are converted the way
+ * Ruby code would expect them: scalars as by redrat_python_scalar_to_ruby,
+ * exact strs and unicode objects to Strings, and anything else handed off.
+ *
+ * Returns Qundef, with a Python exception set, on failure.
+ *
+ * This procedure presumes that the Python GIL and Ruby GVL are already held.
+ */
+static VALUE
+redrat_python_arg_to_ruby(PyObject *p)
+{
+    VALUE r = redrat_python_scalar_to_ruby(p);
+
+    if (r != Qundef)
+        return r;
+
+    if (PyString_CheckExact(p) || PyUnicode_CheckExact(p))
+        return redrat_python_string_to_ruby(p);
+
+    return redrat_ruby_handoff(p);
+}
+
+static void
+redrat_set_key_error(PyObject *pKey)
+{
+    PyObject *pArgs = PyTuple_Pack(1, pKey);
+
+    if (pArgs == NULL)
+        return;
+
+    PyErr_SetObject(PyExc_KeyError, pArgs);
+    Py_DECREF(pArgs);
+}
+
+/*
+ * redrat_hash_find - Look up a key in a Hash, without its default
+ *
+ * Python strings cannot tell a String key from a Symbol one, so when a String
+ * is not found, the Symbol of the same name is tried, and *rKey replaced by
+ * it if it is.
+ */
+static bool
+redrat_hash_find(VALUE rHash, VALUE *rKey, VALUE *rFound)
+{
+    VALUE rName = *rKey;
+    ID    id;
+
+    *rFound = rb_hash_lookup2(rHash, *rKey, Qundef);
+
+    if (*rFound != Qundef)
+        return true;
+
+    if (TYPE(rName) != T_STRING || (id = rb_check_id(&rName)) == 0)
+        return false;
+
+    *rFound = rb_hash_lookup2(rHash, ID2SYM(id), Qundef);
+
+    if (*rFound == Qundef)
+        return false;
+
+    *rKey = ID2SYM(id);
+    return true;
+}
+
+/*
+ * redrat_array_index - Resolve a Python index into an Array
+ *
+ * Negative indices count from the end, as in Python.  Returns false with an
+ * IndexError or TypeError set if the index is out of range or not an index.
+ */
+static bool
+redrat_array_index(VALUE rAry, PyObject *pKey, long *index)
+{
+    Py_ssize_t i;
+
+    if (!PyIndex_Check(pKey))
+    {
+        PyErr_Format(PyExc_TypeError,
+                     "Ruby Array indices must be integers, not %.200s",
+                     Py_TYPE(pKey)->tp_name);
+        return false;
+    }
+
+    i = PyNumber_AsSsize_t(pKey, PyExc_IndexError);
+
+    if (i == -1 && PyErr_Occurred())
+        return false;
+
+    if (i < 0)
+        i += RARRAY_LEN(rAry);
+
+    if (i < 0 || i >= RARRAY_LEN(rAry))
+    {
+        PyErr_SetString(PyExc_IndexError, "Ruby Array index out of range");
+        return false;
+    }
+
+    *index = i;
+    return true;
+}
+
+/*
+ * redrat_array_slice - A slice of an Array, as another Array
+ *
+ * Contiguous slices share memory with the original until either is written.
+ */
+static VALUE
+redrat_array_slice(redrat_rubyop *op)
+{
+    Py_ssize_t start;
+    Py_ssize_t stop;
+    Py_ssize_t step;
+    Py_ssize_t sliceLen;
+    Py_ssize_t i;
+    VALUE      rSlice;
+
+    if (PySlice_GetIndicesEx((PySliceObject *) op->pKey, RARRAY_LEN(op->r),
+                             &start, &stop, &step, &sliceLen) < 0)
+        return Qfalse;
+
+    if (step == 1)
+        rSlice = rb_ary_subseq(op->r, start, sliceLen);
+    else
+    {
+        rSlice = rb_ary_new_capa(sliceLen);
+
+        for (i = 0; i < sliceLen; i += 1)
+            rb_ary_push(rSlice, rb_ary_entry(op->r, start + i * step));
+    }
+
+    op->pResult = redrat_python_handoff(rSlice);
+
+    return (op->pResult != NULL) ? Qtrue : Qfalse;
+}
+
+static VALUE
+redrat_rubyobject_length_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+
+    op->n = NUM2SSIZET(rb_funcall(op->r, redrat_id_size, 0));
+
+    if (op->n < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Ruby size is negative");
+        return Qfalse;
+    }
+
+    return Qtrue;
+}
+
+/*
+ * redrat_rubyobject_length - len() of a RubyObject
+ *
+ * Arrays and Hashes are measured without running any Ruby code, so long as
+ * this thread holds the GVL, and anything else is asked for its size.
+ */
+static Py_ssize_t
+redrat_rubyobject_length(PyObject *self)
+{
+    redrat_rubyop op;
+
+    op.r = ((redrat_RubyObject *) self)->r;
+
+    if (redrat_ruby_direct_p())
+    {
+        if (TYPE(op.r) == T_ARRAY)
+            return RARRAY_LEN(op.r);
+        else if (TYPE(op.r) == T_HASH)
+            return RHASH_SIZE(op.r);
+    }
+
+    if (!redrat_ruby_run(redrat_rubyobject_length_r, &op))
+        return -1;
+
+    return op.n;
+}
+
+static VALUE
+redrat_rubyobject_item_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    VALUE          rItem;
+
+    if (TYPE(op->r) == T_ARRAY)
+    {
+        if (op->n < 0 || op->n >= RARRAY_LEN(op->r))
+        {
+            PyErr_SetString(PyExc_IndexError, "Ruby Array index out of range");
+            return Qfalse;
+        }
+
+        rItem = RARRAY_AREF(op->r, op->n);
+    }
+    else
+        rItem = rb_funcall(op->r, redrat_id_aref, 1, LONG2NUM(op->n));
+
+    op->pResult = redrat_python_handoff(rItem);
+
+    return (op->pResult != NULL) ? Qtrue : Qfalse;
+}
+
+/*
+ * redrat_rubyobject_item - Indexing by an int, as in sequences
+ *
+ * Python has already added the length to negative indices.
+ */
+static PyObject *
+redrat_rubyobject_item(PyObject *self, Py_ssize_t i)
+{
+    redrat_rubyop op;
+
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.n = i;
+    op.pResult = NULL;
+
+    if (TYPE(op.r) == T_ARRAY && redrat_ruby_direct_p())
+        redrat_rubyobject_item_r((VALUE) &op);
+    else
+        redrat_ruby_run(redrat_rubyobject_item_r, &op);
+
+    return op.pResult;
+}
+
+static VALUE
+redrat_rubyobject_subscript_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    VALUE          rKey;
+    VALUE          rFound;
+    long           i;
+
+    if (TYPE(op->r) == T_ARRAY)
+    {
+        if (PySlice_Check(op->pKey))
+            return redrat_array_slice(op);
+
+        if (!redrat_array_index(op->r, op->pKey, &i))
+            return Qfalse;
+
+        op->pResult = redrat_python_handoff(RARRAY_AREF(op->r, i));
+
+        return (op->pResult != NULL) ? Qtrue : Qfalse;
+    }
+
+    rKey = redrat_python_arg_to_ruby(op->pKey);
+
+    if (rKey == Qundef)
+        return Qfalse;
+
+    if (TYPE(op->r) != T_HASH)
+        rFound = rb_funcall(op->r, redrat_id_aref, 1, rKey);
+    else if (!redrat_hash_find(op->r, &rKey, &rFound))
+    {
+        redrat_set_key_error(op->pKey);
+        return Qfalse;
+    }
+
+    op->pResult = redrat_python_handoff(rFound);
+
+    return (op->pResult != NULL) ? Qtrue : Qfalse;
+}
+
+/*
+ * redrat_rubyobject_subscript - Indexing, as in mappings
+ *
+ * Arrays take ints and slices, with Python's rules for negative indices and
+ * ranges.  Hashes behave like dicts: a missing key raises KeyError, rather
+ * than giving the Hash's default.  Anything else is sent [].
+ */
+static PyObject *
+redrat_rubyobject_subscript(PyObject *self, PyObject *pKey)
+{
+    redrat_rubyop op;
+
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.pKey = pKey;
+    op.pResult = NULL;
+
+    if (TYPE(op.r) == T_ARRAY && !PySlice_Check(pKey) &&
+        redrat_ruby_direct_p())
+        redrat_rubyobject_subscript_r((VALUE) &op);
+    else
+        redrat_ruby_run(redrat_rubyobject_subscript_r, &op);
+
+    return op.pResult;
+}
+
+static VALUE
+redrat_rubyobject_ass_subscript_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    VALUE          rKey;
+    VALUE          rValue = Qundef;
+    VALUE          rFound;
+    long           i;
+
+    if (op->pValue != NULL)
+    {
+        rValue = redrat_python_arg_to_ruby(op->pValue);
+
+        if (rValue == Qundef)
+            return Qfalse;
+    }
+
+    if (TYPE(op->r) == T_ARRAY)
+    {
+        if (!redrat_array_index(op->r, op->pKey, &i))
+            return Qfalse;
+
+        if (rValue == Qundef)
+            rb_ary_delete_at(op->r, i);
+        else
+            rb_ary_store(op->r, i, rValue);
+
+        return Qtrue;
+    }
+
+    rKey = redrat_python_arg_to_ruby(op->pKey);
+
+    if (rKey == Qundef)
+        return Qfalse;
+
+    if (TYPE(op->r) != T_HASH)
+    {
+        if (rValue == Qundef)
+            rb_funcall(op->r, redrat_id_delete, 1, rKey);
+        else
+            rb_funcall(op->r, redrat_id_aset, 2, rKey, rValue);
+
+        return Qtrue;
+    }
+
+    if (!redrat_hash_find(op->r, &rKey, &rFound) && rValue == Qundef)
+    {
+        redrat_set_key_error(op->pKey);
+        return Qfalse;
+    }
+
+    if (rValue == Qundef)
+        rb_funcall(op->r, redrat_id_delete, 1, rKey);
+    else
+        rb_hash_aset(op->r, rKey, rValue);
+
+    return Qtrue;
+}
+
+/*
+ * redrat_rubyobject_ass_subscript - Item assignment and deletion
+ *
+ * Arrays can be assigned to and deleted from within their bounds, and do not
+ * grow.  Hashes behave like dicts.  Anything else is sent []= or delete.
+ */
+static int
+redrat_rubyobject_ass_subscript(PyObject *self, PyObject *pKey,
+                                PyObject *pValue)
+{
+    redrat_rubyop op;
+
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.pKey = pKey;
+    op.pValue = pValue;
+
+    return redrat_ruby_run(redrat_rubyobject_ass_subscript_r, &op) ? 0 : -1;
+}
+
+static VALUE
+redrat_rubyobject_contains_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    VALUE          rKey;
+    VALUE          rFound;
+
+    rKey = redrat_python_arg_to_ruby(op->pKey);
+
+    if (rKey == Qundef)
+        return Qfalse;
+
+    if (TYPE(op->r) == T_ARRAY)
+        op->n = RTEST(rb_ary_includes(op->r, rKey));
+    else if (TYPE(op->r) == T_HASH)
+        op->n = redrat_hash_find(op->r, &rKey, &rFound);
+    else
+        op->n = RTEST(rb_funcall(op->r, redrat_id_include_p, 1, rKey));
+
+    return Qtrue;
+}
+
+/*
+ * redrat_rubyobject_contains - The in operator
+ *
+ * Arrays are searched for an element, Hashes for a key, and anything else is
+ * asked include?.
+ */
+static int
+redrat_rubyobject_contains(PyObject *self, PyObject *pKey)
+{
+    redrat_rubyop op;
 
-    PyGILState_Release(gstate);
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.pKey = pKey;
 
-    if (rExcGetBuiltin != Qnil)
-        redrat_rb_exc_raise(rExcGetBuiltin,
-                            "redrat_ext: couldn't read Python builtins, "
-                            "RedRat cannot initialize");
-    else
-        rb_fatal("redrat_ext: report this bug in redrat_builtin_mapping");
+    if (!redrat_ruby_run(redrat_rubyobject_contains_r, &op))
+        return -1;
 
-    Assert(false);
+    return (int) op.n;
 }
 
 static VALUE
-redrat_apply(int argc, VALUE *argv, VALUE self)
+redrat_rubyobject_hash_r(VALUE data)
 {
-    PyGILState_STATE    gstate;
+    redrat_rubyop *op = (void *) data;
 
-    PyObject *pMaybeCallable;
-    PyObject *pArgs = NULL;
-    PyObject *pResult;
-
-    VALUE rExcStringConvert = Qnil;
-    VALUE rExcApplication   = Qnil;
-    VALUE rResult;
+    op->n = NUM2LONG(rb_hash(op->r));
 
-    int argIter;
+    return Qtrue;
+}
 
-    /* Reject zero arguments */
-    if (argc == 0)
-        rb_raise(rb_eArgError,
-                 "redrat_ext: apply must take at least one argument");
+/*
+ * redrat_rubyobject_hash - hash(), from Ruby's hash
+ */
+static long
+redrat_rubyobject_hash(PyObject *self)
+{
+    redrat_rubyop op;
 
-    gstate = PyGILState_Ensure();
+    op.r = ((redrat_RubyObject *) self)->r;
 
-    pMaybeCallable = redrat_python_handoff(argv[0]);
-    Py_INCREF(pMaybeCallable);
+    if (!redrat_ruby_run(redrat_rubyobject_hash_r, &op))
+        return -1;
 
-    /*
-     * Gin up an argument tuple for the function.
-     *
-     * The first Ruby argument to this function is not counted towards this, so
-     * adjust the tuple size accordingly.
-     */
-    pArgs = PyTuple_New(argc - 1);
+    /* -1 signals an error to Python */
+    return (op.n == -1) ? -2 : (long) op.n;
+}
 
-    for (argIter = 1; argIter < argc; argIter += 1)
+static VALUE
+redrat_rubyobject_call_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    Py_ssize_t     nargs = PyTuple_GET_SIZE(op->pKey);
+    Py_ssize_t     i;
+    Py_ssize_t     pos = 0;
+    PyObject      *pName;
+    PyObject      *pValue;
+    VALUE          rArgs;
+    VALUE          rKwargs = Qnil;
+    VALUE          rResult;
+
+    if (!rb_respond_to(op->r, redrat_id_call))
     {
-        const Py_ssize_t         tupleWritePosition = argIter - 1;
-        const VALUE              rCurrentArg        = argv[argIter];
-        PyObject                *pArg;
+        PyErr_SetString(PyExc_TypeError,
+                        "'redrat.RubyObject' object is not callable");
+        return Qfalse;
+    }
 
-        Assert(PyTuple_Size(pArgs) > tupleWritePosition);
+    rArgs = rb_ary_new_capa(nargs + 1);
 
-        pArg = redrat_python_handoff(rCurrentArg);
+    for (i = 0; i < nargs; i += 1)
+    {
+        VALUE rArg = redrat_python_arg_to_ruby(PyTuple_GET_ITEM(op->pKey, i));
+
+        if (rArg == Qundef)
+            return Qfalse;
 
-        PyTuple_SET_ITEM(pArgs, tupleWritePosition, pArg);
+        rb_ary_push(rArgs, rArg);
     }
 
-    pResult = PyObject_Call(pMaybeCallable, pArgs, NULL);
-    REDRAT_ERRJMP_PYEXC(rExcApplication, pResult);
+    if (op->pValue != NULL && PyDict_Size(op->pValue) > 0)
+    {
+        rKwargs = rb_hash_new();
 
-    rResult = redrat_ruby_handoff(pResult);
+        while (PyDict_Next(op->pValue, &pos, &pName, &pValue))
+        {
+            VALUE rName = redrat_python_arg_to_ruby(pName);
+            VALUE rValue = redrat_python_arg_to_ruby(pValue);
 
-    Py_DECREF(pMaybeCallable);
-    Py_DECREF(pArgs);
-    Py_DECREF(pResult);
+            if (rName == Qundef || rValue == Qundef)
+                return Qfalse;
 
-    PyGILState_Release(gstate);
-    return rResult;
+            rb_hash_aset(rKwargs, rb_str_intern(rName), rValue);
+        }
 
-py_rb_error:
-    Py_XDECREF(pArgs);
-    Py_XDECREF(pResult);
+        rb_ary_push(rArgs, rKwargs);
+    }
 
-    PyGILState_Release(gstate);
+#ifdef HAVE_RB_FUNCALLV_KW
+    rResult = rb_funcallv_kw(op->r, redrat_id_call, (int) RARRAY_LEN(rArgs),
+                             RARRAY_CONST_PTR(rArgs),
+                             (rKwargs == Qnil) ?
+                             RB_NO_KEYWORDS : RB_PASS_KEYWORDS);
+#else
+    rResult = rb_funcallv(op->r, redrat_id_call, (int) RARRAY_LEN(rArgs),
+                          RARRAY_CONST_PTR(rArgs));
+#endif
 
-    if (rExcApplication != Qnil)
-        redrat_rb_exc_raise(rExcApplication,
-                            "redrat_ext: applied function raised an error");
-    else if (rExcStringConvert != Qnil)
-        redrat_rb_exc_raise(rExcStringConvert,
-                            "redrat_ext: could not convert a Ruby string to a "
-                            "Python string during function application");
+    RB_GC_GUARD(rArgs);
+    op->pResult = redrat_python_handoff(rResult);
 
-    Assert(false);
+    return (op->pResult != NULL) ? Qtrue : Qfalse;
 }
 
-static VALUE
-redrat_truth(VALUE self, VALUE rVal)
+/*
+ * redrat_rubyobject_call - Calling a RubyObject sends it call
+ *
+ * So Procs, Methods and anything else with a call method can be used as
+ * Python callables.  Keyword arguments are passed as Ruby keywords.
+ */
+static PyObject *
+redrat_rubyobject_call(PyObject *self, PyObject *pArgs, PyObject *pKwargs)
 {
-    PyGILState_STATE gstate;
+    redrat_rubyop op;
 
-    PyObject *pVal;
-    VALUE     rTruth;
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.pKey = pArgs;
+    op.pValue = pKwargs;
+    op.pResult = NULL;
 
-    if (!REDRAT_PYTHONVALUE_P(rVal))
-        rb_raise(rb_eArgError,
-                 "redrat_ext: truth can only accept a PythonValue");
+    redrat_ruby_run(redrat_rubyobject_call_r, &op);
 
-    Assert(REDRAT_PYTHONVALUE_P(rVal));
-    Data_Get_Struct(rVal, PyObject, pVal);
+    return op.pResult;
+}
 
-    gstate = PyGILState_Ensure();
+static VALUE
+redrat_rubyobject_richcompare_r(VALUE data)
+{
+    redrat_rubyop *op = (void *) data;
+    VALUE          rOther;
+    VALUE          rCmp;
+    bool           truth;
+    int            cmp;
 
-    switch (PyObject_Not(pVal))
+    rOther = redrat_python_arg_to_ruby(op->pKey);
+
+    if (rOther == Qundef)
+        return Qfalse;
+
+    if (op->op == Py_EQ || op->op == Py_NE)
+        truth = (rb_equal(op->r, rOther) == Qtrue) == (op->op == Py_EQ);
+    else
     {
-        case -1:
-            goto py_rb_error;
-        case 0:
-            rTruth = Qtrue;
-            break;
-        case 1:
-            rTruth = Qfalse;
-            break;
-        default:
-            Assert(false);
-            rb_fatal("redrat_ext: received totally unexpected return code in "
-                     "redrat_truth");
-            rTruth = Qnil;
+        rCmp = rb_funcall(op->r, redrat_id_cmp, 1, rOther);
+
+        if (NIL_P(rCmp))
+        {
+            Py_INCREF(Py_NotImplemented);
+            op->pResult = Py_NotImplemented;
+
+            return Qtrue;
+        }
+
+        cmp = rb_cmpint(rCmp, op->r, rOther);
+
+        switch (op->op)
+        {
+            case Py_LT:
+                truth = cmp < 0;
+                break;
+            case Py_LE:
+                truth = cmp <= 0;
+                break;
+            case Py_GT:
+                truth = cmp > 0;
+                break;
+            default:
+                truth = cmp >= 0;
+                break;
+        }
     }
 
-    PyGILState_Release(gstate);
+    op->pResult = PyBool_FromLong(truth);
 
-    return rTruth;
+    return Qtrue;
+}
 
-py_rb_error:
-    {
-        VALUE     rExc;
+/*
+ * redrat_rubyobject_richcompare - Comparisons, through == and <=>
+ *
+ * Orderings Ruby has no answer for, where <=> gives nil, are left to Python.
+ */
+static PyObject *
+redrat_rubyobject_richcompare(PyObject *self, PyObject *pOther, int op)
+{
+    redrat_rubyop rop;
 
-        /*
-         * Assumption: getting here means that a Python Exception will be
-         * found.  That may be a false one, though, and in general this
-         * function will screw up the GIL state when that happens.
-         */
-        rExc = redrat_exception_convert();
-        PyErr_Clear();
+    rop.r = ((redrat_RubyObject *) self)->r;
+    rop.pKey = pOther;
+    rop.op = op;
+    rop.pResult = NULL;
 
-        PyGILState_Release(gstate);
+    redrat_ruby_run(redrat_rubyobject_richcompare_r, &rop);
 
-        redrat_rb_exc_raise(
-            rExc, "redrat_ext: could not compute truth value for PythonValue");
-        Assert(false);
-    }
+    return rop.pResult;
 }
 
 static VALUE
-redrat_unicode(VALUE self, VALUE rVal)
+redrat_rubyobject_iter_r(VALUE data)
 {
-    if (TYPE(rVal) == T_STRING)
+    redrat_rubyop       *op = (void *) data;
+    redrat_RubyIterator *pIter;
+    VALUE                rSource = op->r;
+    long                 index = 0;
+
+    if (TYPE(rSource) == T_HASH)
+        rSource = rb_funcall(rSource, redrat_id_keys, 0);
+    else if (TYPE(rSource) != T_ARRAY)
     {
-        PyGILState_STATE gstate = PyGILState_Ensure();
+        if (!rb_respond_to(rSource, redrat_id_each))
+        {
+            PyErr_Format(PyExc_TypeError, "Ruby %.200s is not iterable",
+                         rb_obj_classname(rSource));
+            return Qfalse;
+        }
+
+        rSource = rb_funcall(rSource, redrat_id_to_enum, 0);
+        index = -1;
+    }
 
-        PyObject *pUnicode;
-        VALUE     rExcPythonUnicode = Qnil;
-        VALUE     rRetVal;
+    pIter = (void *) redrat_RubyIteratorType.tp_alloc(&redrat_RubyIteratorType,
+                                                       0);
 
-        pUnicode = redrat_ruby_string_to_python(rVal);
-        REDRAT_ERRJMP_PYEXC(rExcPythonUnicode, pUnicode);
+    if (pIter == NULL)
+        return Qfalse;
 
-        rRetVal = redrat_ruby_handoff(pUnicode);
-        Py_DECREF(pUnicode);
+    pIter->r = rSource;
+    pIter->root = redrat_root_add(rSource);
+    pIter->index = index;
 
-        PyGILState_Release(gstate);
+    op->pResult = (PyObject *) pIter;
 
-        return rRetVal;
+    return Qtrue;
+}
 
-    py_rb_error:
-        /*
-         * This is the only error path, so this should never be non-NULL, yet
-         * do the normal XDECREF handling for idiom's sake.
-         */
-        Assert(pUnicode == NULL);
-        Py_XDECREF(pUnicode);
+/*
+ * redrat_rubyobject_iter - iter() of a RubyObject
+ *
+ * Arrays are walked with an index, so that nothing is copied, and see
+ * elements appended during iteration.  Hashes iterate over their keys, like
+ * dicts, from a snapshot of them.  Anything else with an each method is
+ * iterated through an Enumerator.
+ */
+static PyObject *
+redrat_rubyobject_iter(PyObject *self)
+{
+    redrat_rubyop op;
 
-        PyGILState_Release(gstate);
+    op.r = ((redrat_RubyObject *) self)->r;
+    op.pResult = NULL;
 
-        /*
-         * There is only one error path, so this must be the exception
-         * condition raised, but follow the usual error handling protocol
-         * anyway, which involves checking the exception for Nillity.
-         */
-        Assert(rExcPythonUnicode != Qnil);
-        if (rExcPythonUnicode != Qnil)
-            redrat_rb_exc_raise(
-                rExcPythonUnicode,
-                "redrat_exc: could not construct PythonValue from "
-                "Ruby String");
+    redrat_ruby_run(redrat_rubyobject_iter_r, &op);
 
-        Assert(false);
-    }
-    else
-        rb_raise(rb_eArgError,
-                 "redrat_ext: Only Ruby Strings are accepted when "
-                 "constructing Python Unicode");
+    return op.pResult;
 }
 
-#define redrat_stringify_generate(lowcase, upcase)                            \
-    static VALUE                                                              \
-    redrat_##lowcase(VALUE self, VALUE rPythonValue)                          \
-    {                                                                         \
-        PyGILState_STATE  gstate;                                             \
-        PyObject         *pThing;                                             \
-        PyObject         *pString = NULL;                                     \
-        VALUE             r;                                                  \
-        VALUE             rExcCant;                                           \
-                                                                              \
-        Data_Get_Struct(rPythonValue, PyObject, pThing);                      \
-                                                                              \
-        gstate = PyGILState_Ensure();                                         \
-                                                                              \
-        pString = PyObject_##upcase(pThing);                                  \
-        REDRAT_ERRJMP_PYEXC(rExcCant, pString);                               \
-        Assert(PyString_Check(pString));                                      \
-        r = rb_str_new2(PyString_AsString(pString));                          \
-        Py_DECREF(pString);                                                   \
-                                                                              \
-        PyGILState_Release(gstate);                                           \
-                                                                              \
-        return r;                                                             \
-                                                                              \
-    py_rb_error:                                                              \
-        Py_XDECREF(pString);                                                  \
-                                                                              \
-        PyGILState_Release(gstate);                                           \
-                                                                              \
-        if (rExcCant != Qnil)                                                 \
-            redrat_rb_exc_raise(                                              \
-                rExcCant,                                                     \
-                "redrat_ext: could not compute representation of "            \
-                "Python object");                                             \
-    }
-
-redrat_stringify_generate(repr, Repr)
-redrat_stringify_generate(str, Str)
+static VALUE
+redrat_enumerator_next(VALUE rEnum)
+{
+    return rb_funcall(rEnum, redrat_id_next, 0);
+}
 
-void
-Init_redrat_ext()
+static VALUE
+redrat_enumerator_stopped(VALUE unused, VALUE rExc)
 {
-    rb_mRedRat = rb_define_module("RedRat");
-    rb_mRedRatInternal = rb_define_module_under(rb_mRedRat, "Internal");
+    return Qundef;
+}
 
-    rb_define_module_function(rb_mRedRatInternal, "builtins",
-                              redrat_builtin_mapping, 0);
-    rb_define_module_function(rb_mRedRatInternal, "apply", redrat_apply, -1);
-    rb_define_module_function(
-        rb_mRedRatInternal, "unicode", redrat_unicode, 1);
-    rb_define_module_function(
-        rb_mRedRatInternal, "getattr", redrat_getattr, 2);
-    rb_define_module_function(rb_mRedRatInternal, "truth", redrat_truth, 1);
+/*
+ * Leaves op->pResult NULL, with no Python exception set, once the iterator is
+ * exhausted.
+ */
+static VALUE
+redrat_rubyiterator_next_r(VALUE data)
+{
+    redrat_rubyop       *op = (void *) data;
+    redrat_RubyIterator *pIter = (void *) op->pKey;
+    VALUE                rItem;
 
-    /* Generated, see redrat_stringify_generate */
-    rb_define_module_function(rb_mRedRatInternal, "repr", redrat_repr, 1);
-    rb_define_module_function(rb_mRedRatInternal, "str", redrat_str, 1);
+    if (pIter->index >= 0)
+    {
+        if (pIter->index >= RARRAY_LEN(pIter->r))
+            return Qtrue;
 
-    rb_cPythonValue = rb_define_class_under(rb_mRedRatInternal,
-                                            "PythonValue", rb_cObject);
+        rItem = RARRAY_AREF(pIter->r, pIter->index);
+        pIter->index += 1;
+    }
+    else
+    {
+        rItem = rb_rescue2(redrat_enumerator_next, pIter->r,
+                           redrat_enumerator_stopped, Qnil,
+                           rb_eStopIteration, (VALUE) 0);
 
-    /*
-     * The RedRatException type, which wraps (optionally) a RedRat reason for
-     * the exception as well as the underlying python_exception, which can be
-     * inspected as a normal PythonValue would.
-     */
-    rb_eRedRatException = rb_define_class_under(rb_mRedRatInternal,
-                                                "RedRatException",
-                                                rb_eStandardError);
-    rb_define_attr(rb_eRedRatException, "redrat_reason", 1, 0);
-    rb_define_attr(rb_eRedRatException, "python_type", 1, 1);
-    rb_define_attr(rb_eRedRatException, "python_value", 1, 1);
-    rb_define_attr(rb_eRedRatException, "python_traceback", 1, 1);
+        if (rItem == Qundef)
+            return Qtrue;
+    }
 
-    Py_Initialize();
+    op->pResult = redrat_python_handoff(rItem);
 
-    /* Initialize the redrat module in Python */
-    initredrat();
+    return (op->pResult != NULL) ? Qtrue : Qfalse;
 }
 
+static PyObject *
+redrat_rubyiterator_next(PyObject *self)
+{
+    redrat_rubyop op;
 
-/* Python Constructs */
-
-/*
- * The inverse of PythonValue in RedRat for Ruby is RubyObject in Python.  This
- * is useful so that one can write Ruby classes that can be sent into Python
- * classes, or even send standard Ruby Hashes, Arrays, and Unicode directly to
- * Python, without marshalling or copying, so long as they are taught the right
- * operator conventions.
- */
+    op.pKey = self;
+    op.pResult = NULL;
 
-static PyMethodDef rubyobject_methods[] = {
-    {NULL}  /* Sentinel */
-};
+    if (((redrat_RubyIterator *) self)->index >= 0 && redrat_ruby_direct_p())
+        redrat_rubyiterator_next_r((VALUE) &op);
+    else
+        redrat_ruby_run(redrat_rubyiterator_next_r, &op);
 
-static void
-redrat_rubyobject_dealloc(redrat_RubyObject* self)
-{
-    /*
-     * Notify Ruby that this value is no longer required by Python.  Analogous
-     * to its Ruby inverse, redrat_py_decref_wrap.
-     */
-    rb_gc_unregister_address(&(self->r));
-    self->ob_type->tp_free((PyObject*)self);
+    return op.pResult;
 }
 
 /*
  * redrat_python_handoff - Hands off a Ruby VALUE to Python
  *
- * If this PyObject is of type RubyObject, then just return the unwrapped Ruby
- * object inside.
+ * If this VALUE is of type PythonValue, then just return the unwrapped Python
+ * object inside.  nil, true, false, Integers, Floats and Symbols are converted
+ * to their Python equivalents (Symbols to interned strs), and anything else is
+ * wrapped in a RubyObject.  Either way, the caller receives a new reference.
  *
  * This procedure presumes that the Python GIL and Ruby GILs are already held.
  *
  * This includes the hybridization of Ruby and Python GC.  To do this, Python
- * will get its own global variable reference (via rb_gc_register_address) and
- * in the destructor for a RubyObject the inverse, rb_gc_unregister_address
- * must be called.
+ * will get its own root for the value (via redrat_root_add) and in the
+ * destructor for a RubyObject the inverse, redrat_root_remove, must be called.
  */
 static PyObject *
 redrat_python_handoff(VALUE r)
 {
+    redrat_RubyObject *pyr;
+
     if (REDRAT_PYTHONVALUE_P(r))
     {
         PyObject *ret;
 
         Data_Get_Struct(r, PyObject, ret);
 
+        if (ret == NULL)
+        {
+            PyErr_SetString(PyExc_RuntimeError, REDRAT_RELEASED_MESSAGE);
+            return NULL;
+        }
+
+        Py_INCREF(ret);
+
+        /* The executor and interpreter threads share at submission */
+        if (ruby_native_thread_p())
+            redrat_pythonvalue_share(r);
+
         return ret;
     }
-    else
-    {
-        redrat_RubyObject *pyr;
 
-        /*
-         * Notify Ruby that this value has a reference somewhere otherwise
-         * unknown to its mark-sweep collection pass, as so the value does not
-         * get GCed while Python has references still.
-         */
-        rb_gc_register_address(&r);
-        pyr = (void *) redrat_RubyType.tp_alloc(&redrat_RubyType, 0);
-        pyr->r = r;
-        return (PyObject *) pyr;
+    switch (TYPE(r))
+    {
+        case T_NIL:
+            Py_RETURN_NONE;
+        case T_TRUE:
+            Py_RETURN_TRUE;
+        case T_FALSE:
+            Py_RETURN_FALSE;
+        case T_FIXNUM:
+        case T_BIGNUM:
+            return redrat_ruby_integer_to_python(r);
+        case T_FLOAT:
+            return PyFloat_FromDouble(RFLOAT_VALUE(r));
+        case T_SYMBOL:
+            return redrat_ruby_symbol_to_python_string(r);
+        default:
+            break;
     }
+
+    pyr = (void *) redrat_RubyType.tp_alloc(&redrat_RubyType, 0);
+
+    if (pyr == NULL)
+        return NULL;
+
+    /*
+     * Notify Ruby that this value has a reference somewhere otherwise
+     * unknown to its mark-sweep collection pass, as so the value does not
+     * get GCed while Python has references still.
+     */
+    pyr->r = r;
+    pyr->root = redrat_root_add(r);
+    PyObject_GC_Track(pyr);
+    return (PyObject *) pyr;
 }
 
 PyMODINIT_FUNC
@@ -740,7 +10409,17 @@ initredrat(void)
 {
     PyObject *m;
 
-    redrat_RubyType.tp_new = PyType_GenericNew;
+    /*
+     * No tp_new: a RubyObject only means something wrapping a Ruby value, and
+     * only redrat_python_handoff can give it one, and a root in redrat_roots.
+     */
+    redrat_RubyType.tp_alloc = redrat_slab_alloc;
+    redrat_RubyType.tp_free = redrat_slab_free;
+    redrat_RubyBufferType.tp_alloc = redrat_slab_alloc;
+    redrat_RubyBufferType.tp_free = redrat_slab_free;
+    redrat_RubyIteratorType.tp_alloc = redrat_slab_alloc;
+    redrat_RubyIteratorType.tp_free = redrat_slab_free;
+
     if (PyType_Ready(&redrat_RubyType) < 0)
         return;
 
@@ -749,4 +10428,17 @@ initredrat(void)
 
     Py_INCREF(&redrat_RubyType);
     PyModule_AddObject(m, "RubyObject", (PyObject *) &redrat_RubyType);
+
+    if (PyType_Ready(&redrat_RubyBufferType) < 0)
+        return;
+
+    Py_INCREF(&redrat_RubyBufferType);
+    PyModule_AddObject(m, "RubyBuffer", (PyObject *) &redrat_RubyBufferType);
+
+    if (PyType_Ready(&redrat_RubyIteratorType) < 0)
+        return;
+
+    Py_INCREF(&redrat_RubyIteratorType);
+    PyModule_AddObject(m, "RubyIterator",
+                       (PyObject *) &redrat_RubyIteratorType);
 }
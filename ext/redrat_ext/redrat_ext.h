@@ -1,9 +1,17 @@
 #ifndef REDRAT_EXT_H
 #define REDRAT_EXT_H
 
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #ifdef RUBY_EXTCONF_H
 #include RUBY_EXTCONF_H
@@ -14,6 +22,44 @@
 #define false 0
 
 #include "Python.h"
+#include "frameobject.h"
+#include "pythread.h"
 #include "ruby.h"
+#include "ruby/encoding.h"
+
+#ifdef HAVE_RUBY_THREAD_H
+#include "ruby/thread.h"
+#endif
+
+#ifdef HAVE_RUBY_DEBUG_H
+#include "ruby/debug.h"
+#endif
+
+#ifdef HAVE_LINUX_FUTEX_H
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <marshal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+#include "ruby/io.h"
+#include "ruby/fiber/scheduler.h"
+#endif
+
+/*
+ * Storage class for per-thread state.  Ruby threads are native threads, so
+ * this is per Ruby thread as well.
+ */
+#ifdef __GNUC__
+#define REDRAT_THREAD_LOCAL __thread
+#else
+#define REDRAT_THREAD_LOCAL _Thread_local
+#endif
 
 #endif /* REDRAT_EXT_H*/
@@ -116,4 +116,1512 @@ class TestRedrat < Test::Unit::TestCase
       raise
     end
   end
+
+  def test_with_gil
+    str = get_builtin('str')
+
+    result = RedRat::Internal::with_gil {
+      RedRat::Internal::with_gil {
+        RedRat::Internal::apply(str, RedRat::Internal::unicode('nested'))
+      }
+    }
+
+    if RedRat::Internal::str(result) != 'nested'
+      raise
+    end
+  end
+
+  def test_with_gil_released_on_raise
+    begin
+      RedRat::Internal::with_gil { raise IndexError }
+    rescue IndexError
+    end
+
+    # Another thread could not get the GIL if the session leaked it
+    Thread.new { get_builtin('str') }.join
+  end
+
+  def test_with_gil_contended
+    str = get_builtin('str')
+
+    threads = (1..4).map { |i|
+      Thread.new {
+        200.times {
+          RedRat::Internal::with_gil {
+            Thread.pass
+            RedRat::Internal::apply(str, RedRat::Internal::unicode(i.to_s))
+          }
+          RedRat::Internal::apply(str, RedRat::Internal::unicode(i.to_s))
+        }
+      }
+    }
+
+    threads.each { |t| t.join }
+  end
+
+  def test_apply_nogvl
+    str = get_builtin('str')
+    p_hi = RedRat::Internal::apply_nogvl(str, RedRat::Internal::unicode('hi'))
+
+    if RedRat::Internal::str(p_hi) != 'hi'
+      raise
+    end
+
+    begin
+      RedRat::Internal::apply_nogvl(get_builtin('int'),
+                                    RedRat::Internal::unicode('nope'))
+      raise
+    rescue RedRat::Internal::RedRatException => e
+      e.python_value
+    end
+  end
+
+  def test_apply_nogvl_lets_threads_run
+    import = get_builtin '__import__'
+    time = RedRat::Internal::apply(import, RedRat::Internal::unicode('time'))
+    sleep = RedRat::Internal::getattr(time, RedRat::Internal::unicode('sleep'))
+    seconds = RedRat::Internal::apply(get_builtin('float'),
+                                      RedRat::Internal::unicode('0.2'))
+
+    count = 0
+    started = Queue.new
+    counter = Thread.new {
+      started << true
+      loop { count += 1; Thread.pass }
+    }
+    started.pop
+
+    before = count
+    RedRat::Internal::apply_nogvl(sleep, seconds)
+    after = count
+    counter.kill
+
+    if after == before
+      raise
+    end
+  end
+
+  def test_ruby_objects_survive_gc_while_in_python
+    py_list = RedRat::Internal::apply(get_builtin('list'))
+    append = RedRat::Internal::getattr(py_list,
+                                       RedRat::Internal::unicode('append'))
+    100.times { |i| RedRat::Internal::apply(append, "ruby #{i}") }
+
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+
+    getitem = RedRat::Internal::getattr(
+      py_list, RedRat::Internal::unicode('__getitem__'))
+    ['0', '50', '99'].each { |i|
+      item = RedRat::Internal::apply(
+        getitem,
+        RedRat::Internal::apply(get_builtin('int'),
+                                RedRat::Internal::unicode(i)))
+
+      if item != "ruby #{i}"
+        raise
+      end
+    }
+
+    # Python cannot make RubyObjects of its own, which would have no root
+    2.times {
+      begin
+        RedRat::Internal::eval(
+          RedRat::Internal::compile("__import__('redrat').RubyObject()"))
+        raise
+      rescue RedRat::TypeError => e
+        raise if e.message !~ /cannot create/
+      end
+    }
+    raise if RedRat::Internal::apply(getitem, 99) != 'ruby 99'
+
+    # Clears the list, releasing every root
+    RedRat::Internal::apply(
+      RedRat::Internal::getattr(py_list, RedRat::Internal::unicode('__init__')))
+    GC.start
+  end
+
+  def test_decref_queue
+    str = get_builtin('str')
+    before = RedRat::Internal::decref_queue_stats
+
+    1000.times { RedRat::Internal::apply(str, RedRat::Internal::unicode('x')) }
+    GC.start
+
+    # Any call into Python drains the queue
+    RedRat::Internal::truth(str)
+    after = RedRat::Internal::decref_queue_stats
+
+    if after[:enqueued] <= before[:enqueued] || after[:depth] != 0
+      raise
+    end
+
+    if after[:drained] - before[:drained] != after[:enqueued] - before[:enqueued]
+      raise
+    end
+  end
+
+  def test_getattr_symbol_and_string
+    str = get_builtin('str')
+    p_hi = RedRat::Internal::apply(str, RedRat::Internal::unicode('hi'))
+
+    [:upper, 'upper', RedRat::Internal::unicode('upper')].each { |name|
+      upper = RedRat::Internal::getattr(p_hi, name)
+
+      if RedRat::Internal::str(RedRat::Internal::apply(upper)) != 'HI'
+        raise
+      end
+    }
+
+    # A String that no Symbol exists for
+    begin
+      RedRat::Internal::getattr(p_hi, 'redrat_never_interned')
+      raise
+    rescue RedRat::Internal::RedRatException => e
+      if RedRat::Internal::repr(e.python_type) !~ /AttributeError/
+        raise
+      end
+    end
+  end
+
+  def test_dynamic_symbols_are_not_pinned
+    str = get_builtin('str')
+    p_hi = RedRat::Internal::apply(str, RedRat::Internal::unicode('hi'))
+
+    200.times { |i|
+      name = "redrat_dynamic_#{i}".to_sym
+
+      begin
+        RedRat::Internal::getattr(p_hi, name)
+        raise
+      rescue RedRat::Internal::RedRatException
+      end
+
+      RedRat::Internal::to_python(name)
+    }
+
+    # Dynamic Symbols nothing refers to any longer can be collected
+    GC.start
+    left = Symbol.all_symbols.count { |sym|
+      sym.to_s.start_with?('redrat_dynamic_')
+    }
+    raise left.to_s if left >= 100
+  end
+
+  def test_getattr_rejects_other_names
+    begin
+      RedRat::Internal::getattr(RedRat::Internal::builtins, 42)
+      raise
+    rescue ArgumentError
+    end
+  end
+
+  def test_method_proxy
+    str = get_builtin('str')
+    p_hi = RedRat::Internal::apply(str, RedRat::Internal::unicode('hi'))
+
+    # Twice: through method_missing, then through the generated stub
+    2.times {
+      if RedRat::Internal::str(p_hi.upper) != 'HI'
+        raise
+      end
+
+      if !RedRat::Internal::truth(
+          p_hi.startswith(RedRat::Internal::unicode('h')))
+        raise
+      end
+    }
+
+    if !p_hi.respond_to?(:upper) || p_hi.respond_to?(:redrat_nope)
+      raise
+    end
+
+    begin
+      p_hi.redrat_nope
+      raise
+    rescue NoMethodError
+    end
+  end
+
+  def test_method_proxy_attributes
+    import = get_builtin '__import__'
+    types = RedRat::Internal::apply(import, RedRat::Internal::unicode('types'))
+    mod = types.ModuleType(RedRat::Internal::apply(
+        get_builtin('str'), RedRat::Internal::unicode('m')))
+
+    mod.answer = RedRat::Internal::unicode('42')
+
+    if RedRat::Internal::str(mod.answer) != '42'
+      raise
+    end
+  end
+
+  def test_method_proxy_sees_class_changes
+    str = get_builtin('str')
+    py_eval = get_builtin('eval')
+    setattr = get_builtin('setattr')
+    klass = RedRat::Internal::apply(
+      get_builtin('type'),
+      RedRat::Internal::apply(str, RedRat::Internal::unicode('C')),
+      RedRat::Internal::apply(get_builtin('tuple')),
+      RedRat::Internal::apply(get_builtin('dict')))
+    obj = RedRat::Internal::apply(klass)
+
+    ['41', '42'].each { |answer|
+      RedRat::Internal::apply(
+        setattr, klass, RedRat::Internal::unicode('f'),
+        RedRat::Internal::apply(
+          py_eval, RedRat::Internal::unicode("lambda self: #{answer}"),
+          RedRat::Internal::apply(get_builtin('dict'))))
+
+      if RedRat::Internal::str(obj.f) != answer
+        raise
+      end
+    }
+  end
+
+  def test_apply_keywords
+    py_eval = get_builtin('eval')
+    globals = RedRat::Internal::apply(get_builtin('dict'))
+    f = RedRat::Internal::apply(
+      py_eval,
+      RedRat::Internal::unicode('lambda a, b=2, *args, **kw: ' \
+                                '(a, b, args, sorted(kw.items()))'),
+      globals)
+    x = RedRat::Internal::unicode('x')
+    y = RedRat::Internal::unicode('y')
+
+    expected = {
+      [[x], {}] => "(u'x', 2, (), [])",
+      [[x, y, x], {}] => "(u'x', u'y', (u'x',), [])",
+      [[], {a: x, b: y}] => "(u'x', u'y', (), [])",
+      [[x], {c: y, 'd' => x}] => "(u'x', 2, (), [('c', u'y'), ('d', u'x')])",
+    }
+
+    expected.each { |(args, kwargs), repr|
+      [:apply, :apply_nogvl].each { |m|
+        got = RedRat::Internal::repr(
+          RedRat::Internal::send(m, f, *args, **kwargs))
+
+        if got != repr
+          raise "#{m}: #{got} != #{repr}"
+        end
+      }
+    }
+
+    # A Hash passed positionally stays positional
+    got = RedRat::Internal::str(
+      RedRat::Internal::apply(get_builtin('type'), {c: y}))
+    if !got.include?('RubyObject')
+      raise got
+    end
+
+    begin
+      RedRat::Internal::apply(f, x, 1 => y)
+      raise
+    rescue ArgumentError
+    end
+
+    begin
+      RedRat::Internal::apply(f, x, a: y)
+      raise
+    rescue RedRat::Internal::RedRatException
+    end
+  end
+
+  def test_apply_builtin_fast_paths
+    d = RedRat::Internal::apply(get_builtin('dict'))
+    abc = RedRat::Internal::unicode('abc')
+
+    if RedRat::Internal::str(
+        RedRat::Internal::apply(get_builtin('len'), abc)) != '3'
+      raise
+    end
+
+    if RedRat::Internal::str(
+        RedRat::Internal::apply(RedRat::Internal::getattr(d, :keys))) != '[]'
+      raise
+    end
+
+    begin
+      RedRat::Internal::apply(get_builtin('len'))
+      raise
+    rescue RedRat::Internal::RedRatException
+    end
+  end
+
+  def test_method_proxy_keywords
+    klass = RedRat::Internal::apply(
+      get_builtin('type'),
+      RedRat::Internal::apply(get_builtin('str'),
+                              RedRat::Internal::unicode('C')),
+      RedRat::Internal::apply(get_builtin('tuple')),
+      RedRat::Internal::apply(get_builtin('dict')))
+    RedRat::Internal::apply(
+      get_builtin('setattr'), klass, RedRat::Internal::unicode('f'),
+      RedRat::Internal::apply(
+        get_builtin('eval'),
+        RedRat::Internal::unicode('lambda self, a=1, **kw: (a, kw)'),
+        RedRat::Internal::apply(get_builtin('dict'))))
+    obj = RedRat::Internal::apply(klass)
+    x = RedRat::Internal::unicode('x')
+
+    if RedRat::Internal::repr(obj.f(b: x)) != "(1, {'b': u'x'})"
+      raise
+    end
+
+    if RedRat::Internal::repr(obj.f(x)) != "(u'x', {})"
+      raise
+    end
+  end
+
+  def test_scalar_handoff
+    identity = RedRat::Internal::apply(
+      get_builtin('eval'), RedRat::Internal::unicode('lambda x: x'),
+      RedRat::Internal::apply(get_builtin('dict')))
+    type = get_builtin('type')
+
+    {
+      42 => 'int', 2**62 => 'int', -(2**63) => 'int', 2**63 => 'long',
+      -(2**200) => 'long', 1.5 => 'float', true => 'bool', nil => 'NoneType',
+      :foo => 'str',
+    }.each { |value, name|
+      got = RedRat::Internal::str(
+        RedRat::Internal::getattr(RedRat::Internal::apply(type, value),
+                                  :__name__))
+      if got != name
+        raise "#{value.inspect}: #{got} != #{name}"
+      end
+    }
+
+    [0, -5, 256, 257, 2**62, 2**63 - 1, 2**63, -(2**63), -(2**63) - 1,
+     2**200, -(2**200), 1.5, -0.0, true, false, nil].each { |value|
+      got = RedRat::Internal::apply(identity, value).to_ruby
+      if !got.eql?(value)
+        raise "#{value.inspect} came back as #{got.inspect}"
+      end
+    }
+
+    if RedRat::Internal::str(RedRat::Internal::apply(identity, :foo)) != 'foo'
+      raise
+    end
+
+    add = RedRat::Internal::apply(
+      get_builtin('eval'), RedRat::Internal::unicode('lambda a, b: a + b'),
+      RedRat::Internal::apply(get_builtin('dict')))
+    if RedRat::Internal::to_ruby(RedRat::Internal::apply(add, 40, 2)) != 42
+      raise
+    end
+  end
+
+  def test_scalar_singletons
+    identity = RedRat::Internal::apply(
+      get_builtin('eval'), RedRat::Internal::unicode('lambda x: x'),
+      RedRat::Internal::apply(get_builtin('dict')))
+
+    [nil, true, false, -5, 7, 256].each { |value|
+      a = RedRat::Internal::apply(identity, value)
+      b = RedRat::Internal::apply(identity, value)
+
+      if !a.equal?(b)
+        raise "#{value.inspect} not shared"
+      end
+    }
+
+    if RedRat::Internal::apply(identity, 257).equal?(
+        RedRat::Internal::apply(identity, 257))
+      raise
+    end
+
+    # Anything but a scalar is left alone
+    u = RedRat::Internal::unicode('x')
+    if !u.to_ruby.equal?(u) || RedRat::Internal::to_ruby(5) != 5
+      raise
+    end
+  end
+
+  def test_bytes_view
+    binary = "a\0b\xff".b
+    view = RedRat::Internal::bytes_view(binary)
+
+    if RedRat::Internal::apply(get_builtin('len'), view).to_ruby != 4 ||
+        RedRat::Internal::getattr(view, :readonly).to_ruby != true
+      raise
+    end
+
+    if RedRat::Internal::string_view(view) != binary
+      raise
+    end
+
+    # The view sees the String as it was when the view was made
+    big = 'abc' * 10_000
+    view = RedRat::Internal::bytes_view(big)
+    big[0] = 'z'
+    big = nil
+    GC.start
+    GC.compact if GC.respond_to?(:compact)
+
+    got = RedRat::Internal::string_view(view)
+    if got.bytesize != 30_000 || !got.start_with?('abcabc')
+      raise
+    end
+
+    begin
+      RedRat::Internal::bytes_view(42)
+      raise
+    rescue TypeError
+    end
+  end
+
+  def test_string_view
+    hello = RedRat::Internal::apply(get_builtin('str'),
+                                    RedRat::Internal::unicode('hello'))
+    got = RedRat::Internal::string_view(hello)
+    hello = nil
+    GC.start
+
+    if got != 'hello' || !got.frozen? || got.encoding != Encoding::BINARY
+      raise
+    end
+
+    # Writes from Python to a mutable buffer show through
+    ba = RedRat::Internal::apply(get_builtin('bytearray'), 3)
+    got = RedRat::Internal::string_view(ba)
+    RedRat::Internal::apply(RedRat::Internal::getattr(ba, :__setitem__),
+                            0, 65)
+    if got != "A\0\0"
+      raise got.inspect
+    end
+
+    # Substrings keep the buffer alive
+    tail = RedRat::Internal::string_view(
+      RedRat::Internal::apply(get_builtin('str'),
+                              RedRat::Internal::unicode('x' * 4096)))[1..]
+    GC.start
+    if tail != 'x' * 4095
+      raise
+    end
+
+    begin
+      RedRat::Internal::string_view(RedRat::Internal::apply(
+        get_builtin('int'), 5))
+      raise
+    rescue RedRat::Internal::RedRatException
+    end
+
+    begin
+      RedRat::Internal::string_view('not Python')
+      raise
+    rescue ArgumentError
+    end
+  end
+
+  def test_string_encodings
+    len = get_builtin('len')
+    py_len = lambda { |s|
+      RedRat::Internal::apply(len, RedRat::Internal::unicode(s)).to_ruby
+    }
+    round_trip = lambda { |s|
+      RedRat::Internal::str(RedRat::Internal::unicode(s))
+    }
+
+    if py_len.call("a\0b") != 3 || round_trip.call("a\0b") != "a\0b"
+      raise
+    end
+
+    ['abc', 'héllo', '日本語', "x\u{1F600}y"].each { |text|
+      got = round_trip.call(text)
+      if got != text || got.encoding != Encoding::UTF_8
+        raise "#{text} came back as #{got.inspect}"
+      end
+
+      ['ISO-8859-1', 'UTF-16LE', 'UTF-16BE', 'UTF-32LE', 'UTF-32BE',
+       'Shift_JIS', 'EUC-JP'].each { |enc|
+        begin
+          encoded = text.encode(enc)
+        rescue EncodingError
+          next
+        end
+
+        if round_trip.call(encoded) != text
+          raise "#{text} in #{enc}"
+        end
+      }
+    }
+
+    if py_len.call('héllo') != 5 || py_len.call('日本'.encode('Shift_JIS')) != 2
+      raise
+    end
+
+    if !round_trip.call('plain').ascii_only? ||
+        RedRat::Internal::repr(RedRat::Internal::unicode('é')) != "u'\\xe9'"
+      raise
+    end
+
+    begin
+      RedRat::Internal::unicode("\xff".force_encoding('UTF-8'))
+      raise
+    rescue RedRat::Internal::RedRatException
+    end
+
+    # strs with bytes outside of ASCII come back as binary
+    bytes = RedRat::Internal::apply(
+      RedRat::Internal::getattr(RedRat::Internal::unicode('é'), :encode),
+      RedRat::Internal::unicode('utf-8'))
+    got = RedRat::Internal::str(bytes)
+    if got != "\xC3\xA9".b || got.encoding != Encoding::BINARY
+      raise got.inspect
+    end
+  end
+
+  def test_bulk_conversion
+    value = [1, 'a', [2.5, nil, 2**80], {x: 1, 'y' => [true, "\xff".b]}]
+    pv = RedRat::Internal::to_python(value, deep: true)
+
+    if RedRat::Internal::str(RedRat::Internal::getattr(
+        RedRat::Internal::apply(get_builtin('type'), pv), :__name__)) != 'list'
+      raise
+    end
+
+    back = RedRat::Internal::to_ruby(pv, deep: true)
+    if back != [1, 'a', [2.5, nil, 2**80], {'x' => 1, 'y' => [true, "\xff".b]}]
+      raise back.inspect
+    end
+
+    if pv.to_ruby(deep: true) != back || !pv.to_ruby.equal?(pv)
+      raise
+    end
+
+    # Tuples become Arrays, and what cannot be converted stays wrapped
+    tuple = RedRat::Internal::apply(get_builtin('tuple'), pv)
+    back = RedRat::Internal::to_ruby(tuple, deep: true)
+    if !back.is_a?(Array) || back.length != 4
+      raise
+    end
+
+    obj = RedRat::Internal::apply(get_builtin('object'))
+    back = RedRat::Internal::to_ruby(
+      RedRat::Internal::to_python([obj], deep: true), deep: true)
+    if !back[0].is_a?(RedRat::Internal::PythonValue) ||
+        RedRat::Internal::repr(back[0]) != RedRat::Internal::repr(obj)
+      raise
+    end
+
+    # Without deep, elements are handed off as apply would
+    shallow = RedRat::Internal::to_python([[1], 2])
+    first = RedRat::Internal::apply(
+      RedRat::Internal::getattr(shallow, :__getitem__), 0)
+    if RedRat::Internal::str(RedRat::Internal::getattr(
+        RedRat::Internal::apply(get_builtin('type'), first), :__name__)) !=
+        'RubyObject'
+      raise
+    end
+  end
+
+  def test_bulk_conversion_sharing_and_cycles
+    py_eval = get_builtin('eval')
+    globals = RedRat::Internal::apply(get_builtin('dict'))
+    same = RedRat::Internal::apply(
+      py_eval, RedRat::Internal::unicode('lambda x: x[0] is x[1]'), globals)
+
+    shared = [1]
+    pv = RedRat::Internal::to_python([shared, shared], deep: true)
+    if !RedRat::Internal::apply(same, pv).to_ruby
+      raise
+    end
+
+    back = RedRat::Internal::to_ruby(pv, deep: true)
+    if !back[0].equal?(back[1])
+      raise
+    end
+
+    cycle = [1]
+    cycle << cycle
+    pv = RedRat::Internal::to_python(cycle, deep: true)
+    if RedRat::Internal::repr(pv) != '[1, [...]]'
+      raise
+    end
+
+    back = RedRat::Internal::to_ruby(pv, deep: true)
+    if !back[1].equal?(back)
+      raise
+    end
+
+    if RedRat::Internal::repr(
+        RedRat::Internal::to_python({[1, [2]] => 3}, deep: true)) !=
+        '{(1, (2,)): 3}'
+      raise
+    end
+
+    begin
+      RedRat::Internal::to_python({cycle => 1}, deep: true)
+      raise
+    rescue RedRat::Internal::RedRatException
+    end
+  end
+
+  def test_ruby_object_protocols
+    py_eval = get_builtin('eval')
+    globals = RedRat::Internal::apply(get_builtin('dict'))
+    py = lambda { |src|
+      RedRat::Internal::apply(py_eval, RedRat::Internal::unicode(src), globals)
+    }
+
+    ary = [10, 'b', [1, 2], :sym]
+    got = RedRat::Internal::apply(
+      py.call('lambda a: [len(a), a[0], a[-1], a[1:3], a[::2], ' \
+              '10 in a, 11 in a, [x for x in a]]'), ary).to_ruby(deep: true)
+    if got != [4, 10, 'sym', ['b', [1, 2]], [10, [1, 2]], true, false,
+               [10, 'b', [1, 2], 'sym']]
+      raise got.inspect
+    end
+
+    # Hashes behave like dicts, and strs find Symbol keys too
+    hash = {'a' => 1, b: 2}
+    got = RedRat::Internal::apply(
+      py.call('lambda h: [len(h), h["a"], h["b"], "b" in h, "c" in h, ' \
+              'sorted(h)]'), hash).to_ruby(deep: true)
+    if got != [2, 1, 2, true, false, ['a', 'b']]
+      raise got.inspect
+    end
+
+    # Measured from inside apply_nogvl too, which needs the GVL back first
+    got = RedRat::Internal::apply_nogvl(
+      py.call('lambda a, h: (len(a), len(h))'), ary, hash).to_ruby(deep: true)
+    raise got.inspect if got != [4, 2]
+
+    RedRat::Internal::apply(
+      py.call('lambda h, a: (h.__setitem__("b", 3), h.__setitem__("c", 4), ' \
+              'h.__delitem__("a"), a.__setitem__(-1, "z"))'), hash, ary)
+    if hash != {b: 3, 'c' => 4} || ary.last != 'z'
+      raise hash.inspect
+    end
+
+    [['lambda h: h["nope"]', hash, /KeyError/],
+     ['lambda a: a[4]', ary, /IndexError/],
+     ['lambda o: iter(o)', 42, /TypeError/]].each { |src, arg, type|
+      begin
+        RedRat::Internal::apply(py.call(src), arg)
+        raise
+      rescue RedRat::Internal::RedRatException => e
+        raise e.inspect if RedRat::Internal::repr(e.python_type) !~ type
+      end
+    }
+
+    # Procs are callable, keywords included, and Ruby exceptions come back
+    adder = lambda { |x, y: 1| x + y }
+    got = RedRat::Internal::apply(
+      py.call('lambda f: [f(1), f(1, y=41)]'), adder).to_ruby(deep: true)
+    if got != [2, 42]
+      raise got.inspect
+    end
+
+    begin
+      RedRat::Internal::apply(py.call('lambda f: f()'),
+                              lambda { raise 'from ruby' })
+      raise
+    rescue RedRat::Internal::RedRatException => e
+      raise if RedRat::Internal::str(e.python_value) != 'RuntimeError: from ruby'
+    end
+
+    # Comparison and hashing go through Ruby, and Enumerables iterate
+    got = RedRat::Internal::apply(
+      py.call('lambda a, b, r: [a == b, a < b, hash(a) == hash(b), ' \
+              'list(r)]'), 'x', 'y', 1..3).to_ruby(deep: true)
+    if got != [false, true, false, [1, 2, 3]]
+      raise got.inspect
+    end
+
+    # The GVL is taken back when Python calls into Ruby from apply_nogvl
+    got = RedRat::Internal::apply_nogvl(py.call('lambda a: sum(a)'), [1, 2, 3])
+    if got.to_ruby != 6
+      raise
+    end
+  end
+
+  def test_each
+    py_eval = get_builtin('eval')
+    globals = RedRat::Internal::apply(get_builtin('dict'))
+    py = lambda { |src|
+      RedRat::Internal::apply(py_eval, RedRat::Internal::unicode(src), globals)
+    }
+
+    gen = py.call('lambda n: (i * 2 for i in xrange(n))')
+
+    [1, 3, 256, 1000].each { |batch|
+      got = []
+      RedRat::Internal::apply(gen, 10).each(batch: batch) { |v|
+        got << v.to_ruby
+      }
+
+      if got != (0...10).map { |i| i * 2 }
+        raise "batch #{batch}: #{got.inspect}"
+      end
+    }
+
+    # Enumerators, and with them Enumerator::Lazy
+    got = RedRat::Internal::apply(gen, 1_000_000).each(batch: 7).lazy
+      .map(&:to_ruby).select(&:even?).first(3)
+    if got != [0, 2, 4]
+      raise got.inspect
+    end
+
+    if RedRat::Internal::to_python([1, 2, 3]).each.map(&:to_ruby) != [1, 2, 3]
+      raise
+    end
+
+    # Items before an error are yielded, then the error is raised
+    failing = py.call('lambda: (1 / (2 - i) for i in xrange(5))')
+    got = []
+    begin
+      RedRat::Internal::apply(failing).each { |v| got << v.to_ruby }
+      raise
+    rescue RedRat::Internal::RedRatException => e
+      if got != [0, 1] ||
+          RedRat::Internal::repr(e.python_type) !~ /ZeroDivisionError/
+        raise got.inspect
+      end
+    end
+
+    [lambda { RedRat::Internal::apply(get_builtin('object')).each { } },
+     lambda { RedRat::Internal::apply(gen, 1).each(batch: 0) { } }].each { |l|
+      begin
+        l.call
+        raise
+      rescue RedRat::Internal::RedRatException, ArgumentError
+      end
+    }
+  end
+
+  def test_exception_classes
+    d = RedRat::Internal::to_python({'a' => 1})
+    getitem = RedRat::Internal::getattr(d, :__getitem__)
+
+    begin
+      RedRat::Internal::apply(getitem, :nope)
+      raise
+    rescue RedRat::KeyError => e
+      if !e.is_a?(RedRat::LookupError) ||
+          !e.is_a?(RedRat::Internal::RedRatException) ||
+          e.message != "KeyError: 'nope'" ||
+          e.redrat_reason != 'redrat_ext: applied function raised an error'
+        raise e.message
+      end
+
+      # Materialized once, and replaceable
+      if !e.python_type.equal?(e.python_type) ||
+          RedRat::Internal::repr(e.python_value) !~ /'nope'/
+        raise
+      end
+
+      e.python_value = 42
+      raise if e.python_value != 42
+    end
+
+    # Subclasses map to the nearest class RedRat knows of
+    py_eval = get_builtin('eval')
+    raiser = RedRat::Internal::apply(
+      py_eval, RedRat::Internal::unicode(
+        'lambda: (_ for _ in ()).throw(UnicodeDecodeError("utf8", "", 0, 1, "x"))'),
+      RedRat::Internal::apply(get_builtin('dict')))
+
+    begin
+      RedRat::Internal::apply(raiser)
+      raise
+    rescue RedRat::UnicodeError => e
+      raise if !e.is_a?(RedRat::ValueError)
+    end
+
+    # Python errors passing through Ruby come back out unchanged
+    reraise = RedRat::Internal::apply(
+      py_eval,
+      RedRat::Internal::unicode('lambda f: f()'),
+      RedRat::Internal::apply(get_builtin('dict')))
+    begin
+      RedRat::Internal::apply(reraise,
+                              lambda { RedRat::Internal::apply(getitem, :x) })
+      raise
+    rescue RedRat::KeyError => e
+      raise if RedRat::Internal::repr(e.python_value) !~ /'x'/
+    end
+  end
+
+  def test_probes
+    p_hi = RedRat::Internal::unicode('hi')
+    missing = Object.new
+
+    # getattr and hasattr
+    raise if !RedRat::Internal::getattr(p_hi, :upper, missing).is_a?(
+        RedRat::Internal::PythonValue)
+    raise if !RedRat::Internal::getattr(p_hi, :nope, missing).equal?(missing)
+    raise if !RedRat::Internal::hasattr(p_hi, :upper)
+    raise if RedRat::Internal::hasattr(p_hi, 'nope')
+
+    begin
+      RedRat::Internal::getattr(p_hi, :nope)
+      raise
+    rescue RedRat::AttributeError
+    end
+
+    # Old-style instances and __getattr__ find attributes their own way
+    ns = RedRat::Internal::to_python({})
+    RedRat::Internal::eval(RedRat::Internal::compile(<<-PY, :exec), ns)
+class Old:
+    def __init__(self):
+        self.x = 1
+
+class Dynamic(object):
+    def __getattr__(self, name):
+        if name == 'x':
+            return 1
+        raise AttributeError(name)
+
+old, dynamic = Old(), Dynamic()
+    PY
+    [:old, :dynamic].each { |name|
+      p_obj = RedRat::Internal::getitem(ns, name)
+      raise if !RedRat::Internal::hasattr(p_obj, :x)
+      raise if RedRat::Internal::hasattr(p_obj, :y)
+      raise if RedRat::Internal::getattr(p_obj, :x, missing).to_ruby != 1
+      raise if !RedRat::Internal::getattr(p_obj, :y, missing).equal?(missing)
+      raise if RedRat::Internal::getattr(p_obj, :x).to_ruby != 1
+    }
+
+    # getitem, on dicts and on other sequences
+    p_dict = RedRat::Internal::to_python({'present' => 1, 2 => 3}, deep: true)
+    raise if RedRat::Internal::getitem(p_dict, :present).to_ruby != 1
+    raise if RedRat::Internal::getitem(p_dict, 2, missing).to_ruby != 3
+    raise if !RedRat::Internal::getitem(p_dict, :absent, nil).nil?
+    raise if !RedRat::Internal::getitem(p_dict, 4, missing).equal?(missing)
+
+    begin
+      RedRat::Internal::getitem(p_dict, :absent)
+      raise
+    rescue RedRat::KeyError
+    end
+
+    p_list = RedRat::Internal::to_python([10, 20])
+    raise if RedRat::Internal::getitem(p_list, -1).to_ruby != 20
+    raise if RedRat::Internal::getitem(p_list, 5, :none) != :none
+
+    # Errors other than missing keys are still raised
+    begin
+      RedRat::Internal::getitem(p_list, :x, :none)
+      raise
+    rescue RedRat::TypeError
+    end
+
+    # apply? returns a pair rather than raising
+    py_int = get_builtin('int')
+    result, error = RedRat::Internal::apply?(py_int, RedRat::Internal::unicode('7'))
+    raise if result.to_ruby != 7 || !error.nil?
+
+    result, error = RedRat::Internal::apply?(py_int, RedRat::Internal::unicode('x'))
+    raise if !result.nil?
+    raise if RedRat::Internal::repr(error) !~ /^ValueError\(/
+
+    raise if !RedRat::Internal::apply?(get_builtin('id'), nil)[1].nil?
+  end
+
+  def test_python_interpreters
+    one = RedRat::Internal::PythonInterpreter.new
+    two = RedRat::Internal::PythonInterpreter.new
+
+    # Each has a namespace, and modules, of its own
+    one.exec("import sys\nsys.redrat_marker = 1\nx = 41")
+    raise if one.eval('x + 1') != 42
+    raise if two.eval("hasattr(__import__('sys'), 'redrat_marker')") != false
+    raise if one.eval("__import__('redrat').RubyObject.__name__") != 'RubyObject'
+
+    begin
+      two.eval('x')
+      raise
+    rescue RedRat::NameError => e
+      raise if e.message !~ /x/
+    end
+
+    # Data crosses over both ways
+    one.exec("def pair(a, b):\n    return [a, {u'b': b}]")
+    raise if one.call('pair', 1, 'two') != [1, {'b' => 'two'}]
+
+    begin
+      one.call('nope')
+      raise
+    rescue RedRat::NameError
+    end
+
+    # Anything else would be one interpreter's object used from the other
+    one.exec("class K(object):\n    pass")
+    [lambda { one.eval('K()') },
+     lambda { one.eval('pair') },
+     lambda { one.call('pair', RedRat::Internal::builtins, 1) },
+     lambda { one.call('pair', Object.new, 1) }].each { |crossing|
+      begin
+        crossing.call
+        raise
+      rescue RedRat::TypeError => e
+        raise if e.message !~ /plain data/
+      end
+    }
+
+    one.close
+    one.close
+
+    begin
+      one.eval('1')
+      raise
+    rescue RuntimeError
+    end
+
+    # Pools route jobs from many Ruby threads
+    pool = RedRat::Internal::PythonInterpreterPool.new(3)
+    raise if pool.interpreters.size != 3
+
+    pool.exec_all("def square(n):\n    return n * n")
+    threads = (1..6).map { |i|
+      Thread.new { (1..20).map { |j| pool.call('square', i * j) } }
+    }
+
+    threads.each_with_index { |t, i|
+      raise if t.value != (1..20).map { |j| ((i + 1) * j) ** 2 }
+    }
+
+    raise if pool.eval('6 * 7') != 42
+    pool.close
+    two.close
+  end
+
+  def test_call_plans
+    import = get_builtin('__import__')
+    json = RedRat::Internal::apply(import, RedRat::Internal::unicode('json'))
+
+    dumps = RedRat::Internal::plan(json, :dumps)
+    list = RedRat::Internal::to_python([1, 2], deep: true)
+    raise if dumps.call(list).to_ruby(deep: true) != '[1, 2]'
+    raise if dumps.call(list, indent: 1).to_ruby(deep: true) !~ /\n/
+    raise if dumps.resolutions != 1
+
+    # Guarded steps stay resolved; replacing the attribute is noticed
+    10.times { dumps.call(1) }
+    raise if dumps.resolutions != 1
+
+    saved = RedRat::Internal::getattr(json, :dumps)
+    setattr = get_builtin('setattr')
+    RedRat::Internal::apply(setattr, json, RedRat::Internal::unicode('dumps'),
+                            get_builtin('repr'))
+    raise if dumps.call(1).to_ruby(deep: true) != '1' || dumps.resolutions != 2
+    RedRat::Internal::apply(setattr, json, RedRat::Internal::unicode('dumps'),
+                            saved)
+    raise if dumps.call(nil).to_ruby(deep: true) != 'null' || dumps.resolutions != 3
+
+    # Chains through classes follow their version tags
+    decoder = RedRat::Internal::plan(json, 'JSONDecoder', :decode)
+    raise if decoder.resolutions != 2
+    decoder_class = RedRat::Internal::getattr(json, :JSONDecoder)
+    instance = RedRat::Internal::apply(decoder_class)
+    raise if decoder.call(instance, RedRat::Internal::unicode('[3]')).to_ruby(deep: true) != [3]
+    raise if decoder.resolutions != 2
+
+    RedRat::Internal::apply(setattr, decoder_class,
+                            RedRat::Internal::unicode('marker'), 1)
+    decoder.call(instance, RedRat::Internal::unicode('1'))
+    raise if decoder.resolutions != 3
+
+    # Instances cannot be guarded, so their steps resolve on every call
+    bound = RedRat::Internal::plan(instance, :decode)
+    bound.call(RedRat::Internal::unicode('1'))
+    raise if bound.resolutions != 2
+    raise if !RedRat::Internal::truth(
+        RedRat::Internal::apply(get_builtin('callable'), bound.callable))
+
+    begin
+      RedRat::Internal::plan(json, :no_such_attribute)
+      raise
+    rescue RedRat::AttributeError
+    end
+
+    begin
+      RedRat::Internal::plan(json, 5)
+      raise
+    rescue ArgumentError
+    end
+  end
+
+  def test_code_cache
+    before = RedRat::Internal::code_cache_stats
+
+    raise if RedRat::Internal.eval('1 + 2').to_ruby != 3
+    raise if RedRat::Internal.eval('x * y', x: 6, 'y' => 7).to_ruby != 42
+    raise if RedRat::Internal.eval('len(s)', s: 'abc').to_ruby != 3
+    raise if RedRat::Internal.eval('1 + 2').to_ruby != 3
+
+    stats = RedRat::Internal::code_cache_stats
+    raise if stats[:misses] - before[:misses] != 3
+    raise if stats[:hits] - before[:hits] != 1
+    raise if stats[:total_compile_ns] <= before[:total_compile_ns]
+
+    # Compiled code is shared, and statements assign into given locals
+    code = RedRat::Internal.compile('1 + 2')
+    raise if !code.equal?(RedRat::Internal.compile('1 + 2'))
+    raise if RedRat::Internal.eval(code).to_ruby != 3
+
+    locals = RedRat::Internal::to_python({})
+    RedRat::Internal.eval(
+      RedRat::Internal.compile("def f(n):\n    return n * 2\nz = f(21)\n",
+                               :exec),
+      locals)
+    raise if RedRat::Internal::getitem(locals, :z).to_ruby != 42
+
+    # Only the least recently used code is evicted
+    RedRat::Internal.eval('0')
+    (1..stats[:capacity]).each { |i| RedRat::Internal.eval(i.to_s) }
+    evicted = RedRat::Internal::code_cache_stats
+    raise if evicted[:evictions] - stats[:evictions] < 1
+    hits = evicted[:hits]
+    RedRat::Internal.eval(stats[:capacity].to_s)
+    raise if RedRat::Internal::code_cache_stats[:hits] != hits + 1
+
+    # Not a module function, so that Kernel#eval is not shadowed
+    raise if !self.class.include?(Kernel) || eval('1 + 1') != 2
+
+    begin
+      RedRat::Internal.eval('1 +')
+      raise
+    rescue RedRat::SyntaxError
+    end
+
+    begin
+      RedRat::Internal.eval('missing')
+      raise
+    rescue RedRat::NameError
+    end
+
+    begin
+      RedRat::Internal.eval('1', 5 => 1)
+      raise
+    rescue ArgumentError
+    end
+
+    begin
+      RedRat::Internal.compile('1', :single)
+      raise
+    rescue ArgumentError
+    end
+  end
+
+  def test_wrapper_identity
+    len = RedRat::Internal::getitem(RedRat::Internal::builtins, :len)
+    raise if !len.equal?(RedRat::Internal::getitem(RedRat::Internal::builtins,
+                                                   :len))
+    raise if !RedRat::Internal::builtins.equal?(RedRat::Internal::builtins)
+    raise if ({ len => 1 })[get_builtin('len')] != 1
+
+    # Fresh results join the map once they go back to Python
+    list = get_builtin('list')
+    fresh = RedRat::Internal::apply(list)
+    holder = RedRat::Internal::apply(list)
+    RedRat::Internal::apply(RedRat::Internal::getattr(holder, :append), fresh)
+    raise if !RedRat::Internal::getitem(holder, 0).equal?(fresh)
+
+    # Borrowed handoffs are looked up even when only their container holds them
+    only_held = RedRat::Internal::eval(RedRat::Internal::compile('[object()]'))
+    item = RedRat::Internal::to_ruby(only_held, deep: true)[0]
+    raise if !RedRat::Internal::to_ruby(only_held, deep: true)[0].equal?(item)
+    raise if !RedRat::Internal::getitem(only_held, 0).equal?(item)
+
+    # Collected PythonValues are forgotten, and made anew
+    hits = RedRat::Internal::wrapper_stats[:hits]
+    5.times { RedRat::Internal::getitem(holder, 0) }
+    raise if RedRat::Internal::wrapper_stats[:hits] != hits + 5
+
+    fresh = nil
+    GC.start
+    again = RedRat::Internal::getitem(holder, 0)
+    raise if RedRat::Internal::apply(get_builtin('len'), again).to_ruby != 0
+  end
+
+  def test_wrapper_scopes
+    list = get_builtin('list')
+    len = get_builtin('len')
+    repr = get_builtin('repr')
+    kept = nil
+    inner = nil
+    held = nil
+
+    released = lambda { |&blk|
+      begin
+        blk.call
+        raise 'used a released PythonValue'
+      rescue StandardError => e
+        raise unless e.message =~ /released by RedRat::Internal.scope/
+      end
+    }
+
+    got = RedRat::Internal::scope {
+      kept = RedRat::Internal::apply(list)
+      RedRat::Internal::apply(RedRat::Internal::getattr(kept, :append), 1)
+      inner = RedRat::Internal::scope { RedRat::Internal::apply(list) }
+      held = [RedRat::Internal::apply(list)]
+      RedRat::Internal::apply(list)
+    }
+
+    # The block's value survives; a nested block's, only until the outer exits
+    raise if RedRat::Internal::apply(len, got).to_ruby != 0
+
+    # Anything else that escaped raises on use rather than reading as None
+    released.call { RedRat::Internal::apply(repr, kept) }
+    released.call { RedRat::Internal::apply(repr, inner) }
+    released.call { held[0].to_ruby }
+    released.call { kept.append(2) }
+    released.call { RedRat::Internal::getattr(kept, :append) }
+    released.call { RedRat::Internal::truth(kept) }
+    released.call { RedRat::Internal::str(kept) }
+    raise if held.flatten != held
+
+    # Released even when the block raises
+    begin
+      RedRat::Internal::scope {
+        kept = RedRat::Internal::apply(list)
+        raise ArgumentError
+      }
+      raise
+    rescue ArgumentError
+    end
+    released.call { RedRat::Internal::apply(repr, kept) }
+
+    # What redrat_ext keeps for itself is not released
+    view = nil
+    code = RedRat::Internal::scope {
+      view = RedRat::Internal::string_view(
+        RedRat::Internal::apply(get_builtin('str'),
+                                RedRat::Internal::unicode('x' * 64)))
+      RedRat::Internal::compile('1 + 1')
+    }
+    GC.start
+    raise if view != 'x' * 64
+    raise if RedRat::Internal::eval(code).to_ruby != 2
+    raise if RedRat::Internal::eval('1 + 1').to_ruby != 2
+
+    stats = RedRat::Internal::wrapper_stats
+    raise if stats[:python_values_peak] < stats[:python_values_live]
+    raise if stats[:ruby_objects_peak] < stats[:ruby_objects_live]
+    raise if stats[:slabs] < 1
+  end
+
+  def test_cross_heap_cycles
+    list = get_builtin('list')
+    append = lambda { |l, x|
+      RedRat::Internal::apply(RedRat::Internal::getattr(l, :append), x)
+    }
+    rss = lambda {
+      File.read('/proc/self/status')[/VmRSS:\s+(\d+)/, 1].to_i * 1024
+    }
+
+    # Kept from Ruby, directly and by way of another list
+    kept = []
+    held = RedRat::Internal::apply(list)
+    append.call(held, kept)
+    kept << held
+
+    py_kept = RedRat::Internal::apply(list)
+    rooted = RedRat::Internal::apply(list)
+    append.call(py_kept, rooted)
+    append.call(rooted, [rooted])
+    rooted = nil
+
+    # A million Arrays holding lists that hold them back, which leak without
+    # collect_cycles
+    baseline = nil
+
+    10.times { |round|
+      100_000.times {
+        a = []
+        l = RedRat::Internal::apply(list)
+        append.call(l, a)
+        a << l
+      }
+
+      raise if RedRat::Internal::collect_cycles < 90_000
+      baseline = rss.call if round == 1 && File.exist?('/proc/self/status')
+    }
+
+    raise if baseline && rss.call - baseline > 64 * 1024 * 1024
+
+    GC.start
+    raise if !RedRat::Internal::getitem(held, 0).equal?(kept)
+    inner = RedRat::Internal::getitem(RedRat::Internal::getitem(py_kept, 0), 0)
+    raise if !inner.is_a?(Array) || inner.length != 1
+
+    stats = RedRat::Internal::cycle_stats
+    raise if stats[:passes] < 10 || stats[:broken] < 900_000
+  end
+
+  def test_stats
+    int = get_builtin('int')
+    list = get_builtin('list')
+    stats = RedRat::Internal::stats
+    raise if stats[:apply_calls] < 0 || stats[:gil_wait_ns] < 0
+
+    text = RedRat::Internal::stats(:prometheus)
+    raise if text !~ /^# TYPE redrat_calls_total counter$/
+    raise if text !~ /^redrat_calls_total\{entry="apply"\} \d+$/
+    raise if text !~ /^redrat_gil_wait_seconds_total \d+\.\d{9}$/
+    raise if text.scan(/^# TYPE /).size != 6
+
+    begin
+      RedRat::Internal::stats(:yaml)
+      raise
+    rescue ArgumentError
+    end
+
+    if !RedRat::Internal.respond_to?(:stats_enabled=)
+      # Compiled out: nothing is ever counted
+      raise if RedRat::Internal::stats_enabled?
+      raise if stats.values.any? { |n| n != 0 }
+      return
+    end
+
+    begin
+      RedRat::Internal::stats_enabled = true
+      before = RedRat::Internal::stats
+
+      # From another thread too, whose counts outlive it
+      Thread.new { 3.times { RedRat::Internal::apply(int, 1) } }.join
+      v = RedRat::Internal::apply(int, 5)
+      RedRat::Internal::getattr(v, :real)
+      RedRat::Internal::truth(v)
+      RedRat::Internal::repr(v)
+      RedRat::Internal::str(v)
+      RedRat::Internal::unicode('x')
+      RedRat::Internal::apply(list, [[]])
+
+      after = RedRat::Internal::stats
+      diff = lambda { |key| after[key] - before[key] }
+
+      raise if diff.call(:apply_calls) != 5
+      raise if diff.call(:getattr_calls) != 1
+      raise if diff.call(:truth_calls) != 1
+      raise if diff.call(:repr_calls) != 1
+      raise if diff.call(:str_calls) != 1
+      raise if diff.call(:unicode_calls) != 1
+      raise if diff.call(:exceptions_converted) != 0
+      raise if diff.call(:gil_waits) < 10 || diff.call(:gil_wait_ns) <= 0
+      raise if diff.call(:python_values_made) < 1
+      raise if diff.call(:ruby_objects_made) < 1
+
+      before = after
+      begin
+        RedRat::Internal::apply(int, RedRat::Internal::unicode('x'))
+        raise
+      rescue RedRat::Internal::RedRatException
+      end
+      after = RedRat::Internal::stats
+      raise if diff.call(:exceptions_converted) != 1
+
+      RedRat::Internal::stats_enabled = false
+      before = RedRat::Internal::stats
+      RedRat::Internal::apply(int, 1)
+      raise if RedRat::Internal::stats != before
+    ensure
+      RedRat::Internal::stats_enabled = false
+    end
+  end
+
+  def test_profile
+    return if !RedRat::Internal.respond_to?(:profile)
+
+    ns = RedRat::Internal::to_python({})
+    RedRat::Internal.eval(RedRat::Internal.compile(<<-PY, :exec), ns)
+def spin(n):
+    t = 0
+    for i in xrange(n):
+        t += i
+    return t
+
+def outer(n, spin=spin):
+    return spin(n)
+
+def calls_back(f, n):
+    return f(n)
+    PY
+    outer = RedRat::Internal::getitem(ns, :outer)
+    calls_back = RedRat::Internal::getitem(ns, :calls_back)
+    busy = proc { |n| i = 0; i += 1 while i < n; n }
+
+    collapsed = RedRat::Internal::profile(500) {
+      started = Time.now
+      while Time.now - started < 0.3
+        RedRat::Internal::apply(outer, 20_000)
+        RedRat::Internal::apply(calls_back, busy, 20_000)
+      end
+    }
+
+    stacks = collapsed.lines.map { |line|
+      raise if line !~ /\A(\S.*) (\d+)\n\z/
+      [$1.split(';'), $2.to_i]
+    }
+    raise if stacks.sum { |_, n| n } < 100
+
+    # Ruby frames lead to the entry point, then the Python frames it ran
+    raise if !stacks.any? { |frames, _|
+      i = frames.index('RedRat::Internal.apply')
+      i && frames[i - 1].start_with?('TestRedrat#test_profile') &&
+        frames[i + 1..-1] == ['outer (<redrat>)', 'spin (<redrat>)']
+    }
+
+    # And calls back into Ruby continue with Ruby frames
+    raise if !stacks.any? { |frames, _|
+      i = frames.index('calls_back (<redrat>)')
+      i && frames[i - 1] == 'RedRat::Internal.apply' &&
+        frames[i + 1].to_s.start_with?('TestRedrat#test_profile')
+    }
+
+    # Waiting for the GIL another thread holds
+    holder = Thread.new {
+      RedRat::Internal::with_gil {
+        started = Time.now
+        nil while Time.now - started < 0.2
+      }
+    }
+    sleep 0.05
+    collapsed = RedRat::Internal::profile { RedRat::Internal::apply(outer, 1) }
+    holder.join
+    raise if collapsed !~ /;RedRat::Internal\.apply;\[GIL wait\] \d+$/
+
+    begin
+      RedRat::Internal::profile { RedRat::Internal::profile { } }
+      raise
+    rescue RuntimeError => e
+      raise if e.message !~ /already profiling/
+    end
+
+    begin
+      RedRat::Internal::profile(0) { }
+      raise
+    rescue ArgumentError
+    end
+  end
+
+  def test_apply_async
+    py_int = get_builtin('int')
+
+    futures = (0...100).map { |i| RedRat::Internal::apply_async(py_int, i) }
+    raise if futures.map { |f| f.value.to_ruby } != (0...100).to_a
+    raise if !futures.all?(&:done?)
+    raise if !futures[0].value.equal?(futures[0].value)
+
+    # Symbols are handed off before queueing, and errors raised by value
+    failing = RedRat::Internal::apply_async(py_int, :x)
+    raise if !failing.wait.equal?(failing)
+
+    2.times {
+      begin
+        failing.value
+        raise
+      rescue RedRat::ValueError => e
+        raise if e.message !~ /invalid literal/
+      end
+    }
+
+    # Waiting lets go of the GVL, and can time out
+    py_sleep = RedRat::Internal::getattr(
+      RedRat::Internal::apply(get_builtin('__import__'),
+                              RedRat::Internal::unicode('time')),
+      :sleep)
+    slow = RedRat::Internal::apply_async(py_sleep, 0.2)
+    ticks = 0
+    ticker = Thread.new { 10.times { ticks += 1; sleep 0.005 } }
+
+    raise if !slow.wait(0.01).nil?
+    raise if !slow.value.to_ruby.nil? || ticks == 0
+    ticker.join
+
+    # Queued arguments stay put through compaction, and futures nobody keeps
+    # stay alive until they are done
+    identity = RedRat::Internal::eval(RedRat::Internal::compile('lambda x: x'))
+    RedRat::Internal::apply_async(py_sleep, 0.1)
+    queued = (0...300).map { |i|
+      RedRat::Internal::apply_async(identity, "queued #{i}")
+    }
+    100.times { |i| RedRat::Internal::apply_async(identity, "dropped #{i}") }
+
+    if GC.respond_to?(:verify_compaction_references)
+      GC.verify_compaction_references(toward: :empty)
+    else
+      GC.start
+    end
+
+    raise if queued.each_with_index.any? { |f, i|
+      f.value != "queued #{i}"
+    }
+
+    RedRat::Internal::with_gil {
+      begin
+        RedRat::Internal::apply_async(py_sleep, 0).value
+        raise
+      rescue ThreadError
+      end
+    }
+
+    stats = RedRat::Internal::async_stats
+    raise if stats[:submitted] != stats[:completed] || stats[:depth] != 0
+    raise if stats[:batches] == 0 || stats[:max_service_ns] < 200_000_000
+  end
+
+  def test_python_workers
+    return if !defined?(RedRat::Internal::PythonWorkerPool)
+
+    pool = RedRat::Internal::PythonWorkerPool.new(2)
+    raise if pool.pids.length != 2 || pool.pids.include?(Process.pid)
+
+    # Names are "module.attribute", or globals defined with exec_all
+    raise if pool.apply('operator.add', 2, 3).to_ruby(deep: true) != 5
+    pool.exec_all("import os\ndef pid_and(x):\n    return (os.getpid(), x)\n" +
+                  "def opaque():\n    return object()\n")
+
+    results = (0...20).map { |i| pool.apply(:pid_and, [i, 'x' * i]) }
+    raise if results.map { |r| r.to_ruby(deep: true)[1][0] } != (0...20).to_a
+    raise if results.map { |r| r.to_ruby(deep: true)[0] }.uniq.sort != pool.pids.sort
+
+    # Large values go through the ring in one piece
+    big = 'y' * 300_000
+    raise if pool.apply('operator.concat', big, big).to_ruby(deep: true) != big * 2
+
+    # Errors of builtin classes keep their class
+    begin
+      pool.apply('operator.div', 1, 0)
+      raise
+    rescue RedRat::ZeroDivisionError => e
+      raise if e.message !~ /division/
+    end
+
+    begin
+      pool.apply(:no_such_function)
+      raise
+    rescue RedRat::NameError
+    end
+
+    # Results must be marshallable
+    begin
+      pool.apply(:opaque)
+      raise
+    rescue RedRat::ValueError
+    end
+
+    threads = (0...4).map { |t|
+      Thread.new { (0...25).map { |i| pool.apply('operator.mul', t, i).to_ruby(deep: true) } }
+    }
+    threads.each_with_index { |th, t|
+      raise if th.value != (0...25).map { |i| t * i }
+    }
+
+    pool.close
+
+    begin
+      pool.apply('operator.add', 1, 2)
+      raise
+    rescue RuntimeError => e
+      raise if e.message !~ /gone/
+    end
+  end
 end